@@ -7,11 +7,11 @@
 # it should be included into your project Makefile
 #
 # NOTES:
-#  Generates blk_virt.elf
+#  Generates blk_virt.elf blk_cache.elf blk_raid.elf blk_log.elf
 #
 
 
-BLK_IMAGES := blk_virt.elf
+BLK_IMAGES := blk_virt.elf blk_cache.elf blk_raid.elf blk_log.elf
 
 CFLAGS_blk ?=
 
@@ -33,8 +33,29 @@ blk_partitioning.o: ${CHECK_BLK_FLAGS_MD5}
 blk_partitioning.o: ${SDDF}/blk/components/partitioning.c | $(SDDF_LIBC_INCLUDE)
 	${CC} ${CFLAGS} ${CFLAGS_blk} -o $@ -c $<
 
+blk_cache.elf: blk_cache.o
+	$(LD) $(LDFLAGS) $^ $(LIBS) -o $@
+
+blk_cache.o: ${CHECK_BLK_FLAGS_MD5}
+blk_cache.o: ${SDDF}/blk/components/cache.c | $(SDDF_LIBC_INCLUDE)
+	${CC} ${CFLAGS} ${CFLAGS_blk} -o $@ -c $<
+
+blk_raid.elf: blk_raid.o
+	$(LD) $(LDFLAGS) $^ $(LIBS) -o $@
+
+blk_raid.o: ${CHECK_BLK_FLAGS_MD5}
+blk_raid.o: ${SDDF}/blk/components/raid.c | $(SDDF_LIBC_INCLUDE)
+	${CC} ${CFLAGS} ${CFLAGS_blk} -o $@ -c $<
+
+blk_log.elf: blk_log.o
+	$(LD) $(LDFLAGS) $^ $(LIBS) -o $@
+
+blk_log.o: ${CHECK_BLK_FLAGS_MD5}
+blk_log.o: ${SDDF}/blk/components/log.c | $(SDDF_LIBC_INCLUDE)
+	${CC} ${CFLAGS} ${CFLAGS_blk} -o $@ -c $<
+
 clean::
-	rm -f blk_virt.[od] blk_partitioning.[od] .blk_cflags-*
+	rm -f blk_virt.[od] blk_partitioning.[od] blk_cache.[od] blk_raid.[od] blk_log.[od] .blk_cflags-*
 
 clobber::
 	rm -f ${BLK_IMAGES}
@@ -42,3 +63,6 @@ clobber::
 
 -include blk_virt.d
 -include blk_partitioning.d
+-include blk_cache.d
+-include blk_raid.d
+-include blk_log.d
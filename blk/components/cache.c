@@ -0,0 +1,667 @@
+/*
+ * Copyright 2026, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <os/sddf.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sddf/blk/config.h>
+#include <sddf/blk/queue.h>
+#include <sddf/blk/storage_info.h>
+#include <sddf/util/cache.h>
+#include <sddf/util/ialloc.h>
+#include <sddf/util/printf.h>
+#include <sddf/util/util.h>
+
+/**
+ * The block cache sits between the block virtualiser and the driver, keeping
+ * recently used blocks in memory so that repeated reads, including reads of
+ * the same blocks by different clients, are served without going to the
+ * device. Blocks are keyed by their device block number, which already
+ * accounts for the partition of the client that requested them.
+ *
+ * Reads are served from memory if all of their blocks are cached, otherwise
+ * they are passed to the driver and the blocks are inserted into the cache
+ * once the read completes. Writes always update the cache. In write-through
+ * mode they are then passed to the driver, in write-back mode they complete
+ * immediately and the dirty blocks are written back in the background once
+ * too many have accumulated, and all at once before a flush or barrier is
+ * passed to the driver. Discards drop the cached copies of their blocks and
+ * write zeroes zero them, before both are passed to the driver. Blocks are
+ * evicted in least recently used order.
+ */
+
+/* Uncomment this to enable debug logging */
+// #define DEBUG_BLK_CACHE
+
+#if defined(DEBUG_BLK_CACHE)
+#define LOG_BLK_CACHE(...) do{ sddf_dprintf("BLK_CACHE|INFO: "); sddf_dprintf(__VA_ARGS__); }while(0)
+#else
+#define LOG_BLK_CACHE(...) do{}while(0)
+#endif
+#define LOG_BLK_CACHE_ERR(...) do{ sddf_dprintf("BLK_CACHE|ERROR: "); sddf_dprintf(__VA_ARGS__); }while(0)
+
+#define DRIVER_MAX_NUM_BUFFERS 1024
+
+#define BLK_CACHE_MAX_BLOCKS 4096
+#define BLK_CACHE_HASH_BITS 13
+#define BLK_CACHE_HASH_BUCKETS (1 << BLK_CACHE_HASH_BITS)
+_Static_assert(BLK_CACHE_HASH_BUCKETS >= 2 * BLK_CACHE_MAX_BLOCKS, "hash table must be at least twice the cache size");
+
+#define SLOT_NONE UINT32_MAX
+
+__attribute__((__section__(".blk_cache_config"))) blk_cache_config_t config;
+
+typedef struct slot {
+    uint64_t block_number;
+    /* links in the LRU list, or next free slot */
+    uint32_t lru_prev;
+    uint32_t lru_next;
+    uint32_t hash_next;
+    /* block differs from the device */
+    bool dirty;
+    /* a write back of the block is in flight, its data must not be evicted */
+    bool writeback;
+} slot_t;
+
+typedef enum {
+    /* request from the virtualiser passed on to the driver */
+    REQ_PASSTHROUGH,
+    /* write back of a dirty block */
+    REQ_WRITEBACK,
+} req_type_t;
+
+/* Request info to be bookkept for each driver request */
+typedef struct reqbk {
+    req_type_t type;
+    blk_req_code_t code;
+    uint32_t virt_req_id;
+    uintptr_t io_addr;
+    uint64_t block_number;
+    uint16_t count;
+    uint32_t slot;
+    /* value of write_seq when a read was passed on */
+    uint64_t write_seq;
+} reqbk_t;
+
+typedef struct state {
+    blk_queue_handle_t virt_h;
+    blk_queue_handle_t drv_h;
+
+    slot_t slots[BLK_CACHE_MAX_BLOCKS];
+    uint32_t num_slots;
+    uint32_t hash[BLK_CACHE_HASH_BUCKETS];
+    /* most and least recently used cached blocks */
+    uint32_t lru_head;
+    uint32_t lru_tail;
+    uint32_t free_head;
+    uint32_t num_dirty;
+    uint32_t num_writeback;
+    /* number of blocks that are dirty or being written back, which cannot be evicted */
+    uint32_t num_pinned;
+
+    /**
+     * Incremented on every write. A read which was passed to the driver only
+     * inserts its blocks into the cache if no write happened while it was in
+     * flight, otherwise it could insert data older than the write's.
+     */
+    uint64_t write_seq;
+    /* a write back failed since the last flush, so the next flush must fail */
+    bool writeback_error;
+
+    /* flush or barrier waiting for dirty blocks to be written back */
+    bool flush_pending;
+    blk_req_code_t flush_code;
+    uint32_t flush_id;
+
+    bool notify_virt;
+    bool notify_drv;
+} state_t;
+
+state_t state;
+
+static reqbk_t reqsbk[DRIVER_MAX_NUM_BUFFERS];
+
+/* Index allocator for driver request id */
+ialloc_t ialloc;
+static uint32_t ialloc_idxlist[DRIVER_MAX_NUM_BUFFERS];
+
+static inline uint32_t hash_bucket(uint64_t block_number)
+{
+    return (block_number * 0x9E3779B97F4A7C15ull) >> (64 - BLK_CACHE_HASH_BITS);
+}
+
+static inline uintptr_t slot_vaddr(uint32_t idx)
+{
+    return (uintptr_t)config.cache.region.vaddr + (uintptr_t)idx * BLK_TRANSFER_SIZE;
+}
+
+static inline uintptr_t slot_io_addr(uint32_t idx)
+{
+    return config.cache.io_addr + (uintptr_t)idx * BLK_TRANSFER_SIZE;
+}
+
+static uint32_t slot_lookup(uint64_t block_number)
+{
+    uint32_t idx = state.hash[hash_bucket(block_number)];
+    while (idx != SLOT_NONE && state.slots[idx].block_number != block_number) {
+        idx = state.slots[idx].hash_next;
+    }
+    return idx;
+}
+
+static void lru_remove(uint32_t idx)
+{
+    slot_t *slot = &state.slots[idx];
+    if (slot->lru_prev != SLOT_NONE) {
+        state.slots[slot->lru_prev].lru_next = slot->lru_next;
+    } else {
+        state.lru_head = slot->lru_next;
+    }
+    if (slot->lru_next != SLOT_NONE) {
+        state.slots[slot->lru_next].lru_prev = slot->lru_prev;
+    } else {
+        state.lru_tail = slot->lru_prev;
+    }
+}
+
+static void lru_push(uint32_t idx)
+{
+    slot_t *slot = &state.slots[idx];
+    slot->lru_prev = SLOT_NONE;
+    slot->lru_next = state.lru_head;
+    if (state.lru_head != SLOT_NONE) {
+        state.slots[state.lru_head].lru_prev = idx;
+    } else {
+        state.lru_tail = idx;
+    }
+    state.lru_head = idx;
+}
+
+static void lru_touch(uint32_t idx)
+{
+    if (state.lru_head != idx) {
+        lru_remove(idx);
+        lru_push(idx);
+    }
+}
+
+static void slot_set_state(uint32_t idx, bool dirty, bool writeback)
+{
+    slot_t *slot = &state.slots[idx];
+    state.num_pinned -= (slot->dirty || slot->writeback);
+    state.num_dirty -= slot->dirty;
+    state.num_writeback -= slot->writeback;
+
+    slot->dirty = dirty;
+    slot->writeback = writeback;
+
+    state.num_pinned += (dirty || writeback);
+    state.num_dirty += dirty;
+    state.num_writeback += writeback;
+}
+
+static void slot_release(uint32_t idx)
+{
+    slot_t *slot = &state.slots[idx];
+    assert(!slot->dirty && !slot->writeback);
+
+    uint32_t *link = &state.hash[hash_bucket(slot->block_number)];
+    while (*link != idx) {
+        link = &state.slots[*link].hash_next;
+    }
+    *link = slot->hash_next;
+
+    lru_remove(idx);
+    slot->lru_next = state.free_head;
+    state.free_head = idx;
+}
+
+/**
+ * Allocate a slot for a block which is not cached, evicting the least
+ * recently used clean block if there are no free slots.
+ *
+ * @return index of the slot, or SLOT_NONE if every cached block is pinned.
+ */
+static uint32_t slot_alloc(uint64_t block_number)
+{
+    if (state.free_head == SLOT_NONE) {
+        uint32_t victim = state.lru_tail;
+        while (victim != SLOT_NONE && (state.slots[victim].dirty || state.slots[victim].writeback)) {
+            victim = state.slots[victim].lru_prev;
+        }
+        if (victim == SLOT_NONE) {
+            return SLOT_NONE;
+        }
+        slot_release(victim);
+    }
+
+    uint32_t idx = state.free_head;
+    slot_t *slot = &state.slots[idx];
+    state.free_head = slot->lru_next;
+
+    slot->block_number = block_number;
+    slot->dirty = false;
+    slot->writeback = false;
+    uint32_t bucket = hash_bucket(block_number);
+    slot->hash_next = state.hash[bucket];
+    state.hash[bucket] = idx;
+    lru_push(idx);
+
+    return idx;
+}
+
+/**
+ * Resolve the virtual address of a buffer given to us by the virtualiser.
+ *
+ * @return virtual address of the buffer, or 0 if it does not lie within a
+ *         region mapped into the cache.
+ */
+static uintptr_t buffer_vaddr(uintptr_t io_addr, uint16_t count)
+{
+    uint64_t len = (uint64_t)count * BLK_TRANSFER_SIZE;
+    for (uint8_t i = 0; i < config.num_data; i++) {
+        device_region_resource_t *data = &config.data[i];
+        if (io_addr >= data->io_addr && io_addr + len <= data->io_addr + data->region.size) {
+            return (uintptr_t)data->region.vaddr + (io_addr - data->io_addr);
+        }
+    }
+    return 0;
+}
+
+static bool driver_has_space(void)
+{
+    return !blk_queue_full_req(&state.drv_h) && !ialloc_full(&ialloc);
+}
+
+static void enqueue_driver(reqbk_t reqbk, uintptr_t io_addr)
+{
+    uint32_t drv_req_id = 0;
+    int err = ialloc_alloc(&ialloc, &drv_req_id);
+    assert(!err);
+    reqsbk[drv_req_id] = reqbk;
+
+    err = blk_enqueue_req(&state.drv_h, reqbk.code, io_addr, reqbk.block_number, reqbk.count, drv_req_id);
+    assert(!err);
+    state.notify_drv = true;
+}
+
+static void respond_virt(blk_resp_status_t status, uint16_t success_count, uint32_t id)
+{
+    /* Response queue should never be full since the virtualiser never has more
+     * requests in flight than the queue capacity. */
+    int err = blk_enqueue_resp(&state.virt_h, status, success_count, id);
+    assert(!err);
+    state.notify_virt = true;
+}
+
+static void passthrough(blk_req_code_t code, uintptr_t io_addr, uint64_t block_number, uint16_t count, uint32_t id)
+{
+    reqbk_t reqbk = { REQ_PASSTHROUGH, code, id, io_addr, block_number, count, SLOT_NONE, state.write_seq };
+    enqueue_driver(reqbk, io_addr);
+}
+
+/**
+ * Write back the least recently used dirty blocks to the driver.
+ *
+ * @param all write back every dirty block rather than only enough to bring
+ *            the number of dirty blocks below the low watermark.
+ */
+static void write_back(bool all)
+{
+    uint32_t low_watermark = all ? 0 : state.num_slots / 4;
+    uint32_t idx = state.lru_tail;
+    while (idx != SLOT_NONE && state.num_dirty > low_watermark && driver_has_space()) {
+        slot_t *slot = &state.slots[idx];
+        uint32_t prev = slot->lru_prev;
+        if (slot->dirty && !slot->writeback) {
+            cache_clean(slot_vaddr(idx), slot_vaddr(idx) + BLK_TRANSFER_SIZE);
+            slot_set_state(idx, false, true);
+
+            reqbk_t reqbk = { REQ_WRITEBACK, BLK_REQ_WRITE, 0, 0, slot->block_number, 1, idx, 0 };
+            enqueue_driver(reqbk, slot_io_addr(idx));
+            LOG_BLK_CACHE("writing back block %lu\n", slot->block_number);
+        }
+        idx = prev;
+    }
+}
+
+/**
+ * Serve a read from the cache.
+ *
+ * @return true if all blocks were cached and copied into the buffer.
+ */
+static bool read_cached(uint64_t block_number, uint16_t count, uintptr_t vaddr)
+{
+    for (uint16_t i = 0; i < count; i++) {
+        if (slot_lookup(block_number + i) == SLOT_NONE) {
+            return false;
+        }
+    }
+
+    for (uint16_t i = 0; i < count; i++) {
+        uint32_t idx = slot_lookup(block_number + i);
+        memcpy((void *)(vaddr + (uintptr_t)i * BLK_TRANSFER_SIZE), (void *)slot_vaddr(idx), BLK_TRANSFER_SIZE);
+        lru_touch(idx);
+    }
+
+    return true;
+}
+
+/**
+ * Copy written blocks into the cache, allocating slots for blocks which are
+ * not cached if possible.
+ */
+static void write_cached(uint64_t block_number, uint16_t count, uintptr_t vaddr, bool dirty)
+{
+    for (uint16_t i = 0; i < count; i++) {
+        uint32_t idx = slot_lookup(block_number + i);
+        if (idx == SLOT_NONE) {
+            idx = slot_alloc(block_number + i);
+            if (idx == SLOT_NONE) {
+                continue;
+            }
+        } else {
+            lru_touch(idx);
+        }
+
+        memcpy((void *)slot_vaddr(idx), (void *)(vaddr + (uintptr_t)i * BLK_TRANSFER_SIZE), BLK_TRANSFER_SIZE);
+        /* Keep a block dirty if it already was, as the block may also be
+        being written back with older data */
+        slot_set_state(idx, dirty || state.slots[idx].dirty, state.slots[idx].writeback);
+    }
+}
+
+/**
+ * Drop the cached copies of discarded blocks. Blocks being written back are
+ * only marked clean, as their data must stay in place until the write back
+ * completes.
+ */
+static void discard_cached(uint64_t block_number, uint16_t count)
+{
+    for (uint16_t i = 0; i < count; i++) {
+        uint32_t idx = slot_lookup(block_number + i);
+        if (idx == SLOT_NONE) {
+            continue;
+        }
+        slot_set_state(idx, false, state.slots[idx].writeback);
+        if (!state.slots[idx].writeback) {
+            slot_release(idx);
+        }
+    }
+}
+
+/**
+ * Zero the cached copies of blocks being zeroed. Blocks which are not cached
+ * are not allocated, as there is no write back of them which could race with
+ * the driver zeroing them.
+ */
+static void zero_cached(uint64_t block_number, uint16_t count, bool dirty)
+{
+    for (uint16_t i = 0; i < count; i++) {
+        uint32_t idx = slot_lookup(block_number + i);
+        if (idx == SLOT_NONE) {
+            continue;
+        }
+        memset((void *)slot_vaddr(idx), 0, BLK_TRANSFER_SIZE);
+        slot_set_state(idx, dirty || state.slots[idx].dirty, state.slots[idx].writeback);
+    }
+}
+
+static void handle_read_complete(reqbk_t *reqbk, uint16_t success_count)
+{
+    uintptr_t vaddr = buffer_vaddr(reqbk->io_addr, reqbk->count);
+    assert(vaddr);
+    /* Invalidate cache, so we don't read stale data */
+    cache_clean_and_invalidate(vaddr, vaddr + (uintptr_t)reqbk->count * BLK_TRANSFER_SIZE);
+
+    bool insert = (reqbk->write_seq == state.write_seq);
+    for (uint16_t i = 0; i < success_count; i++) {
+        uintptr_t block_vaddr = vaddr + (uintptr_t)i * BLK_TRANSFER_SIZE;
+        uint32_t idx = slot_lookup(reqbk->block_number + i);
+        if (idx != SLOT_NONE) {
+            /* The cached block may be newer than the device's */
+            memcpy((void *)block_vaddr, (void *)slot_vaddr(idx), BLK_TRANSFER_SIZE);
+            lru_touch(idx);
+        } else if (insert) {
+            idx = slot_alloc(reqbk->block_number + i);
+            if (idx != SLOT_NONE) {
+                memcpy((void *)slot_vaddr(idx), (void *)block_vaddr, BLK_TRANSFER_SIZE);
+            }
+        }
+    }
+}
+
+static void handle_write_complete(reqbk_t *reqbk, blk_resp_status_t status)
+{
+    if (status == BLK_RESP_OK) {
+        return;
+    }
+
+    /* The cache now holds data the device does not, drop it unless it is
+    dirty in which case it will be written back again */
+    for (uint16_t i = 0; i < reqbk->count; i++) {
+        uint32_t idx = slot_lookup(reqbk->block_number + i);
+        if (idx != SLOT_NONE && !state.slots[idx].dirty && !state.slots[idx].writeback) {
+            slot_release(idx);
+        }
+    }
+}
+
+static void handle_writeback_complete(reqbk_t *reqbk, blk_resp_status_t status)
+{
+    uint32_t idx = reqbk->slot;
+    slot_t *slot = &state.slots[idx];
+    slot_set_state(idx, slot->dirty, false);
+
+    if (status != BLK_RESP_OK) {
+        LOG_BLK_CACHE_ERR("failed to write back block %lu, status %d\n", slot->block_number, status);
+        /* Like a failed write-through write, the block is dropped and the
+        error is reported at the next flush */
+        state.writeback_error = true;
+        if (!slot->dirty) {
+            slot_release(idx);
+        }
+    }
+}
+
+static void handle_driver(void)
+{
+    blk_resp_status_t drv_status = 0;
+    uint16_t drv_success_count = 0;
+    uint32_t drv_resp_id = 0;
+
+    while (!blk_queue_empty_resp(&state.drv_h)) {
+        int err = blk_dequeue_resp(&state.drv_h, &drv_status, &drv_success_count, &drv_resp_id);
+        assert(!err);
+
+        reqbk_t reqbk = reqsbk[drv_resp_id];
+        err = ialloc_free(&ialloc, drv_resp_id);
+        assert(!err);
+
+        if (reqbk.type == REQ_WRITEBACK) {
+            handle_writeback_complete(&reqbk, drv_status);
+            continue;
+        }
+
+        if (reqbk.code == BLK_REQ_READ && drv_status == BLK_RESP_OK) {
+            handle_read_complete(&reqbk, drv_success_count);
+        } else if (reqbk.code == BLK_REQ_WRITE || reqbk.code == BLK_REQ_WRITE_ZEROES) {
+            handle_write_complete(&reqbk, drv_status);
+        }
+
+        respond_virt(drv_status, drv_success_count, reqbk.virt_req_id);
+    }
+}
+
+/**
+ * Make progress on a pending flush or barrier, which in write-back mode can
+ * only be passed to the driver once all dirty blocks have been written back.
+ */
+static void handle_flush(void)
+{
+    if (!state.flush_pending) {
+        return;
+    }
+
+    write_back(true);
+    if (state.num_dirty || state.num_writeback || !driver_has_space()) {
+        return;
+    }
+
+    if (state.writeback_error) {
+        respond_virt(BLK_RESP_ERR_IO, 0, state.flush_id);
+        state.writeback_error = false;
+    } else {
+        passthrough(state.flush_code, 0, 0, 0, state.flush_id);
+    }
+    state.flush_pending = false;
+}
+
+static void handle_virt(void)
+{
+    blk_req_code_t code = 0;
+    uintptr_t io_addr = 0;
+    uint64_t block_number = 0;
+    uint16_t count = 0;
+    uint32_t id = 0;
+
+    /* Requests after a pending flush or barrier must wait for it to be passed on */
+    while (!state.flush_pending && !blk_queue_empty_req(&state.virt_h) && driver_has_space()) {
+        int err = blk_dequeue_req(&state.virt_h, &code, &io_addr, &block_number, &count, &id);
+        assert(!err);
+
+        switch (code) {
+        case BLK_REQ_READ: {
+            uintptr_t vaddr = buffer_vaddr(io_addr, count);
+            if (!vaddr) {
+                LOG_BLK_CACHE_ERR("read buffer 0x%lx is not within a mapped data region\n", io_addr);
+                respond_virt(BLK_RESP_ERR_INVALID_PARAM, 0, id);
+                break;
+            }
+
+            if (count && read_cached(block_number, count, vaddr)) {
+                respond_virt(BLK_RESP_OK, count, id);
+                break;
+            }
+
+            /* Make sure none of our cache lines for the buffer are written
+            back over the data the device writes */
+            cache_clean_and_invalidate(vaddr, vaddr + (uintptr_t)count * BLK_TRANSFER_SIZE);
+            passthrough(code, io_addr, block_number, count, id);
+            break;
+        }
+        case BLK_REQ_WRITE: {
+            uintptr_t vaddr = buffer_vaddr(io_addr, count);
+            if (!vaddr) {
+                LOG_BLK_CACHE_ERR("write buffer 0x%lx is not within a mapped data region\n", io_addr);
+                respond_virt(BLK_RESP_ERR_INVALID_PARAM, 0, id);
+                break;
+            }
+
+            state.write_seq++;
+            bool write_back_mode = config.mode == BLK_CACHE_WRITE_BACK;
+            if (write_back_mode && count && count <= state.num_slots - state.num_pinned) {
+                write_cached(block_number, count, vaddr, true);
+                respond_virt(BLK_RESP_OK, count, id);
+                break;
+            }
+
+            /* Too large to absorb, or write-through. In write-back mode cached
+            copies are marked dirty in case a write back of older data is in
+            flight. */
+            write_cached(block_number, count, vaddr, write_back_mode);
+            passthrough(code, io_addr, block_number, count, id);
+            break;
+        }
+        case BLK_REQ_DISCARD:
+            state.write_seq++;
+            discard_cached(block_number, count);
+            passthrough(code, io_addr, block_number, count, id);
+            break;
+        case BLK_REQ_WRITE_ZEROES:
+            /* Like a write-through write, cached copies are marked dirty in
+            write-back mode in case a write back of older data is in flight */
+            state.write_seq++;
+            zero_cached(block_number, count, config.mode == BLK_CACHE_WRITE_BACK);
+            passthrough(code, io_addr, block_number, count, id);
+            break;
+        case BLK_REQ_FLUSH:
+        case BLK_REQ_BARRIER:
+            if (config.mode == BLK_CACHE_WRITE_BACK) {
+                state.flush_pending = true;
+                state.flush_code = code;
+                state.flush_id = id;
+                handle_flush();
+                break;
+            }
+            passthrough(code, io_addr, block_number, count, id);
+            break;
+        default:
+            /* Let the driver reject it */
+            passthrough(code, io_addr, block_number, count, id);
+            break;
+        }
+    }
+}
+
+void notified(sddf_channel ch)
+{
+    if (ch == config.driver.id) {
+        handle_driver();
+    }
+
+    handle_flush();
+    handle_virt();
+
+    if (config.mode == BLK_CACHE_WRITE_BACK && state.num_dirty > state.num_slots / 2) {
+        write_back(false);
+    }
+
+    if (state.notify_virt) {
+        sddf_notify(config.virt.id);
+        state.notify_virt = false;
+    }
+    if (state.notify_drv) {
+        sddf_notify(config.driver.id);
+        state.notify_drv = false;
+    }
+}
+
+void init(void)
+{
+    assert(blk_config_check_magic(&config));
+    assert(config.mode <= BLK_CACHE_WRITE_BACK);
+
+    state.num_slots = MIN(config.cache.region.size / BLK_TRANSFER_SIZE, BLK_CACHE_MAX_BLOCKS);
+    assert(state.num_slots);
+    for (uint32_t i = 0; i < BLK_CACHE_HASH_BUCKETS; i++) {
+        state.hash[i] = SLOT_NONE;
+    }
+    for (uint32_t i = 0; i < state.num_slots; i++) {
+        state.slots[i].lru_next = (i + 1 < state.num_slots) ? i + 1 : SLOT_NONE;
+    }
+    state.free_head = 0;
+    state.lru_head = SLOT_NONE;
+    state.lru_tail = SLOT_NONE;
+
+    uint16_t driver_num_buffers = config.driver.num_buffers;
+    assert(driver_num_buffers <= DRIVER_MAX_NUM_BUFFERS);
+    blk_queue_init(&state.drv_h, config.driver.req_queue.vaddr, config.driver.resp_queue.vaddr, driver_num_buffers);
+    blk_queue_init(&state.virt_h, config.virt.req_queue.vaddr, config.virt.resp_queue.vaddr, config.virt.num_buffers);
+    ialloc_init(&ialloc, ialloc_idxlist, driver_num_buffers);
+
+    /* The cache is transparent, so present the driver's storage info as our own */
+    blk_storage_info_t *driver_storage_info = config.driver.storage_info.vaddr;
+    blk_storage_info_t *virt_storage_info = config.virt.storage_info.vaddr;
+    while (!blk_storage_is_ready(driver_storage_info));
+    blk_storage_info_t storage_info = *driver_storage_info;
+    storage_info.ready = false;
+    *virt_storage_info = storage_info;
+    blk_storage_set_ready(virt_storage_info, true);
+
+    LOG_BLK_CACHE("caching %u blocks in %s mode\n", state.num_slots,
+                  config.mode == BLK_CACHE_WRITE_BACK ? "write-back" : "write-through");
+}
@@ -18,6 +18,8 @@
 #define GPT_PARTITION_INFO_CODE 0x1
 #define GPT_PARTITION_INFO_MIRROR_CODE 0x2
 #define GPT_HEADER_SIGNATURE "EFI PART"
+/* Size of the header fields below, covered by the header checksum */
+#define GPT_HEADER_MIN_SIZE 0x5C
 
 struct gpt_partition_header {
     char signature[8];
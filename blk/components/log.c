@@ -0,0 +1,1363 @@
+/*
+ * Copyright 2026, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <os/sddf.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sddf/blk/config.h>
+#include <sddf/blk/queue.h>
+#include <sddf/blk/storage_info.h>
+#include <sddf/util/cache.h>
+#include <sddf/util/ialloc.h>
+#include <sddf/util/printf.h>
+#include <sddf/util/util.h>
+
+/**
+ * The block log sits between the block virtualiser and the driver of a flash
+ * device, such as an SD card or eMMC, on which small random writes are far
+ * slower than sequential ones. Small writes are appended to a log kept at the
+ * end of the device instead of being written in place, and an in-memory remap
+ * table records where the latest copy of each block is. The virtualiser is
+ * presented with the device less the log.
+ *
+ * Writes are copied into a staging ring in memory and gathered into records,
+ * each a header block listing the blocks it holds followed by their data. The
+ * writes dequeued in one notification go into the same record, which is
+ * written to the log with sequential driver requests, and complete once it
+ * has been. Writes of at least LOG_DIRECT_BLOCKS blocks, none of which are in
+ * the log, are already sequential and are passed straight to the driver.
+ * Reads are split into runs of blocks in place, in the log and still in the
+ * staging ring, which are served from the device, the log and memory.
+ *
+ * Once the log is a quarter full, or a write is waiting for space in it, the
+ * oldest records are destaged in the background. The latest copies of the
+ * blocks they hold are written in place, runs of consecutive blocks with one
+ * request, and once these are flushed the log's superblock is moved past the
+ * records and flushed in turn before their space is reused. Blocks which are
+ * written again while in the log are only written in place once.
+ *
+ * Flushes and barriers are passed to the driver once every earlier write has
+ * completed, at which point the records holding them are in the log. When
+ * started, the log replays the records from the superblock onwards to rebuild
+ * the remap table. Each record carries a checksum, so that one which was torn
+ * by a power loss ends the log.
+ */
+
+/* Uncomment this to enable debug logging */
+// #define DEBUG_BLK_LOG
+
+#if defined(DEBUG_BLK_LOG)
+#define LOG_BLK_LOG(...) do{ sddf_dprintf("BLK_LOG|INFO: "); sddf_dprintf(__VA_ARGS__); }while(0)
+#else
+#define LOG_BLK_LOG(...) do{}while(0)
+#endif
+#define LOG_BLK_LOG_ERR(...) do{ sddf_dprintf("BLK_LOG|ERROR: "); sddf_dprintf(__VA_ARGS__); }while(0)
+
+#define VIRT_MAX_NUM_BUFFERS 1024
+#define DRIVER_MAX_NUM_BUFFERS 1024
+
+/* Most blocks of the log, excluding its superblock */
+#define LOG_MAX_BLOCKS 16384
+/* Records hold at least one block besides their header */
+#define LOG_MAX_RECORDS (LOG_MAX_BLOCKS / 2)
+#define LOG_HASH_BITS 15
+#define LOG_HASH_BUCKETS (1 << LOG_HASH_BITS)
+_Static_assert(LOG_HASH_BUCKETS >= 2 * LOG_MAX_BLOCKS, "hash table must be at least twice the log size");
+
+/* Most data blocks of a record, limited by what its header can list */
+#define LOG_RECORD_MAX_BLOCKS 255
+/* Blocks of the destage buffer, which must hold the largest record */
+#define LOG_DESTAGE_BLOCKS (LOG_RECORD_MAX_BLOCKS + 1)
+/* Writes at least this large are passed to the driver if none of their blocks are in the log */
+#define LOG_DIRECT_BLOCKS 16
+/* Times the write of a record is retried before the writes in it fail */
+#define LOG_MAX_RETRIES 3
+
+#define LOG_SUPERBLOCK_MAGIC 0x6b6c427373646673ull
+#define LOG_RECORD_MAGIC 0x636552676f4c6673ull
+#define LOG_CHECKSUM_SEED 0xcbf29ce484222325ull
+
+#define IDX_NONE UINT32_MAX
+
+__attribute__((__section__(".blk_log_config"))) blk_log_config_t config;
+
+/* First block of the log on the device */
+typedef struct log_superblock {
+    uint64_t magic;
+    /* log position and sequence number of the oldest record in the log */
+    uint64_t tail_lsn;
+    uint64_t tail_seq;
+    /* blocks of the log excluding the superblock, positions are only meaningful for the same size */
+    uint64_t ring_blocks;
+    /* of the superblock with this field zero */
+    uint64_t checksum;
+} log_superblock_t;
+
+/* First block of each record in the log */
+typedef struct log_header {
+    uint64_t magic;
+    /* records are numbered consecutively */
+    uint64_t seq;
+    /* of the header with this field zero, followed by the data blocks */
+    uint64_t checksum;
+    uint32_t count;
+    uint32_t reserved;
+    /* blocks in place of which the data blocks are copies */
+    uint64_t home[LOG_RECORD_MAX_BLOCKS];
+} log_header_t;
+_Static_assert(sizeof(log_header_t) <= BLK_TRANSFER_SIZE, "record header must fit in a block");
+
+/* Block of the log, indexed by log position modulo the size of the log */
+typedef struct log_block {
+    /* block in place of which this is a copy, unused for headers */
+    uint64_t home;
+    uint32_t hash_next;
+    /* this is the latest copy of its block, and is in the remap table */
+    bool mapped;
+} log_block_t;
+
+typedef enum {
+    /* blocks are still being added */
+    RECORD_OPEN,
+    /* being written to the log */
+    RECORD_CLOSED,
+    /* in the log, or the write failed for good */
+    RECORD_WRITTEN,
+} record_state_t;
+
+typedef struct record {
+    /* log position of the header */
+    uint64_t lsn;
+    uint16_t count;
+    record_state_t state;
+    /* blocks handed to the driver so far and driver requests still in flight */
+    uint16_t submitted;
+    uint16_t pending;
+    uint8_t retries;
+    blk_resp_status_t status;
+} record_t;
+
+/* Request info to be bookkept for each request from the virtualiser */
+typedef struct reqbk {
+    uint32_t virt_req_id;
+    blk_req_code_t code;
+    uint16_t count;
+    /* driver requests still in flight */
+    uint16_t pending;
+    /* first error of a driver request or record, or BLK_RESP_OK */
+    blk_resp_status_t status;
+    /* log positions of the data of a write staged in the log */
+    uint64_t lsn_start;
+    uint64_t lsn_end;
+} reqbk_t;
+
+typedef enum {
+    /* part of a request from the virtualiser, in place */
+    DRV_CLIENT,
+    /* part of a read from the virtualiser, from the log */
+    DRV_CLIENT_LOG,
+    /* part of a record being written to the log */
+    DRV_RECORD,
+    /* background work, see bg_state_t */
+    DRV_BACKGROUND,
+} drv_req_type_t;
+
+typedef struct drv_reqbk {
+    drv_req_type_t type;
+    /* request or record index */
+    uint32_t idx;
+} drv_reqbk_t;
+
+typedef enum {
+    /* rebuilding the remap table */
+    BG_RECOVER_SUPERBLOCK,
+    BG_RECOVER_HEADER,
+    BG_RECOVER_RECORD,
+    /* starting a new log, as the superblock is not valid */
+    BG_FORMAT,
+    BG_FORMAT_FLUSH,
+    BG_IDLE,
+    BG_DESTAGE_READ,
+    BG_DESTAGE_WRITE,
+    BG_DESTAGE_FLUSH,
+    BG_SUPERBLOCK,
+    BG_SUPERBLOCK_FLUSH,
+    BG_DESTAGE_FREE,
+} bg_state_t;
+
+static blk_queue_handle_t virt_h;
+static blk_queue_handle_t drv_h;
+
+static reqbk_t reqsbk[VIRT_MAX_NUM_BUFFERS];
+static ialloc_t ialloc;
+static uint32_t ialloc_idxlist[VIRT_MAX_NUM_BUFFERS];
+
+static drv_reqbk_t drv_reqsbk[DRIVER_MAX_NUM_BUFFERS];
+static ialloc_t drv_ialloc;
+static uint32_t drv_ialloc_idxlist[DRIVER_MAX_NUM_BUFFERS];
+
+/* Remap table, chaining the blocks of the log which are the latest copy of a block */
+static log_block_t blocks[LOG_MAX_BLOCKS];
+static uint32_t hash[LOG_HASH_BUCKETS];
+
+static record_t records[LOG_MAX_RECORDS];
+
+/* Writes staged in the log waiting for their records, in log order */
+static uint32_t staged[VIRT_MAX_NUM_BUFFERS];
+
+/**
+ * Positions in the log are counted in blocks from when the log was started,
+ * and never wrap. Records [tail_seq, head_seq) are in the log and occupy
+ * positions [tail_lsn, head_lsn), of which records before written_seq have
+ * been written.
+ */
+static struct {
+    /* blocks presented to the virtualiser, the log follows them */
+    uint64_t home_blocks;
+    uint32_t ring_blocks;
+    uint32_t stage_blocks;
+    uint16_t drv_max_transfer;
+    uint16_t max_transfer;
+
+    uint64_t tail_lsn;
+    uint64_t tail_seq;
+    uint64_t head_lsn;
+    uint64_t head_seq;
+    uint64_t written_seq;
+    /* the last record is still open */
+    bool open;
+    /* positions from here on are in the staging ring if they have not been overwritten */
+    uint64_t stage_valid_lsn;
+    /**
+     * A record the driver failed to write breaks the chain of records replayed
+     * at start up, so records up to here are not persistent until the tail has
+     * moved past them.
+     */
+    uint64_t broken_seq;
+
+    uint32_t staged_head;
+    uint32_t staged_tail;
+    /* writes passed straight to the driver and reads from the log in flight */
+    uint32_t direct_writes;
+    uint32_t log_reads;
+    /* a write is waiting for space in the log */
+    bool waiting_space;
+
+    /* flush or barrier waiting for earlier writes to complete */
+    bool flush_pending;
+    uint32_t flush_req;
+
+    bool ready;
+    bool notify_virt;
+    bool notify_drv;
+} state;
+
+/**
+ * Background work, which rebuilds the remap table at start up and destages
+ * records after that. Both go through the destage buffer, in which the block
+ * at log position lsn is at lsn - base_lsn.
+ */
+static struct {
+    bg_state_t state;
+    uint64_t base_lsn;
+    /* next position to transfer and end of the records being recovered or destaged */
+    uint64_t next_lsn;
+    uint64_t end_lsn;
+    uint64_t end_seq;
+    /* record and block within it to consider next for writing in place */
+    uint64_t seq;
+    uint16_t idx;
+    uint32_t pending;
+    /* the single request of the current step has been issued */
+    bool issued;
+    bool wrote;
+    bool failed;
+} bg;
+
+static inline uint32_t hash_bucket(uint64_t block_number)
+{
+    return (block_number * 0x9E3779B97F4A7C15ull) >> (64 - LOG_HASH_BITS);
+}
+
+static inline uint32_t ring_idx(uint64_t lsn)
+{
+    return lsn % state.ring_blocks;
+}
+
+static inline uint64_t log_block_number(uint64_t lsn)
+{
+    /* The superblock comes first */
+    return state.home_blocks + 1 + ring_idx(lsn);
+}
+
+static inline record_t *record(uint64_t seq)
+{
+    return &records[seq % LOG_MAX_RECORDS];
+}
+
+static inline uintptr_t superblock_vaddr(void)
+{
+    return (uintptr_t)config.stage.region.vaddr;
+}
+
+static inline uintptr_t destage_vaddr(uint64_t lsn)
+{
+    return (uintptr_t)config.stage.region.vaddr + (uintptr_t)(1 + lsn - bg.base_lsn) * BLK_TRANSFER_SIZE;
+}
+
+static inline uintptr_t destage_io_addr(uint64_t lsn)
+{
+    return config.stage.io_addr + (uintptr_t)(1 + lsn - bg.base_lsn) * BLK_TRANSFER_SIZE;
+}
+
+static inline uintptr_t stage_vaddr(uint64_t lsn)
+{
+    uint64_t idx = 1 + LOG_DESTAGE_BLOCKS + lsn % state.stage_blocks;
+    return (uintptr_t)config.stage.region.vaddr + (uintptr_t)idx * BLK_TRANSFER_SIZE;
+}
+
+static inline uintptr_t stage_io_addr(uint64_t lsn)
+{
+    uint64_t idx = 1 + LOG_DESTAGE_BLOCKS + lsn % state.stage_blocks;
+    return config.stage.io_addr + (uintptr_t)idx * BLK_TRANSFER_SIZE;
+}
+
+/* Whether the data at a log position is in the staging ring */
+static inline bool lsn_staged(uint64_t lsn)
+{
+    return lsn >= state.stage_valid_lsn && state.head_lsn <= lsn + state.stage_blocks;
+}
+
+/* Log position of a block of the log, which must be in use */
+static inline uint64_t idx_lsn(uint32_t idx)
+{
+    return state.tail_lsn + (idx + state.ring_blocks - ring_idx(state.tail_lsn)) % state.ring_blocks;
+}
+
+/* Blocks from a log position that are contiguous on the device and fit in a driver request */
+static inline uint32_t log_run(uint64_t lsn, uint64_t n)
+{
+    return MIN(MIN(n, state.ring_blocks - ring_idx(lsn)), state.drv_max_transfer);
+}
+
+/* As log_run, but also contiguous in the staging ring */
+static inline uint32_t stage_run(uint64_t lsn, uint64_t n)
+{
+    return MIN(log_run(lsn, n), state.stage_blocks - lsn % state.stage_blocks);
+}
+
+static uint64_t checksum(uint64_t sum, uintptr_t vaddr)
+{
+    /* FNV-1a over 64-bit words */
+    const uint64_t *words = (const uint64_t *)vaddr;
+    for (uint32_t i = 0; i < BLK_TRANSFER_SIZE / sizeof(uint64_t); i++) {
+        sum ^= words[i];
+        sum *= 0x100000001b3ull;
+    }
+    return sum;
+}
+
+static uint32_t map_lookup(uint64_t home)
+{
+    uint32_t idx = hash[hash_bucket(home)];
+    while (idx != IDX_NONE && blocks[idx].home != home) {
+        idx = blocks[idx].hash_next;
+    }
+    return idx;
+}
+
+static void map_remove(uint32_t idx)
+{
+    log_block_t *block = &blocks[idx];
+    assert(block->mapped);
+
+    uint32_t *link = &hash[hash_bucket(block->home)];
+    while (*link != idx) {
+        link = &blocks[*link].hash_next;
+    }
+    *link = block->hash_next;
+    block->mapped = false;
+}
+
+/* Make a block of the log the latest copy of a block */
+static void map_insert(uint32_t idx, uint64_t home)
+{
+    uint32_t old = map_lookup(home);
+    if (old != IDX_NONE) {
+        map_remove(old);
+    }
+
+    log_block_t *block = &blocks[idx];
+    uint32_t bucket = hash_bucket(home);
+    block->home = home;
+    block->hash_next = hash[bucket];
+    block->mapped = true;
+    hash[bucket] = idx;
+}
+
+/* Drop the blocks of a record from the remap table that are still the latest copies */
+static void record_unmap(record_t *r)
+{
+    for (uint16_t i = 0; i < r->count; i++) {
+        uint32_t idx = ring_idx(r->lsn + 1 + i);
+        if (blocks[idx].mapped) {
+            map_remove(idx);
+        }
+    }
+}
+
+/**
+ * Resolve the virtual address of a buffer given to us by the virtualiser.
+ *
+ * @return virtual address of the buffer, or 0 if it does not lie within a
+ *         region mapped into the log.
+ */
+static uintptr_t buffer_vaddr(uintptr_t io_addr, uint16_t count)
+{
+    uint64_t len = (uint64_t)count * BLK_TRANSFER_SIZE;
+    for (uint8_t i = 0; i < config.num_data; i++) {
+        device_region_resource_t *data = &config.data[i];
+        if (io_addr >= data->io_addr && io_addr + len <= data->io_addr + data->region.size) {
+            return (uintptr_t)data->region.vaddr + (io_addr - data->io_addr);
+        }
+    }
+    return 0;
+}
+
+static inline uint32_t driver_space(void)
+{
+    return MIN(ialloc_num_free(&drv_ialloc), drv_h.capacity - blk_queue_length_req(&drv_h));
+}
+
+static void enqueue_driver(drv_req_type_t type, uint32_t idx, blk_req_code_t code, uintptr_t io_addr,
+                           uint64_t block_number, uint16_t count)
+{
+    uint32_t drv_req_id = 0;
+    int err = ialloc_alloc(&drv_ialloc, &drv_req_id);
+    assert(!err);
+    drv_reqsbk[drv_req_id] = (drv_reqbk_t) { type, idx };
+
+    err = blk_enqueue_req(&drv_h, code, io_addr, block_number, count, drv_req_id);
+    assert(!err);
+    state.notify_drv = true;
+}
+
+static void respond_virt(blk_resp_status_t status, uint16_t success_count, uint32_t id)
+{
+    /* Response queue should never be full since the virtualiser never has more
+     * requests in flight than the queue capacity. */
+    int err = blk_enqueue_resp(&virt_h, status, success_count, id);
+    assert(!err);
+    state.notify_virt = true;
+}
+
+static void finish_request(uint32_t req)
+{
+    reqbk_t *reqbk = &reqsbk[req];
+    respond_virt(reqbk->status, (reqbk->status == BLK_RESP_OK) ? reqbk->count : 0, reqbk->virt_req_id);
+    int err = ialloc_free(&ialloc, req);
+    assert(!err);
+}
+
+/* Write a superblock with the current tail of the log */
+static void superblock_write(void)
+{
+    log_superblock_t *sb = (log_superblock_t *)superblock_vaddr();
+    memset(sb, 0, BLK_TRANSFER_SIZE);
+    sb->magic = LOG_SUPERBLOCK_MAGIC;
+    sb->tail_lsn = state.tail_lsn;
+    sb->tail_seq = state.tail_seq;
+    sb->ring_blocks = state.ring_blocks;
+    sb->checksum = checksum(LOG_CHECKSUM_SEED, superblock_vaddr());
+    cache_clean(superblock_vaddr(), superblock_vaddr() + BLK_TRANSFER_SIZE);
+}
+
+static bool superblock_valid(void)
+{
+    log_superblock_t *sb = (log_superblock_t *)superblock_vaddr();
+    uint64_t sum = sb->checksum;
+    sb->checksum = 0;
+    return sb->magic == LOG_SUPERBLOCK_MAGIC && sb->ring_blocks == state.ring_blocks
+        && checksum(LOG_CHECKSUM_SEED, superblock_vaddr()) == sum;
+}
+
+/* Add a block to the open record, opening one if there is none */
+static void stage_block(uint64_t home, uintptr_t vaddr)
+{
+    if (!state.open) {
+        record_t *r = record(state.head_seq);
+        *r = (record_t) { .lsn = state.head_lsn, .state = RECORD_OPEN, .status = BLK_RESP_OK };
+        log_header_t *hdr = (log_header_t *)stage_vaddr(r->lsn);
+        memset(hdr, 0, BLK_TRANSFER_SIZE);
+        hdr->magic = LOG_RECORD_MAGIC;
+        hdr->seq = state.head_seq;
+        state.head_seq++;
+        state.head_lsn++;
+        state.open = true;
+    }
+
+    record_t *r = record(state.head_seq - 1);
+    log_header_t *hdr = (log_header_t *)stage_vaddr(r->lsn);
+    uint64_t lsn = state.head_lsn++;
+    memcpy((void *)stage_vaddr(lsn), (void *)vaddr, BLK_TRANSFER_SIZE);
+    hdr->home[r->count++] = home;
+    map_insert(ring_idx(lsn), home);
+}
+
+/* Close the open record, after which it is written to the log */
+static void record_close(void)
+{
+    assert(state.open);
+    record_t *r = record(state.head_seq - 1);
+    log_header_t *hdr = (log_header_t *)stage_vaddr(r->lsn);
+    hdr->count = r->count;
+    hdr->checksum = 0;
+
+    uint64_t sum = checksum(LOG_CHECKSUM_SEED, (uintptr_t)hdr);
+    for (uint16_t i = 0; i < r->count; i++) {
+        sum = checksum(sum, stage_vaddr(r->lsn + 1 + i));
+    }
+    hdr->checksum = sum;
+
+    r->state = RECORD_CLOSED;
+    state.open = false;
+    LOG_BLK_LOG("closed record %lu of %u blocks at %lu\n", hdr->seq, r->count, r->lsn);
+}
+
+/* Hand closed records to the driver as far as it has space */
+static void submit_records(void)
+{
+    for (uint64_t seq = state.written_seq; seq < state.head_seq; seq++) {
+        record_t *r = record(seq);
+        uint16_t total = r->count + 1;
+        while (r->state == RECORD_CLOSED && r->submitted < total && driver_space()) {
+            uint64_t lsn = r->lsn + r->submitted;
+            uint32_t n = stage_run(lsn, total - r->submitted);
+            cache_clean(stage_vaddr(lsn), stage_vaddr(lsn) + (uintptr_t)n * BLK_TRANSFER_SIZE);
+            enqueue_driver(DRV_RECORD, seq % LOG_MAX_RECORDS, BLK_REQ_WRITE, stage_io_addr(lsn), log_block_number(lsn),
+                           n);
+            r->pending++;
+            r->submitted += n;
+        }
+    }
+}
+
+/* Complete the writes in records which have been written, in log order */
+static void complete_records(void)
+{
+    while (state.written_seq < state.head_seq && record(state.written_seq)->state == RECORD_WRITTEN) {
+        record_t *r = record(state.written_seq);
+        uint64_t end = r->lsn + 1 + r->count;
+        if (r->status != BLK_RESP_OK) {
+            /* The blocks are left as they are in place */
+            LOG_BLK_LOG_ERR("failed to write record %lu to the log, status %d\n", state.written_seq, r->status);
+            record_unmap(r);
+            state.broken_seq = state.written_seq + 1;
+        }
+
+        while (state.staged_head != state.staged_tail) {
+            uint32_t req = staged[state.staged_head % VIRT_MAX_NUM_BUFFERS];
+            reqbk_t *reqbk = &reqsbk[req];
+            if (reqbk->lsn_start >= end) {
+                break;
+            }
+            if (r->status != BLK_RESP_OK) {
+                reqbk->status = r->status;
+            }
+            if (reqbk->lsn_end > end) {
+                /* Continues in the next record */
+                break;
+            }
+            finish_request(req);
+            state.staged_head++;
+        }
+        state.written_seq++;
+    }
+}
+
+static void handle_record_complete(uint32_t idx, blk_resp_status_t status)
+{
+    record_t *r = &records[idx];
+    r->pending--;
+    if (status != BLK_RESP_OK && r->status == BLK_RESP_OK) {
+        r->status = status;
+    }
+    if (r->pending || r->submitted < r->count + 1) {
+        return;
+    }
+
+    if (r->status != BLK_RESP_OK && r->retries < LOG_MAX_RETRIES) {
+        /* The record is still in the staging ring, so it can be written again */
+        r->retries++;
+        r->status = BLK_RESP_OK;
+        r->submitted = 0;
+        return;
+    }
+
+    r->state = RECORD_WRITTEN;
+    complete_records();
+}
+
+/* Whether a write fits in the log and the staging ring, possibly along with the header of another record */
+static bool stage_fits(uint16_t count)
+{
+    uint64_t needed = (uint64_t)count + 2;
+    uint64_t stage_tail = (state.written_seq < state.head_seq) ? record(state.written_seq)->lsn : state.head_lsn;
+    return state.head_lsn + needed - state.tail_lsn <= state.ring_blocks
+        && state.head_lsn + needed - stage_tail <= state.stage_blocks
+        && state.head_seq + 2 - state.tail_seq <= LOG_MAX_RECORDS;
+}
+
+static void stage_write(uint32_t req, uint64_t block_number, uint16_t count, uintptr_t vaddr)
+{
+    reqbk_t *reqbk = &reqsbk[req];
+    for (uint16_t i = 0; i < count; i++) {
+        if (state.open && record(state.head_seq - 1)->count == LOG_RECORD_MAX_BLOCKS) {
+            record_close();
+        }
+        stage_block(block_number + i, vaddr + (uintptr_t)i * BLK_TRANSFER_SIZE);
+        if (i == 0) {
+            reqbk->lsn_start = state.head_lsn - 1;
+        }
+    }
+    reqbk->lsn_end = state.head_lsn;
+
+    staged[state.staged_tail % VIRT_MAX_NUM_BUFFERS] = req;
+    state.staged_tail++;
+}
+
+static bool write_direct(uint64_t block_number, uint16_t count)
+{
+    if (count < LOG_DIRECT_BLOCKS) {
+        return false;
+    }
+    for (uint16_t i = 0; i < count; i++) {
+        if (map_lookup(block_number + i) != IDX_NONE) {
+            return false;
+        }
+    }
+    return true;
+}
+
+typedef enum {
+    RUN_IN_PLACE,
+    RUN_LOG,
+    RUN_STAGED,
+} run_type_t;
+
+/**
+ * Find the run of blocks a read starts with, which is either in place, in the
+ * log or in the staging ring. Runs in the staging ring are a block long, the
+ * others as long as a driver request can be.
+ *
+ * @return length of the run.
+ */
+static uint16_t read_run(uint64_t block_number, uint16_t count, run_type_t *type, uint64_t *lsn)
+{
+    uint32_t idx = map_lookup(block_number);
+    uint16_t run = 1;
+
+    if (idx == IDX_NONE) {
+        *type = RUN_IN_PLACE;
+        while (run < count && run < state.drv_max_transfer && map_lookup(block_number + run) == IDX_NONE) {
+            run++;
+        }
+        return run;
+    }
+
+    *lsn = idx_lsn(idx);
+    if (lsn_staged(*lsn)) {
+        *type = RUN_STAGED;
+        return run;
+    }
+
+    /* Consecutive blocks in the log are usually consecutive in place too */
+    *type = RUN_LOG;
+    while (run < log_run(*lsn, count) && map_lookup(block_number + run) == idx + run && !lsn_staged(*lsn + run)) {
+        run++;
+    }
+    return run;
+}
+
+/* Number of driver requests a read is split into */
+static uint32_t read_requests(uint64_t block_number, uint16_t count)
+{
+    uint32_t requests = 0;
+    for (uint16_t done = 0; done < count;) {
+        run_type_t type;
+        uint64_t lsn;
+        done += read_run(block_number + done, count - done, &type, &lsn);
+        requests += (type != RUN_STAGED);
+    }
+    return requests;
+}
+
+/**
+ * Split a read into runs of blocks in place, in the log and in the staging
+ * ring. Runs in the staging ring are copied straight away, the others are
+ * read by the driver into their part of the buffer.
+ */
+static void read_blocks(uint32_t req, uint64_t block_number, uint16_t count, uintptr_t io_addr, uintptr_t vaddr)
+{
+    reqbk_t *reqbk = &reqsbk[req];
+
+    /* Make sure none of our cache lines for the buffer are written back over
+    the data the device writes */
+    cache_clean_and_invalidate(vaddr, vaddr + (uintptr_t)count * BLK_TRANSFER_SIZE);
+
+    for (uint16_t done = 0; done < count;) {
+        run_type_t type;
+        uint64_t lsn = 0;
+        uint16_t run = read_run(block_number + done, count - done, &type, &lsn);
+        uintptr_t offset = (uintptr_t)done * BLK_TRANSFER_SIZE;
+
+        switch (type) {
+        case RUN_IN_PLACE:
+            enqueue_driver(DRV_CLIENT, req, BLK_REQ_READ, io_addr + offset, block_number + done, run);
+            reqbk->pending++;
+            break;
+        case RUN_LOG:
+            enqueue_driver(DRV_CLIENT_LOG, req, BLK_REQ_READ, io_addr + offset, log_block_number(lsn), run);
+            reqbk->pending++;
+            state.log_reads++;
+            break;
+        case RUN_STAGED:
+            memcpy((void *)(vaddr + offset), (void *)stage_vaddr(lsn), BLK_TRANSFER_SIZE);
+            break;
+        }
+        done += run;
+    }
+
+    if (reqbk->pending == 0) {
+        finish_request(req);
+    }
+}
+
+static blk_resp_status_t validate_request(blk_req_code_t code, uint64_t block_number, uint16_t count)
+{
+    switch (code) {
+    case BLK_REQ_FLUSH:
+    case BLK_REQ_BARRIER:
+        return BLK_RESP_OK;
+    case BLK_REQ_READ:
+    case BLK_REQ_WRITE:
+        break;
+    default:
+        /* Discards and write zeroes would have to go through the log as well, they are not offered */
+        LOG_BLK_LOG_ERR("invalid request code %d\n", code);
+        return BLK_RESP_ERR_INVALID_PARAM;
+    }
+
+    if (count == 0 || count > state.max_transfer || block_number >= state.home_blocks
+        || count > state.home_blocks - block_number) {
+        LOG_BLK_LOG_ERR("request code %d for %u blocks at block %lu is invalid\n", code, count, block_number);
+        return BLK_RESP_ERR_INVALID_PARAM;
+    }
+
+    return BLK_RESP_OK;
+}
+
+/**
+ * Check whether a request can be passed on in full, so that a request is
+ * never partly passed on.
+ */
+static bool request_fits(blk_req_code_t code, uint64_t block_number, uint16_t count)
+{
+    switch (code) {
+    case BLK_REQ_READ:
+        return driver_space() >= read_requests(block_number, count);
+    case BLK_REQ_WRITE:
+        if (write_direct(block_number, count)) {
+            return driver_space() > 0;
+        }
+        if (!stage_fits(count)) {
+            state.waiting_space = true;
+            return false;
+        }
+        return true;
+    default:
+        return true;
+    }
+}
+
+/**
+ * Pass a pending flush or barrier to the driver once every earlier write has
+ * completed, which for writes staged in the log means their records are in
+ * the log.
+ */
+static void handle_flush(void)
+{
+    if (!state.flush_pending) {
+        return;
+    }
+
+    if (state.staged_head != state.staged_tail || state.direct_writes || state.tail_seq < state.broken_seq
+        || !driver_space()) {
+        return;
+    }
+
+    reqbk_t *reqbk = &reqsbk[state.flush_req];
+    enqueue_driver(DRV_CLIENT, state.flush_req, reqbk->code, 0, 0, 0);
+    reqbk->pending++;
+    state.flush_pending = false;
+}
+
+static void handle_virt(void)
+{
+    blk_req_code_t code = 0;
+    uintptr_t io_addr = 0;
+    uint64_t block_number = 0;
+    uint16_t count = 0;
+    uint32_t id = 0;
+
+    state.waiting_space = false;
+    /* Requests after a pending flush or barrier must wait for it to be passed on */
+    while (!state.flush_pending && !ialloc_full(&ialloc)
+           && !blk_peek_req(&virt_h, &code, &io_addr, &block_number, &count, &id)) {
+        blk_resp_status_t status = validate_request(code, block_number, count);
+        uintptr_t vaddr = 0;
+        if (status == BLK_RESP_OK && (code == BLK_REQ_READ || code == BLK_REQ_WRITE)) {
+            vaddr = buffer_vaddr(io_addr, count);
+            if (!vaddr) {
+                LOG_BLK_LOG_ERR("buffer 0x%lx is not within a mapped data region\n", io_addr);
+                status = BLK_RESP_ERR_INVALID_PARAM;
+            }
+        }
+        if (status == BLK_RESP_OK && !request_fits(code, block_number, count)) {
+            /* Wait for the driver to complete requests or for space in the log */
+            break;
+        }
+
+        int err = blk_dequeue_req(&virt_h, &code, &io_addr, &block_number, &count, &id);
+        assert(!err);
+        if (status != BLK_RESP_OK) {
+            respond_virt(status, 0, id);
+            continue;
+        }
+
+        uint32_t req = 0;
+        err = ialloc_alloc(&ialloc, &req);
+        assert(!err);
+        reqsbk[req] = (reqbk_t) { id, code, count, 0, BLK_RESP_OK, 0, 0 };
+
+        switch (code) {
+        case BLK_REQ_READ:
+            read_blocks(req, block_number, count, io_addr, vaddr);
+            break;
+        case BLK_REQ_WRITE:
+            if (write_direct(block_number, count)) {
+                enqueue_driver(DRV_CLIENT, req, code, io_addr, block_number, count);
+                reqsbk[req].pending++;
+                state.direct_writes++;
+            } else {
+                stage_write(req, block_number, count, vaddr);
+            }
+            break;
+        case BLK_REQ_FLUSH:
+        case BLK_REQ_BARRIER:
+            if (state.open) {
+                record_close();
+            }
+            state.flush_pending = true;
+            state.flush_req = req;
+            handle_flush();
+            break;
+        default:
+            /* This should never happen as we validate request codes before they are bookkept */
+            assert(false);
+        }
+    }
+
+    /* Everything written in this round goes to the log together */
+    if (state.open) {
+        record_close();
+    }
+}
+
+static bool destage_wanted(void)
+{
+    if (state.tail_seq == state.written_seq) {
+        return false;
+    }
+    return state.head_lsn - state.tail_lsn >= state.ring_blocks / 4 || state.waiting_space
+        || state.tail_seq < state.broken_seq;
+}
+
+/* Whether any block of the records being destaged is still the latest copy */
+static bool destage_live(void)
+{
+    for (uint64_t seq = state.tail_seq; seq < bg.end_seq; seq++) {
+        record_t *r = record(seq);
+        for (uint16_t i = 0; i < r->count; i++) {
+            if (blocks[ring_idx(r->lsn + 1 + i)].mapped) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static void bg_next(bg_state_t next)
+{
+    bg.state = next;
+    bg.issued = false;
+    bg.failed = false;
+}
+
+/**
+ * Issue the single driver request of the current step, unless it already has
+ * been.
+ *
+ * @return true once it has completed.
+ */
+static bool bg_single(blk_req_code_t code, uintptr_t io_addr, uint64_t block_number, uint16_t count)
+{
+    if (!bg.issued) {
+        if (!driver_space()) {
+            return false;
+        }
+        enqueue_driver(DRV_BACKGROUND, 0, code, io_addr, block_number, count);
+        bg.pending++;
+        bg.issued = true;
+    }
+    return bg.pending == 0;
+}
+
+/* Transfer log positions up to end_lsn between the log and the destage buffer, as far as the driver has space */
+static void bg_transfer(blk_req_code_t code, uint64_t end_lsn)
+{
+    while (bg.next_lsn < end_lsn && driver_space()) {
+        uint64_t lsn = bg.next_lsn;
+        uint32_t n = log_run(lsn, end_lsn - lsn);
+        enqueue_driver(DRV_BACKGROUND, 0, code, destage_io_addr(lsn), log_block_number(lsn), n);
+        bg.pending++;
+        bg.next_lsn += n;
+    }
+}
+
+/* Start destaging the oldest records that fit in the destage buffer together */
+static void destage_start(void)
+{
+    bg.base_lsn = state.tail_lsn;
+    bg.end_seq = state.tail_seq;
+    bg.end_lsn = state.tail_lsn;
+    while (bg.end_seq < state.written_seq) {
+        record_t *r = record(bg.end_seq);
+        uint64_t end = r->lsn + 1 + r->count;
+        if (end - bg.base_lsn > LOG_DESTAGE_BLOCKS) {
+            break;
+        }
+        bg.end_seq++;
+        bg.end_lsn = end;
+    }
+    assert(bg.end_seq > state.tail_seq);
+    bg.next_lsn = bg.base_lsn;
+    bg.seq = state.tail_seq;
+    bg.idx = 0;
+    bg.wrote = false;
+    LOG_BLK_LOG("destaging records %lu to %lu\n", state.tail_seq, bg.end_seq);
+
+    if (!destage_live()) {
+        bg_next(BG_SUPERBLOCK);
+        return;
+    }
+
+    uint64_t len = (bg.end_lsn - bg.base_lsn) * BLK_TRANSFER_SIZE;
+    if (lsn_staged(bg.base_lsn)) {
+        /* Still in the staging ring, which may be overwritten while the blocks are written in place */
+        for (uint64_t lsn = bg.base_lsn; lsn < bg.end_lsn; lsn++) {
+            memcpy((void *)destage_vaddr(lsn), (void *)stage_vaddr(lsn), BLK_TRANSFER_SIZE);
+        }
+        cache_clean(destage_vaddr(bg.base_lsn), destage_vaddr(bg.base_lsn) + len);
+        bg_next(BG_DESTAGE_WRITE);
+        return;
+    }
+
+    cache_clean_and_invalidate(destage_vaddr(bg.base_lsn), destage_vaddr(bg.base_lsn) + len);
+    bg_next(BG_DESTAGE_READ);
+}
+
+/* Write the latest copies of the blocks being destaged in place, as far as the driver has space */
+static void destage_write(void)
+{
+    while (bg.seq < bg.end_seq && driver_space()) {
+        record_t *r = record(bg.seq);
+        if (bg.idx == r->count) {
+            bg.seq++;
+            bg.idx = 0;
+            continue;
+        }
+
+        uint64_t lsn = r->lsn + 1 + bg.idx;
+        log_block_t *block = &blocks[ring_idx(lsn)];
+        if (!block->mapped) {
+            bg.idx++;
+            continue;
+        }
+
+        uint16_t run = 1;
+        while (bg.idx + run < r->count && run < state.drv_max_transfer) {
+            log_block_t *next = &blocks[ring_idx(lsn + run)];
+            if (!next->mapped || next->home != block->home + run) {
+                break;
+            }
+            run++;
+        }
+        enqueue_driver(DRV_BACKGROUND, 0, BLK_REQ_WRITE, destage_io_addr(lsn), block->home, run);
+        bg.pending++;
+        bg.wrote = true;
+        bg.idx += run;
+    }
+}
+
+/* Rebuild the remap table from a record read into the destage buffer, returns whether it is valid */
+static bool recover_record(void)
+{
+    log_header_t *hdr = (log_header_t *)destage_vaddr(bg.base_lsn);
+    uint64_t sum = hdr->checksum;
+    hdr->checksum = 0;
+    uint64_t check = checksum(LOG_CHECKSUM_SEED, (uintptr_t)hdr);
+    for (uint32_t i = 0; i < hdr->count; i++) {
+        check = checksum(check, destage_vaddr(bg.base_lsn + 1 + i));
+        if (hdr->home[i] >= state.home_blocks) {
+            return false;
+        }
+    }
+    if (check != sum) {
+        return false;
+    }
+
+    record_t *r = record(state.head_seq);
+    *r = (record_t) { .lsn = bg.base_lsn, .count = hdr->count, .state = RECORD_WRITTEN, .status = BLK_RESP_OK };
+    for (uint32_t i = 0; i < hdr->count; i++) {
+        map_insert(ring_idx(bg.base_lsn + 1 + i), hdr->home[i]);
+    }
+    state.head_seq++;
+    state.head_lsn = bg.base_lsn + 1 + hdr->count;
+    return true;
+}
+
+static bool header_valid(void)
+{
+    log_header_t *hdr = (log_header_t *)destage_vaddr(bg.base_lsn);
+    return hdr->magic == LOG_RECORD_MAGIC && hdr->seq == state.head_seq && hdr->count > 0
+        && hdr->count <= LOG_RECORD_MAX_BLOCKS && bg.base_lsn + 1 + hdr->count - state.tail_lsn <= state.ring_blocks
+        && state.head_seq + 1 - state.tail_seq <= LOG_MAX_RECORDS;
+}
+
+static void recover_next_header(void)
+{
+    bg.base_lsn = state.head_lsn;
+    cache_clean_and_invalidate(destage_vaddr(bg.base_lsn), destage_vaddr(bg.base_lsn) + BLK_TRANSFER_SIZE);
+    bg_next(BG_RECOVER_HEADER);
+}
+
+static void recover_finish(void)
+{
+    state.written_seq = state.head_seq;
+    state.stage_valid_lsn = state.head_lsn;
+
+    blk_storage_info_t *driver_storage_info = config.driver.storage_info.vaddr;
+    blk_storage_info_t *virt_storage_info = config.virt.storage_info.vaddr;
+    blk_storage_info_t storage_info = *driver_storage_info;
+    storage_info.ready = false;
+    storage_info.capacity = state.home_blocks;
+    storage_info.max_transfer = state.max_transfer;
+    storage_info.max_discard = 0;
+    storage_info.max_write_zeroes = 0;
+    *virt_storage_info = storage_info;
+    blk_storage_set_ready(virt_storage_info, true);
+
+    state.ready = true;
+    bg_next(BG_IDLE);
+    LOG_BLK_LOG("recovered %lu records of %lu blocks, presenting %lu blocks\n", state.head_seq - state.tail_seq,
+                state.head_lsn - state.tail_lsn, state.home_blocks);
+}
+
+static void bg_step(void)
+{
+    while (true) {
+        switch (bg.state) {
+        case BG_RECOVER_SUPERBLOCK:
+            if (!bg_single(BLK_REQ_READ, config.stage.io_addr, state.home_blocks, 1)) {
+                return;
+            }
+            cache_clean_and_invalidate(superblock_vaddr(), superblock_vaddr() + BLK_TRANSFER_SIZE);
+            if (bg.failed) {
+                LOG_BLK_LOG_ERR("failed to read the superblock, retrying\n");
+                bg_next(BG_RECOVER_SUPERBLOCK);
+                break;
+            }
+            if (!superblock_valid()) {
+                LOG_BLK_LOG("no valid superblock, starting a new log\n");
+                /* Records left from an earlier log must not follow on from the new superblock */
+                bg.base_lsn = 0;
+                memset((void *)destage_vaddr(0), 0, BLK_TRANSFER_SIZE);
+                cache_clean(destage_vaddr(0), destage_vaddr(0) + BLK_TRANSFER_SIZE);
+                bg_next(BG_FORMAT);
+                break;
+            }
+            state.tail_lsn = ((log_superblock_t *)superblock_vaddr())->tail_lsn;
+            state.tail_seq = ((log_superblock_t *)superblock_vaddr())->tail_seq;
+            state.head_lsn = state.tail_lsn;
+            state.head_seq = state.tail_seq;
+            recover_next_header();
+            break;
+        case BG_RECOVER_HEADER:
+            if (!bg_single(BLK_REQ_READ, destage_io_addr(bg.base_lsn), log_block_number(bg.base_lsn), 1)) {
+                return;
+            }
+            cache_clean_and_invalidate(destage_vaddr(bg.base_lsn), destage_vaddr(bg.base_lsn) + BLK_TRANSFER_SIZE);
+            if (bg.failed || !header_valid()) {
+                if (bg.failed) {
+                    LOG_BLK_LOG_ERR("failed to read the log at %lu, dropping the rest of it\n", bg.base_lsn);
+                }
+                recover_finish();
+                break;
+            }
+            bg.next_lsn = bg.base_lsn + 1;
+            bg.end_lsn = bg.next_lsn + ((log_header_t *)destage_vaddr(bg.base_lsn))->count;
+            cache_clean_and_invalidate(destage_vaddr(bg.next_lsn), destage_vaddr(bg.end_lsn));
+            bg_next(BG_RECOVER_RECORD);
+            break;
+        case BG_RECOVER_RECORD:
+            bg_transfer(BLK_REQ_READ, bg.end_lsn);
+            if (bg.pending || bg.next_lsn < bg.end_lsn) {
+                return;
+            }
+            cache_clean_and_invalidate(destage_vaddr(bg.base_lsn), destage_vaddr(bg.end_lsn));
+            if (bg.failed) {
+                LOG_BLK_LOG_ERR("failed to read the log at %lu, dropping the rest of it\n", bg.base_lsn);
+                recover_finish();
+            } else if (!recover_record()) {
+                recover_finish();
+            } else {
+                recover_next_header();
+            }
+            break;
+        case BG_FORMAT:
+            if (!bg_single(BLK_REQ_WRITE, destage_io_addr(0), log_block_number(0), 1)) {
+                return;
+            }
+            bg_next(bg.failed ? BG_FORMAT : BG_FORMAT_FLUSH);
+            break;
+        case BG_FORMAT_FLUSH:
+            if (!bg_single(BLK_REQ_FLUSH, 0, 0, 0)) {
+                return;
+            }
+            bg_next(bg.failed ? BG_FORMAT_FLUSH : BG_SUPERBLOCK);
+            break;
+        case BG_IDLE:
+            if (!destage_wanted()) {
+                return;
+            }
+            destage_start();
+            break;
+        case BG_DESTAGE_READ:
+            bg_transfer(BLK_REQ_READ, bg.end_lsn);
+            if (bg.pending || bg.next_lsn < bg.end_lsn) {
+                return;
+            }
+            if (bg.failed) {
+                /* Try again later */
+                LOG_BLK_LOG_ERR("failed to read records %lu to %lu for destaging\n", state.tail_seq, bg.end_seq);
+                bg_next(BG_IDLE);
+                return;
+            }
+            bg_next(BG_DESTAGE_WRITE);
+            break;
+        case BG_DESTAGE_WRITE:
+            destage_write();
+            if (bg.pending || bg.seq < bg.end_seq) {
+                return;
+            }
+            if (bg.failed) {
+                LOG_BLK_LOG_ERR("failed to write records %lu to %lu in place\n", state.tail_seq, bg.end_seq);
+                bg_next(BG_IDLE);
+                return;
+            }
+            bg_next(bg.wrote ? BG_DESTAGE_FLUSH : BG_SUPERBLOCK);
+            break;
+        case BG_DESTAGE_FLUSH:
+            if (!bg_single(BLK_REQ_FLUSH, 0, 0, 0)) {
+                return;
+            }
+            if (bg.failed) {
+                bg_next(BG_IDLE);
+                return;
+            }
+            bg_next(BG_SUPERBLOCK);
+            break;
+        case BG_SUPERBLOCK:
+            if (!bg.issued) {
+                /* When formatting the tail is where the log starts */
+                uint64_t tail_lsn = state.tail_lsn;
+                uint64_t tail_seq = state.tail_seq;
+                if (state.ready) {
+                    state.tail_lsn = bg.end_lsn;
+                    state.tail_seq = bg.end_seq;
+                }
+                superblock_write();
+                state.tail_lsn = tail_lsn;
+                state.tail_seq = tail_seq;
+            }
+            if (!bg_single(BLK_REQ_WRITE, config.stage.io_addr, state.home_blocks, 1)) {
+                return;
+            }
+            bg_next(bg.failed ? BG_SUPERBLOCK : BG_SUPERBLOCK_FLUSH);
+            break;
+        case BG_SUPERBLOCK_FLUSH:
+            if (!bg_single(BLK_REQ_FLUSH, 0, 0, 0)) {
+                return;
+            }
+            if (bg.failed) {
+                bg_next(BG_SUPERBLOCK_FLUSH);
+            } else if (!state.ready) {
+                recover_finish();
+            } else {
+                bg_next(BG_DESTAGE_FREE);
+            }
+            break;
+        case BG_DESTAGE_FREE:
+            /* Reads from the log must not see the records' space being reused */
+            if (state.log_reads) {
+                return;
+            }
+            for (uint64_t seq = state.tail_seq; seq < bg.end_seq; seq++) {
+                record_unmap(record(seq));
+            }
+            state.tail_lsn = bg.end_lsn;
+            state.tail_seq = bg.end_seq;
+            bg_next(BG_IDLE);
+            break;
+        }
+    }
+}
+
+static void handle_driver(void)
+{
+    blk_resp_status_t drv_status = 0;
+    uint16_t drv_success_count = 0;
+    uint32_t drv_resp_id = 0;
+
+    while (!blk_queue_empty_resp(&drv_h)) {
+        int err = blk_dequeue_resp(&drv_h, &drv_status, &drv_success_count, &drv_resp_id);
+        assert(!err);
+
+        drv_reqbk_t drv_reqbk = drv_reqsbk[drv_resp_id];
+        err = ialloc_free(&drv_ialloc, drv_resp_id);
+        assert(!err);
+
+        switch (drv_reqbk.type) {
+        case DRV_CLIENT:
+        case DRV_CLIENT_LOG: {
+            reqbk_t *reqbk = &reqsbk[drv_reqbk.idx];
+            reqbk->pending--;
+            if (drv_status != BLK_RESP_OK && reqbk->status == BLK_RESP_OK) {
+                reqbk->status = drv_status;
+            }
+            if (drv_reqbk.type == DRV_CLIENT_LOG) {
+                state.log_reads--;
+            }
+            if (reqbk->pending == 0) {
+                if (reqbk->code == BLK_REQ_WRITE) {
+                    state.direct_writes--;
+                }
+                finish_request(drv_reqbk.idx);
+            }
+            break;
+        }
+        case DRV_RECORD:
+            handle_record_complete(drv_reqbk.idx, drv_status);
+            break;
+        case DRV_BACKGROUND:
+            bg.pending--;
+            if (drv_status != BLK_RESP_OK) {
+                bg.failed = true;
+            }
+            break;
+        }
+    }
+}
+
+void notified(sddf_channel ch)
+{
+    if (ch == config.driver.id) {
+        handle_driver();
+    }
+
+    if (state.ready) {
+        handle_flush();
+        handle_virt();
+        submit_records();
+    }
+    bg_step();
+    /* Destaging may have made space in the log */
+    if (state.ready && state.waiting_space) {
+        handle_virt();
+        submit_records();
+    }
+
+    if (state.notify_virt) {
+        sddf_notify(config.virt.id);
+        state.notify_virt = false;
+    }
+    if (state.notify_drv) {
+        sddf_notify(config.driver.id);
+        state.notify_drv = false;
+    }
+}
+
+void init(void)
+{
+    assert(blk_config_check_magic(&config));
+
+    assert(config.virt.num_buffers <= VIRT_MAX_NUM_BUFFERS);
+    assert(config.driver.num_buffers <= DRIVER_MAX_NUM_BUFFERS);
+    blk_queue_init(&virt_h, config.virt.req_queue.vaddr, config.virt.resp_queue.vaddr, config.virt.num_buffers);
+    blk_queue_init(&drv_h, config.driver.req_queue.vaddr, config.driver.resp_queue.vaddr, config.driver.num_buffers);
+    ialloc_init(&ialloc, ialloc_idxlist, config.virt.num_buffers);
+    ialloc_init(&drv_ialloc, drv_ialloc_idxlist, config.driver.num_buffers);
+
+    for (uint32_t i = 0; i < LOG_HASH_BUCKETS; i++) {
+        hash[i] = IDX_NONE;
+    }
+
+    blk_storage_info_t *driver_storage_info = config.driver.storage_info.vaddr;
+    while (!blk_storage_is_ready(driver_storage_info));
+    assert(!driver_storage_info->read_only);
+
+    /* The log holds a superblock and at least two of the largest records */
+    state.ring_blocks = config.log_blocks - 1;
+    assert(config.log_blocks > 1 && state.ring_blocks <= LOG_MAX_BLOCKS);
+    assert(config.log_blocks < driver_storage_info->capacity);
+    state.home_blocks = driver_storage_info->capacity - config.log_blocks;
+
+    /* The stage region holds the superblock, the destage buffer and the staging ring */
+    uint64_t stage_region_blocks = config.stage.region.size / BLK_TRANSFER_SIZE;
+    assert(stage_region_blocks > 1 + LOG_DESTAGE_BLOCKS + 2);
+    state.stage_blocks = stage_region_blocks - 1 - LOG_DESTAGE_BLOCKS;
+
+    uint16_t drv_max_transfer = driver_storage_info->max_transfer;
+    state.drv_max_transfer = drv_max_transfer ? drv_max_transfer : UINT16_MAX;
+    /* A write spans at most two records, and must fit in the staging ring and the log along with their headers */
+    state.max_transfer = MIN(MIN(state.stage_blocks, state.ring_blocks) - 2, LOG_RECORD_MAX_BLOCKS);
+    if (drv_max_transfer) {
+        state.max_transfer = MIN(state.max_transfer, drv_max_transfer);
+    }
+
+    /* Start rebuilding the remap table, the virtualiser waits for us to be ready */
+    cache_clean_and_invalidate(superblock_vaddr(), superblock_vaddr() + BLK_TRANSFER_SIZE);
+    bg_next(BG_RECOVER_SUPERBLOCK);
+    bg_step();
+    if (state.notify_drv) {
+        sddf_notify(config.driver.id);
+        state.notify_drv = false;
+    }
+
+    LOG_BLK_LOG("%u blocks of log and %u blocks of staging in front of %lu blocks\n", state.ring_blocks,
+                state.stage_blocks, state.home_blocks);
+}
@@ -5,6 +5,7 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 
 /**
@@ -34,3 +35,21 @@ struct msdos_mbr {
 
 #define MSDOS_MBR_PARTITION_TYPE_EMPTY 0x00
 #define MSDOS_MBR_PARTITION_TYPE_GPT 0xEE
+#define MSDOS_MBR_PARTITION_TYPE_EXTENDED_CHS 0x05
+#define MSDOS_MBR_PARTITION_TYPE_EXTENDED_LBA 0x0F
+#define MSDOS_MBR_PARTITION_TYPE_EXTENDED_LINUX 0x85
+
+/**
+ * Logical partitions are described by a chain of extended boot records (EBR)
+ * within an extended primary partition. Each EBR has the layout of an MBR,
+ * its first entry is a logical partition starting relative to the EBR, and
+ * its second entry locates the next EBR relative to the extended partition.
+ * Logical partitions are numbered after the primary partitions.
+ */
+#define MSDOS_MBR_MAX_LOGICAL_PARTITIONS 64
+
+static inline bool msdos_mbr_partition_is_extended(uint8_t type)
+{
+    return type == MSDOS_MBR_PARTITION_TYPE_EXTENDED_CHS || type == MSDOS_MBR_PARTITION_TYPE_EXTENDED_LBA
+        || type == MSDOS_MBR_PARTITION_TYPE_EXTENDED_LINUX;
+}
@@ -11,55 +11,212 @@
 #include <sddf/util/cache.h>
 #include <sddf/util/util.h>
 
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+#define SECTORS_PER_BLOCK (BLK_TRANSFER_SIZE / MSDOS_MBR_SECTOR_SIZE)
+
 /* Client specific info */
 typedef struct client {
-    uint32_t start_sector;
-    uint32_t sectors;
+    uint64_t start_sector;
+    uint64_t sectors;
+    /* the client's partition has been validated and its storage info published */
+    bool ready;
 } client_t;
 static client_t clients[SDDF_BLK_MAX_CLIENTS];
 
+/**
+ * Partition metadata is read into the driver data region, which is handed
+ * over to readahead once discovery has finished. The blocks at the start of
+ * the disk hold the MBR, or a protective MBR followed by the primary GPT
+ * header and usually its whole partition table, and the blocks at the end
+ * hold the backup GPT table and header. Both ends are read up front, before
+ * the kind of partition table is known, so that a GPT disk takes a single
+ * round trip to the device. Partition tables placed elsewhere, and the chain
+ * of extended boot records describing logical MBR partitions, are read once
+ * the metadata locating them has been validated.
+ */
+typedef enum meta_kind {
+    META_PRIMARY = 0,
+    META_BACKUP,
+    /* GPT partition table not covered by the reads of either end */
+    META_TABLE,
+    META_EBR,
+    META_NUM_KINDS,
+} meta_kind_t;
+
+typedef struct meta_read {
+    /* the read is issued as soon as the driver queue has space */
+    bool wanted;
+    bool inflight;
+    bool done;
+    bool ok;
+    uint32_t id;
+    uint64_t block_number;
+    uint16_t count;
+    /* offset of the buffer in the driver data region */
+    uintptr_t offset;
+} meta_read_t;
+static meta_read_t meta_reads[META_NUM_KINDS];
+
+/* Blocks read from each end of the disk, enough for a GPT header and a table of GPT_MAX_PARTITIONS entries */
+#define META_END_BLOCKS                                                                                                \
+    ((2 * GPT_SECTOR_SIZE + GPT_MAX_PARTITIONS * sizeof(struct gpt_partition_entry) + BLK_TRANSFER_SIZE - 1)        \
+     / BLK_TRANSFER_SIZE)
+
 /* MS-DOS Master boot record */
 static struct msdos_mbr msdos_mbr;
+static bool mbr_valid;
+
+/* Logical partitions found so far, with start sectors relative to the disk */
+static struct msdos_mbr_partition logical_partitions[MSDOS_MBR_MAX_LOGICAL_PARTITIONS];
+static uint32_t num_logical_partitions;
+static uint32_t ebr_extended_start;
+static uint32_t ebr_sector;
+static uint32_t ebr_count;
+
+/* GPT metadata, from the primary and the backup copy at the end of the disk */
+typedef enum gpt_copy_kind {
+    GPT_PRIMARY = 0,
+    GPT_BACKUP,
+    GPT_NUM_COPIES,
+} gpt_copy_kind_t;
+
+typedef struct gpt_copy {
+    /* the header has been read and checked */
+    bool read;
+    bool header_valid;
+    /* the partition table has been read and its checksum checked */
+    bool table_checked;
+    bool table_valid;
+    struct gpt_partition_header header;
+    uint8_t *table;
+} gpt_copy_t;
+static gpt_copy_t gpt_copies[GPT_NUM_COPIES];
+static const meta_kind_t gpt_header_reads[GPT_NUM_COPIES] = { META_PRIMARY, META_BACKUP };
+/* copy clients are assigned partitions from, GPT_NUM_COPIES until one has been validated */
+static gpt_copy_kind_t gpt_in_use = GPT_NUM_COPIES;
+/* copy whose partition table is being read by META_TABLE */
+static gpt_copy_kind_t gpt_table_read;
+/* neither copy is valid, so no client can be given a partition */
+static bool gpt_failed;
+static bool gpt_compared;
+
+static const char *gpt_copy_name(gpt_copy_kind_t kind)
+{
+    return (kind == GPT_PRIMARY) ? "primary" : "backup";
+}
+
+static uint64_t disk_sectors(void)
+{
+    blk_storage_info_t *driver_storage_info = config.driver.conn.storage_info.vaddr;
+    return driver_storage_info->capacity * SECTORS_PER_BLOCK;
+}
+
+/**
+ * Find a range of sectors in the buffer of a completed metadata read.
+ *
+ * @return address of the first sector, NULL if the read failed or did not cover the range.
+ */
+static void *meta_sectors(meta_kind_t kind, uint64_t sector, uint64_t len)
+{
+    meta_read_t *read = &meta_reads[kind];
+    uint64_t start = read->block_number * SECTORS_PER_BLOCK;
+    uint64_t end = (read->block_number + read->count) * SECTORS_PER_BLOCK;
+    if (!read->ok || sector < start || sector >= end || len > (end - sector) * MSDOS_MBR_SECTOR_SIZE) {
+        return NULL;
+    }
+
+    return (void *)((uintptr_t)config.driver.data.region.vaddr + read->offset
+                    + (sector - start) * MSDOS_MBR_SECTOR_SIZE);
+}
+
+/**
+ * Ask for a metadata read, to be issued by meta_issue().
+ *
+ * @return false if the buffer would not fit in the driver data region.
+ */
+static bool meta_want(meta_kind_t kind, uint64_t block_number, uint64_t count, uintptr_t offset)
+{
+    if (count == 0 || count > UINT16_MAX || offset + count * BLK_TRANSFER_SIZE > config.driver.data.region.size) {
+        LOG_BLK_VIRT_ERR("partition metadata of %lu blocks at block %lu does not fit in the driver data region\n",
+                         count, block_number);
+        return false;
+    }
+
+    meta_read_t *read = &meta_reads[kind];
+    assert(!read->inflight);
+    *read = (meta_read_t) { .wanted = true, .block_number = block_number, .count = count, .offset = offset };
+    return true;
+}
 
-static const int mbr_req_count = 1;
-static struct {
-    /* Whether or not we have sent the initial request to the driver for the MBR metadata block. */
-    bool sent_request;
-    /* Request info associated with the MBR metadata block request, valid after sent_request is true */
-    uintptr_t req_addr;
-    uint32_t req_id;
-} mbr_state;
-
-/* GPT metadata */
-/* There are usually 1 (Protective MBR) + 1 (partition header) + 32 (partition table entries) sectors at the
- * start of the disk in total, but the size of entry could be different in some cases. */
-static struct {
-    struct gpt_partition_header *header;
-    struct gpt_partition_entry *table;
-    struct gpt_partition_header *mirror_header;
-    struct gpt_partition_entry *mirror_table;
-    uint32_t table_size;
-} gpt_meta;
-
-static struct {
-    /* Whether or not we have started the requests for GPT metadata blocks. */
-    bool sent_request;
-    uintptr_t req_addr;
-    uint32_t req_id;
-    uint32_t req_cnt;
-    uintptr_t mirror_req_addr;
-    uint32_t mirror_req_id;
-    uint32_t mirror_req_cnt;
-    bool partition_table_ready;
-    bool mirror_partition_table_ready;
-} gpt_state;
+static void meta_issue(void)
+{
+    bool notify = false;
+    for (int i = 0; i < META_NUM_KINDS; i++) {
+        meta_read_t *read = &meta_reads[i];
+        if (!read->wanted) {
+            continue;
+        }
+        if (blk_queue_full_req(&drv_h) || ialloc_full(&ialloc)) {
+            /* Retried by virt_partition_continue() once the driver has taken requests */
+            break;
+        }
+
+        int err = ialloc_alloc(&ialloc, &read->id);
+        assert(!err);
+
+        uintptr_t vaddr = (uintptr_t)config.driver.data.region.vaddr + read->offset;
+        cache_clean_and_invalidate(vaddr, vaddr + read->count * BLK_TRANSFER_SIZE);
+        err = blk_enqueue_req(&drv_h, BLK_REQ_READ, config.driver.data.io_addr + read->offset, read->block_number,
+                              read->count, read->id);
+        assert(!err);
+        LOG_BLK_VIRT("reading %u blocks of partition metadata from block %lu\n", read->count, read->block_number);
+
+        read->wanted = false;
+        read->inflight = true;
+        notify = true;
+    }
+
+    if (notify) {
+        sddf_deferred_notify(config.driver.conn.id);
+    }
+}
+
+/**
+ * Publish a client's partition in its storage info, after which the client
+ * may start issuing requests.
+ */
+static void client_release(int cli_id, uint64_t start_sector, uint64_t sectors)
+{
+    clients[cli_id].start_sector = start_sector;
+    clients[cli_id].sectors = sectors;
+
+    blk_storage_info_t *client_storage_info = config.clients[cli_id].conn.storage_info.vaddr;
+    blk_storage_info_t *driver_storage_info = config.driver.conn.storage_info.vaddr;
+    client_storage_info->sector_size = driver_storage_info->sector_size;
+    client_storage_info->capacity = sectors / SECTORS_PER_BLOCK;
+    client_storage_info->read_only = driver_storage_info->read_only;
+    client_storage_info->max_transfer = driver_storage_info->max_transfer;
+    client_storage_info->max_discard = driver_storage_info->max_discard;
+    client_storage_info->max_write_zeroes = driver_storage_info->max_write_zeroes;
+    clients[cli_id].ready = true;
+    blk_storage_set_ready(client_storage_info, true);
+
+    LOG_BLK_VIRT("client %d given partition %u at sector %lu\n", cli_id, config.clients[cli_id].partition,
+                 start_sector);
+}
 
 static void mbr_partitions_dump()
 {
     sddf_dprintf("the following MBR partitions exist:\n");
-    for (int i = 0; i < MSDOS_MBR_MAX_PRIMARY_PARTITIONS; i++) {
-        sddf_dprintf("      partition %d: type: 0x%hhx", i, msdos_mbr.partitions[i].type);
-        if (msdos_mbr.partitions[i].type == MSDOS_MBR_PARTITION_TYPE_EMPTY) {
+    for (uint32_t i = 0; i < MSDOS_MBR_MAX_PRIMARY_PARTITIONS + num_logical_partitions; i++) {
+        struct msdos_mbr_partition *partition = (i < MSDOS_MBR_MAX_PRIMARY_PARTITIONS)
+                                                  ? &msdos_mbr.partitions[i]
+                                                  : &logical_partitions[i - MSDOS_MBR_MAX_PRIMARY_PARTITIONS];
+        sddf_dprintf("      partition %u: type: 0x%hhx", i, partition->type);
+        if (partition->type == MSDOS_MBR_PARTITION_TYPE_EMPTY) {
             sddf_dprintf(" (empty)\n");
         } else {
             sddf_dprintf("\n");
@@ -69,315 +226,395 @@ static void mbr_partitions_dump()
 
 static void gpt_partitions_dump()
 {
+    struct gpt_partition_header *header = &gpt_copies[gpt_in_use].header;
     sddf_dprintf("the following GPT partitions exist:\n");
-    for (int i = 0; i < GPT_MAX_PARTITIONS; i++) {
+    for (int i = 0; i < header->num_entries; i++) {
+        struct gpt_partition_entry *entry = (struct gpt_partition_entry *)(gpt_copies[gpt_in_use].table
+                                                                           + i * header->entry_size);
         /* If no lba_start addr, then do not dump the partition as it is non-existent. */
-        if (gpt_meta.table[i].lba_start != 0) {
-            sddf_dprintf("      partition %d, lba_start: 0x%lx, name: %s\n", i, gpt_meta.table[i].lba_start,
-                         gpt_meta.table[i].name);
+        if (entry->lba_start != 0) {
+            sddf_dprintf("      partition %d, lba_start: 0x%lx, name: %s\n", i, entry->lba_start, entry->name);
         }
     }
 }
 
-static bool gpt_partitions_init()
+static void gpt_partitions_init()
 {
+    struct gpt_partition_header *header = &gpt_copies[gpt_in_use].header;
     for (int i = 0; i < config.num_clients; i++) {
-        blk_virt_config_client_t *client = &config.clients[i];
-        size_t client_partition = client->partition;
-        if (gpt_meta.table[client_partition].lba_start == 0) {
+        size_t client_partition = config.clients[i].partition;
+        struct gpt_partition_entry *entry = (struct gpt_partition_entry *)(gpt_copies[gpt_in_use].table
+                                                                           + client_partition * header->entry_size);
+        if (client_partition >= header->num_entries || entry->lba_start == 0 || entry->lba_end < entry->lba_start) {
             /* Partition does not exist */
             LOG_BLK_VIRT_ERR(
                 "Invalid client partition mapping for client %d: partition: %zu, partition does not exist\n", i,
                 client_partition);
             gpt_partitions_dump();
-            return false;
+            continue;
         }
-        clients[i].start_sector = gpt_meta.table[client_partition].lba_start;
-        clients[i].sectors = gpt_meta.table[client_partition].lba_end - gpt_meta.table[client_partition].lba_start + 1;
 
-        blk_storage_info_t *client_storage_info = client->conn.storage_info.vaddr;
-        blk_storage_info_t *driver_storage_info = config.driver.conn.storage_info.vaddr;
-        client_storage_info->sector_size = driver_storage_info->sector_size;
-        client_storage_info->capacity = clients[i].sectors / (BLK_TRANSFER_SIZE / MSDOS_MBR_SECTOR_SIZE);
-        client_storage_info->read_only = driver_storage_info->read_only;
-        blk_storage_set_ready(client_storage_info, true);
+        client_release(i, entry->lba_start, entry->lba_end - entry->lba_start + 1);
     }
-
-    return true;
 }
 
 uint32_t gpt_calc_crc32(const uint8_t *buffer, uint32_t len)
 {
-    int i, j;
-    uint32_t byte, crc, mask;
-
-    i = 0;
-    crc = 0xFFFFFFFF;
-    for (i = 0; i < len; i++) {
-        byte = buffer[i];            // Get next byte.
-        crc = crc ^ byte;
-        for (j = 7; j >= 0; j--) {    // Do eight times.
-            mask = -(crc & 1);
-            crc = (crc >> 1) ^ (0xEDB88320 & mask);
-        }
+    uint32_t crc = 0xFFFFFFFF;
+#if defined(__ARM_FEATURE_CRC32)
+    /* ARMv8 CRC32 instructions use the same polynomial as GPT */
+    for (; len >= sizeof(uint64_t); len -= sizeof(uint64_t), buffer += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, buffer, sizeof(word));
+        crc = __crc32d(crc, word);
+    }
+    for (; len > 0; len--) {
+        crc = __crc32b(crc, *buffer++);
     }
+#else
+    /* CRC of each byte value with the reflected polynomial 0xEDB88320 */
+    static const uint32_t crc32_table[256] = {
+        0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f, 0xe963a535, 0x9e6495a3,
+        0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988, 0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91,
+        0x1db71064, 0x6ab020f2, 0xf3b97148, 0x84be41de, 0x1adad47d, 0x6ddde4eb, 0xf4d4b551, 0x83d385c7,
+        0x136c9856, 0x646ba8c0, 0xfd62f97a, 0x8a65c9ec, 0x14015c4f, 0x63066cd9, 0xfa0f3d63, 0x8d080df5,
+        0x3b6e20c8, 0x4c69105e, 0xd56041e4, 0xa2677172, 0x3c03e4d1, 0x4b04d447, 0xd20d85fd, 0xa50ab56b,
+        0x35b5a8fa, 0x42b2986c, 0xdbbbc9d6, 0xacbcf940, 0x32d86ce3, 0x45df5c75, 0xdcd60dcf, 0xabd13d59,
+        0x26d930ac, 0x51de003a, 0xc8d75180, 0xbfd06116, 0x21b4f4b5, 0x56b3c423, 0xcfba9599, 0xb8bda50f,
+        0x2802b89e, 0x5f058808, 0xc60cd9b2, 0xb10be924, 0x2f6f7c87, 0x58684c11, 0xc1611dab, 0xb6662d3d,
+        0x76dc4190, 0x01db7106, 0x98d220bc, 0xefd5102a, 0x71b18589, 0x06b6b51f, 0x9fbfe4a5, 0xe8b8d433,
+        0x7807c9a2, 0x0f00f934, 0x9609a88e, 0xe10e9818, 0x7f6a0dbb, 0x086d3d2d, 0x91646c97, 0xe6635c01,
+        0x6b6b51f4, 0x1c6c6162, 0x856530d8, 0xf262004e, 0x6c0695ed, 0x1b01a57b, 0x8208f4c1, 0xf50fc457,
+        0x65b0d9c6, 0x12b7e950, 0x8bbeb8ea, 0xfcb9887c, 0x62dd1ddf, 0x15da2d49, 0x8cd37cf3, 0xfbd44c65,
+        0x4db26158, 0x3ab551ce, 0xa3bc0074, 0xd4bb30e2, 0x4adfa541, 0x3dd895d7, 0xa4d1c46d, 0xd3d6f4fb,
+        0x4369e96a, 0x346ed9fc, 0xad678846, 0xda60b8d0, 0x44042d73, 0x33031de5, 0xaa0a4c5f, 0xdd0d7cc9,
+        0x5005713c, 0x270241aa, 0xbe0b1010, 0xc90c2086, 0x5768b525, 0x206f85b3, 0xb966d409, 0xce61e49f,
+        0x5edef90e, 0x29d9c998, 0xb0d09822, 0xc7d7a8b4, 0x59b33d17, 0x2eb40d81, 0xb7bd5c3b, 0xc0ba6cad,
+        0xedb88320, 0x9abfb3b6, 0x03b6e20c, 0x74b1d29a, 0xead54739, 0x9dd277af, 0x04db2615, 0x73dc1683,
+        0xe3630b12, 0x94643b84, 0x0d6d6a3e, 0x7a6a5aa8, 0xe40ecf0b, 0x9309ff9d, 0x0a00ae27, 0x7d079eb1,
+        0xf00f9344, 0x8708a3d2, 0x1e01f268, 0x6906c2fe, 0xf762575d, 0x806567cb, 0x196c3671, 0x6e6b06e7,
+        0xfed41b76, 0x89d32be0, 0x10da7a5a, 0x67dd4acc, 0xf9b9df6f, 0x8ebeeff9, 0x17b7be43, 0x60b08ed5,
+        0xd6d6a3e8, 0xa1d1937e, 0x38d8c2c4, 0x4fdff252, 0xd1bb67f1, 0xa6bc5767, 0x3fb506dd, 0x48b2364b,
+        0xd80d2bda, 0xaf0a1b4c, 0x36034af6, 0x41047a60, 0xdf60efc3, 0xa867df55, 0x316e8eef, 0x4669be79,
+        0xcb61b38c, 0xbc66831a, 0x256fd2a0, 0x5268e236, 0xcc0c7795, 0xbb0b4703, 0x220216b9, 0x5505262f,
+        0xc5ba3bbe, 0xb2bd0b28, 0x2bb45a92, 0x5cb36a04, 0xc2d7ffa7, 0xb5d0cf31, 0x2cd99e8b, 0x5bdeae1d,
+        0x9b64c2b0, 0xec63f226, 0x756aa39c, 0x026d930a, 0x9c0906a9, 0xeb0e363f, 0x72076785, 0x05005713,
+        0x95bf4a82, 0xe2b87a14, 0x7bb12bae, 0x0cb61b38, 0x92d28e9b, 0xe5d5be0d, 0x7cdcefb7, 0x0bdbdf21,
+        0x86d3d2d4, 0xf1d4e242, 0x68ddb3f8, 0x1fda836e, 0x81be16cd, 0xf6b9265b, 0x6fb077e1, 0x18b74777,
+        0x88085ae6, 0xff0f6a70, 0x66063bca, 0x11010b5c, 0x8f659eff, 0xf862ae69, 0x616bffd3, 0x166ccf45,
+        0xa00ae278, 0xd70dd2ee, 0x4e048354, 0x3903b3c2, 0xa7672661, 0xd06016f7, 0x4969474d, 0x3e6e77db,
+        0xaed16a4a, 0xd9d65adc, 0x40df0b66, 0x37d83bf0, 0xa9bcae53, 0xdebb9ec5, 0x47b2cf7f, 0x30b5ffe9,
+        0xbdbdf21c, 0xcabac28a, 0x53b39330, 0x24b4a3a6, 0xbad03605, 0xcdd70693, 0x54de5729, 0x23d967bf,
+        0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94, 0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d,
+    };
+
+    for (uint32_t i = 0; i < len; i++) {
+        crc = crc32_table[(crc ^ buffer[i]) & 0xFF] ^ (crc >> 8);
+    }
+#endif
     return ~crc;
 }
 
-static bool gpt_validate_partitions()
+static void gpt_check_table(gpt_copy_kind_t kind)
 {
-    int err = 0;
-    if (blk_queue_empty_resp(&drv_h)) {
-        LOG_BLK_VIRT_ERR(
-            "Notified by driver but queue is empty, expecting a response to a BLK_REQ_READ request for GPT "
-            "partition entries\n");
-        return false;
+    gpt_copy_t *copy = &gpt_copies[kind];
+    copy->table_checked = true;
+    uint32_t crc32_entry_array = gpt_calc_crc32(copy->table, copy->header.num_entries * copy->header.entry_size);
+    if (crc32_entry_array != copy->header.crc32_entry_array) {
+        LOG_BLK_VIRT_ERR("CRC32 checksum of %s partition entry array is incorrect.\n", gpt_copy_name(kind));
+        return;
     }
 
-    blk_resp_status_t drv_status;
-    uint16_t drv_success_count;
-    uint32_t gpt_resp_id;
+    copy->table_valid = true;
+}
 
-    /* Two responses could be notified only once */
-    while (!blk_queue_empty_resp(&drv_h)) {
-        err = blk_dequeue_resp(&drv_h, &drv_status, &drv_success_count, &gpt_resp_id);
-        assert(!err);
+/**
+ * Validate the header of a GPT copy, and its partition table too if it was
+ * read along with the header.
+ */
+static void gpt_check_header(gpt_copy_kind_t kind)
+{
+    gpt_copy_t *copy = &gpt_copies[kind];
+    copy->read = true;
+
+    /* The primary header follows the protective MBR, the backup is in the last sector */
+    uint64_t sector = (kind == GPT_PRIMARY) ? 1 : disk_sectors() - 1;
+    struct gpt_partition_header *header = meta_sectors(gpt_header_reads[kind], sector, GPT_SECTOR_SIZE);
+    if (header == NULL) {
+        LOG_BLK_VIRT_ERR("Failed to read %s GPT header\n", gpt_copy_name(kind));
+        return;
+    }
 
-        err = ialloc_free(&ialloc, gpt_resp_id);
-        assert(!err);
+    if (memcmp(header->signature, GPT_HEADER_SIGNATURE, sizeof(header->signature))) {
+        LOG_BLK_VIRT_ERR("Invalid GPT signature in %s partition header\n", gpt_copy_name(kind));
+        return;
+    }
 
-        if (drv_status != BLK_RESP_OK) {
-            LOG_BLK_VIRT_ERR("Failed to read partition table from driver\n");
-            return false;
-        }
+    if (header->header_size < GPT_HEADER_MIN_SIZE || header->header_size > GPT_SECTOR_SIZE) {
+        LOG_BLK_VIRT_ERR("Invalid %s GPT header size %u\n", gpt_copy_name(kind), header->header_size);
+        return;
+    }
 
-        if (gpt_resp_id == gpt_state.req_id) {
-            // Validate the signature in partition header
-            if (strcmp(gpt_meta.header->signature, GPT_HEADER_SIGNATURE)) {
-                LOG_BLK_VIRT_ERR("Invalid GPT signature\n");
-                return false;
-            }
+    uint32_t reserved_crc32 = header->crc32_header;
+    header->crc32_header = 0; // checksum field is zeroed for calculation
+    uint32_t crc32_header = gpt_calc_crc32((uint8_t *)header, header->header_size);
+    header->crc32_header = reserved_crc32;
+    if (crc32_header != reserved_crc32) {
+        LOG_BLK_VIRT_ERR("%s CRC32 checksum is incorrect.\n", gpt_copy_name(kind));
+        return;
+    }
 
-            // Validate the header checksum
-            uint32_t reserved_crc32 = gpt_meta.header->crc32_header;
-            gpt_meta.header->crc32_header = 0;              // checksum field is zeroed for calculation
-            uint32_t crc32_header = gpt_calc_crc32((uint8_t *)gpt_meta.header, 0x5C);
-            if (crc32_header != reserved_crc32) {
-                LOG_BLK_VIRT_ERR("CRC32 checksum is incorrect.\n");
-                return false;
-            }
-            gpt_meta.header->crc32_header = reserved_crc32; // Recover the checksum field
+    uint64_t table_size = (uint64_t)header->num_entries * header->entry_size;
+    if (header->lba_header != sector || header->entry_size < sizeof(struct gpt_partition_entry)
+        || header->entry_size % sizeof(uint64_t) || table_size > config.driver.data.region.size) {
+        LOG_BLK_VIRT_ERR("Invalid %s GPT header fields\n", gpt_copy_name(kind));
+        return;
+    }
 
-            cache_clean_and_invalidate(gpt_state.req_addr,
-                                       gpt_state.req_addr + (BLK_TRANSFER_SIZE * gpt_state.req_cnt));
+    copy->header = *header;
+    copy->header_valid = true;
+    copy->table = meta_sectors(gpt_header_reads[kind], header->lba_start, table_size);
+    if (copy->table != NULL) {
+        gpt_check_table(kind);
+    }
+}
 
-            uint32_t crc32_entry_array = gpt_calc_crc32((uint8_t *)gpt_meta.table, gpt_meta.table_size);
-            if (crc32_entry_array != gpt_meta.header->crc32_entry_array) {
-                LOG_BLK_VIRT_ERR("CRC32 checksum of partition entry array is incorrect.\n");
-                return false;
-            }
+/**
+ * Ask for the partition table of a GPT copy which was not read along with its header.
+ *
+ * @return false if the table cannot be read.
+ */
+static bool gpt_want_table(gpt_copy_kind_t kind)
+{
+    struct gpt_partition_header *header = &gpt_copies[kind].header;
+    uint64_t table_size = (uint64_t)header->num_entries * header->entry_size;
+    uint64_t block_number = header->lba_start / SECTORS_PER_BLOCK;
+    uint64_t count = ((header->lba_start % SECTORS_PER_BLOCK) * MSDOS_MBR_SECTOR_SIZE + table_size
+                      + BLK_TRANSFER_SIZE - 1)
+                   / BLK_TRANSFER_SIZE;
+    if (!meta_want(META_TABLE, block_number, count, 2 * META_END_BLOCKS * BLK_TRANSFER_SIZE)) {
+        gpt_copies[kind].table_checked = true;
+        return false;
+    }
 
-            gpt_state.partition_table_ready = true;
+    gpt_table_read = kind;
+    return true;
+}
 
-        } else if (gpt_resp_id == gpt_state.mirror_req_id) {
-            cache_clean_and_invalidate(gpt_state.mirror_req_addr,
-                                       gpt_state.mirror_req_addr + (BLK_TRANSFER_SIZE * gpt_state.mirror_req_cnt));
-            assert(!err);
+/**
+ * Compare the primary and backup GPT headers, which should describe the same
+ * partition table. A mismatch is reported but does not stop the validated
+ * copy from being used.
+ */
+static void gpt_compare(void)
+{
+    struct gpt_partition_header *header = &gpt_copies[GPT_PRIMARY].header;
+    struct gpt_partition_header *mirror_header = &gpt_copies[GPT_BACKUP].header;
+    if (header->revision != mirror_header->revision || memcmp(header->guid, mirror_header->guid, sizeof(header->guid))
+        || header->lba_header != mirror_header->lba_alt_header || header->lba_alt_header != mirror_header->lba_header
+        || header->num_entries != mirror_header->num_entries || header->entry_size != mirror_header->entry_size
+        || header->crc32_entry_array != mirror_header->crc32_entry_array) {
+        LOG_BLK_VIRT_ERR("Primary and backup GPT headers do not match\n");
+    }
+    gpt_compared = true;
+}
 
-            gpt_meta.mirror_header = (struct gpt_partition_header *)(gpt_state.mirror_req_addr
-                                                                     + gpt_state.mirror_req_cnt * BLK_TRANSFER_SIZE
-                                                                     - GPT_SECTOR_SIZE);
-            // Validate the signature in mirror header
-            if (strcmp(gpt_meta.mirror_header->signature, GPT_HEADER_SIGNATURE)) {
-                LOG_BLK_VIRT_ERR("Invalid GPT signature in mirror partition header\n");
-                return false;
-            }
+/**
+ * Make what progress the completed GPT metadata reads allow. The primary copy
+ * is used if it is valid, the backup otherwise.
+ */
+static void gpt_discover(void)
+{
+    for (int i = 0; i < GPT_NUM_COPIES; i++) {
+        if (!gpt_copies[i].read && meta_reads[gpt_header_reads[i]].done) {
+            gpt_check_header(i);
+        }
+    }
 
-            // Validate the CRC32 checksum in mirror header
-            // mirror header is located at the back of the disk
-            uint32_t reserved_crc32 = gpt_meta.mirror_header->crc32_header;
-            gpt_meta.mirror_header->crc32_header = 0;              // checksum field is zeroed for calculation
-            uint32_t crc32_header = gpt_calc_crc32((uint8_t *)gpt_meta.mirror_header, 0x5C);
-            if (crc32_header != reserved_crc32) {
-                LOG_BLK_VIRT_ERR("mirror CRC32 checksum is incorrect.\n");
-                return false;
+    if (gpt_in_use == GPT_NUM_COPIES && !gpt_failed) {
+        for (int i = 0; i < GPT_NUM_COPIES; i++) {
+            gpt_copy_t *copy = &gpt_copies[i];
+            meta_read_t *table_read = &meta_reads[META_TABLE];
+            if (!copy->read || (i == gpt_table_read && (table_read->wanted || table_read->inflight))) {
+                /* Wait for the preferred copy before falling back to the next */
+                return;
             }
-            gpt_meta.mirror_header->crc32_header = reserved_crc32; // Recover the checksum field
-
-            // Validate mirror partition table
-            // mirror table is before the mirror header
-            uint32_t table_offset = gpt_state.mirror_req_cnt * BLK_TRANSFER_SIZE - gpt_meta.table_size
-                                  - GPT_SECTOR_SIZE;
-            gpt_meta.mirror_table = (struct gpt_partition_entry *)(gpt_state.mirror_req_addr + table_offset);
-            uint32_t crc32_mirror_entry_array = gpt_calc_crc32((uint8_t *)gpt_meta.mirror_table, gpt_meta.table_size);
-            if (crc32_mirror_entry_array != gpt_meta.mirror_header->crc32_entry_array) {
-                LOG_BLK_VIRT_ERR("CRC32 checksum of partition entry array is incorrect.\n");
-                return false;
+            if (copy->table_valid) {
+                LOG_BLK_VIRT("initialising GPT partitions from %s table\n", gpt_copy_name(i));
+                gpt_in_use = i;
+                gpt_partitions_init();
+                break;
+            }
+            if (copy->header_valid && !copy->table_checked && gpt_want_table(i)) {
+                return;
             }
-
-            gpt_state.mirror_partition_table_ready = true;
         }
-    }
 
-    if (gpt_state.partition_table_ready && gpt_state.mirror_partition_table_ready) {
-        // Compare key fields of partition header and backup header
-        assert(gpt_meta.header->revision == gpt_meta.mirror_header->revision);
-        assert(gpt_meta.header->header_size == gpt_meta.mirror_header->header_size);
-        for (int i = 0; i < 16; i++) {
-            assert(gpt_meta.header->guid[i] == gpt_meta.mirror_header->guid[i]);
+        if (gpt_in_use == GPT_NUM_COPIES) {
+            LOG_BLK_VIRT_ERR("No valid GPT partition table\n");
+            gpt_failed = true;
+            return;
         }
-        assert(gpt_meta.header->lba_header == gpt_meta.mirror_header->lba_alt_header);
-        assert(gpt_meta.header->lba_alt_header == gpt_meta.mirror_header->lba_header);
-        assert(gpt_meta.header->lba_start = gpt_meta.mirror_header->lba_start);
-        assert(gpt_meta.header->num_entries = gpt_meta.mirror_header->num_entries);
-        assert(gpt_meta.header->entry_size = gpt_meta.mirror_header->entry_size);
-        assert(gpt_meta.header->crc32_entry_array = gpt_meta.mirror_header->crc32_entry_array);
+    }
 
-        return true;
+    if (!gpt_compared && gpt_copies[GPT_PRIMARY].header_valid && gpt_copies[GPT_BACKUP].header_valid) {
+        gpt_compare();
     }
-    return false;
 }
 
-static bool mbr_partitions_init(void)
+static void mbr_partition_init(int cli_id, struct msdos_mbr_partition *partition)
 {
-    if (msdos_mbr.signature != MSDOS_MBR_SIGNATURE) {
-        LOG_BLK_VIRT_ERR("Invalid MBR signature\n");
-        return false;
+    if (partition->type == MSDOS_MBR_PARTITION_TYPE_EMPTY) {
+        /* Partition does not exist */
+        LOG_BLK_VIRT_ERR("Invalid client partition mapping for client %d: partition: %u, partition does not exist\n",
+                         cli_id, config.clients[cli_id].partition);
+        mbr_partitions_dump();
+        return;
+    }
+
+    if (partition->lba_start % SECTORS_PER_BLOCK != 0) {
+        /* Partition start sector is not aligned to sDDF transfer size */
+        LOG_BLK_VIRT_ERR("Partition %u start sector %u not aligned to sDDF transfer size\n",
+                         config.clients[cli_id].partition, partition->lba_start);
+        return;
     }
 
-    /* Validate partition and assign to client */
+    client_release(cli_id, partition->lba_start, partition->sectors);
+}
+
+/**
+ * Whether a client is waiting for a logical partition beyond those found so far.
+ */
+static bool mbr_logical_wanted(void)
+{
     for (int i = 0; i < config.num_clients; i++) {
-        blk_virt_config_client_t *client = &config.clients[i];
-        size_t client_partition = client->partition;
+        if (!clients[i].ready
+            && config.clients[i].partition >= MSDOS_MBR_MAX_PRIMARY_PARTITIONS + num_logical_partitions) {
+            return true;
+        }
+    }
 
-        if (client_partition >= MSDOS_MBR_MAX_PRIMARY_PARTITIONS
-            || msdos_mbr.partitions[client_partition].type == MSDOS_MBR_PARTITION_TYPE_EMPTY) {
-            /* Partition does not exist */
+    return false;
+}
+
+/**
+ * Fail the clients waiting for logical partitions once there are no more.
+ */
+static void mbr_logical_end(void)
+{
+    for (int i = 0; i < config.num_clients; i++) {
+        size_t client_partition = config.clients[i].partition;
+        if (!clients[i].ready && client_partition >= MSDOS_MBR_MAX_PRIMARY_PARTITIONS + num_logical_partitions) {
             LOG_BLK_VIRT_ERR(
                 "Invalid client partition mapping for client %d: partition: %zu, partition does not exist\n", i,
                 client_partition);
             mbr_partitions_dump();
-            return false;
         }
-
-        if (msdos_mbr.partitions[client_partition].lba_start % (BLK_TRANSFER_SIZE / MSDOS_MBR_SECTOR_SIZE) != 0) {
-            /* Partition start sector is not aligned to sDDF transfer size */
-            LOG_BLK_VIRT_ERR("Partition %d start sector %d not aligned to sDDF transfer size\n", (int)client_partition,
-                             msdos_mbr.partitions[client_partition].lba_start);
-            return false;
-        }
-
-        /* We have a valid partition now. */
-        clients[i].start_sector = msdos_mbr.partitions[client_partition].lba_start;
-        clients[i].sectors = msdos_mbr.partitions[client_partition].sectors;
-
-        blk_storage_info_t *client_storage_info = client->conn.storage_info.vaddr;
-        blk_storage_info_t *driver_storage_info = config.driver.conn.storage_info.vaddr;
-        client_storage_info->sector_size = driver_storage_info->sector_size;
-        client_storage_info->capacity = clients[i].sectors / (BLK_TRANSFER_SIZE / MSDOS_MBR_SECTOR_SIZE);
-        client_storage_info->read_only = driver_storage_info->read_only;
-        blk_storage_set_ready(client_storage_info, true);
     }
-    return true;
 }
 
-static void mbr_request()
+static void ebr_want(uint32_t sector)
 {
-    int err = 0;
-    uintptr_t mbr_paddr = config.driver.data.io_addr;
-    mbr_state.req_addr = (uintptr_t)config.driver.data.region.vaddr;
+    if (ebr_count == MSDOS_MBR_MAX_LOGICAL_PARTITIONS || !meta_want(META_EBR, sector / SECTORS_PER_BLOCK, 1, 0)) {
+        mbr_logical_end();
+        return;
+    }
 
-    err = ialloc_alloc(&ialloc, &mbr_state.req_id);
-    assert(!err);
+    ebr_sector = sector;
+    ebr_count++;
+}
 
-    /* Virt-to-driver data region needs to be big enough to transfer MBR data */
-    assert(config.driver.data.region.size >= BLK_TRANSFER_SIZE);
-    err = blk_enqueue_req(&drv_h, BLK_REQ_READ, mbr_paddr, 0, 1, mbr_state.req_id);
-    assert(!err);
+/**
+ * Assign the clients of primary partitions, and start following the chain of
+ * extended boot records if any client asked for a logical partition.
+ */
+static void mbr_partitions_init(void)
+{
+    for (int i = 0; i < config.num_clients; i++) {
+        size_t client_partition = config.clients[i].partition;
+        if (client_partition < MSDOS_MBR_MAX_PRIMARY_PARTITIONS) {
+            mbr_partition_init(i, &msdos_mbr.partitions[client_partition]);
+        }
+    }
+
+    if (!mbr_logical_wanted()) {
+        return;
+    }
 
-    sddf_deferred_notify(config.driver.conn.id);
+    for (int i = 0; i < MSDOS_MBR_MAX_PRIMARY_PARTITIONS; i++) {
+        if (msdos_mbr_partition_is_extended(msdos_mbr.partitions[i].type)) {
+            ebr_extended_start = msdos_mbr.partitions[i].lba_start;
+            ebr_want(ebr_extended_start);
+            return;
+        }
+    }
 
-    mbr_state.sent_request = true;
+    mbr_logical_end();
 }
 
-/* Process response for MBR metadata.
- * Returns true if valid MBR.
- * Return false if invalid MBR or GPT disk.
- */
-static bool mbr_handle_response()
+static void ebr_handle_response(void)
 {
-    /* Should not get here without the initial metadata request. */
-    assert(mbr_state.sent_request);
+    struct msdos_mbr *ebr = meta_sectors(META_EBR, ebr_sector, MSDOS_MBR_SECTOR_SIZE);
+    if (ebr == NULL || ebr->signature != MSDOS_MBR_SIGNATURE) {
+        LOG_BLK_VIRT_ERR("Invalid extended boot record at sector %u\n", ebr_sector);
+        mbr_logical_end();
+        return;
+    }
 
-    int err = 0;
-    if (blk_queue_empty_resp(&drv_h)) {
-        LOG_BLK_VIRT_ERR(
-            "Notified by driver but queue is empty, expecting a response to a BLK_REQ_READ request into sector 0\n");
-        return false;
+    struct msdos_mbr_partition *partition = &ebr->partitions[0];
+    if (partition->type != MSDOS_MBR_PARTITION_TYPE_EMPTY) {
+        uint32_t number = MSDOS_MBR_MAX_PRIMARY_PARTITIONS + num_logical_partitions;
+        struct msdos_mbr_partition *logical = &logical_partitions[num_logical_partitions++];
+        *logical = *partition;
+        logical->lba_start += ebr_sector;
+
+        for (int i = 0; i < config.num_clients; i++) {
+            if (config.clients[i].partition == number) {
+                mbr_partition_init(i, logical);
+            }
+        }
     }
 
-    blk_resp_status_t drv_status;
-    uint16_t drv_success_count;
-    uint32_t drv_resp_id;
-    err = blk_dequeue_resp(&drv_h, &drv_status, &drv_success_count, &drv_resp_id);
-    assert(!err);
+    struct msdos_mbr_partition *next = &ebr->partitions[1];
+    if (!mbr_logical_wanted()) {
+        return;
+    }
+    if (!msdos_mbr_partition_is_extended(next->type) || next->lba_start == 0) {
+        mbr_logical_end();
+        return;
+    }
 
-    err = ialloc_free(&ialloc, mbr_state.req_id);
-    assert(!err);
+    ebr_want(ebr_extended_start + next->lba_start);
+}
 
-    if (drv_status != BLK_RESP_OK) {
+/**
+ * Process the blocks at the start of the disk, which decide whether partitions
+ * are described by the MBR or a GPT.
+ */
+static void mbr_handle_response(void)
+{
+    struct msdos_mbr *mbr = meta_sectors(META_PRIMARY, 0, sizeof(struct msdos_mbr));
+    if (mbr == NULL) {
         LOG_BLK_VIRT_ERR("Failed to read sector 0 from driver\n");
-        return false;
+        return;
     }
 
-    cache_clean_and_invalidate(mbr_state.req_addr, mbr_state.req_addr + (BLK_TRANSFER_SIZE * mbr_req_count));
-    memcpy(&msdos_mbr, (void *)mbr_state.req_addr, sizeof(struct msdos_mbr));
+    memcpy(&msdos_mbr, mbr, sizeof(struct msdos_mbr));
+    if (msdos_mbr.signature != MSDOS_MBR_SIGNATURE) {
+        LOG_BLK_VIRT_ERR("Invalid MBR signature\n");
+        return;
+    }
+    mbr_valid = true;
 
     /* There is only one partition entry in Protective MBR of the GPT partition schema */
     if (msdos_mbr.partitions[0].type == MSDOS_MBR_PARTITION_TYPE_GPT) {
         LOG_BLK_VIRT("Protective MBR of GPT is detected\n");
-
-        /* Save the primary GPT header, and validate the header in gpt_validate_partitionsk() */
-        gpt_meta.header = (struct gpt_partition_header *)(mbr_state.req_addr + GPT_SECTOR_SIZE);
-        gpt_meta.table_size = gpt_meta.header->num_entries * gpt_meta.header->entry_size;
-
-        /* Copy the first two sectors of partition entries to the table */
-        gpt_meta.table = (struct gpt_partition_entry *)(mbr_state.req_addr + GPT_SECTOR_SIZE * 2);
-
-        /* Request for the blocks containing the rest of partition entries */
-        uint32_t gpt_req_id = 0;
-        err = ialloc_alloc(&ialloc, &gpt_req_id);
-        assert(!err);
-        uint32_t meta_blk_cnt = (GPT_SECTOR_SIZE * 2 + BLK_TRANSFER_SIZE - 1 + gpt_meta.table_size) / BLK_TRANSFER_SIZE;
-        gpt_state.req_addr = (uintptr_t)config.driver.data.region.vaddr + BLK_TRANSFER_SIZE;
-        gpt_state.req_id = gpt_req_id;
-        gpt_state.req_cnt = meta_blk_cnt - 1;
-        err = blk_enqueue_req(&drv_h, BLK_REQ_READ, (uintptr_t)config.driver.data.io_addr + BLK_TRANSFER_SIZE, 1,
-                              meta_blk_cnt - 1, gpt_req_id);
-        assert(!err);
-
-        /* Request for mirror of partition table and header */
-        err = ialloc_alloc(&ialloc, &gpt_req_id);
-        assert(!err);
-
-        uint32_t meta_mirror_blk_cnt = (GPT_SECTOR_SIZE * 1 + BLK_TRANSFER_SIZE - 1 + gpt_meta.table_size)
-                                     / BLK_TRANSFER_SIZE;
-        uint32_t mirror_blk_start = (gpt_meta.header->lba_alt_header - gpt_meta.table_size / GPT_SECTOR_SIZE)
-                                  / (BLK_TRANSFER_SIZE / GPT_SECTOR_SIZE);
-        gpt_state.mirror_req_addr = (uintptr_t)config.driver.data.region.vaddr + BLK_TRANSFER_SIZE * meta_blk_cnt;
-        gpt_state.mirror_req_id = gpt_req_id;
-        gpt_state.mirror_req_cnt = meta_mirror_blk_cnt;
-        err = blk_enqueue_req(&drv_h, BLK_REQ_READ,
-                              (uintptr_t)config.driver.data.io_addr + BLK_TRANSFER_SIZE * meta_blk_cnt,
-                              mirror_blk_start, meta_mirror_blk_cnt, gpt_req_id);
-        assert(!err);
-        gpt_state.sent_request = true;
-
-        sddf_deferred_notify(config.driver.conn.id);
-        return false;
+        gpt_discover();
+        return;
     }
 
-    return true;
+    LOG_BLK_VIRT("MBR partitioning detected\n");
+    mbr_partitions_init();
 }
 
 blk_resp_status_t get_drv_block_number(uint64_t cli_block_number, uint16_t cli_count, int cli_id,
@@ -399,32 +636,104 @@ blk_resp_status_t get_drv_block_number(uint64_t cli_block_number, uint16_t cli_c
     return BLK_RESP_OK;
 }
 
-bool virt_partition_init(void)
+uint64_t get_drv_block_limit(int cli_id)
 {
-    if (!mbr_state.sent_request) {
-        LOG_BLK_VIRT("sending MBR request\n");
-        mbr_request();
+    uint64_t blocks_per_sector = BLK_TRANSFER_SIZE / MSDOS_MBR_SECTOR_SIZE;
+    return (clients[cli_id].start_sector + clients[cli_id].sectors) / blocks_per_sector;
+}
+
+void virt_partition_init(void)
+{
+    blk_storage_info_t *driver_storage_info = config.driver.conn.storage_info.vaddr;
+    uint64_t region_blocks = config.driver.data.region.size / BLK_TRANSFER_SIZE;
+    uint64_t capacity = driver_storage_info->capacity;
+
+    /* Virt-to-driver data region needs to be big enough to transfer MBR data */
+    assert(region_blocks >= 1 && capacity >= 1);
+    uint64_t count = MIN(META_END_BLOCKS, MIN(region_blocks, capacity));
+    meta_want(META_PRIMARY, 0, count, 0);
+
+    if (region_blocks >= 2 * META_END_BLOCKS && capacity >= 2 * META_END_BLOCKS) {
+        meta_want(META_BACKUP, capacity - META_END_BLOCKS, META_END_BLOCKS, META_END_BLOCKS * BLK_TRANSFER_SIZE);
+    } else {
+        /* No backup GPT can be read, treat it as failed */
+        meta_reads[META_BACKUP].done = true;
+    }
+
+    LOG_BLK_VIRT("reading partition metadata\n");
+    meta_issue();
+}
+
+bool virt_partition_handle_response(uint32_t id, blk_resp_status_t status)
+{
+    meta_kind_t kind = 0;
+    while (kind < META_NUM_KINDS && !(meta_reads[kind].inflight && meta_reads[kind].id == id)) {
+        kind++;
+    }
+    if (kind == META_NUM_KINDS) {
         return false;
     }
 
-    bool success = false;
+    int err = ialloc_free(&ialloc, id);
+    assert(!err);
 
-    if (gpt_state.sent_request) {
-        LOG_BLK_VIRT("validating GPT partitions\n");
-        /* need to validate partition header and table of a GPT disk */
-        success = gpt_validate_partitions();
-        if (success) {
-            LOG_BLK_VIRT("initialising GPT partitions\n");
-            success = gpt_partitions_init();
+    meta_read_t *read = &meta_reads[kind];
+    read->inflight = false;
+    read->done = true;
+    read->ok = status == BLK_RESP_OK;
+    if (read->ok) {
+        uintptr_t vaddr = (uintptr_t)config.driver.data.region.vaddr + read->offset;
+        cache_clean_and_invalidate(vaddr, vaddr + read->count * BLK_TRANSFER_SIZE);
+    } else {
+        LOG_BLK_VIRT_ERR("Failed to read partition metadata at block %lu\n", read->block_number);
+    }
+
+    switch (kind) {
+    case META_PRIMARY:
+        mbr_handle_response();
+        break;
+    case META_BACKUP:
+        /* Only of use once the MBR has shown the disk to have a GPT */
+        if (mbr_valid && msdos_mbr.partitions[0].type == MSDOS_MBR_PARTITION_TYPE_GPT) {
+            gpt_discover();
         }
-        return success;
+        break;
+    case META_TABLE: {
+        gpt_copy_t *copy = &gpt_copies[gpt_table_read];
+        uint64_t table_size = (uint64_t)copy->header.num_entries * copy->header.entry_size;
+        copy->table = meta_sectors(META_TABLE, copy->header.lba_start, table_size);
+        if (copy->table != NULL) {
+            gpt_check_table(gpt_table_read);
+        } else {
+            copy->table_checked = true;
+        }
+        gpt_discover();
+        break;
+    }
+    case META_EBR:
+        ebr_handle_response();
+        break;
+    default:
+        break;
     }
 
-    success = mbr_handle_response();
-    if (success) {
-        LOG_BLK_VIRT("MBR partitioning detected\n");
-        success = mbr_partitions_init();
+    return true;
+}
+
+bool virt_partition_continue(void)
+{
+    meta_issue();
+
+    for (int i = 0; i < META_NUM_KINDS; i++) {
+        if (meta_reads[i].wanted || meta_reads[i].inflight) {
+            return false;
+        }
     }
 
-    return success;
+    return true;
+}
+
+bool virt_partition_client_ready(int cli_id)
+{
+    return clients[cli_id].ready;
 }
@@ -0,0 +1,462 @@
+/*
+ * Copyright 2026, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <os/sddf.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sddf/blk/config.h>
+#include <sddf/blk/queue.h>
+#include <sddf/blk/storage_info.h>
+#include <sddf/util/ialloc.h>
+#include <sddf/util/printf.h>
+#include <sddf/util/util.h>
+
+/**
+ * The RAID component sits between the block virtualiser and the drivers of
+ * several devices, presenting them to the virtualiser as a single device.
+ * Buffers are never copied, each driver request refers to its part of the
+ * virtualiser's buffer by IO address.
+ *
+ * When striping, the device is split into chunks which are laid out across
+ * the devices in turn. A request is split at chunk boundaries into a driver
+ * request per chunk it covers, and completes once all of them have.
+ *
+ * When mirroring, every device holds a copy of every block. Writes, discards
+ * and write zeroes go to all devices in parallel and only succeed if they
+ * succeed on all of them. Each read goes to the device with the fewest
+ * requests in flight, and is retried on another device if it fails.
+ *
+ * Flushes and barriers are passed to every device. Requests are only passed
+ * on once all of their driver requests fit, so the order of requests to each
+ * device is kept.
+ */
+
+/* Uncomment this to enable debug logging */
+// #define DEBUG_BLK_RAID
+
+#if defined(DEBUG_BLK_RAID)
+#define LOG_BLK_RAID(...) do{ sddf_dprintf("BLK_RAID|INFO: "); sddf_dprintf(__VA_ARGS__); }while(0)
+#else
+#define LOG_BLK_RAID(...) do{}while(0)
+#endif
+#define LOG_BLK_RAID_ERR(...) do{ sddf_dprintf("BLK_RAID|ERROR: "); sddf_dprintf(__VA_ARGS__); }while(0)
+
+#define VIRT_MAX_NUM_BUFFERS 1024
+#define DRIVER_MAX_NUM_BUFFERS 1024
+
+__attribute__((__section__(".blk_raid_config"))) blk_raid_config_t config;
+
+/* Request info to be bookkept for each request from the virtualiser */
+typedef struct reqbk {
+    uint32_t virt_req_id;
+    blk_req_code_t code;
+    uintptr_t io_addr;
+    uint64_t block_number;
+    uint16_t count;
+    /* driver requests still in flight */
+    uint16_t pending;
+    /* first error of a driver request, or BLK_RESP_OK */
+    blk_resp_status_t status;
+    /* devices a mirrored read has been sent to */
+    uint8_t tried;
+} reqbk_t;
+
+typedef struct driver {
+    blk_queue_handle_t h;
+    /* Index allocator for driver request id, which maps to the request it is part of */
+    ialloc_t ialloc;
+    uint32_t ialloc_idxlist[DRIVER_MAX_NUM_BUFFERS];
+    uint32_t drv_req_to_req[DRIVER_MAX_NUM_BUFFERS];
+    bool notify;
+} driver_t;
+
+static blk_queue_handle_t virt_h;
+static driver_t drivers[SDDF_BLK_MAX_RAID_DEVICES];
+
+static reqbk_t reqsbk[VIRT_MAX_NUM_BUFFERS];
+static ialloc_t ialloc;
+static uint32_t ialloc_idxlist[VIRT_MAX_NUM_BUFFERS];
+
+/* Capacity and largest request presented to the virtualiser, in BLK_TRANSFER_SIZE units */
+static uint64_t capacity;
+static uint16_t max_transfer;
+
+/* Device the next mirrored read starts looking from, so that ties are spread across devices */
+static uint8_t next_read_device;
+
+static bool notify_virt;
+
+/* Number of driver requests that can still be enqueued to a device */
+static inline uint32_t driver_space(uint8_t dev)
+{
+    driver_t *drv = &drivers[dev];
+    return MIN(ialloc_num_free(&drv->ialloc), drv->h.capacity - blk_queue_length_req(&drv->h));
+}
+
+static inline bool is_stripe(void)
+{
+    return config.level == BLK_RAID_STRIPE;
+}
+
+/**
+ * Find the device holding a block of the striped device and the block's
+ * number on that device.
+ */
+static inline uint8_t stripe_map(uint64_t block_number, uint64_t *dev_block_number)
+{
+    uint64_t chunk = block_number / config.chunk_blocks;
+    *dev_block_number = (chunk / config.num_drivers) * config.chunk_blocks + block_number % config.chunk_blocks;
+    return chunk % config.num_drivers;
+}
+
+/* Blocks of a striped request from the given block to the end of its chunk, at most count */
+static inline uint16_t stripe_piece(uint64_t block_number, uint16_t count)
+{
+    return MIN(count, config.chunk_blocks - block_number % config.chunk_blocks);
+}
+
+static void respond_virt(blk_resp_status_t status, uint16_t success_count, uint32_t id)
+{
+    /* Response queue should never be full since the virtualiser never has more
+     * requests in flight than the queue capacity. */
+    int err = blk_enqueue_resp(&virt_h, status, success_count, id);
+    assert(!err);
+    notify_virt = true;
+}
+
+static void enqueue_driver(uint8_t dev, uint32_t req, blk_req_code_t code, uintptr_t io_addr, uint64_t block_number,
+                           uint16_t count)
+{
+    driver_t *drv = &drivers[dev];
+    uint32_t drv_req_id = 0;
+    int err = ialloc_alloc(&drv->ialloc, &drv_req_id);
+    assert(!err);
+    drv->drv_req_to_req[drv_req_id] = req;
+
+    err = blk_enqueue_req(&drv->h, code, io_addr, block_number, count, drv_req_id);
+    assert(!err);
+    drv->notify = true;
+    reqsbk[req].pending++;
+}
+
+/**
+ * Choose the device with the fewest requests in flight that a mirrored read
+ * has not been sent to yet.
+ *
+ * @return the device, or -1 if none of them have space.
+ */
+static int mirror_pick(uint8_t tried)
+{
+    int best = -1;
+    uint32_t best_space = 0;
+    for (uint8_t i = 0; i < config.num_drivers; i++) {
+        uint8_t dev = (next_read_device + i) % config.num_drivers;
+        uint32_t space = driver_space(dev);
+        if (!(tried & BIT(dev)) && space > best_space) {
+            best = dev;
+            best_space = space;
+        }
+    }
+
+    return best;
+}
+
+/**
+ * Check whether every driver request of a request fits in its device's
+ * queue, so that a request is never partly passed on.
+ */
+static bool request_fits(blk_req_code_t code, uint64_t block_number, uint16_t count)
+{
+    bool data = (code == BLK_REQ_READ || code == BLK_REQ_WRITE || code == BLK_REQ_DISCARD
+                 || code == BLK_REQ_WRITE_ZEROES);
+    if (is_stripe() && data) {
+        uint32_t needed[SDDF_BLK_MAX_RAID_DEVICES] = { 0 };
+        for (uint16_t done = 0; done < count;) {
+            uint64_t dev_block_number;
+            needed[stripe_map(block_number + done, &dev_block_number)]++;
+            done += stripe_piece(block_number + done, count - done);
+        }
+        for (uint8_t dev = 0; dev < config.num_drivers; dev++) {
+            if (driver_space(dev) < needed[dev]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    if (code == BLK_REQ_READ) {
+        return mirror_pick(0) >= 0;
+    }
+
+    /* Everything else goes to every device */
+    for (uint8_t dev = 0; dev < config.num_drivers; dev++) {
+        if (driver_space(dev) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static blk_resp_status_t validate_request(blk_req_code_t code, uint64_t block_number, uint16_t count)
+{
+    blk_storage_info_t *storage_info = config.virt.storage_info.vaddr;
+    uint16_t max_count = 0;
+    switch (code) {
+    case BLK_REQ_FLUSH:
+    case BLK_REQ_BARRIER:
+        return BLK_RESP_OK;
+    case BLK_REQ_READ:
+    case BLK_REQ_WRITE:
+        max_count = max_transfer;
+        break;
+    case BLK_REQ_DISCARD:
+    case BLK_REQ_WRITE_ZEROES:
+        max_count = (code == BLK_REQ_DISCARD) ? storage_info->max_discard : storage_info->max_write_zeroes;
+        if (max_count == 0) {
+            LOG_BLK_RAID_ERR("request code %d is not supported by every device\n", code);
+            return BLK_RESP_ERR_INVALID_PARAM;
+        }
+        break;
+    default:
+        LOG_BLK_RAID_ERR("invalid request code %d\n", code);
+        return BLK_RESP_ERR_INVALID_PARAM;
+    }
+
+    if (count == 0 || (max_count && count > max_count) || block_number >= capacity
+        || count > capacity - block_number) {
+        LOG_BLK_RAID_ERR("request code %d for %u blocks at block %lu is invalid\n", code, count, block_number);
+        return BLK_RESP_ERR_INVALID_PARAM;
+    }
+
+    return BLK_RESP_OK;
+}
+
+static void submit(uint32_t req)
+{
+    reqbk_t *reqbk = &reqsbk[req];
+    switch (reqbk->code) {
+    case BLK_REQ_READ:
+    case BLK_REQ_WRITE:
+    case BLK_REQ_DISCARD:
+    case BLK_REQ_WRITE_ZEROES:
+        if (is_stripe()) {
+            for (uint16_t done = 0; done < reqbk->count;) {
+                uint64_t dev_block_number;
+                uint8_t dev = stripe_map(reqbk->block_number + done, &dev_block_number);
+                uint16_t piece = stripe_piece(reqbk->block_number + done, reqbk->count - done);
+                /* Discards and write zeroes carry no data, but offsetting their buffer is harmless */
+                enqueue_driver(dev, req, reqbk->code, reqbk->io_addr + (uintptr_t)done * BLK_TRANSFER_SIZE,
+                               dev_block_number, piece);
+                done += piece;
+            }
+            break;
+        }
+
+        if (reqbk->code == BLK_REQ_READ) {
+            int dev = mirror_pick(0);
+            assert(dev >= 0);
+            next_read_device = (dev + 1) % config.num_drivers;
+            reqbk->tried = BIT(dev);
+            enqueue_driver(dev, req, reqbk->code, reqbk->io_addr, reqbk->block_number, reqbk->count);
+            break;
+        }
+        /* Mirrored writes go to every device */
+        for (uint8_t dev = 0; dev < config.num_drivers; dev++) {
+            enqueue_driver(dev, req, reqbk->code, reqbk->io_addr, reqbk->block_number, reqbk->count);
+        }
+        break;
+    case BLK_REQ_FLUSH:
+    case BLK_REQ_BARRIER:
+        for (uint8_t dev = 0; dev < config.num_drivers; dev++) {
+            enqueue_driver(dev, req, reqbk->code, 0, 0, 0);
+        }
+        break;
+    default:
+        /* This should never happen as we validate request codes before they are bookkept */
+        assert(false);
+    }
+}
+
+static void handle_virt(void)
+{
+    blk_req_code_t code = 0;
+    uintptr_t io_addr = 0;
+    uint64_t block_number = 0;
+    uint16_t count = 0;
+    uint32_t id = 0;
+
+    while (!ialloc_full(&ialloc) && !blk_peek_req(&virt_h, &code, &io_addr, &block_number, &count, &id)) {
+        blk_resp_status_t status = validate_request(code, block_number, count);
+        if (status == BLK_RESP_OK && !request_fits(code, block_number, count)) {
+            /* Wait for the drivers to complete requests */
+            break;
+        }
+
+        int err = blk_dequeue_req(&virt_h, &code, &io_addr, &block_number, &count, &id);
+        assert(!err);
+        if (status != BLK_RESP_OK) {
+            respond_virt(status, 0, id);
+            continue;
+        }
+
+        uint32_t req = 0;
+        err = ialloc_alloc(&ialloc, &req);
+        assert(!err);
+        reqsbk[req] = (reqbk_t) { id, code, io_addr, block_number, count, 0, BLK_RESP_OK, 0 };
+        submit(req);
+    }
+}
+
+/**
+ * Retry a failed mirrored read on a device it has not been sent to yet.
+ *
+ * @return true if the read was sent to another device.
+ */
+static bool mirror_retry(uint32_t req)
+{
+    reqbk_t *reqbk = &reqsbk[req];
+    int dev = mirror_pick(reqbk->tried);
+    if (dev < 0) {
+        return false;
+    }
+
+    LOG_BLK_RAID("retrying read of %u blocks at block %lu on device %d\n", reqbk->count, reqbk->block_number, dev);
+    reqbk->tried |= BIT(dev);
+    enqueue_driver(dev, req, reqbk->code, reqbk->io_addr, reqbk->block_number, reqbk->count);
+    return true;
+}
+
+static void handle_driver(uint8_t dev)
+{
+    driver_t *drv = &drivers[dev];
+    blk_resp_status_t drv_status = 0;
+    uint16_t drv_success_count = 0;
+    uint32_t drv_resp_id = 0;
+
+    while (!blk_queue_empty_resp(&drv->h)) {
+        int err = blk_dequeue_resp(&drv->h, &drv_status, &drv_success_count, &drv_resp_id);
+        assert(!err);
+
+        uint32_t req = drv->drv_req_to_req[drv_resp_id];
+        err = ialloc_free(&drv->ialloc, drv_resp_id);
+        assert(!err);
+
+        reqbk_t *reqbk = &reqsbk[req];
+        reqbk->pending--;
+        if (drv_status != BLK_RESP_OK) {
+            LOG_BLK_RAID_ERR("device %u failed request code %d at block %lu, status %d\n", dev, reqbk->code,
+                             reqbk->block_number, drv_status);
+            if (!is_stripe() && reqbk->code == BLK_REQ_READ && mirror_retry(req)) {
+                continue;
+            }
+            if (reqbk->status == BLK_RESP_OK) {
+                reqbk->status = drv_status;
+            }
+        }
+
+        if (reqbk->pending == 0) {
+            /* Driver requests complete out of order, so nothing less than all of them counts */
+            respond_virt(reqbk->status, (reqbk->status == BLK_RESP_OK) ? reqbk->count : 0, reqbk->virt_req_id);
+            err = ialloc_free(&ialloc, req);
+            assert(!err);
+        }
+    }
+}
+
+void notified(sddf_channel ch)
+{
+    for (uint8_t dev = 0; dev < config.num_drivers; dev++) {
+        if (ch == config.drivers[dev].id) {
+            handle_driver(dev);
+        }
+    }
+
+    handle_virt();
+
+    if (notify_virt) {
+        sddf_notify(config.virt.id);
+        notify_virt = false;
+    }
+    for (uint8_t dev = 0; dev < config.num_drivers; dev++) {
+        if (drivers[dev].notify) {
+            sddf_notify(config.drivers[dev].id);
+            drivers[dev].notify = false;
+        }
+    }
+}
+
+/* Smallest of two limits where 0 means no limit */
+static inline uint16_t min_limit(uint16_t a, uint16_t b)
+{
+    return (a && b) ? MIN(a, b) : (a | b);
+}
+
+void init(void)
+{
+    assert(blk_config_check_magic(&config));
+    assert(config.num_drivers > 0 && config.num_drivers <= SDDF_BLK_MAX_RAID_DEVICES);
+    assert(config.level <= BLK_RAID_MIRROR);
+    assert(!is_stripe() || config.chunk_blocks > 0);
+
+    assert(config.virt.num_buffers <= VIRT_MAX_NUM_BUFFERS);
+    blk_queue_init(&virt_h, config.virt.req_queue.vaddr, config.virt.resp_queue.vaddr, config.virt.num_buffers);
+    ialloc_init(&ialloc, ialloc_idxlist, config.virt.num_buffers);
+
+    blk_storage_info_t storage_info = { 0 };
+    strcpy(storage_info.serial_number, is_stripe() ? "raid0" : "raid1");
+    uint64_t min_capacity = UINT64_MAX;
+    uint16_t min_queue_depth = UINT16_MAX;
+    uint32_t total_queue_depth = 0;
+    uint16_t drv_max_transfer = 0;
+    uint16_t max_discard = UINT16_MAX;
+    uint16_t max_write_zeroes = UINT16_MAX;
+    for (uint8_t dev = 0; dev < config.num_drivers; dev++) {
+        blk_connection_resource_t *conn = &config.drivers[dev];
+        assert(conn->num_buffers <= DRIVER_MAX_NUM_BUFFERS);
+        blk_queue_init(&drivers[dev].h, conn->req_queue.vaddr, conn->resp_queue.vaddr, conn->num_buffers);
+        ialloc_init(&drivers[dev].ialloc, drivers[dev].ialloc_idxlist, conn->num_buffers);
+
+        blk_storage_info_t *drv_storage_info = conn->storage_info.vaddr;
+        while (!blk_storage_is_ready(drv_storage_info));
+
+        storage_info.read_only |= drv_storage_info->read_only;
+        storage_info.sector_size = MAX(storage_info.sector_size, drv_storage_info->sector_size);
+        storage_info.block_size = MAX(storage_info.block_size, drv_storage_info->block_size);
+        min_capacity = MIN(min_capacity, drv_storage_info->capacity);
+        min_queue_depth = MIN(min_queue_depth, drv_storage_info->queue_depth);
+        total_queue_depth += drv_storage_info->queue_depth;
+        drv_max_transfer = min_limit(drv_max_transfer, drv_storage_info->max_transfer);
+        max_discard = MIN(max_discard, drv_storage_info->max_discard);
+        max_write_zeroes = MIN(max_write_zeroes, drv_storage_info->max_write_zeroes);
+    }
+
+    if (is_stripe()) {
+        /* Each driver request lies within a chunk, which must fit in a single request of every device */
+        assert(!drv_max_transfer || config.chunk_blocks <= drv_max_transfer);
+        uint32_t stripe_blocks = (uint32_t)config.chunk_blocks * config.num_drivers;
+        capacity = (min_capacity / config.chunk_blocks) * stripe_blocks;
+        /* A request of at most a stripe is split into at most one more driver request than there are devices */
+        max_transfer = MIN(stripe_blocks, UINT16_MAX);
+        storage_info.max_discard = (max_discard >= config.chunk_blocks) ? max_transfer : 0;
+        storage_info.max_write_zeroes = (max_write_zeroes >= config.chunk_blocks) ? max_transfer : 0;
+        storage_info.block_size = MAX(storage_info.block_size, config.chunk_blocks);
+        storage_info.queue_depth = MIN(total_queue_depth, UINT16_MAX);
+    } else {
+        capacity = min_capacity;
+        max_transfer = drv_max_transfer;
+        storage_info.max_discard = max_discard;
+        storage_info.max_write_zeroes = max_write_zeroes;
+        storage_info.queue_depth = min_queue_depth;
+    }
+    storage_info.capacity = capacity;
+    storage_info.max_transfer = max_transfer;
+
+    blk_storage_info_t *virt_storage_info = config.virt.storage_info.vaddr;
+    *virt_storage_info = storage_info;
+    blk_storage_set_ready(virt_storage_info, true);
+
+    LOG_BLK_RAID("%s of %u devices, %lu blocks\n", is_stripe() ? "stripe" : "mirror", config.num_drivers, capacity);
+}
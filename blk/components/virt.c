@@ -10,34 +10,278 @@
 #include <sddf/util/printf.h>
 #include <string.h>
 #include <sddf/util/util.h>
+#include <sddf/util/si_units.h>
+#include <sddf/timer/client.h>
+#include <sddf/timer/config.h>
+#include <sddf/blk/stats.h>
 
 #include "virt.h"
 
-#define DRIVER_MAX_NUM_BUFFERS 1024
+/* Largest merged request if the driver does not report a maximum transfer size */
+#define MERGE_DEFAULT_MAX_BLOCKS 32
+/* Largest readahead window of a client */
+#define READAHEAD_MAX_BLOCKS 32
+/* Number of back to back sequential reads after which a client's reads are read ahead */
+#define READAHEAD_TRIGGER 2
+
+#define REQBK_NONE UINT32_MAX
+
+/* Rate limited clients may burst up to a tenth of a second's worth of their limit */
+#define SCHED_BURST_DIVISOR 10
 
 __attribute__((__section__(".blk_virt_config"))) blk_virt_config_t config;
+/* Only required if a client is rate limited */
+__attribute__((__section__(".timer_client_config"))) timer_client_config_t timer_config;
 
 /* Driver queue handle */
 blk_queue_handle_t drv_h;
 /* Client queue handles */
 blk_queue_handle_t client_queues[SDDF_BLK_MAX_CLIENTS];
 
-/* Request info to be bookkept from client */
+/**
+ * Request info to be bookkept from client. Each client request in flight has
+ * its own entry, indexed by an id from the index allocator. Contiguous client
+ * requests merged into a single driver request are chained together, with the
+ * driver request using the id of the first.
+ */
 typedef struct reqbk {
     uint32_t cli_id;
     uint32_t cli_req_id;
     uintptr_t vaddr;
     uint16_t count;
     blk_req_code_t code;
+    /* driver block number of the first block */
+    uint64_t block_number;
+    /* next client request of the same driver request, or waiting on the same readahead */
+    uint32_t next;
+    /* the entry is the readahead itself and has no client request to respond to */
+    bool readahead;
+    /* time the client request was dequeued, and the driver request enqueued if the entry heads one */
+    uint64_t start;
+    uint64_t submitted;
 } reqbk_t;
 static reqbk_t reqsbk[DRIVER_MAX_NUM_BUFFERS];
 
+#define STATS_DRIVER 0
+#define STATS_CLIENT(client) (1 + (client))
+
+static uint64_t stats_fallback[BLK_STATS_SIZE(1 + SDDF_BLK_MAX_CLIENTS) / sizeof(uint64_t)];
+static blk_stats_t *stats;
+
+/**
+ * Once a client has issued READAHEAD_TRIGGER sequential reads, the blocks
+ * following its last read are read ahead into the client's window in the
+ * driver data region, so that its next reads can be served from memory. The
+ * driver data region is only used for partition metadata until discovery
+ * has finished, after which it is split evenly between the clients.
+ */
+typedef struct readahead {
+    /* driver block number of the first block in the window */
+    uint64_t block_number;
+    /* number of blocks in the window holding valid data */
+    uint16_t valid;
+    /* a readahead into the window is in flight */
+    bool inflight;
+    /* number of blocks being read ahead */
+    uint16_t count;
+    /* a write overlapped the blocks being read ahead */
+    bool stale;
+    /* id of the readahead in flight, and the last read waiting for it */
+    uint32_t id;
+    uint32_t tail;
+    /* driver block number the client's next sequential read would start at */
+    uint64_t next_block;
+    uint16_t sequential;
+} readahead_t;
+static readahead_t readaheads[SDDF_BLK_MAX_CLIENTS];
+static uint16_t readahead_blocks;
+
+/* Largest number of blocks in a driver request */
+static uint16_t merge_max_blocks;
+
+/* Largest discard and write zeroes requests the driver accepts, 0 if it does not support them */
+static uint16_t max_discard;
+static uint16_t max_write_zeroes;
+
+/**
+ * Scheduling state of a client under BLK_SCHED_FAIR. Fair clients take turns
+ * by deficit round robin, each turn adding weight * sched_quantum bytes to
+ * the client's deficit, which its reads and writes are charged against.
+ * Flushes and barriers carry no data and are free. Caps are enforced with a
+ * token bucket each for requests and bytes.
+ */
+typedef struct client_sched {
+    uint64_t deficit;
+    /* the client has been given its quantum for the current round */
+    bool in_round;
+    uint64_t io_tokens;
+    uint64_t byte_tokens;
+    uint64_t last_refill;
+} client_sched_t;
+static client_sched_t client_sched[SDDF_BLK_MAX_CLIENTS];
+static uint64_t sched_quantum;
+/* fair client the next round robin pass starts from */
+static int next_client;
+/* whether any client has a cap, requiring the timer */
+static bool rate_limited;
+/* time of the pending timeout, 0 if there is none */
+static uint64_t timeout_at;
+
 /* Index allocator for driver request id */
 ialloc_t ialloc;
 static uint32_t ialloc_idxlist[DRIVER_MAX_NUM_BUFFERS];
 
+/* Partition discovery has finished. Clients are served before then, once given their partition */
 bool initialised = false;
 
+static inline uintptr_t readahead_vaddr(int cli_id)
+{
+    return (uintptr_t)config.driver.data.region.vaddr + (uintptr_t)cli_id * readahead_blocks * BLK_TRANSFER_SIZE;
+}
+
+static inline uintptr_t readahead_io_addr(int cli_id)
+{
+    return config.driver.data.io_addr + (uintptr_t)cli_id * readahead_blocks * BLK_TRANSFER_SIZE;
+}
+
+static inline uint64_t sched_io_burst(int cli_id)
+{
+    return MAX(config.sched[cli_id].iops_limit / SCHED_BURST_DIVISOR, 1);
+}
+
+static inline uint64_t sched_byte_burst(int cli_id)
+{
+    return MAX(config.sched[cli_id].bandwidth_limit / SCHED_BURST_DIVISOR, sched_quantum);
+}
+
+static inline uint64_t sched_cost(blk_req_code_t code, uint16_t count)
+{
+    return (code == BLK_REQ_READ || code == BLK_REQ_WRITE) ? (uint64_t)count * BLK_TRANSFER_SIZE : 0;
+}
+
+static uint64_t sched_earned(uint64_t elapsed, uint64_t rate)
+{
+    /* Split the elapsed time to avoid overflow after long idle periods */
+    return (elapsed / NS_IN_S) * rate + ((elapsed % NS_IN_S) * rate) / NS_IN_S;
+}
+
+static void sched_refill(int cli_id, uint64_t now)
+{
+    client_sched_t *cs = &client_sched[cli_id];
+    blk_virt_config_sched_t *client = &config.sched[cli_id];
+    uint64_t elapsed = now - cs->last_refill;
+    uint64_t ios = sched_earned(elapsed, client->iops_limit);
+    uint64_t bytes = sched_earned(elapsed, client->bandwidth_limit);
+    if (ios == 0 && bytes == 0) {
+        return;
+    }
+
+    cs->io_tokens = MIN(cs->io_tokens + ios, sched_io_burst(cli_id));
+    cs->byte_tokens = MIN(cs->byte_tokens + bytes, sched_byte_burst(cli_id));
+    cs->last_refill = now;
+}
+
+/**
+ * Request a timeout for when a client will have accumulated missing tokens
+ * at the given rate.
+ */
+static void sched_wait(uint64_t missing, uint64_t rate, uint64_t now)
+{
+    uint64_t wait = (missing * NS_IN_S + rate - 1) / rate;
+    if (timeout_at == 0 || now + wait < timeout_at) {
+        timeout_at = now + wait;
+        sddf_timer_set_timeout(timer_config.driver_id, wait);
+    }
+}
+
+/**
+ * Check whether a request of the given cost is within a client's caps,
+ * scheduling a timeout for when it will be if not. Requests larger than the
+ * burst only need a full bucket, so that they are not held back forever.
+ */
+static bool sched_within_rate(int cli_id, uint64_t cost, uint64_t now)
+{
+    client_sched_t *cs = &client_sched[cli_id];
+    blk_virt_config_sched_t *client = &config.sched[cli_id];
+    bool within = true;
+    if (client->iops_limit && cs->io_tokens == 0) {
+        sched_wait(1, client->iops_limit, now);
+        within = false;
+    }
+
+    uint64_t needed = MIN(cost, sched_byte_burst(cli_id));
+    if (client->bandwidth_limit && cs->byte_tokens < needed) {
+        sched_wait(needed - cs->byte_tokens, client->bandwidth_limit, now);
+        within = false;
+    }
+
+    return within;
+}
+
+/**
+ * Cost of the request at the head of a client's queue, which must not be empty.
+ */
+static uint64_t sched_head_cost(int cli_id)
+{
+    blk_req_code_t code = 0;
+    uintptr_t offset = 0;
+    uint64_t block_number = 0;
+    uint16_t count = 0;
+    uint32_t id = 0;
+    int err = blk_peek_req(&client_queues[cli_id], &code, &offset, &block_number, &count, &id);
+    assert(!err);
+
+    return sched_cost(code, count);
+}
+
+/**
+ * Check whether the request at the head of a client's queue may be passed on
+ * now. Under BLK_SCHED_FIFO every request is admitted.
+ */
+static bool sched_admit(int cli_id, uint64_t now)
+{
+    if (config.scheduler != BLK_SCHED_FAIR) {
+        return true;
+    }
+
+    uint64_t cost = sched_head_cost(cli_id);
+    if (config.sched[cli_id].sched_class == BLK_SCHED_CLASS_FAIR && cost > client_sched[cli_id].deficit) {
+        return false;
+    }
+
+    return sched_within_rate(cli_id, cost, now);
+}
+
+/**
+ * Check whether a fair client is held back only by its deficit, saving up
+ * over several rounds for a request larger than its quantum.
+ */
+static bool sched_saving(int cli_id)
+{
+    if (blk_queue_empty_req(&client_queues[cli_id])) {
+        return false;
+    }
+
+    return sched_head_cost(cli_id) > client_sched[cli_id].deficit;
+}
+
+/**
+ * Charge a client for a request it has been admitted for. The request is
+ * charged as dequeued, as the client may have changed it since it was peeked.
+ */
+static void sched_charge(int cli_id, blk_req_code_t code, uint16_t count)
+{
+    if (config.scheduler != BLK_SCHED_FAIR) {
+        return;
+    }
+
+    client_sched_t *cs = &client_sched[cli_id];
+    uint64_t cost = sched_cost(code, count);
+    cs->deficit -= MIN(cost, cs->deficit);
+    cs->io_tokens -= MIN(1, cs->io_tokens);
+    cs->byte_tokens -= MIN(cost, cs->byte_tokens);
+}
+
 void init(void)
 {
     assert(blk_config_check_magic(&config));
@@ -45,6 +289,9 @@ void init(void)
     blk_storage_info_t *driver_storage_info = config.driver.conn.storage_info.vaddr;
     while (!blk_storage_is_ready(driver_storage_info));
 
+    stats = blk_stats_init(&config.stats, stats_fallback, sizeof(stats_fallback), BLK_STATS_VIRT,
+                           1 + config.num_clients);
+
     /* Initialise client queues */
     for (int i = 0; i < config.num_clients; i++) {
         blk_virt_config_client_t *client = &config.clients[i];
@@ -52,45 +299,104 @@ void init(void)
         blk_resp_queue_t *curr_resp = client->conn.resp_queue.vaddr;
         uint32_t queue_capacity = client->conn.num_buffers;
         blk_queue_init(&client_queues[i], curr_req, curr_resp, queue_capacity);
+        stats->queues[STATS_CLIENT(i)].capacity = queue_capacity;
     }
 
     /* Initialise driver queue */
     uint16_t driver_num_buffers = config.driver.conn.num_buffers;
     assert(driver_num_buffers <= DRIVER_MAX_NUM_BUFFERS);
     blk_queue_init(&drv_h, config.driver.conn.req_queue.vaddr, config.driver.conn.resp_queue.vaddr, driver_num_buffers);
+    stats->queues[STATS_DRIVER].capacity = driver_num_buffers;
 
     /* Initialise index allocator */
     ialloc_init(&ialloc, ialloc_idxlist, DRIVER_MAX_NUM_BUFFERS);
 
+    merge_max_blocks = driver_storage_info->max_transfer ? driver_storage_info->max_transfer : MERGE_DEFAULT_MAX_BLOCKS;
+    max_discard = driver_storage_info->max_discard;
+    max_write_zeroes = driver_storage_info->max_write_zeroes;
+
+    sched_quantum = (uint64_t)merge_max_blocks * BLK_TRANSFER_SIZE;
+    if (config.scheduler == BLK_SCHED_FAIR) {
+        for (int i = 0; i < config.num_clients; i++) {
+            blk_virt_config_sched_t *client = &config.sched[i];
+            client_sched[i].io_tokens = sched_io_burst(i);
+            client_sched[i].byte_tokens = sched_byte_burst(i);
+            rate_limited |= client->iops_limit || client->bandwidth_limit;
+        }
+    }
+
+    if (rate_limited) {
+        assert(timer_config_check_magic(&timer_config));
+        uint64_t now = sddf_timer_time_now(timer_config.driver_id);
+        for (int i = 0; i < config.num_clients; i++) {
+            client_sched[i].last_refill = now;
+        }
+    }
+
     virt_partition_init();
 }
 
-static void handle_driver()
+/**
+ * Drop any read ahead blocks of a client which a write overlaps. This is done
+ * both when the write is passed on and when it completes, as the driver may
+ * reorder a readahead issued while the write was in flight ahead of it.
+ */
+static void readahead_invalidate(int cli_id, uint64_t block_number, uint16_t count)
 {
-    bool client_notify[SDDF_BLK_MAX_CLIENTS];
-    memset(client_notify, 0, SDDF_BLK_MAX_CLIENTS);
-
-    blk_resp_status_t drv_status = 0;
-    uint16_t drv_success_count = 0;
-    uint32_t drv_resp_id = 0;
+    readahead_t *ra = &readaheads[cli_id];
+    uint16_t window = ra->inflight ? ra->count : ra->valid;
+    if (block_number < ra->block_number + window && ra->block_number < block_number + count) {
+        if (ra->inflight) {
+            ra->stale = true;
+        } else {
+            ra->valid = 0;
+        }
+    }
+}
 
-    int err = 0;
-    while (!blk_queue_empty_resp(&drv_h)) {
-        err = blk_dequeue_resp(&drv_h, &drv_status, &drv_success_count, &drv_resp_id);
+/**
+ * Respond to each client request of a completed driver request. The blocks
+ * of a merged request complete in order, so each client request is given the
+ * part of the driver's success count that falls within it.
+ */
+static void complete_chain(uint32_t id, blk_resp_status_t drv_status, uint16_t drv_success_count,
+                           uint32_t client_tails[], uint64_t now)
+{
+    blk_req_code_t drv_code = reqsbk[id].code;
+    uint64_t submitted = reqsbk[id].submitted;
+    uint32_t drv_count = 0;
+    uint32_t done = 0;
+    while (id != REQBK_NONE) {
+        reqbk_t reqbk = reqsbk[id];
+        int err = ialloc_free(&ialloc, id);
         assert(!err);
+        id = reqbk.next;
 
-        reqbk_t reqbk = reqsbk[drv_resp_id];
-        err = ialloc_free(&ialloc, drv_resp_id);
-        assert(!err);
+        uint16_t success_count = 0;
+        if (reqbk.code == BLK_REQ_READ || reqbk.code == BLK_REQ_WRITE) {
+            success_count = (drv_success_count > done) ? MIN(drv_success_count - done, reqbk.count) : 0;
+            done += reqbk.count;
+        } else {
+            success_count = drv_success_count;
+        }
+
+        blk_resp_status_t status = drv_status;
+        if (drv_status != BLK_RESP_OK && reqbk.count && success_count == reqbk.count) {
+            status = BLK_RESP_OK;
+        }
 
         switch (reqbk.code) {
         case BLK_REQ_READ:
-            if (drv_status == BLK_RESP_OK) {
+            if (success_count) {
                 /* Invalidate cache */
-                cache_clean_and_invalidate(reqbk.vaddr, reqbk.vaddr + (BLK_TRANSFER_SIZE * reqbk.count));
+                cache_clean_and_invalidate(reqbk.vaddr, reqbk.vaddr + (BLK_TRANSFER_SIZE * success_count));
             }
             break;
         case BLK_REQ_WRITE:
+        case BLK_REQ_DISCARD:
+        case BLK_REQ_WRITE_ZEROES:
+            readahead_invalidate(reqbk.cli_id, reqbk.block_number, reqbk.count);
+            break;
         case BLK_REQ_FLUSH:
         case BLK_REQ_BARRIER:
             break;
@@ -106,20 +412,276 @@ static void handle_driver()
         /* Response queue should never be full since number of inflight requests (ialloc size)
          * should always be less than or equal to resp queue capacity.
          */
-        err = blk_enqueue_resp(h, drv_status, drv_success_count, reqbk.cli_req_id);
+        err = blk_enqueue_resp_local(h, &client_tails[reqbk.cli_id], status, success_count, reqbk.cli_req_id);
+        assert(!err);
+        blk_stats_complete(&stats->queues[STATS_CLIENT(reqbk.cli_id)], reqbk.code, reqbk.count, status, reqbk.start,
+                           now);
+        drv_count += reqbk.count;
+    }
+
+    blk_stats_complete(&stats->queues[STATS_DRIVER], drv_code, drv_count, drv_status, submitted, now);
+}
+
+/**
+ * Copy blocks from a client's readahead window into its buffer.
+ */
+static void readahead_copy(int cli_id, uint64_t drv_block_number, uint16_t count, uintptr_t vaddr)
+{
+    readahead_t *ra = &readaheads[cli_id];
+    uintptr_t src = readahead_vaddr(cli_id) + (drv_block_number - ra->block_number) * BLK_TRANSFER_SIZE;
+    memcpy((void *)vaddr, (void *)src, (size_t)count * BLK_TRANSFER_SIZE);
+    /* The buffer may be read into by DMA later, so make sure our writes are not
+    written back over it */
+    cache_clean(vaddr, vaddr + (size_t)count * BLK_TRANSFER_SIZE);
+}
+
+/**
+ * Complete a readahead, serving the reads that were waiting on it.
+ */
+static void complete_readahead(uint32_t id, blk_resp_status_t drv_status, uint16_t drv_success_count,
+                               uint32_t client_tails[], uint64_t now)
+{
+    int cli_id = reqsbk[id].cli_id;
+    readahead_t *ra = &readaheads[cli_id];
+    assert(ra->inflight && ra->id == id);
+    blk_stats_complete(&stats->queues[STATS_DRIVER], BLK_REQ_READ, reqsbk[id].count, drv_status, reqsbk[id].submitted,
+                       now);
+
+    uint16_t valid = (drv_status == BLK_RESP_OK) ? reqsbk[id].count : drv_success_count;
+    if (valid) {
+        uintptr_t window = readahead_vaddr(cli_id);
+        cache_clean_and_invalidate(window, window + (uintptr_t)valid * BLK_TRANSFER_SIZE);
+    }
+
+    uint32_t next = reqsbk[id].next;
+    int err = ialloc_free(&ialloc, id);
+    assert(!err);
+
+    /* Waiting reads were issued before any write that made the window stale
+    had completed, so can still be served from it */
+    uint64_t valid_end = ra->block_number + valid;
+    while (next != REQBK_NONE) {
+        reqbk_t reqbk = reqsbk[next];
+        err = ialloc_free(&ialloc, next);
+        assert(!err);
+        next = reqbk.next;
+
+        blk_resp_status_t status = BLK_RESP_OK;
+        uint16_t success_count = reqbk.count;
+        if (reqbk.block_number + reqbk.count > valid_end) {
+            success_count = (valid_end > reqbk.block_number) ? valid_end - reqbk.block_number : 0;
+            status = (drv_status != BLK_RESP_OK) ? drv_status : BLK_RESP_ERR_IO;
+        }
+        if (success_count) {
+            readahead_copy(cli_id, reqbk.block_number, success_count, reqbk.vaddr);
+        }
+
+        err = blk_enqueue_resp_local(&client_queues[cli_id], &client_tails[cli_id], status, success_count,
+                                     reqbk.cli_req_id);
         assert(!err);
-        client_notify[reqbk.cli_id] = true;
+        blk_stats_complete(&stats->queues[STATS_CLIENT(cli_id)], BLK_REQ_READ, reqbk.count, status, reqbk.start,
+                           now);
+    }
+
+    ra->inflight = false;
+    ra->valid = ra->stale ? 0 : valid;
+    ra->stale = false;
+}
+
+/**
+ * Notify a client of new responses, unless it opted into signal suppression
+ * and has not asked to be woken again since it was last notified.
+ */
+static void notify_client(int cli_id)
+{
+    blk_queue_handle_t *h = &client_queues[cli_id];
+    if (blk_queue_require_signal_resp(h)) {
+        blk_queue_cancel_signal_resp(h);
+        sddf_notify(config.clients[cli_id].conn.id);
+    }
+}
+
+static void handle_driver()
+{
+    /* Responses are published to each client once all driver responses have
+    been handled, rather than one at a time */
+    uint32_t client_tails[SDDF_BLK_MAX_CLIENTS];
+    for (int i = 0; i < config.num_clients; i++) {
+        client_tails[i] = client_queues[i].resp_queue->tail;
+    }
+
+    blk_resp_status_t drv_status = 0;
+    uint16_t drv_success_count = 0;
+    uint32_t drv_resp_id = 0;
+
+    /* Every response in the queue had arrived by now */
+    uint64_t now = blk_stats_now();
+    uint32_t drv_head = drv_h.resp_queue->head;
+    while (!blk_dequeue_resp_local(&drv_h, &drv_head, &drv_status, &drv_success_count, &drv_resp_id)) {
+        if (!initialised && virt_partition_handle_response(drv_resp_id, drv_status)) {
+            continue;
+        }
+        if (reqsbk[drv_resp_id].readahead) {
+            complete_readahead(drv_resp_id, drv_status, drv_success_count, client_tails, now);
+        } else {
+            complete_chain(drv_resp_id, drv_status, drv_success_count, client_tails, now);
+        }
+    }
+    blk_resp_update_shared_head(&drv_h, drv_head);
+
+    if (!initialised && virt_partition_continue()) {
+        LOG_BLK_VIRT("partition discovery finished\n");
+        initialised = true;
+        /* The driver data region is now free for readahead */
+        if (config.num_clients) {
+            readahead_blocks = MIN(config.driver.data.region.size / BLK_TRANSFER_SIZE / config.num_clients,
+                                   MIN(READAHEAD_MAX_BLOCKS, merge_max_blocks));
+        }
     }
 
     /* Notify corresponding client if a response was enqueued */
     for (int i = 0; i < config.num_clients; i++) {
-        if (client_notify[i]) {
-            sddf_notify(config.clients[i].conn.id);
+        if (client_tails[i] != client_queues[i].resp_queue->tail) {
+            blk_resp_update_shared_tail(&client_queues[i], client_tails[i]);
+            notify_client(i);
         }
     }
 }
 
-static bool handle_client(int cli_id)
+/* Driver request being built up from contiguous client requests */
+typedef struct merge {
+    uint32_t head;
+    uint32_t tail;
+    blk_req_code_t code;
+    uintptr_t io_addr;
+    uint64_t block_number;
+    uint16_t count;
+} merge_t;
+
+static void merge_submit(merge_t *merge)
+{
+    if (merge->head == REQBK_NONE) {
+        return;
+    }
+
+    int err = blk_enqueue_req(&drv_h, merge->code, merge->io_addr, merge->block_number, merge->count, merge->head);
+    assert(!err);
+    reqsbk[merge->head].submitted = blk_stats_now();
+    blk_stats_submit(&stats->queues[STATS_DRIVER]);
+    merge->head = REQBK_NONE;
+}
+
+/**
+ * Check whether another driver request can be enqueued, accounting for the
+ * request being merged which has not been enqueued yet. Until partition
+ * discovery has finished, a slot is kept for its metadata reads so that
+ * clients already given their partition cannot hold them up.
+ */
+static bool driver_has_space(merge_t *merge)
+{
+    uint32_t pending = (merge->head != REQBK_NONE) ? 1 : 0;
+    uint32_t reserved = initialised ? 0 : 1;
+    return blk_queue_length_req(&drv_h) + pending + reserved < drv_h.capacity
+        && ialloc_num_free(&ialloc) > reserved;
+}
+
+static bool merge_contiguous(merge_t *merge, blk_req_code_t code, uintptr_t io_addr, uint64_t block_number,
+                             uint16_t count)
+{
+    return merge->head != REQBK_NONE && merge->code == code
+        && merge->io_addr + (uintptr_t)merge->count * BLK_TRANSFER_SIZE == io_addr
+        && merge->block_number + merge->count == block_number && (uint32_t)merge->count + count <= merge_max_blocks;
+}
+
+/**
+ * Serve a read from the client's readahead window if it lies entirely within
+ * it, either immediately or once the readahead completes.
+ *
+ * @return true if the read was served or is waiting on the readahead.
+ */
+static bool readahead_serve(int cli_id, uint64_t block_number, uint16_t count, uintptr_t vaddr, uint32_t cli_req_id,
+                            uint64_t start)
+{
+    readahead_t *ra = &readaheads[cli_id];
+    uint16_t window = ra->inflight ? ra->count : ra->valid;
+    if (ra->stale || block_number < ra->block_number || block_number + count > ra->block_number + window) {
+        return false;
+    }
+
+    if (ra->inflight) {
+        uint32_t id = 0;
+        int err = ialloc_alloc(&ialloc, &id);
+        assert(!err);
+        reqsbk[id] = (reqbk_t) { cli_id, cli_req_id, vaddr, count, BLK_REQ_READ, block_number, REQBK_NONE, false,
+                                 start };
+        reqsbk[ra->tail].next = id;
+        ra->tail = id;
+        return true;
+    }
+
+    readahead_copy(cli_id, block_number, count, vaddr);
+    int err = blk_enqueue_resp(&client_queues[cli_id], BLK_RESP_OK, count, cli_req_id);
+    assert(!err);
+    blk_stats_complete(&stats->queues[STATS_CLIENT(cli_id)], BLK_REQ_READ, count, BLK_RESP_OK, start,
+                       blk_stats_now());
+    return true;
+}
+
+/**
+ * Track whether a client is reading sequentially, and if so read ahead of it
+ * once it reaches the end of its window.
+ *
+ * @return true if a readahead was enqueued to the driver.
+ */
+static bool readahead_update(int cli_id, uint64_t block_number, uint16_t count, merge_t *merge)
+{
+    readahead_t *ra = &readaheads[cli_id];
+    ra->sequential = (block_number == ra->next_block) ? ra->sequential + 1 : 0;
+    ra->next_block = block_number + count;
+
+    uint64_t start = ra->next_block;
+    if (!readahead_blocks || ra->sequential + 1 < READAHEAD_TRIGGER || ra->inflight
+        || (start >= ra->block_number && start < ra->block_number + ra->valid) || !driver_has_space(merge)) {
+        return false;
+    }
+
+    uint64_t limit = get_drv_block_limit(cli_id);
+    uint16_t ra_count = (start < limit) ? MIN(readahead_blocks, limit - start) : 0;
+    if (ra_count == 0) {
+        return false;
+    }
+
+    uint32_t id = 0;
+    int err = ialloc_alloc(&ialloc, &id);
+    assert(!err);
+    reqsbk[id] = (reqbk_t) { cli_id, 0, readahead_vaddr(cli_id), ra_count, BLK_REQ_READ, start, REQBK_NONE, true };
+    reqsbk[id].submitted = blk_stats_now();
+    blk_stats_submit(&stats->queues[STATS_DRIVER]);
+
+    ra->block_number = start;
+    ra->valid = 0;
+    ra->count = ra_count;
+    ra->inflight = true;
+    ra->stale = false;
+    ra->id = id;
+    ra->tail = id;
+
+    uintptr_t window = readahead_vaddr(cli_id);
+    cache_clean_and_invalidate(window, window + (uintptr_t)ra_count * BLK_TRANSFER_SIZE);
+    err = blk_enqueue_req(&drv_h, BLK_REQ_READ, readahead_io_addr(cli_id), start, ra_count, id);
+    assert(!err);
+    LOG_BLK_VIRT("client %d reading ahead %u blocks from block %lu\n", cli_id, ra_count, start);
+
+    return true;
+}
+
+/**
+ * Pass on up to max_requests requests of a client, for as long as the
+ * scheduler admits them and the driver has space.
+ *
+ * @return number of requests dequeued from the client.
+ */
+static uint32_t handle_client(int cli_id, uint32_t max_requests, uint64_t now, bool *drv_notify)
 {
     int err = 0;
     blk_queue_handle_t h = client_queues[cli_id];
@@ -133,6 +695,7 @@ static bool handle_client(int cli_id)
     uint16_t cli_count = 0;
     uint32_t cli_req_id = 0;
 
+    merge_t merge = { .head = REQBK_NONE };
     bool driver_notify = false;
     bool client_notify = false;
     /*
@@ -141,10 +704,19 @@ static bool handle_client(int cli_id)
      * is not full. We check the index allocator as there can be more in-flight requests
      * than currently in the driver queue.
      */
-    while (!blk_queue_empty_req(&h) && !blk_queue_full_req(&drv_h) && !ialloc_full(&ialloc)) {
+    uint32_t served = 0;
+    if (!virt_partition_client_ready(cli_id)) {
+        return served;
+    }
+
+    while (served < max_requests && !blk_queue_empty_req(&h) && driver_has_space(&merge) && sched_admit(cli_id, now)) {
 
         err = blk_dequeue_req(&h, &cli_code, &cli_offset, &cli_block_number, &cli_count, &cli_req_id);
         assert(!err);
+        sched_charge(cli_id, cli_code, cli_count);
+        served++;
+        uint64_t dequeued = blk_stats_now();
+        blk_stats_submit(&stats->queues[STATS_CLIENT(cli_id)]);
 
         uint64_t drv_block_number = 0;
 
@@ -180,6 +752,24 @@ static bool handle_client(int cli_id)
             }
             break;
         }
+        case BLK_REQ_DISCARD:
+        case BLK_REQ_WRITE_ZEROES: {
+            uint16_t max_count = (cli_code == BLK_REQ_DISCARD) ? max_discard : max_write_zeroes;
+            if (cli_count == 0 || cli_count > max_count) {
+                LOG_BLK_VIRT_ERR("client %d request code %d for %u blocks is not supported by the driver\n", cli_id,
+                                 cli_code, cli_count);
+                resp_status = BLK_RESP_ERR_INVALID_PARAM;
+                goto req_fail;
+            }
+
+            /* No data is transferred, so only the blocks need to lie within the client's partition */
+            resp_status = get_drv_block_number(cli_block_number, cli_count, cli_id, &drv_block_number);
+            if (resp_status != BLK_RESP_OK) {
+                goto req_fail;
+            }
+            cli_offset = 0;
+            break;
+        }
         case BLK_REQ_FLUSH:
         case BLK_REQ_BARRIER:
             break;
@@ -190,21 +780,47 @@ static bool handle_client(int cli_id)
             goto req_fail;
         }
 
+        uintptr_t cli_vaddr = cli_data_base_vaddr + cli_offset;
+        uintptr_t cli_paddr = cli_data_base_paddr + cli_offset;
         if (cli_code == BLK_REQ_WRITE) {
-            cache_clean(cli_data_base_vaddr + cli_offset,
-                        cli_data_base_vaddr + cli_offset + (BLK_TRANSFER_SIZE * cli_count));
+            cache_clean(cli_vaddr, cli_vaddr + (BLK_TRANSFER_SIZE * cli_count));
+            readahead_invalidate(cli_id, drv_block_number, cli_count);
+        } else if (cli_code == BLK_REQ_DISCARD || cli_code == BLK_REQ_WRITE_ZEROES) {
+            readahead_invalidate(cli_id, drv_block_number, cli_count);
+        } else if (cli_code == BLK_REQ_READ) {
+            bool waiting = readaheads[cli_id].inflight;
+            if (readahead_serve(cli_id, drv_block_number, cli_count, cli_vaddr, cli_req_id, dequeued)) {
+                client_notify |= !waiting;
+                driver_notify |= readahead_update(cli_id, drv_block_number, cli_count, &merge);
+                continue;
+            }
         }
 
         /* Bookkeep client request and generate driver req id */
         uint32_t drv_req_id = 0;
         err = ialloc_alloc(&ialloc, &drv_req_id);
         assert(!err);
-        reqsbk[drv_req_id] = (reqbk_t) { cli_id, cli_req_id, cli_data_base_vaddr + cli_offset, cli_count, cli_code };
-
-        err = blk_enqueue_req(&drv_h, cli_code, cli_data_base_paddr + cli_offset, drv_block_number, cli_count,
-                              drv_req_id);
-        assert(!err);
+        reqsbk[drv_req_id] = (reqbk_t) { cli_id,     cli_req_id, cli_vaddr, cli_count, cli_code, drv_block_number,
+                                         REQBK_NONE, false,     dequeued };
+
+        /* Merge contiguous reads and writes into a single driver request */
+        if (merge_contiguous(&merge, cli_code, cli_paddr, drv_block_number, cli_count)) {
+            reqsbk[merge.tail].next = drv_req_id;
+            merge.tail = drv_req_id;
+            merge.count += cli_count;
+        } else {
+            merge_submit(&merge);
+            merge = (merge_t) { drv_req_id, drv_req_id, cli_code, cli_paddr, drv_block_number, cli_count };
+            if (cli_code != BLK_REQ_READ && cli_code != BLK_REQ_WRITE) {
+                /* Only reads and writes are merged */
+                merge_submit(&merge);
+            }
+        }
         driver_notify = true;
+
+        if (cli_code == BLK_REQ_READ) {
+            readahead_update(cli_id, drv_block_number, cli_count, &merge);
+        }
         continue;
 
     req_fail:
@@ -213,22 +829,108 @@ static bool handle_client(int cli_id)
          */
         err = blk_enqueue_resp(&h, resp_status, 0, cli_req_id);
         assert(!err);
+        blk_stats_complete(&stats->queues[STATS_CLIENT(cli_id)], cli_code, cli_count, resp_status, dequeued, dequeued);
         client_notify = true;
     }
 
+    merge_submit(&merge);
+
     if (client_notify) {
-        sddf_notify(config.clients[cli_id].conn.id);
+        notify_client(cli_id);
+    }
+
+    *drv_notify |= driver_notify;
+    return served;
+}
+
+/**
+ * Serve deadline clients ahead of all fair clients, taking turns one request
+ * at a time so that none of them waits behind another's backlog.
+ */
+static void serve_deadline(uint64_t now, bool *driver_notify)
+{
+    bool progress = true;
+    while (progress) {
+        progress = false;
+        for (int i = 0; i < config.num_clients; i++) {
+            if (config.sched[i].sched_class == BLK_SCHED_CLASS_DEADLINE
+                && handle_client(i, 1, now, driver_notify)) {
+                progress = true;
+            }
+        }
     }
+}
+
+/**
+ * Share the driver between fair clients by deficit round robin. A pass that
+ * is cut short by a full driver queue resumes from where it stopped.
+ */
+static void serve_fair(uint64_t now, bool *driver_notify)
+{
+    merge_t none = { .head = REQBK_NONE };
+    bool progress = true;
+    while (progress && driver_has_space(&none)) {
+        progress = false;
+        for (int j = 0; j < config.num_clients; j++) {
+            int i = (next_client + j) % config.num_clients;
+            client_sched_t *cs = &client_sched[i];
+            blk_virt_config_sched_t *client = &config.sched[i];
+            if (client->sched_class != BLK_SCHED_CLASS_FAIR) {
+                continue;
+            }
+
+            if (blk_queue_empty_req(&client_queues[i]) || !virt_partition_client_ready(i)) {
+                /* Idle clients do not bank deficit */
+                cs->deficit = 0;
+                cs->in_round = false;
+                continue;
+            }
+
+            if (!cs->in_round) {
+                /* Capped clients do not accumulate deficit while waiting for tokens */
+                if (!sched_within_rate(i, sched_head_cost(i), now)) {
+                    continue;
+                }
+                cs->deficit += (uint64_t)MAX(client->weight, 1) * sched_quantum;
+                cs->in_round = true;
+            }
 
-    return driver_notify;
+            uint32_t served = handle_client(i, UINT32_MAX, now, driver_notify);
+            if (!driver_has_space(&none)) {
+                /* Resume from this client if it was cut short, otherwise
+                from the next one */
+                bool cut_short = !blk_queue_empty_req(&client_queues[i]) && sched_admit(i, now);
+                cs->in_round = cut_short;
+                next_client = cut_short ? i : (i + 1) % config.num_clients;
+                return;
+            }
+
+            cs->in_round = false;
+            if (served || sched_saving(i)) {
+                progress = true;
+            }
+        }
+    }
 }
 
 static void handle_clients()
 {
     bool driver_notify = false;
-    for (int i = 0; i < config.num_clients; i++) {
-        if (handle_client(i)) {
-            driver_notify = true;
+
+    if (config.scheduler == BLK_SCHED_FAIR) {
+        uint64_t now = 0;
+        if (rate_limited) {
+            now = sddf_timer_time_now(timer_config.driver_id);
+            for (int i = 0; i < config.num_clients; i++) {
+                sched_refill(i, now);
+            }
+        }
+
+        serve_deadline(now, &driver_notify);
+        serve_fair(now, &driver_notify);
+    } else {
+        for (int i = 0; i < config.num_clients; i++) {
+            handle_client(i, UINT32_MAX, 0, &driver_notify);
         }
     }
 
@@ -239,19 +941,20 @@ static void handle_clients()
 
 void notified(sddf_channel ch)
 {
-    if (!initialised) {
-        /* Continue processing partitions until initialisation has finished. */
-        LOG_BLK_VIRT("initialising partitions\n");
-        initialised = virt_partition_init();
+    blk_stats_begin(stats);
+
+    if (rate_limited && ch == timer_config.driver_id) {
+        timeout_at = 0;
     }
 
-    /* Do not handle driver/clients until we have finished initialisation. */
-    if (initialised) {
-        if (ch == config.driver.conn.id) {
-            handle_driver();
-            handle_clients();
-        } else {
-            handle_clients();
-        }
+    /* Clients are served as soon as they have been given their partition,
+    handle_clients() skips the others while discovery is in progress */
+    if (ch == config.driver.conn.id) {
+        handle_driver();
+        handle_clients();
+    } else {
+        handle_clients();
     }
+
+    blk_stats_end(stats);
 }
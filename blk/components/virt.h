@@ -42,15 +42,45 @@ blk_resp_status_t get_drv_block_number(uint64_t cli_block_number, uint16_t cli_c
                                        uint64_t *drv_block_number);
 
 /**
- * Initialise the block device partition metadata, either MBR or GPT
+ * Get the driver block number one past the end of a client's partition.
  *
- * This function is intended to be called multiple times until it returns true when
- * it has finished all the request/response handling to get the partition metadata.
- * The process is as follows:
- * 1. Request MBR partition metadata.
- * 2. Read MBR partition metadata, see if we are dealing with just MBR or GPT.
- * 3. If MBR then we fill client storage info based on partitions, and then we are done.
- * 4. If GPT, then we have more requests to send, then validate the partitions, then
- *    fill the client storage info based on that.
+ * @param cli_id the client ID number
+ */
+uint64_t get_drv_block_limit(int cli_id);
+
+/**
+ * Start discovering the partitions of the block device, from an MBR or GPT.
+ *
+ * The blocks at both ends of the disk are read at once, covering the MBR, the
+ * primary GPT and the backup GPT of a typical disk. Each client is released by
+ * publishing its storage info as soon as its partition has been validated,
+ * while the metadata needed by other clients, such as the extended boot
+ * records of logical MBR partitions, may still be being read. Partition
+ * metadata is read into the driver data region.
+ */
+void virt_partition_init(void);
+
+/**
+ * Handle a driver response if it belongs to a partition metadata read.
+ *
+ * @param id the id of the driver request
+ * @param status the status of the driver response
+ *
+ * @return true if the response was for partition metadata.
+ */
+bool virt_partition_handle_response(uint32_t id, blk_resp_status_t status);
+
+/**
+ * Issue any partition metadata reads which did not fit in the driver queue.
+ *
+ * @return true once discovery has finished and the driver data region is no
+ *         longer used for partition metadata.
+ */
+bool virt_partition_continue(void);
+
+/**
+ * Whether a client has been given its partition and may be served.
+ *
+ * @param cli_id the client ID number
  */
-bool virt_partition_init(void);
+bool virt_partition_client_ready(int cli_id);
@@ -8,6 +8,7 @@
 #include <os/sddf.h>
 #include <sddf/blk/config.h>
 #include <sddf/blk/queue.h>
+#include <sddf/blk/stats.h>
 #include <sddf/blk/storage_info.h>
 #include <sddf/util/printf.h>
 #include <sddf/timer/config.h>
@@ -44,11 +45,29 @@
 #define SD_BLOCK_SIZE 512
 #define SDDF_BLOCKS_TO_SD_BLOCKS (BLK_TRANSFER_SIZE / SD_BLOCK_SIZE)
 
+/* Descriptors per ADMA2 table, enough for the largest single request we accept */
+#define ADMA_TABLE_LEN 1024
+#define ADMA_TABLE_SIZE (ADMA_TABLE_LEN * sizeof(usdhc_adma2_desc_t))
+/* The ADMA region holds two descriptor tables followed by a scratch buffer for card registers */
+#define ADMA_SCRATCH_OFFSET (2 * ADMA_TABLE_SIZE)
+#define ADMA_REGION_SIZE (ADMA_SCRATCH_OFFSET + 0x1000)
+
+#define ADMA_DESCS_NEEDED(count) \
+    (((uint32_t)(count) * BLK_TRANSFER_SIZE + USDHC_ADMA2_DESC_MAX_LEN - 1) / USDHC_ADMA2_DESC_MAX_LEN)
+
+/* Most requests combined into one card transfer */
+#define BATCH_MAX_REQS 128
+/* Most sDDF blocks in one card transfer, bounded by BLK_ATT[BLKCNT] */
+#define BATCH_MAX_BLOCKS (USDHC_BLK_ATT_BLKCNT_MAX / SDDF_BLOCKS_TO_SD_BLOCKS)
+
 #define fallthrough __attribute__((__fallthrough__))
 
 blk_queue_handle_t blk_queue;
 volatile imx_usdhc_regs_t *usdhc_regs;
 
+static usdhc_adma2_desc_t *adma_tables;
+static uintptr_t adma_tables_paddr;
+
 __attribute__((__section__(".device_resources"))) device_resources_t device_resources;
 __attribute__((__section__(".blk_driver_config"))) blk_driver_config_t blk_config;
 __attribute__((__section__(".timer_client_config"))) timer_client_config_t timer_config;
@@ -71,6 +90,10 @@ static struct card_info {
     sd_card_state_t card_state;
     /* [SD-PHY] 5.3 CSD Register */
     uint32_t csd[4];
+    /* [SD-PHY] 5.6 SCR Register; card accepts CMD23 SET_BLOCK_COUNT */
+    bool cmd23;
+    /* [SD-PHY] 5.6 SCR Register; erased blocks read as zeroes (DATA_STAT_AFTER_ERASE = 0) */
+    bool erase_zeroes;
 } card_info;
 
 #define DRIVER_STATE_INIT 0
@@ -111,6 +134,9 @@ static struct driver_state {
         CardIdentStateFrequencyChange,
         CardIdentStateSendCsd,
         CardIdentStateCardSelect,
+        CardIdentStateSetBlockLen,
+        CardIdentStateScrSetup,
+        CardIdentStateSendScr,
         CardIdentStateDone,
     } card_ident;
 
@@ -118,19 +144,51 @@ static struct driver_state {
 
     enum {
         DataStateInit = DRIVER_STATE_INIT,
+        DataStateSetBlockCount,
         DataStateSend,
     } data_transfer;
 
-    struct {
-        bool inflight;
-        uint32_t id;
+    enum {
+        EraseStateInit = DRIVER_STATE_INIT,
+        EraseStateSetEnd,
+        EraseStateErase,
+        EraseStatePollDelay,
+        EraseStateWaitReady,
+    } erase;
+
+    /* when to next poll the status of an erasing card, and when to give up */
+    uint64_t erase_poll_at;
+    uint64_t erase_deadline;
+
+    /* Client requests are handed to the card in batches: a run of reads or
+       writes to consecutive blocks which the card executes as one multi-block
+       transfer, scattered across the clients' buffers by an ADMA2 descriptor
+       table. While one batch is on the card, the next one is dequeued,
+       validated and has its table built, so that it can be issued as soon as
+       the card finishes. Flushes, barriers, discards and write zeroes always
+       form a batch of their own. */
+    struct blk_batch {
+        bool ready;
         blk_req_code_t code;
-        uintptr_t paddr;
         uint64_t blk_number;
-        uint16_t blk_count;
-    } blk_req;
+        uint32_t blk_count;
+        uint16_t num_reqs;
+        uint16_t num_descs;
+        uint32_t ids[BATCH_MAX_REQS];
+        uint16_t counts[BATCH_MAX_REQS];
+        /* time each request was dequeued, for statistics */
+        uint64_t starts[BATCH_MAX_REQS];
+    } batches[2];
+    /* Index of the batch on the card; the other is the one prepared behind it */
+    uint8_t current;
+    bool inflight;
 } driver_state;
 
+static void respond_batch(struct blk_batch *batch, blk_resp_status_t status);
+
+static uint64_t stats_fallback[BLK_STATS_SIZE(1) / sizeof(uint64_t)];
+static blk_stats_t *stats;
+
 /* Used for clearing card state on ejection */
 static inline void clear_card_state(void);
 /* Cancel the driver's active operations and clear current card info */
@@ -143,9 +201,10 @@ static inline void stop_operations_and_clear_card_state(void)
     usdhc_regs->int_status_en = 0x0;
     usdhc_regs->int_signal_en = 0x0;
 
-    if (driver_state.blk_req.inflight) {
-        /* if the queue is full we can't do anything about it... */
-        (void)blk_enqueue_resp(&blk_queue, BLK_RESP_ERR_NO_DEVICE, 0, driver_state.blk_req.id);
+    for (int i = 0; i < ARRAY_SIZE(driver_state.batches); i++) {
+        if (driver_state.batches[i].ready) {
+            respond_batch(&driver_state.batches[i], BLK_RESP_ERR_NO_DEVICE);
+        }
     }
 
     driver_state = (struct driver_state) {
@@ -157,7 +216,12 @@ static inline void stop_operations_and_clear_card_state(void)
         .card_ident = DRIVER_STATE_INIT,
         .card_init_start_time = DRIVER_STATE_INIT,
         .data_transfer = DRIVER_STATE_INIT,
-        .blk_req = {0},
+        .erase = DRIVER_STATE_INIT,
+        .erase_poll_at = 0,
+        .erase_deadline = 0,
+        .batches = {{0}},
+        .current = 0,
+        .inflight = false,
     };
 
     clear_card_state();
@@ -173,6 +237,8 @@ static inline void clear_card_state(void)
         > After power-on by the host, all cards are in Idle State */
         .card_state = CardStateIdle,
         .csd = { 0x0, 0x0, 0x0, 0x0 },
+        .cmd23 = false,
+        .erase_zeroes = false,
     };
 }
 
@@ -288,7 +354,8 @@ static drv_status_t handle_interrupt_status(sd_cmd_t cmd)
         if (int_status & USDHC_INT_STATUS_DMAE) {
             /* DMA error ==> probably a virtualiser error because of an
                incorrect memory address. */
-            LOG_DRIVER_ERR("DMA error encountered: DS_ADDR: 0x%x\n", usdhc_regs->ds_addr);
+            LOG_DRIVER_ERR("DMA error encountered: ADMA_SYS_ADDR: 0x%x, ADMA_ERR_STATUS: 0x%x\n",
+                           usdhc_regs->adma_sys_addr, usdhc_regs->adma_err_status);
         }
 
         usdhc_regs->int_status = 0xffffffff;
@@ -595,7 +662,7 @@ void usdhc_reset(void)
     usdhc_regs->wtmk_lvl = (0x01 << 16) | (0x01);
     usdhc_regs->prot_ctrl = (USDHC_PROT_CTRL_DTW_1_BIT << USDHC_PROT_CTRL_DTW_SHIFT)
                             | (USDHC_PROT_CTRL_EMODE_LITTLE << USDHC_PROT_CTRL_EMODE_SHIFT)
-                            | (USDHC_PROT_CTRL_DMASEL_SIMPLE << USDHC_PROT_CTRL_DMASEL_SHIFT);
+                            | (USDHC_PROT_CTRL_DMASEL_ADMA2 << USDHC_PROT_CTRL_DMASEL_SHIFT);
 
     // TODO(#187): Probably should set up VEND_SPEC as desired...?
 }
@@ -823,6 +890,63 @@ drv_status_t perform_card_identification_and_select()
         LOG_DRIVER("Card (RCA: 0x%04x) is now waiting in the transfer state\n", card_info.rca);
         card_info.card_state = CardStateTran;
 
+        driver_state.card_ident = CardIdentStateSetBlockLen;
+        fallthrough;
+
+    case CardIdentStateSetBlockLen:
+        /* The block length stays the same for all our transfers, so we set it
+           once here rather than ahead of each one. */
+        status = send_command(SD_CMD16_SET_BLOCKLEN, SD_BLOCK_SIZE);
+        if (status == DrvIrqWait) {
+            return DrvIrqWait;
+        }
+        driver_state.command = (struct command_state) {};
+        if (status != DrvSuccess) {
+            return status;
+        }
+
+        driver_state.card_ident = CardIdentStateScrSetup;
+        fallthrough;
+
+    case CardIdentStateScrSetup:
+        /* [SD-PHY] 4.7.4 ACMD51: the SCR is sent as a single 8-byte data block;
+           we read it into the scratch buffer after the descriptor tables. */
+        adma_tables[0] = (usdhc_adma2_desc_t) {
+            .attr = USDHC_ADMA2_ATTR_VALID | USDHC_ADMA2_ATTR_END | USDHC_ADMA2_ATTR_ACT_TRAN,
+            .len = SD_SCR_SIZE,
+            .addr = adma_tables_paddr + ADMA_SCRATCH_OFFSET,
+        };
+        THREAD_MEMORY_RELEASE();
+
+        usdhc_regs->blk_att = (SD_SCR_SIZE << USDHC_BLK_ATT_BLKSIZE_SHIFT) | (1 << USDHC_BLK_ATT_BLKCNT_SHIFT);
+        usdhc_regs->adma_sys_addr = adma_tables_paddr;
+        usdhc_regs->mix_ctrl = (usdhc_regs->mix_ctrl & ~(USDHC_MIX_CTRL_MSBSEL | USDHC_MIX_CTRL_AC12EN))
+                               | USDHC_MIX_CTRL_DMAEN | USDHC_MIX_CTRL_DTDSEL;
+
+        driver_state.card_ident = CardIdentStateSendScr;
+        fallthrough;
+
+    case CardIdentStateSendScr:
+        status = send_command(SD_ACMD51_SEND_SCR, 0x0);
+        if (status == DrvIrqWait) {
+            return DrvIrqWait;
+        }
+        driver_state.command = (struct command_state) {};
+        if (status != DrvSuccess) {
+            return status;
+        }
+
+        uint8_t *scr_bytes = (uint8_t *)adma_tables + ADMA_SCRATCH_OFFSET;
+        uint64_t scr = 0;
+        for (int i = 0; i < SD_SCR_SIZE; i++) {
+            scr = (scr << 8) | scr_bytes[i];
+        }
+
+        card_info.cmd23 = !!(scr & SD_SCR_CMD_SUPPORT_CMD23);
+        card_info.erase_zeroes = !(scr & SD_SCR_DATA_STAT_AFTER_ERASE);
+        LOG_DRIVER("SCR: 0x%016lx, CMD23 %ssupported, erased blocks read as %s\n", scr, card_info.cmd23 ? "" : "not ",
+                   card_info.erase_zeroes ? "zeroes" : "ones");
+
         driver_state.card_ident = CardIdentStateDone;
         fallthrough;
 
@@ -835,51 +959,76 @@ drv_status_t perform_card_identification_and_select()
     }
 }
 
-/* [IMX8MDQLQRM] 10.3.4.3.2.1 Normal read
+/* [IMX8MDQLQRM] 10.3.4.3.2.1 Normal read, 10.3.4.3.1.1 Normal write
 
     1. Wait until the card is ready for data
     2. Set the block length with SET_BLOCKLEN
     3. Set the uSDHC block length register
     4. Set the uSDHC number block register
-    5. a. Disable the buffer read ready interrupt, configure the DMA settings
+    5. a. Disable the buffer read/write ready interrupt, configure the DMA settings
        b. enable the uSDHC DMA when sending the command with data transfer
        c. The AC12EN bit should also be set.
     6. Wait for the Transfer Complete interrupt.
 
-    Also reference [SD-PHY] 4.3.3 Data Read.
+    SET_BLOCKLEN is sent once during card identification. The DMA settings are
+    an ADMA2 descriptor table, which lets a single multi-block transfer span
+    any number of scattered buffers.
+
+    Cards that support it are told the length of the transfer upfront with
+    CMD23 SET_BLOCK_COUNT, and stop by themselves at the end of it; otherwise
+    the controller stops the transfer with an automatic CMD12.
+
+    Also reference [SD-PHY] 4.3.3 Data Read, 4.3.4 Data Write.
 */
-drv_status_t usdhc_read_blocks(uintptr_t dma_address, uint32_t sector_number, uint16_t sector_count)
+drv_status_t usdhc_transfer_blocks(bool write, uintptr_t adma_table, uint32_t sector_number, uint16_t sector_count)
 {
     drv_status_t status;
     uint32_t data_address;
     switch (driver_state.data_transfer) {
     case DataStateInit:
-        // TODO(#187): We shouldn't need to do this for every command I think.
-        status = send_command(SD_CMD16_SET_BLOCKLEN, SD_BLOCK_SIZE);
-        if (status == DrvIrqWait) {
-            return DrvIrqWait;
+        usdhc_regs->blk_att = (SD_BLOCK_SIZE << USDHC_BLK_ATT_BLKSIZE_SHIFT)
+                              | ((uint32_t)sector_count << USDHC_BLK_ATT_BLKCNT_SHIFT);
+
+        usdhc_regs->adma_sys_addr = adma_table;
+
+        uint32_t mix_ctrl = usdhc_regs->mix_ctrl | USDHC_MIX_CTRL_DMAEN | USDHC_MIX_CTRL_MSBSEL | USDHC_MIX_CTRL_BCEN;
+        /* Select the data transfer direction */
+        if (write) {
+            mix_ctrl &= ~USDHC_MIX_CTRL_DTDSEL;
+        } else {
+            mix_ctrl |= USDHC_MIX_CTRL_DTDSEL;
         }
-        driver_state.command = (struct command_state) {};
-        if (status != DrvSuccess) {
-            return status;
+        if (card_info.cmd23) {
+            mix_ctrl &= ~USDHC_MIX_CTRL_AC12EN;
+        } else {
+            mix_ctrl |= USDHC_MIX_CTRL_AC12EN;
         }
+        usdhc_regs->mix_ctrl = mix_ctrl;
 
-        usdhc_regs->blk_att = (usdhc_regs->blk_att & ~USDHC_BLK_ATT_BLKSIZE_MASK) | (SD_BLOCK_SIZE <<
-                                                                                     USDHC_BLK_ATT_BLKSIZE_SHIFT);
-
-        usdhc_regs->ds_addr = dma_address;
+        driver_state.data_transfer = DataStateSetBlockCount;
+        fallthrough;
 
-        /* Select read data transfer direction */
-        usdhc_regs->mix_ctrl |= USDHC_MIX_CTRL_DTDSEL;
-        usdhc_regs->blk_att &= ~USDHC_BLK_ATT_BLKCNT_MASK;
-        usdhc_regs->blk_att |= ((uint32_t)sector_count << USDHC_BLK_ATT_BLKCNT_SHIFT);
+    case DataStateSetBlockCount:
+        if (card_info.cmd23) {
+            /* [SD-PHY] 4.7.4 CMD23: the multiple block read or write
+               command that follows transfers exactly this many blocks. */
+            status = send_command(SD_CMD23_SET_BLOCK_COUNT, sector_count);
+            if (status == DrvIrqWait) {
+                return DrvIrqWait;
+            }
+            driver_state.command = (struct command_state) {};
+            if (status != DrvSuccess) {
+                return status;
+            }
+        }
 
         driver_state.data_transfer = DataStateSend;
         fallthrough;
 
     case DataStateSend:
-        /* [SD-PHY] Table 4-24 Block-Oriented Read Commands
-            CMD17:
+        /* [SD-PHY] Table 4-24 Block-Oriented Read Commands,
+                    Table 4-25 Block-Oriented Write Commands
+            CMD18/CMD25:
             > Argument: [31:0] data address
             > SDSC Card (CCS=0) uses byte unit address and SDHC and SDXC Cards (CCS=1)
             > use block unit address (512 Bytes unit).
@@ -889,7 +1038,7 @@ drv_status_t usdhc_read_blocks(uintptr_t dma_address, uint32_t sector_number, ui
         } else {
             data_address = sector_number * SD_BLOCK_SIZE;
         }
-        status = send_command(SD_CMD18_READ_MULTIPLE_BLOCK, data_address);
+        status = send_command(write ? SD_CMD25_WRITE_MULTIPLE_BLOCK : SD_CMD18_READ_MULTIPLE_BLOCK, data_address);
         if (status == DrvIrqWait) {
             return DrvIrqWait;
         }
@@ -898,7 +1047,7 @@ drv_status_t usdhc_read_blocks(uintptr_t dma_address, uint32_t sector_number, ui
             return status;
         }
 
-        card_info.card_state = CardStateData;
+        card_info.card_state = write ? CardStateRcv : CardStateData;
         card_info.card_state = CardStateTran;
         return DrvSuccess;
 
@@ -908,27 +1057,32 @@ drv_status_t usdhc_read_blocks(uintptr_t dma_address, uint32_t sector_number, ui
     }
 }
 
-/* [IMX8MDQLQRM] 10.3.4.3.1.1 Normal write
+/* [SD-PHY] 4.3.5 Erase
 
-    1. Wait until the card is ready for data
-    2. Set the block length with SET_BLOCKLEN
-    3. Set the uSDHC block length register
-    4. Set the uSDHC number block register
-    5. a. Disable the buffer write ready interrupt, configure the DMA settings
-       b. enable the uSDHC DMA when sending the command with data transfer
-       c. The AC12EN bit should also be set.
-    6. Wait for the Transfer Complete interrupt.
+    1. Set the address of the first block with ERASE_WR_BLK_START
+    2. Set the address of the last block with ERASE_WR_BLK_END
+    3. Start the erase with ERASE
+    4. Wait until the card is ready for data again
+
+    The card signals busy on DAT0 for as long as the erase takes, but as we
+    never get transfer complete interrupts for response-with-busy, we instead
+    poll the card status with SEND_STATUS until it is ready for data. Polls are
+    spaced out by SD_ERASE_POLL_INTERVAL with the timer, and the erase fails if
+    the card is still busy after SD_ERASE_TIMEOUT.
 
-    Also reference [SD-PHY] 4.3.4 Data Write
+    Erase (command class 5) is mandatory for SD memory cards. Erased blocks read
+    as either zeroes or ones, given by DATA_STAT_AFTER_ERASE in the SCR.
 */
-drv_status_t usdhc_write_blocks(uintptr_t dma_address, uint32_t sector_number, uint16_t sector_count)
+drv_status_t usdhc_erase_blocks(uint32_t sector_number, uint32_t sector_count)
 {
     drv_status_t status;
-    uint32_t data_address;
-    switch (driver_state.data_transfer) {
-    case DataStateInit:
-        // TODO(#187): We shouldn't need to do this for every command I think.
-        status = send_command(SD_CMD16_SET_BLOCKLEN, SD_BLOCK_SIZE);
+    /* Same addressing as CMD18/CMD25, see usdhc_transfer_blocks() */
+    uint32_t start_address = card_info.ccs ? sector_number : sector_number * SD_BLOCK_SIZE;
+    uint32_t end_address = card_info.ccs ? sector_number + sector_count - 1
+                                         : (sector_number + sector_count - 1) * SD_BLOCK_SIZE;
+    switch (driver_state.erase) {
+    case EraseStateInit:
+        status = send_command(SD_CMD32_ERASE_WR_BLK_START, start_address);
         if (status == DrvIrqWait) {
             return DrvIrqWait;
         }
@@ -937,32 +1091,49 @@ drv_status_t usdhc_write_blocks(uintptr_t dma_address, uint32_t sector_number, u
             return status;
         }
 
-        usdhc_regs->blk_att = (usdhc_regs->blk_att & ~USDHC_BLK_ATT_BLKSIZE_MASK) | (SD_BLOCK_SIZE <<
-                                                                                     USDHC_BLK_ATT_BLKSIZE_SHIFT);
+        driver_state.erase = EraseStateSetEnd;
+        fallthrough;
+
+    case EraseStateSetEnd:
+        status = send_command(SD_CMD33_ERASE_WR_BLK_END, end_address);
+        if (status == DrvIrqWait) {
+            return DrvIrqWait;
+        }
+        driver_state.command = (struct command_state) {};
+        if (status != DrvSuccess) {
+            return status;
+        }
 
-        usdhc_regs->ds_addr = dma_address;
+        driver_state.erase = EraseStateErase;
+        fallthrough;
 
-        /* Select write data transfer direction */
-        usdhc_regs->mix_ctrl &= ~USDHC_MIX_CTRL_DTDSEL;
-        usdhc_regs->blk_att &= ~USDHC_BLK_ATT_BLKCNT_MASK;
-        usdhc_regs->blk_att |= ((uint32_t)sector_count << USDHC_BLK_ATT_BLKCNT_SHIFT);
+    case EraseStateErase:
+        status = send_command(SD_CMD38_ERASE, 0x0);
+        if (status == DrvIrqWait) {
+            return DrvIrqWait;
+        }
+        driver_state.command = (struct command_state) {};
+        if (status != DrvSuccess) {
+            return status;
+        }
 
-        driver_state.data_transfer = DataStateSend;
+        card_info.card_state = CardStatePrg;
+        driver_state.erase_deadline = sddf_timer_time_now(timer_config.driver_id) + SD_ERASE_TIMEOUT;
+        driver_state.erase = EraseStateWaitReady;
         fallthrough;
 
-    case DataStateSend:
-        /* [SD-PHY] Table 4-25 Block-Oriented Write Commands
-            CMD17:
-            > Argument: [31:0] data address
-            > SDSC Card (CCS=0) uses byte unit address and SDHC and SDXC Cards (CCS=1)
-            > use block unit address (512 Bytes unit).
-        */
-        if (card_info.ccs) {
-            data_address = sector_number;
-        } else {
-            data_address = sector_number * SD_BLOCK_SIZE;
+    case EraseStatePollDelay:
+        /* Only resumed by the timer, not by interrupts arriving in between */
+        if (driver_state.erase == EraseStatePollDelay) {
+            if (sddf_timer_time_now(timer_config.driver_id) < driver_state.erase_poll_at) {
+                return DrvIrqWait;
+            }
+            driver_state.erase = EraseStateWaitReady;
         }
-        status = send_command(SD_CMD25_WRITE_MULTIPLE_BLOCK, data_address);
+        fallthrough;
+
+    case EraseStateWaitReady:
+        status = send_command(SD_CMD13_SEND_STATUS, (uint32_t)card_info.rca << SD_RCA_SHIFT);
         if (status == DrvIrqWait) {
             return DrvIrqWait;
         }
@@ -971,9 +1142,21 @@ drv_status_t usdhc_write_blocks(uintptr_t dma_address, uint32_t sector_number, u
             return status;
         }
 
-        card_info.card_state = CardStateRcv;
-        card_info.card_state = CardStateTran;
+        if (!(usdhc_regs->cmd_rsp0 & SD_CARD_STATUS_READY_FOR_DATA)) {
+            uint64_t now = sddf_timer_time_now(timer_config.driver_id);
+            if (now >= driver_state.erase_deadline) {
+                LOG_DRIVER_ERR("card still busy erasing after SD_ERASE_TIMEOUT\n");
+                return DrvErrorInternal;
+            }
 
+            /* Still erasing; ask again once the timer fires */
+            driver_state.erase_poll_at = now + SD_ERASE_POLL_INTERVAL;
+            sddf_timer_set_timeout(timer_config.driver_id, SD_ERASE_POLL_INTERVAL);
+            driver_state.erase = EraseStatePollDelay;
+            return DrvIrqWait;
+        }
+
+        card_info.card_state = CardStateTran;
         return DrvSuccess;
 
     default:
@@ -1060,6 +1243,10 @@ void setup_blk_storage_info()
 
     LOG_DRIVER("Card size (blocks): %lu\n", storage_info->capacity);
 
+    /* Both are an erase, which write zeroes can only be if erased blocks read as zeroes */
+    storage_info->max_discard = UINT16_MAX;
+    storage_info->max_write_zeroes = card_info.erase_zeroes ? UINT16_MAX : 0;
+
     blk_storage_set_ready(storage_info, true);
     LOG_DRIVER("Driver initialisation complete\n");
 }
@@ -1116,114 +1303,261 @@ void handle_client_device_inactive(void)
             /* response queue is full */
             break;
         }
+        uint64_t now = blk_stats_now();
+        blk_stats_submit(&stats->queues[0]);
+        blk_stats_complete(&stats->queues[0], code, count, BLK_RESP_ERR_NO_DEVICE, now, now);
     }
 
     sddf_notify(blk_config.virt.id);
 }
 
-void handle_client(bool was_irq)
+static blk_resp_status_t validate_request(blk_req_code_t code, uintptr_t paddr, uint64_t blk_number, uint16_t count)
 {
-    /* should never run during a status transition (bringup) */
-    assert(!(driver_status == DrvStatusBringup));
+    blk_storage_info_t *storage_info = blk_config.virt.storage_info.vaddr;
 
-    if (was_irq == false) {
-        if (driver_state.blk_req.inflight) {
-            /* Only handle block queue notifications when idle */
-            return;
-        }
+    switch (code) {
+    case BLK_REQ_FLUSH:
+    case BLK_REQ_BARRIER:
+        return BLK_RESP_OK;
 
-        /* if we're inactive (by choice or by recognition),
-           or if there's no card (but we haven't yet propagated this change to the state) */
-        if (driver_status == DrvStatusInactive || !card_detected()) {
-            handle_client_device_inactive();
-            return;
+    case BLK_REQ_DISCARD:
+    case BLK_REQ_WRITE_ZEROES: {
+        uint16_t max_count = (code == BLK_REQ_DISCARD) ? storage_info->max_discard : storage_info->max_write_zeroes;
+        if (count == 0 || count > max_count || blk_number + count > storage_info->capacity) {
+            return BLK_RESP_ERR_INVALID_PARAM;
         }
+        return BLK_RESP_OK;
+    }
 
-        int err = blk_dequeue_req(&blk_queue, &driver_state.blk_req.code, &driver_state.blk_req.paddr,
-                                  &driver_state.blk_req.blk_number, &driver_state.blk_req.blk_count,
-                                  &driver_state.blk_req.id);
-        if (err == -1) {
-            /* no client requests; we likely handled it already.
-               this can happen as we can dequeue outstanding requests following an
-               IRQ being handled, which might happen before we get the virtualiser
-               notification from the microkit event loop. */
-            return;
-        }
+    case BLK_REQ_READ:
+    case BLK_REQ_WRITE:
+        break;
 
-        driver_state.blk_req.inflight = true;
-        LOG_DRIVER("Received command: code=%d, paddr=0x%lx, block_number=%lu, count=%d, id=%d\n",
-                   driver_state.blk_req.code, driver_state.blk_req.paddr, driver_state.blk_req.blk_number,
-                   driver_state.blk_req.blk_count, driver_state.blk_req.id);
+    default:
+        return BLK_RESP_ERR_INVALID_PARAM;
     }
 
-    /* Should never get IRQs without inflight requests
-       ... but if we do, it's because we reset the driver state from
-           card removal and we got a delayed IRQ from the kernel */
-    if (!driver_state.blk_req.inflight) {
-        return;
+    if (count == 0 || count > BATCH_MAX_BLOCKS || blk_number + count > storage_info->capacity) {
+        return BLK_RESP_ERR_INVALID_PARAM;
     }
 
-    blk_resp_status_t response_status;
-    uint16_t success_count;
-    switch (driver_state.blk_req.code) {
-    case BLK_REQ_FLUSH:
-    case BLK_REQ_BARRIER:
-        /* No-ops. */
-        response_status = BLK_RESP_OK;
-        success_count = 0;
-        break;
+    /* The ADMA2 descriptors use 32-bit addressing */
+    if (paddr % USDHC_ADMA2_ADDR_ALIGN != 0 || paddr + (uint64_t)count * BLK_TRANSFER_SIZE > BIT(32)) {
+        LOG_DRIVER_ERR("Buffer 0x%lx is not reachable by ADMA2\n", paddr);
+        return BLK_RESP_ERR_INVALID_PARAM;
+    }
 
-    case BLK_REQ_READ: {
-        drv_status_t status = usdhc_read_blocks(driver_state.blk_req.paddr,
-                                                driver_state.blk_req.blk_number * SDDF_BLOCKS_TO_SD_BLOCKS,
-                                                driver_state.blk_req.blk_count * SDDF_BLOCKS_TO_SD_BLOCKS);
-        if (status == DrvIrqWait) {
-            return;
+    return BLK_RESP_OK;
+}
+
+/**
+ * Dequeue the next run of client requests that the card can execute as a
+ * single transfer into `batch`, filling in the ADMA2 descriptor table `table`.
+ * Requests that fail validation are answered straight away.
+ *
+ * @return whether a batch was prepared.
+ */
+static bool prepare_batch(struct blk_batch *batch, usdhc_adma2_desc_t *table)
+{
+    assert(!batch->ready);
+    batch->num_reqs = 0;
+    batch->num_descs = 0;
+    batch->blk_count = 0;
+
+    bool notify = false;
+    blk_req_code_t code;
+    uintptr_t paddr;
+    uint64_t blk_number;
+    uint16_t count;
+    uint32_t id;
+    while (batch->num_reqs < BATCH_MAX_REQS
+           && !blk_peek_req(&blk_queue, &code, &paddr, &blk_number, &count, &id)) {
+        if (batch->num_reqs > 0) {
+            /* Only extend the batch with a request of the same direction that
+               carries on where it ends, and still fits in the transfer. */
+            if (code != batch->code || (code != BLK_REQ_READ && code != BLK_REQ_WRITE)
+                || blk_number != batch->blk_number + batch->blk_count
+                || batch->blk_count + count > BATCH_MAX_BLOCKS
+                || batch->num_descs + ADMA_DESCS_NEEDED(count) > ADMA_TABLE_LEN) {
+                break;
+            }
         }
-        driver_state.data_transfer = DRIVER_STATE_INIT;
-        if (status == DrvErrorInternal) {
-            assert(!"TODO; retry?");
+
+        int err = blk_dequeue_req(&blk_queue, &code, &paddr, &blk_number, &count, &id);
+        assert(!err);
+        LOG_DRIVER("Received command: code=%d, paddr=0x%lx, block_number=%lu, count=%d, id=%d\n",
+                   code, paddr, blk_number, count, id);
+        uint64_t start = blk_stats_now();
+        blk_stats_submit(&stats->queues[0]);
+
+        blk_resp_status_t status = validate_request(code, paddr, blk_number, count);
+        if (status != BLK_RESP_OK) {
+            err = blk_enqueue_resp(&blk_queue, status, 0, id);
+            assert(!err);
+            blk_stats_complete(&stats->queues[0], code, count, status, start, blk_stats_now());
+            notify = true;
+            continue;
         }
 
-        response_status = drv_to_blk_status(status);
-        success_count = driver_state.blk_req.blk_count;
-        break;
-    }
+        if (batch->num_reqs == 0) {
+            batch->code = code;
+            batch->blk_number = blk_number;
+        }
+        batch->ids[batch->num_reqs] = id;
+        batch->counts[batch->num_reqs] = count;
+        batch->starts[batch->num_reqs] = start;
+        batch->num_reqs++;
 
-    case BLK_REQ_WRITE: {
-        drv_status_t status = usdhc_write_blocks(driver_state.blk_req.paddr,
-                                                 driver_state.blk_req.blk_number * SDDF_BLOCKS_TO_SD_BLOCKS,
-                                                 driver_state.blk_req.blk_count * SDDF_BLOCKS_TO_SD_BLOCKS);
-        if (status == DrvIrqWait) {
-            return;
+        if (code != BLK_REQ_READ && code != BLK_REQ_WRITE) {
+            break;
         }
-        driver_state.data_transfer = DRIVER_STATE_INIT;
-        if (status == DrvErrorInternal) {
-            assert(!"TODO; retry?");
+
+        uint32_t len = (uint32_t)count * BLK_TRANSFER_SIZE;
+        while (len > 0) {
+            uint32_t desc_len = MIN(len, USDHC_ADMA2_DESC_MAX_LEN);
+            table[batch->num_descs++] = (usdhc_adma2_desc_t) {
+                .attr = USDHC_ADMA2_ATTR_VALID | USDHC_ADMA2_ATTR_ACT_TRAN,
+                .len = desc_len,
+                .addr = paddr,
+            };
+            paddr += desc_len;
+            len -= desc_len;
         }
+        batch->blk_count += count;
+    }
 
-        response_status = drv_to_blk_status(status);
-        success_count = driver_state.blk_req.blk_count;
-        break;
+    if (notify) {
+        sddf_notify(blk_config.virt.id);
     }
 
-    default: {
-        success_count = 0;
-        response_status = BLK_RESP_ERR_INVALID_PARAM;
-        break;
+    if (batch->num_reqs == 0) {
+        return false;
+    }
+
+    if (batch->num_descs > 0) {
+        table[batch->num_descs - 1].attr |= USDHC_ADMA2_ATTR_END;
+        THREAD_MEMORY_RELEASE();
     }
+
+    batch->ready = true;
+    return true;
+}
+
+static void respond_batch(struct blk_batch *batch, blk_resp_status_t status)
+{
+    uint64_t now = blk_stats_now();
+    for (uint16_t i = 0; i < batch->num_reqs; i++) {
+        uint16_t success_count = (status == BLK_RESP_OK) ? batch->counts[i] : 0;
+        /* the response queue is as large as the request queue, so has space for these */
+        int err = blk_enqueue_resp(&blk_queue, status, success_count, batch->ids[i]);
+        assert(!err);
+        blk_stats_complete(&stats->queues[0], batch->code, batch->counts[i], status, batch->starts[i], now);
+        LOG_DRIVER("Enqueued response: status=%d, success_count=%d, id=%d\n", status, success_count,
+                   batch->ids[i]);
     }
 
-    int err = blk_enqueue_resp(&blk_queue, response_status, success_count, driver_state.blk_req.id);
-    assert(!err);
-    LOG_DRIVER("Enqueued response: status=%d, success_count=%d, id=%d\n", response_status, success_count,
-               driver_state.blk_req.id);
     sddf_notify(blk_config.virt.id);
+    batch->ready = false;
+}
+
+void handle_client(bool was_irq)
+{
+    /* should never run during a status transition (bringup) */
+    assert(!(driver_status == DrvStatusBringup));
+
+    struct blk_batch *batch = &driver_state.batches[driver_state.current];
+    struct blk_batch *next = &driver_state.batches[!driver_state.current];
+
+    if (was_irq == false) {
+        if (driver_state.inflight) {
+            /* Don't touch the card while it is busy; just get the next batch
+               ready so it can be issued the moment the current one finishes. */
+            if (!next->ready) {
+                prepare_batch(next, &adma_tables[ADMA_TABLE_LEN * !driver_state.current]);
+            }
+            return;
+        }
+
+        /* if we're inactive (by choice or by recognition),
+           or if there's no card (but we haven't yet propagated this change to the state) */
+        if (driver_status == DrvStatusInactive || !card_detected()) {
+            handle_client_device_inactive();
+            return;
+        }
+    } else if (!driver_state.inflight) {
+        /* Should never get IRQs without inflight requests
+           ... but if we do, it's because we reset the driver state from
+               card removal and we got a delayed IRQ from the kernel */
+        return;
+    }
+
+    while (true) {
+        if (!driver_state.inflight) {
+            if (!batch->ready && !prepare_batch(batch, &adma_tables[ADMA_TABLE_LEN * driver_state.current])) {
+                /* no client requests; we likely handled it already.
+                   this can happen as we can dequeue outstanding requests following an
+                   IRQ being handled, which might happen before we get the virtualiser
+                   notification from the microkit event loop. */
+                return;
+            }
+            driver_state.inflight = true;
+        }
+
+        drv_status_t status;
+        switch (batch->code) {
+        case BLK_REQ_FLUSH:
+        case BLK_REQ_BARRIER:
+            /* No-ops; they are ordered by never sharing a batch with other requests. */
+            status = DrvSuccess;
+            break;
+
+        case BLK_REQ_READ:
+        case BLK_REQ_WRITE:
+            status = usdhc_transfer_blocks(batch->code == BLK_REQ_WRITE,
+                                           adma_tables_paddr + ADMA_TABLE_SIZE * driver_state.current,
+                                           batch->blk_number * SDDF_BLOCKS_TO_SD_BLOCKS,
+                                           batch->blk_count * SDDF_BLOCKS_TO_SD_BLOCKS);
+            if (status == DrvIrqWait) {
+                if (!next->ready) {
+                    prepare_batch(next, &adma_tables[ADMA_TABLE_LEN * !driver_state.current]);
+                }
+                return;
+            }
+            driver_state.data_transfer = DRIVER_STATE_INIT;
+            if (status == DrvErrorInternal) {
+                assert(!"TODO; retry?");
+            }
+            break;
+
+        case BLK_REQ_DISCARD:
+        case BLK_REQ_WRITE_ZEROES:
+            /* A batch of its own, so its only request covers the blocks */
+            status = usdhc_erase_blocks(batch->blk_number * SDDF_BLOCKS_TO_SD_BLOCKS,
+                                        (uint32_t)batch->counts[0] * SDDF_BLOCKS_TO_SD_BLOCKS);
+            if (status == DrvIrqWait) {
+                if (!next->ready) {
+                    prepare_batch(next, &adma_tables[ADMA_TABLE_LEN * !driver_state.current]);
+                }
+                return;
+            }
+            driver_state.erase = DRIVER_STATE_INIT;
+            break;
 
-    driver_state.blk_req.inflight = false;
+        default:
+            /* prepare_batch() only accepts the codes above */
+            assert(!"unreachable");
+            status = DrvErrorInternal;
+            break;
+        }
 
-    /* Tail-call to handle another request */
-    return handle_client(/* was_irq: */ false);
+        respond_batch(batch, drv_to_blk_status(status));
+        driver_state.inflight = false;
+
+        /* Move on to the batch prepared behind this one, if any */
+        driver_state.current = !driver_state.current;
+        batch = &driver_state.batches[driver_state.current];
+        next = &driver_state.batches[!driver_state.current];
+    }
 }
 
 void do_bringup(void)
@@ -1250,7 +1584,7 @@ void do_bringup(void)
     handle_client(/* was_irq: */ false);
 }
 
-void notified(sddf_channel ch)
+static void handle_notification(sddf_channel ch)
 {
     if (driver_status == DrvStatusBringup) {
         if (ch == device_resources.irqs[0].id) {
@@ -1269,32 +1603,49 @@ void notified(sddf_channel ch)
     } else if (ch == blk_config.virt.id) {
         handle_client(/* was_irq: */ false);
     } else if (ch == timer_config.driver_id) {
-        LOG_DRIVER_ERR("got impossible timer interrupt\n");
-        assert(!"unreachable");
+        /* Only used to space out status polls during an erase, which resumes
+           the batch in flight just like an interrupt */
+        handle_client(/* was_irq: */ true);
     } else {
         LOG_DRIVER_ERR("notification on unknown channel: %d\n", ch);
     }
 }
 
+void notified(sddf_channel ch)
+{
+    blk_stats_begin(stats);
+    handle_notification(ch);
+    blk_stats_end(stats);
+}
+
 void init()
 {
     assert(device_resources_check_magic(&device_resources));
     assert(blk_config_check_magic(&blk_config));
     assert(timer_config_check_magic(&timer_config));
-    assert(device_resources.num_regions == 1);
+    assert(device_resources.num_regions == 2);
     assert(device_resources.num_irqs == 1);
 
     usdhc_regs = device_resources.regions[0].region.vaddr;
 
+    /* ADMA2 descriptor tables must be word aligned, which the region always is */
+    assert(device_resources.regions[1].region.size >= ADMA_REGION_SIZE);
+    assert(device_resources.regions[1].io_addr + ADMA_REGION_SIZE <= BIT(32));
+    adma_tables = device_resources.regions[1].region.vaddr;
+    adma_tables_paddr = device_resources.regions[1].io_addr;
+
     LOG_DRIVER("Beginning driver initialisation...\n");
     stop_operations_and_clear_card_state();
 
     /* Setup the sDDF block queue */
     blk_queue_init(&blk_queue, blk_config.virt.req_queue.vaddr, blk_config.virt.resp_queue.vaddr,
                    blk_config.virt.num_buffers);
+    stats = blk_stats_init(&blk_config.stats, stats_fallback, sizeof(stats_fallback), BLK_STATS_DRIVER, 1);
+    stats->queues[0].capacity = blk_config.virt.num_buffers;
 
     /* Make sure we have DMA support. */
     assert(usdhc_regs->host_ctrl_cap & USDHC_HOST_CTRL_CAP_DMAS);
+    assert(usdhc_regs->host_ctrl_cap & USDHC_HOST_CTRL_CAP_ADMAS);
 
     driver_status = DrvStatusBringup;
     do_bringup();
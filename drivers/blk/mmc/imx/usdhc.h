@@ -76,6 +76,7 @@ typedef struct imx_usdhc_regs {
 #define USDHC_BLK_ATT_BLKSIZE_MASK  _MASK(0, 12)  /* BLK_ATT[12-0]        */
 #define USDHC_BLK_ATT_BLKCNT_SHIFT  16            /* Blocks count         */
 #define USDHC_BLK_ATT_BLKCNT_MASK   _MASK(16, 31) /* BLK_ATT[16-31]        */
+#define USDHC_BLK_ATT_BLKCNT_MAX    0xFFFF        /* Largest block count  */
 
 /* [IMX8MDQLQRM] Section 10.3.7.1.5 Command Transfer Type */
 #define USDHC_CMD_XFR_TYP_CCCEN        BIT(19)       /* Command CRC check enable   */
@@ -175,6 +176,7 @@ typedef struct imx_usdhc_regs {
 #define USDHC_INT_SIGNAL_EN_DMAEIEN  BIT(28)  /* DMA error interrupt enable */
 
 /* [IMX8MDQLQRM] Section 10.3.7.1.18 Host Controller Capabilities */
+#define USDHC_HOST_CTRL_CAP_ADMAS BIT(20)  /* ADMA Support */
 #define USDHC_HOST_CTRL_CAP_DMAS  BIT(22)  /* DMA Support */
 #define USDHC_HOST_CTRL_CAP_VS33  BIT(24)  /* Voltage support 3.3 V */
 
@@ -188,6 +190,23 @@ typedef struct imx_usdhc_regs {
 /* [IMX8MDQLQRM] Section 10.3.7.1.29 Vendor Specific Register */
 #define USDHC_VEND_SPEC_FRC_SDCLK_ON BIT(8) /* Force CLK output active. */
 
+/* [SD-HOST] Section 1.13.4 ADMA2 Descriptor Format (32-bit addressing).
+   The uSDHC requires ADMA2 data addresses to be word aligned. */
+typedef struct usdhc_adma2_desc {
+    uint16_t attr;
+    uint16_t len;
+    uint32_t addr;
+} __attribute__((packed)) usdhc_adma2_desc_t;
+
+#define USDHC_ADMA2_ATTR_VALID    BIT(0)         /* Descriptor is valid         */
+#define USDHC_ADMA2_ATTR_END      BIT(1)         /* Last descriptor in table    */
+#define USDHC_ADMA2_ATTR_INT      BIT(2)         /* Interrupt when done         */
+#define USDHC_ADMA2_ATTR_ACT_TRAN (0b10 << 4)    /* Act2:Act1 = Transfer data   */
+
+#define USDHC_ADMA2_ADDR_ALIGN    4
+/* Largest multiple of the sDDF transfer size that fits the 16-bit length field */
+#define USDHC_ADMA2_DESC_MAX_LEN  0xF000
+
 
 /*
     Below this point is generic non-imx specific SD items from [SD-PHY].
@@ -216,7 +235,7 @@ typedef struct {
     bool data_present;
 } sd_cmd_t;
 #define _SD_CMD_DEF(number, rtype, ...)  (sd_cmd_t){.cmd_index = (number), .cmd_response_type = (rtype), .is_app_cmd = false, ##__VA_ARGS__}
-#define _SD_ACMD_DEF(number, rtype) (sd_cmd_t){.cmd_index = (number), .cmd_response_type = (rtype), .is_app_cmd = true, .data_present = false}
+#define _SD_ACMD_DEF(number, rtype, ...) (sd_cmd_t){.cmd_index = (number), .cmd_response_type = (rtype), .is_app_cmd = true, ##__VA_ARGS__}
 
 /* [SD-PHY] Section 4.7.4 Detailed Command Description */
 #define SD_CMD0_GO_IDLE_STATE        _SD_CMD_DEF(0, RespType_None)  /* [31:0] stuff bits */
@@ -227,12 +246,16 @@ typedef struct {
 #define SD_CMD9_SEND_CSD             _SD_CMD_DEF(9, RespType_R2)    /* [31:16] RCA, [15:0] stuff bits */
 #define SD_CMD13_SEND_STATUS         _SD_CMD_DEF(13, RespType_R1)   /* [31:16] RCA, [15:0] stuff bits */
 #define SD_CMD16_SET_BLOCKLEN        _SD_CMD_DEF(16, RespType_R1)   /* [31:0] block length */
+#define SD_CMD23_SET_BLOCK_COUNT     _SD_CMD_DEF(23, RespType_R1)   /* [31:0] block count */
 #define SD_CMD18_READ_MULTIPLE_BLOCK _SD_CMD_DEF(18, RespType_R1, .data_present = true)  /* [31:0] data address */
 #define SD_CMD25_WRITE_MULTIPLE_BLOCK  _SD_CMD_DEF(25, RespType_R1, .data_present = true)  /* [31:0] data address */
+#define SD_CMD32_ERASE_WR_BLK_START  _SD_CMD_DEF(32, RespType_R1)   /* [31:0] data address */
+#define SD_CMD33_ERASE_WR_BLK_END    _SD_CMD_DEF(33, RespType_R1)   /* [31:0] data address */
+#define SD_CMD38_ERASE               _SD_CMD_DEF(38, RespType_R1b)  /* [31:0] erase function; 0 = erase */
 #define SD_CMD55_APP_CMD             _SD_CMD_DEF(55, RespType_R1)   /* [31:16] RCA, [15:0] stuff bits */
 
 #define SD_ACMD41_SD_SEND_OP_COND    _SD_ACMD_DEF(41, RespType_R3)  /* [31] zero, [30] host capacity status (CCS), [29] eSD reserved , [28] XPC, [27:25] zeroed, [24] S18R, [23:0] Vdd Voltage Window (host) */
-#define SD_ACMD51_SEND_SCR           _SD_ACMD_DEF(51, RespType_R1)  /* [31:0] stuff bits */
+#define SD_ACMD51_SEND_SCR           _SD_ACMD_DEF(51, RespType_R1, .data_present = true)  /* [31:0] stuff bits */
 
 /* [SD-PHY] Section 4.9.5 R6 Published RCA Response */
 #define SD_RCA_SHIFT 16               /* New published RCA of the card */
@@ -247,6 +270,7 @@ typedef struct {
 
 /* [SD-PHY] Section 4.10.1 Card Status */
 #define SD_CARD_STATUS_APP_CMD  BIT(5)   /* The card will expect ACMD */
+#define SD_CARD_STATUS_READY_FOR_DATA BIT(8) /* The card is no longer busy */
 
 /* [SD-PHY] Section 5.1 OCR Register */
 #define SD_OCR_VDD27_28         BIT(15)  /* Vdd supports 2.7–2.8V */
@@ -262,6 +286,11 @@ typedef struct {
 #define SD_OCR_HCS              BIT(30)  /* Host Capacity Status (HCS) */
 #define SD_OCR_POWER_UP_STATUS  BIT(31)  /* Card power up status bit (busy) */
 
+/* [SD-PHY] Section 5.6 SCR Register; the 64-bit register is sent MSB first */
+#define SD_SCR_SIZE              8        /* SCR length in bytes        */
+#define SD_SCR_CMD_SUPPORT_CMD23 BIT(33)  /* SET_BLOCK_COUNT supported  */
+#define SD_SCR_DATA_STAT_AFTER_ERASE BIT(55) /* Erased blocks read as ones */
+
 /* [SD-PHY] Section 5.3.1 CSD Register */
 #define SD_CSD_CSD_STRUCTURE_SHIFT    126             /* CSD Structure (version)      */
 #define SD_CSD_CSD_STRUCTURE_MASK     _MASK_128(126, 127) /* CSD-slice: [127:126]         */
@@ -287,6 +316,11 @@ typedef struct {
 #define SD_CLOCK_STABLE_TIMEOUT (150 * NS_IN_MS)
 /* [SD-PHY] 4.2.3.1 Initialization Command - timeout is 1s */
 #define SD_INITIALISATION_TIMEOUT (1 * NS_IN_S)
+/* Interval between SEND_STATUS polls while the card is busy erasing */
+#define SD_ERASE_POLL_INTERVAL (1 * NS_IN_MS)
+/* [SD-PHY] 4.14 Erase Timeout Calculation gives the erase timeout from the SD
+   Status, which we do not read, so a fixed bound well above it is used. */
+#define SD_ERASE_TIMEOUT (30 * NS_IN_S)
 
 /* [SD-PHY] Section 4.10.1 Card Status Field 'CURRENT_STATE',
        and Section 4.1 - Table 4-1. */
@@ -6,6 +6,7 @@
 #include <os/sddf.h>
 #include <sddf/blk/queue.h>
 #include <sddf/blk/config.h>
+#include <sddf/blk/stats.h>
 #include <sddf/blk/storage_info.h>
 #include <sddf/util/util.h>
 #include <sddf/util/ialloc.h>
@@ -48,31 +49,39 @@ nvme_identify_ns_t *nvme_identify_ns;
 #define NVME_CONTROLLER_STATUS_POLL_INTERVAL_NS (NVME_CONTROLLER_STATUS_POLL_INTERVAL_MS * NS_IN_MS)
 
 /* Admin queue has ID 0 [NVMe-2.1 §1.5.4]; I/O queues use IDs 1-65535. [NVMe-2.1 §3.3.3.2] */
-/* Only one I/O queue pair is supported and share ID 1. */
-#define NVME_DEFAULT_IO_Q_ID 1
-/* One IV corresponds to one I/O queue pair. [NVMe-2.1 §5.2.1, Fig. 475] */
+/* I/O queue pair n is given ID n + 1, its SQ and CQ sharing the ID. */
+#define NVME_IO_Q_ID(n) ((uint16_t)((n) + 1))
+/* Pin-based and single MSI interrupts only have vector 0, so all I/O CQs share it. [NVMe-PCIe-1.1 §3.5.1.1] */
 #define NVME_CREATE_IO_Q_INTERRUPT_VECTOR 0
 
-/* Valid NSIDs are 1h through FFFFFFFFh. [NVMe-2.1 §3.2.1.1] */
-/* Only a single namespace is supported. */
-#define NVME_DEFAULT_NSID 1
+_Static_assert(NVME_MAX_IO_QUEUES >= SDDF_BLK_MAX_QUEUES, "must be able to serve every driver connection");
 
-static nvme_queue_info_t admin_queue;
-static nvme_queue_info_t io_queue;
+/* A namespace exposed through one or more I/O queue pairs */
+typedef struct nvme_namespace {
+    /* Valid NSIDs are 1h through FFFFFFFFh. [NVMe-2.1 §3.2.1.1] */
+    uint32_t nsid;
+    uint32_t sector_size;
+    uint32_t sectors_per_block; // Derived from Identify Namespace data
+    uint64_t capacity;          // In BLK_TRANSFER_SIZE blocks
+} nvme_namespace_t;
+
+static nvme_namespace_t namespaces[NVME_MAX_IO_QUEUES];
 
-static blk_queue_handle_t blk_queue;
-static blk_storage_info_t *storage_info;
+static nvme_queue_info_t admin_queue;
 
 /*
  * State machine flow:
  *   WAIT_NOT_READY -> WAIT_READY -> WAIT_IDENTIFY_CTRL (timer-driven, see nvme_poll_controller_status)
- *   WAIT_IDENTIFY_CTRL -> WAIT_IDENTIFY_NS -> WAIT_CREATE_IO_CQ -> WAIT_CREATE_IO_SQ -> READY (IRQ-driven, see handle_admin_completions)
+ *   WAIT_IDENTIFY_CTRL -> WAIT_IDENTIFY_NS_LIST -> WAIT_IDENTIFY_NS for each namespace -> WAIT_SET_NUM_QUEUES
+ *   -> (WAIT_CREATE_IO_CQ -> WAIT_CREATE_IO_SQ) for each I/O queue pair -> READY (IRQ-driven, see handle_admin_completions)
  */
 typedef enum {
     NVME_STATE_WAIT_NOT_READY,    // Waiting for CSTS.RDY=0
     NVME_STATE_WAIT_READY,        // Waiting for CSTS.RDY=1
     NVME_STATE_WAIT_IDENTIFY_CTRL,// Waiting for Identify Controller completion
+    NVME_STATE_WAIT_IDENTIFY_NS_LIST,// Waiting for Identify Active Namespace ID list completion
     NVME_STATE_WAIT_IDENTIFY_NS,  // Waiting for Identify Namespace completion
+    NVME_STATE_WAIT_SET_NUM_QUEUES,// Waiting for Set Features (Number of Queues) completion
     NVME_STATE_WAIT_CREATE_IO_CQ, // Waiting for Create I/O CQ completion
     NVME_STATE_WAIT_CREATE_IO_SQ, // Waiting for Create I/O SQ completion
     NVME_STATE_READY,             // Operational
@@ -83,11 +92,15 @@ typedef struct {
     uint32_t timeout_ms;            // CAP.TO derived timeout
     uint32_t waited_ms;             // Time waited in current state
     uint16_t io_queue_depth;        // 0-based I/O queue depth (n means n+1 entries)
-    uint32_t sectors_per_block;     // Derived from Identify Namespace data
     uint8_t cap_mpsmin;             // CAP.MPSMIN used for MDTS calculation
     uint32_t max_io_pages;          // Maximum number of I/O pages per transfer based on MDTS/CAP.MPSMIN
     bool use_sgl;                   // Whether to use SGLs for I/O commands (controller supports SGL transport)
     bool sgl_requires_dword_align;  // Whether SGL transport support requires dword-aligned addresses and lengths
+    uint16_t oncs;                  // Optional NVM commands supported by the controller
+    uint16_t num_io_queues;         // Number of I/O queue pairs, one per virtualiser connection
+    uint16_t creating_io_queue;     // I/O queue pair currently being created
+    uint16_t num_namespaces;        // Number of namespaces exposed, see NVME_NAMESPACE_PER_QUEUE
+    uint16_t identifying_ns;        // Namespace currently being identified
 } nvme_state_ctx_t;
 
 static nvme_state_ctx_t state_ctx;
@@ -112,23 +125,76 @@ _Static_assert(NVME_IO_CQ_CAPACITY < 0x10000, "capacity of IO CQ must be <=65536
 /* Map sDDF IDs to NVMe CIDs - align with I/O queue depth */
 #define MAX_PENDING_REQS NVME_IO_SQ_CAPACITY
 
-/* PRP List Configuration */
-#define MAX_TRANSFER_PAGES 32   /* 128KB max transfer (32 * 4KB pages) */
+/*
+ * PRP List Configuration
+ *
+ * The start of the PRP region holds a small PRP list slot for each CID of
+ * each queue, enough for most requests. Lists of larger transfers are built
+ * from pages of a pool in the remainder of the region, chained together with
+ * the last entry of each full page pointing to the next. [NVMe-2.1 §4.3.1]
+ */
 #define PRP_LIST_SLOT_SIZE 256
-#define PRP_LIST_REGION_SIZE ((MAX_PENDING_REQS + 1U) * PRP_LIST_SLOT_SIZE)
+#define PRP_LIST_QUEUE_SIZE ((MAX_PENDING_REQS + 1U) * PRP_LIST_SLOT_SIZE)
+#define PRP_LIST_REGION_SIZE (NVME_MAX_IO_QUEUES * PRP_LIST_QUEUE_SIZE)
 #define NVME_PRP_ENTRIES_PER_PAGE       ((uint32_t)(PRP_LIST_SLOT_SIZE / sizeof(uint64_t)))
 #define NVME_PRP_NON_CHAINED_MAX_PAGES  (1 + NVME_PRP_ENTRIES_PER_PAGE) // PRP1 + List slot
 
+#define NVME_PAGE_SIZE                 BIT(NVME_PAGE_SIZE_LOG2)
+#define NVME_PRP_ENTRIES_PER_LIST_PAGE ((uint32_t)(NVME_PAGE_SIZE / sizeof(uint64_t)))
+#define PRP_POOL_OFFSET                ((PRP_LIST_REGION_SIZE + NVME_PAGE_SIZE - 1) / NVME_PAGE_SIZE * NVME_PAGE_SIZE)
+#define PRP_POOL_PAGES                 ((NVME_PRP_LIST_REGION_SIZE - PRP_POOL_OFFSET) / NVME_PAGE_SIZE)
+#define PRP_POOL_NONE                  UINT32_MAX
+/* Largest PRP transfer, bounding the pool pages a single request can hold (8 MiB) */
+#define NVME_PRP_CHAINED_MAX_PAGES     2048U
+
+/* Pool pages needed for the PRP list of a transfer of count pages, excluding PRP1. */
+#define PRP_POOL_PAGES_NEEDED(count) \
+    (((count) - 2U + NVME_PRP_ENTRIES_PER_LIST_PAGE - 2U) / (NVME_PRP_ENTRIES_PER_LIST_PAGE - 1U))
+
 _Static_assert(PRP_LIST_REGION_SIZE <= NVME_PRP_LIST_REGION_SIZE,
                "PRP list region exceeds configured nvme_prp_list region size");
+_Static_assert(PRP_POOL_PAGES_NEEDED(NVME_PRP_CHAINED_MAX_PAGES) <= PRP_POOL_PAGES,
+               "PRP list pool must hold the list of the largest PRP transfer");
 
 /* SGL Data Block (SQE-inlined) needs no per-request memory; max is the blk_req_t count field width. */
 #define NVME_SGL_MAX_INLINE_PAGES ((typeof(((blk_req_t *)0)->count))-1)
 
-static ialloc_t cid_ialloc;
-static uint32_t cid_ialloc_idxlist[MAX_PENDING_REQS + 1U];
-static uint32_t cid_to_id[MAX_PENDING_REQS + 1U];
-static uint16_t cid_to_count[MAX_PENDING_REQS + 1U];
+/* An I/O queue pair and the virtualiser connection it serves */
+typedef struct nvme_io_queue {
+    nvme_queue_info_t queue;
+    blk_connection_resource_t *conn;
+    nvme_namespace_t *ns;
+    blk_queue_handle_t blk_queue;
+    blk_storage_info_t *storage_info;
+    /* CIDs only need to be unique within a submission queue. [NVMe-2.1 Fig. 91] */
+    ialloc_t cid_ialloc;
+    uint32_t cid_ialloc_idxlist[MAX_PENDING_REQS + 1U];
+    uint32_t cid_to_id[MAX_PENDING_REQS + 1U];
+    uint16_t cid_to_count[MAX_PENDING_REQS + 1U];
+    /* for statistics, the request code and the time each request was dequeued */
+    blk_req_code_t cid_to_code[MAX_PENDING_REQS + 1U];
+    uint64_t cid_to_start[MAX_PENDING_REQS + 1U];
+    blk_queue_stats_t *stats;
+    /* first PRP pool page of the CID's list, or PRP_POOL_NONE */
+    uint32_t cid_to_prp[MAX_PENDING_REQS + 1U];
+    /* requests were left in the blk queue until completions free resources */
+    bool deferred;
+    /* completions are polled for rather than signalled by interrupts, see NVME_POLLED_QUEUES */
+    bool polled;
+} nvme_io_queue_t;
+
+static nvme_io_queue_t io_queues[NVME_MAX_IO_QUEUES];
+
+static uint64_t stats_fallback[BLK_STATS_SIZE(SDDF_BLK_MAX_QUEUES) / sizeof(uint64_t)];
+static blk_stats_t *stats;
+
+static ialloc_t prp_pool;
+static uint32_t prp_pool_idxlist[PRP_POOL_PAGES];
+/* next page of the PRP list each pool page belongs to, or PRP_POOL_NONE */
+static uint32_t prp_pool_next[PRP_POOL_PAGES];
+
+static ialloc_t admin_cid_ialloc;
+static uint32_t admin_cid_ialloc_idxlist[NVME_ASQ_CAPACITY + 1U];
 
 /*
  * Host queue entry-size exponents for CC.IOSQES/CC.IOCQES.
@@ -248,13 +314,54 @@ static int build_sgl_dptr(uintptr_t data_paddr, uint32_t byte_count, uint64_t *d
     return 0;
 }
 
-/* Build PRP pointers for a request using a single non-chained PRP list model. */
-static int build_prp_dptr(uint32_t cid, uintptr_t data_paddr, uint16_t count, uint64_t *dptr1, uint64_t *dptr2)
+static inline uint64_t *prp_pool_vaddr(uint32_t page)
+{
+    return (uint64_t *)(NVME_PRP_LIST_VADDR + PRP_POOL_OFFSET + (uintptr_t)page * NVME_PAGE_SIZE);
+}
+
+static inline uint64_t prp_pool_paddr(uint32_t page)
+{
+    return NVME_PRP_LIST_PADDR + PRP_POOL_OFFSET + (uint64_t)page * NVME_PAGE_SIZE;
+}
+
+/* Return the pages of a chained PRP list to the pool. */
+static void prp_pool_free(uint32_t page)
+{
+    while (page != PRP_POOL_NONE) {
+        uint32_t next = prp_pool_next[page];
+        int err = ialloc_free(&prp_pool, page);
+        assert(!err);
+        page = next;
+    }
+}
+
+/* Whether a request of count pages can have its data pointers built now. */
+static bool prp_available(uint16_t count)
 {
-    /* Driver currently supports a single PRP-list page only (no chained PRP-list traversal). */
-    if (count > NVME_PRP_NON_CHAINED_MAX_PAGES) {
-        LOG_NVME_ERR("PRP transfer too large for non-chained list (%u pages, max %u)\n", count,
-                     NVME_PRP_NON_CHAINED_MAX_PAGES);
+    if (state_ctx.use_sgl || count <= NVME_PRP_NON_CHAINED_MAX_PAGES) {
+        return true;
+    }
+
+    return ialloc_num_free(&prp_pool) >= PRP_POOL_PAGES_NEEDED((uint32_t)count);
+}
+
+/* Offset of a CID's PRP list slot within the PRP region. */
+static inline uint64_t prp_list_slot_offset(uint16_t qn, uint32_t cid)
+{
+    return (uint64_t)qn * PRP_LIST_QUEUE_SIZE + (uint64_t)cid * PRP_LIST_SLOT_SIZE;
+}
+
+/*
+ * Build PRP pointers for a request. Lists that fit are stored in the CID's
+ * slot, larger ones are chained across pages from the PRP pool.
+ */
+static int build_prp_dptr(uint16_t qn, uint32_t cid, uintptr_t data_paddr, uint16_t count, uint64_t *dptr1,
+                          uint64_t *dptr2)
+{
+    io_queues[qn].cid_to_prp[cid] = PRP_POOL_NONE;
+
+    if (count > NVME_PRP_CHAINED_MAX_PAGES) {
+        LOG_NVME_ERR("PRP transfer too large (%u pages, max %u)\n", count, NVME_PRP_CHAINED_MAX_PAGES);
         return -1;
     }
 
@@ -269,12 +376,13 @@ static int build_prp_dptr(uint32_t cid, uintptr_t data_paddr, uint16_t count, ui
     if (count == 2) {
         /* Simple case: 2 pages. PRP2 points directly to 2nd page. */
         *dptr2 = data_paddr + BLK_TRANSFER_SIZE;
-    } else if (count > 2) {
+    } else if (count > 2 && count <= NVME_PRP_NON_CHAINED_MAX_PAGES) {
         /* PRP2 points to a PRP List stored in the metadata region. */
         /* hardcoded addresses */
-        /* Each CID gets its own PRP list slot in the PRP region */
-        uint64_t *prp_list = (uint64_t *)(NVME_PRP_LIST_VADDR + (uint64_t)cid * PRP_LIST_SLOT_SIZE);
-        uint64_t prp_list_paddr = NVME_PRP_LIST_PADDR + (uint64_t)cid * PRP_LIST_SLOT_SIZE;
+        /* Each CID of each queue gets its own PRP list slot in the PRP region */
+        uint64_t slot_offset = prp_list_slot_offset(qn, cid);
+        uint64_t *prp_list = (uint64_t *)(NVME_PRP_LIST_VADDR + slot_offset);
+        uint64_t prp_list_paddr = NVME_PRP_LIST_PADDR + slot_offset;
 
         /* Fill the PRP List */
         for (uint16_t i = 1; i < count; i++) {
@@ -282,13 +390,101 @@ static int build_prp_dptr(uint32_t cid, uintptr_t data_paddr, uint16_t count, ui
         }
 
         *dptr2 = prp_list_paddr;
+    } else if (count > NVME_PRP_NON_CHAINED_MAX_PAGES) {
+        /* Callers check prp_available before dequeuing the request */
+        assert(prp_available(count));
+
+        uint32_t page;
+        int err = ialloc_alloc(&prp_pool, &page);
+        assert(!err);
+        prp_pool_next[page] = PRP_POOL_NONE;
+        io_queues[qn].cid_to_prp[cid] = page;
+        *dptr2 = prp_pool_paddr(page);
+
+        uint64_t *prp_list = prp_pool_vaddr(page);
+        uint32_t entry = 0;
+        for (uint16_t i = 1; i < count; i++) {
+            /* The last entry of a full page points to the next page, unless only one data page remains */
+            if (entry == NVME_PRP_ENTRIES_PER_LIST_PAGE - 1 && i < count - 1) {
+                uint32_t next;
+                err = ialloc_alloc(&prp_pool, &next);
+                assert(!err);
+                prp_pool_next[next] = PRP_POOL_NONE;
+                prp_pool_next[page] = next;
+                prp_list[entry] = prp_pool_paddr(next);
+
+                page = next;
+                prp_list = prp_pool_vaddr(page);
+                entry = 0;
+            }
+            prp_list[entry++] = data_paddr + ((uint64_t)i * BLK_TRANSFER_SIZE);
+        }
     }
 
     return 0;
 }
 
-static void handle_request(void)
+/*
+ * Submit a discard as a Dataset Management deallocate of a single range, or a
+ * Write Zeroes. The range has no data pages of its own, so it is kept in the
+ * CID's PRP list slot, which a single PRP entry can point to as the slot does
+ * not cross a page boundary.
+ */
+static void submit_discard_write_zeroes(uint16_t qn, blk_req_code_t code, uint64_t block_number, uint16_t count,
+                                        uint32_t id, uint64_t start)
 {
+    nvme_io_queue_t *ioq = &io_queues[qn];
+    uint64_t lba = block_number * ioq->ns->sectors_per_block;
+    uint32_t nlb = count * ioq->ns->sectors_per_block;
+
+    uint32_t cid;
+    int err = ialloc_alloc(&ioq->cid_ialloc, &cid);
+    assert(err == 0);
+    ioq->cid_to_id[cid] = id;
+    ioq->cid_to_count[cid] = count;
+    ioq->cid_to_prp[cid] = PRP_POOL_NONE;
+    ioq->cid_to_code[cid] = code;
+    ioq->cid_to_start[cid] = start;
+
+    if (code == BLK_REQ_DISCARD) {
+        uint64_t slot_offset = prp_list_slot_offset(qn, cid);
+        nvme_dsm_range_t *range = (nvme_dsm_range_t *)(NVME_PRP_LIST_VADDR + slot_offset);
+        *range = (nvme_dsm_range_t) { .cattr = 0, .nlb = nlb, .slba = lba };
+
+        nvme_queue_submit(&ioq->queue, &(nvme_submission_queue_entry_t) {
+                                         .cdw0 = nvme_build_cdw0((uint16_t)cid, NVME_OP_DSM, NVME_CDW0_PSDT_PRP),
+                                         .nsid = ioq->ns->nsid,
+                                         .dptr1 = NVME_PRP_LIST_PADDR + slot_offset,
+                                         .cdw10 = 0, /* a single range */
+                                         .cdw11 = NVME_DSM_CDW11_AD,
+                                     });
+        LOG_NVME("Submitted DSM deallocate: cid=%u req_id=%u lba=%lu nlb=%u\n", cid, id, lba, nlb);
+    } else {
+        /* Write Zeroes shares the NLB and LR fields of CDW12 with Read and Write */
+        nvme_queue_submit(&ioq->queue, &(nvme_submission_queue_entry_t) {
+                                         .cdw0 = nvme_build_cdw0((uint16_t)cid, NVME_OP_WRITE_ZEROES,
+                                                                 NVME_CDW0_PSDT_PRP),
+                                         .nsid = ioq->ns->nsid,
+                                         .cdw10 = (uint32_t)lba,
+                                         .cdw11 = (uint32_t)(lba >> 32),
+                                         .cdw12 = nvme_build_rw_cdw12((uint16_t)(nlb - 1), true),
+                                     });
+        LOG_NVME("Submitted WRITE ZEROES: cid=%u req_id=%u lba=%lu nlb=%u\n", cid, id, lba, nlb);
+    }
+}
+
+/* Respond to a request which was not submitted to the controller */
+static void reject_request(nvme_io_queue_t *ioq, blk_resp_status_t status, blk_req_code_t code, uint16_t count,
+                           uint32_t id, uint64_t start)
+{
+    int err = blk_enqueue_resp(&ioq->blk_queue, status, 0, id);
+    assert(!err);
+    blk_stats_complete(ioq->stats, code, count, status, start, blk_stats_now());
+}
+
+static void handle_request(uint16_t qn)
+{
+    nvme_io_queue_t *ioq = &io_queues[qn];
     bool notify_virt = false;
 
     blk_req_code_t code;
@@ -297,17 +493,31 @@ static void handle_request(void)
     uint16_t count;
     uint32_t id;
 
+    ioq->deferred = false;
     while (true) {
-        if (ialloc_num_free(&cid_ialloc) == 0U) {
+        if (ialloc_num_free(&ioq->cid_ialloc) == 0U) {
             LOG_NVME("No free CIDs, deferring request dequeue until completions free slots\n");
+            ioq->deferred = true;
             break;
         }
 
-        int err = blk_dequeue_req(&blk_queue, &code, &req_paddr, &block_number, &count, &id);
+        int err = blk_peek_req(&ioq->blk_queue, &code, &req_paddr, &block_number, &count, &id);
         if (err != 0) {
             break;
         }
 
+        if ((code == BLK_REQ_READ || code == BLK_REQ_WRITE) && count <= state_ctx.max_io_pages
+            && !prp_available(count)) {
+            LOG_NVME("No free PRP list pages, deferring request dequeue until completions free pages\n");
+            ioq->deferred = true;
+            break;
+        }
+
+        err = blk_dequeue_req(&ioq->blk_queue, &code, &req_paddr, &block_number, &count, &id);
+        assert(!err);
+        uint64_t start = blk_stats_now();
+        blk_stats_submit(ioq->stats);
+
         uint8_t opcode = 0;
 
         if (code == BLK_REQ_READ) {
@@ -316,36 +526,48 @@ static void handle_request(void)
             opcode = NVME_OP_WRITE;
         } else if (code == BLK_REQ_FLUSH) {
             uint32_t cid;
-            err = ialloc_alloc(&cid_ialloc, &cid);
+            err = ialloc_alloc(&ioq->cid_ialloc, &cid);
             assert(err == 0);
-            cid_to_id[cid] = id;
-            cid_to_count[cid] = 0;
+            ioq->cid_to_id[cid] = id;
+            ioq->cid_to_count[cid] = 0;
+            ioq->cid_to_prp[cid] = PRP_POOL_NONE;
+            ioq->cid_to_code[cid] = code;
+            ioq->cid_to_start[cid] = start;
 
-            nvme_queue_submit(&io_queue, &(nvme_submission_queue_entry_t) {
+            nvme_queue_submit(&ioq->queue, &(nvme_submission_queue_entry_t) {
                                              .cdw0 = nvme_build_cdw0((uint16_t)cid, NVME_OP_FLUSH, NVME_CDW0_PSDT_PRP),
-                                             .nsid = NVME_DEFAULT_NSID,
+                                             .nsid = ioq->ns->nsid,
                                          });
 
             LOG_NVME("Submitted FLUSH: cid=%u req_id=%u\n", cid, id);
             continue;
+        } else if (code == BLK_REQ_DISCARD || code == BLK_REQ_WRITE_ZEROES) {
+            uint16_t max_count = (code == BLK_REQ_DISCARD) ? ioq->storage_info->max_discard
+                                                           : ioq->storage_info->max_write_zeroes;
+            if (count == 0 || count > max_count) {
+                LOG_NVME_ERR("unsupported %s of %u blocks (max %u)\n",
+                             (code == BLK_REQ_DISCARD) ? "discard" : "write zeroes", count, max_count);
+                reject_request(ioq, BLK_RESP_ERR_INVALID_PARAM, code, count, id, start);
+                notify_virt = true;
+                continue;
+            }
+            submit_discard_write_zeroes(qn, code, block_number, count, id, start);
+            continue;
         } else if (code == BLK_REQ_BARRIER) {
             LOG_NVME_ERR("BARRIER is currently unsupported\n");
-            err = blk_enqueue_resp(&blk_queue, BLK_RESP_ERR_INVALID_PARAM, 0, id);
-            assert(!err);
+            reject_request(ioq, BLK_RESP_ERR_INVALID_PARAM, code, count, id, start);
             notify_virt = true;
             continue;
         } else {
             LOG_NVME_ERR("invalid request code: %u\n", code);
-            err = blk_enqueue_resp(&blk_queue, BLK_RESP_ERR_INVALID_PARAM, 0, id);
-            assert(!err);
+            reject_request(ioq, BLK_RESP_ERR_INVALID_PARAM, code, count, id, start);
             notify_virt = true;
             continue;
         }
 
         if (count == 0) {
             LOG_NVME_ERR("rejecting zero-length request\n");
-            err = blk_enqueue_resp(&blk_queue, BLK_RESP_ERR_INVALID_PARAM, 0, id);
-            assert(!err);
+            reject_request(ioq, BLK_RESP_ERR_INVALID_PARAM, code, count, id, start);
             notify_virt = true;
             continue;
         }
@@ -353,22 +575,24 @@ static void handle_request(void)
         /* Reject oversized transfers */
         if (count > state_ctx.max_io_pages) {
             LOG_NVME_ERR("request too large (%u pages, max %u)\n", count, state_ctx.max_io_pages);
-            err = blk_enqueue_resp(&blk_queue, BLK_RESP_ERR_UNSPEC, 0, id);
-            assert(!err);
+            reject_request(ioq, BLK_RESP_ERR_UNSPEC, code, count, id, start);
             notify_virt = true;
             continue;
         }
 
         /* Translate sDDF 4096B blocks to NVMe device sectors. */
-        uint64_t lba = block_number * state_ctx.sectors_per_block;
-        uint32_t nlb = (count * state_ctx.sectors_per_block) - 1;
+        uint64_t lba = block_number * ioq->ns->sectors_per_block;
+        uint32_t nlb = (count * ioq->ns->sectors_per_block) - 1;
 
         /* Allocate a CID */
         uint32_t cid;
-        err = ialloc_alloc(&cid_ialloc, &cid);
+        err = ialloc_alloc(&ioq->cid_ialloc, &cid);
         assert(err == 0);
-        cid_to_id[cid] = id;
-        cid_to_count[cid] = count;
+        ioq->cid_to_id[cid] = id;
+        ioq->cid_to_count[cid] = count;
+        ioq->cid_to_prp[cid] = PRP_POOL_NONE;
+        ioq->cid_to_code[cid] = code;
+        ioq->cid_to_start[cid] = start;
 
         uint64_t dptr1 = 0;
         uint64_t dptr2 = 0;
@@ -379,21 +603,20 @@ static void handle_request(void)
             err = build_sgl_dptr(req_paddr, (uint32_t)count * BLK_TRANSFER_SIZE, &dptr1, &dptr2);
         } else {
             cdw0 = nvme_build_cdw0((uint16_t)cid, opcode, NVME_CDW0_PSDT_PRP);
-            err = build_prp_dptr(cid, req_paddr, count, &dptr1, &dptr2);
+            err = build_prp_dptr(qn, cid, req_paddr, count, &dptr1, &dptr2);
         }
 
         if (err != 0) {
-            err = ialloc_free(&cid_ialloc, cid);
-            assert(!err);
-            err = blk_enqueue_resp(&blk_queue, BLK_RESP_ERR_UNSPEC, 0, id);
+            err = ialloc_free(&ioq->cid_ialloc, cid);
             assert(!err);
+            reject_request(ioq, BLK_RESP_ERR_UNSPEC, code, count, id, start);
             notify_virt = true;
             continue;
         }
 
-        nvme_queue_submit(&io_queue, &(nvme_submission_queue_entry_t) {
+        nvme_queue_submit(&ioq->queue, &(nvme_submission_queue_entry_t) {
                                          .cdw0 = cdw0,
-                                         .nsid = NVME_DEFAULT_NSID,
+                                         .nsid = ioq->ns->nsid,
                                          .cdw10 = (uint32_t)lba,
                                          .cdw11 = (uint32_t)(lba >> 32),
                                          .cdw12 = nvme_build_rw_cdw12((uint16_t)nlb, true),
@@ -403,10 +626,88 @@ static void handle_request(void)
     }
 
     if (notify_virt) {
-        sddf_notify(blk_config.virt.id);
+        sddf_notify(ioq->conn->id);
     }
 }
 
+/*
+ * Identify Namespace for the NVM Command Set (CNS=00h).
+ * [NVM-CommandSet-1.1 §4.1.5.1, Fig. 114]
+ */
+static void submit_identify_ns(uint16_t index)
+{
+    uint32_t admin_cid;
+    int err = ialloc_alloc(&admin_cid_ialloc, &admin_cid);
+    assert(err == 0);
+    assert(admin_cid <= UINT16_MAX);
+
+    nvme_queue_submit(&admin_queue,
+                      &(nvme_submission_queue_entry_t) {
+                          .cdw0 = nvme_build_cdw0((uint16_t)admin_cid, NVME_ADMIN_OP_IDENTIFY, NVME_CDW0_PSDT_PRP),
+                          .nsid = namespaces[index].nsid,
+                          .cdw10 = NVME_IDENTIFY_CNS_NAMESPACE,
+                          .dptr1 = NVME_IDENTIFY_NS_PADDR,
+                      });
+
+    state_ctx.state = NVME_STATE_WAIT_IDENTIFY_NS;
+    LOG_NVME("Submitted Identify Namespace %u, waiting...\n", namespaces[index].nsid);
+}
+
+/* Create the completion queue of an I/O queue pair; §5.2.1 */
+static void submit_create_io_cq(uint16_t qn)
+{
+    // 10. Allocate the appropriate number of I/O Completion Queues [...]
+    //     The I/O Completion Queues are allocated using the Create I/O Completion Queue command.
+    nvme_io_queue_t *ioq = &io_queues[qn];
+    nvme_queues_init(&ioq->queue, NVME_IO_Q_ID(qn), nvme_controller,
+                     nvme_io_sq_region + (uintptr_t)qn * (NVME_IO_SQ_REGION_SIZE / sizeof(nvme_submission_queue_entry_t)),
+                     state_ctx.io_queue_depth,
+                     nvme_io_cq_region + (uintptr_t)qn * (NVME_IO_CQ_REGION_SIZE / sizeof(nvme_completion_queue_entry_t)),
+                     state_ctx.io_queue_depth);
+
+    uint32_t admin_cid;
+    int err = ialloc_alloc(&admin_cid_ialloc, &admin_cid);
+    assert(err == 0);
+    assert(admin_cid <= UINT16_MAX);
+
+    nvme_queue_submit(&admin_queue,
+                      &(nvme_submission_queue_entry_t) {
+                          .cdw0 = nvme_build_cdw0((uint16_t)admin_cid, NVME_ADMIN_OP_CREATE_IO_CQ, NVME_CDW0_PSDT_PRP),
+                          .cdw10 = nvme_build_create_io_q_cdw10(NVME_IO_Q_ID(qn), state_ctx.io_queue_depth),
+                          .cdw11 = nvme_build_create_io_cq_cdw11(NVME_CREATE_IO_Q_INTERRUPT_VECTOR, true, true),
+                          .dptr2 = 0,
+                          .dptr1 = nvme_io_cq_region_paddr + (uintptr_t)qn * NVME_IO_CQ_REGION_SIZE,
+                      });
+
+    state_ctx.state = NVME_STATE_WAIT_CREATE_IO_CQ;
+    LOG_NVME("Submitted Create I/O CQ %u, waiting for completion\n", NVME_IO_Q_ID(qn));
+}
+
+/* Create the submission queue of an I/O queue pair, once its CQ exists; §5.2.2 */
+static void submit_create_io_sq(uint16_t qn)
+{
+    // 11. Allocate the appropriate number of I/O Submission Queues [...]
+    //     The I/O Submission Queues are allocated using the Create I/O Submission Queue command.
+    uint32_t admin_cid;
+    int err = ialloc_alloc(&admin_cid_ialloc, &admin_cid);
+    assert(err == 0);
+    assert(admin_cid <= UINT16_MAX);
+
+    nvme_queue_submit(&admin_queue,
+                      &(nvme_submission_queue_entry_t) {
+                          .cdw0 = nvme_build_cdw0((uint16_t)admin_cid, NVME_ADMIN_OP_CREATE_IO_SQ, NVME_CDW0_PSDT_PRP),
+                          .cdw10 = nvme_build_create_io_q_cdw10(NVME_IO_Q_ID(qn), state_ctx.io_queue_depth),
+                          .cdw11 = nvme_build_create_io_sq_cdw11(NVME_IO_Q_ID(qn), NVME_CREATE_IO_SQ_QPRIO_URGENT,
+                                                                 true),
+                          .cdw12 = 0,
+                          .dptr2 = 0,
+                          .dptr1 = nvme_io_sq_region_paddr + (uintptr_t)qn * NVME_IO_SQ_REGION_SIZE,
+                      });
+
+    state_ctx.state = NVME_STATE_WAIT_CREATE_IO_SQ;
+    LOG_NVME("Submitted Create I/O SQ %u, waiting for completion\n", NVME_IO_Q_ID(qn));
+}
+
 static void handle_admin_completions(void)
 {
     nvme_completion_queue_entry_t entry;
@@ -416,10 +717,10 @@ static void handle_admin_completions(void)
         return;
     }
 
-    assert(entry.cid <= state_ctx.io_queue_depth);
-    assert(ialloc_in_use(&cid_ialloc, entry.cid));
+    assert(entry.cid <= NVME_ASQ_CAPACITY);
+    assert(ialloc_in_use(&admin_cid_ialloc, entry.cid));
 
-    int err = ialloc_free(&cid_ialloc, entry.cid);
+    int err = ialloc_free(&admin_cid_ialloc, entry.cid);
     assert(err == 0);
 
     uint16_t status = (entry.phase_tag_and_status & NVME_CQE_STATUS_MASK) >> NVME_CQE_STATUS_SHIFT;
@@ -460,8 +761,10 @@ static void handle_admin_completions(void)
          * [NVMe-2.1 §5.1.13.2.1, Fig. 312]
          */
         uint8_t mdts = nvme_identify_ctrl->mdts;
+        state_ctx.oncs = nvme_identify_ctrl->oncs;
+        LOG_NVME("ONCS: 0x%04x\n", state_ctx.oncs);
 
-        uint32_t static_max_pages = state_ctx.use_sgl ? NVME_SGL_MAX_INLINE_PAGES : NVME_PRP_ENTRIES_PER_PAGE;
+        uint32_t static_max_pages = state_ctx.use_sgl ? NVME_SGL_MAX_INLINE_PAGES : NVME_PRP_CHAINED_MAX_PAGES;
 
         if (mdts == 0) {
             state_ctx.max_io_pages = static_max_pages;
@@ -482,7 +785,7 @@ static void handle_admin_completions(void)
 
             if (pages > static_max_pages) {
                 LOG_NVME("MDTS: %u pages exceeds %s capacity (%u), clamping\n", pages,
-                         state_ctx.use_sgl ? "SGL inline" : "PRP slot", static_max_pages);
+                         state_ctx.use_sgl ? "SGL inline" : "PRP chain", static_max_pages);
                 pages = static_max_pages;
             }
 
@@ -492,37 +795,57 @@ static void handle_admin_completions(void)
         // 8. The host determines any I/O Command Set specific configuration information
         //    For now, we assume that the controller supports only the NVM Command Set.
 
-        // 9. Determine the number of I/O Submission Queues and I/O Completion Queues
-        //    supported using the Set Features command with the Number of Queues feature identifier.
-        //    After determining the number of I/O Queues, the NVMe Transport specific interrupt registers
-        //    (e.g., MSI and/or MSI-X registers) should be configured
         validate_identify_entry_size_limits();
 
         uint32_t admin_cid;
-        err = ialloc_alloc(&cid_ialloc, &admin_cid);
+        err = ialloc_alloc(&admin_cid_ialloc, &admin_cid);
         assert(err == 0);
         assert(admin_cid <= UINT16_MAX);
 
         /*
-         * Identify Namespace for the NVM Command Set (CNS=00h).
-         * [NVM-CommandSet-1.1 §4.1.5.1, Fig. 114]
-         * [NVM-CommandSet-1.1 §4.1.5.1, Fig. 114]
+         * Identify Active Namespace ID list (CNS=02h), starting after NSID 0.
+         * The list shares the Identify Namespace buffer, it is consumed before
+         * any namespace is identified.
+         * [NVMe-2.1 §5.1.13.2.2]
          */
         nvme_queue_submit(&admin_queue,
                           &(nvme_submission_queue_entry_t) {
                               .cdw0 = nvme_build_cdw0((uint16_t)admin_cid, NVME_ADMIN_OP_IDENTIFY, NVME_CDW0_PSDT_PRP),
-                              .nsid = NVME_DEFAULT_NSID,
-                              .cdw10 = NVME_IDENTIFY_CNS_NAMESPACE,
+                              .nsid = 0,
+                              .cdw10 = NVME_IDENTIFY_CNS_ACTIVE_NSID_LIST,
                               .dptr1 = NVME_IDENTIFY_NS_PADDR,
                           });
 
-        state_ctx.state = NVME_STATE_WAIT_IDENTIFY_NS;
-        LOG_NVME("Submitted Identify Namespace, waiting...\n");
+        state_ctx.state = NVME_STATE_WAIT_IDENTIFY_NS_LIST;
+        LOG_NVME("Submitted Identify Active Namespace ID list, waiting...\n");
+        break;
+    }
+
+    case NVME_STATE_WAIT_IDENTIFY_NS_LIST: {
+        const uint32_t *nsid_list = (const uint32_t *)nvme_identify_ns;
+        uint16_t active = 0;
+        while (active < NVME_IDENTIFY_NSID_LIST_LEN && nsid_list[active] != 0) {
+            LOG_NVME("Active namespace: NSID %u\n", nsid_list[active]);
+            active++;
+        }
+
+        if (active < state_ctx.num_namespaces) {
+            LOG_NVME_ERR("controller has %u active namespaces, %u are required\n", active, state_ctx.num_namespaces);
+            assert(false);
+        }
+
+        for (uint16_t i = 0; i < state_ctx.num_namespaces; i++) {
+            namespaces[i].nsid = nsid_list[i];
+        }
+
+        state_ctx.identifying_ns = 0;
+        submit_identify_ns(0);
         break;
     }
 
     case NVME_STATE_WAIT_IDENTIFY_NS: {
-        LOG_NVME("Identify Namespace completed\n");
+        nvme_namespace_t *ns = &namespaces[state_ctx.identifying_ns];
+        LOG_NVME("Identify Namespace %u completed\n", ns->nsid);
 
         /*
          * FLBAS selects the active LBAF entry; LBADS gives sector size as 2^LBADS.
@@ -537,19 +860,18 @@ static void handle_admin_completions(void)
         assert(BLK_TRANSFER_SIZE >= sector_size);
         assert(BLK_TRANSFER_SIZE % sector_size == 0);
 
-        state_ctx.sectors_per_block = BLK_TRANSFER_SIZE / sector_size;
-        uint64_t total_blocks UNUSED = (nvme_identify_ns->nsze * sector_size) / BLK_TRANSFER_SIZE;
+        ns->sector_size = sector_size;
+        ns->sectors_per_block = BLK_TRANSFER_SIZE / sector_size;
+        ns->capacity = (nvme_identify_ns->nsze * sector_size) / BLK_TRANSFER_SIZE;
 
-        LOG_NVME("NS: NSZE=%lu, LBADS=%u, sector=%uB, capacity=%lu blocks\n", nvme_identify_ns->nsze, lbads,
-                 sector_size, total_blocks);
+        LOG_NVME("NS %u: NSZE=%lu, LBADS=%u, sector=%uB, capacity=%lu blocks\n", ns->nsid, nvme_identify_ns->nsze,
+                 lbads, sector_size, ns->capacity);
 
-        uint16_t io_queue_id = NVME_DEFAULT_IO_Q_ID;
-        assert(nvme_io_sq_region != 0x0);
-        assert(nvme_io_cq_region != 0x0);
-        assert(nvme_io_sq_region_paddr != 0x0);
-        assert(nvme_io_cq_region_paddr != 0x0);
-        nvme_queues_init(&io_queue, io_queue_id, nvme_controller, nvme_io_sq_region, state_ctx.io_queue_depth,
-                         nvme_io_cq_region, state_ctx.io_queue_depth);
+        state_ctx.identifying_ns++;
+        if (state_ctx.identifying_ns < state_ctx.num_namespaces) {
+            submit_identify_ns(state_ctx.identifying_ns);
+            break;
+        }
 
         // §3.3.1.1 Queue Setup & Initialization
         // => Configures the size of the I/O Submission Queues (CC.IOSQES) and I/O Completion Queues (CC.IOCQES)
@@ -558,58 +880,61 @@ static void handle_admin_completions(void)
         nvme_controller->cc |= ((uint32_t)NVME_HOST_IOCQES_EXP << NVME_CC_IOCQES_SHIFT)
                              | ((uint32_t)NVME_HOST_IOSQES_EXP << NVME_CC_IOSQES_SHIFT);
 
-        // 10. Allocate the appropriate number of I/O Completion Queues [...]
-        //     The I/O Completion Queues are allocated using the Create I/O Completion Queue command.
-        // §5.2.1
+        // 9. Determine the number of I/O Submission Queues and I/O Completion Queues
+        //    supported using the Set Features command with the Number of Queues feature identifier.
+        //    After determining the number of I/O Queues, the NVMe Transport specific interrupt registers
+        //    (e.g., MSI and/or MSI-X registers) should be configured
+        /* One queue pair per virtualiser connection, all sharing interrupt vector 0 */
         uint32_t admin_cid;
-        int err = ialloc_alloc(&cid_ialloc, &admin_cid);
+        int err = ialloc_alloc(&admin_cid_ialloc, &admin_cid);
         assert(err == 0);
         assert(admin_cid <= UINT16_MAX);
 
+        uint16_t requested = state_ctx.num_io_queues - 1;
         nvme_queue_submit(
             &admin_queue,
             &(nvme_submission_queue_entry_t) {
-                .cdw0 = nvme_build_cdw0((uint16_t)admin_cid, NVME_ADMIN_OP_CREATE_IO_CQ, NVME_CDW0_PSDT_PRP),
-                .cdw10 = nvme_build_create_io_q_cdw10(NVME_DEFAULT_IO_Q_ID, state_ctx.io_queue_depth),
-                .cdw11 = nvme_build_create_io_cq_cdw11(NVME_CREATE_IO_Q_INTERRUPT_VECTOR, true, true),
-                .dptr2 = 0,
-                .dptr1 = nvme_io_cq_region_paddr,
+                .cdw0 = nvme_build_cdw0((uint16_t)admin_cid, NVME_ADMIN_OP_SET_FEATURES, NVME_CDW0_PSDT_PRP),
+                .cdw10 = NVME_FEATURE_NUMBER_OF_QUEUES,
+                .cdw11 = nvme_build_num_queues_cdw11(requested, requested),
             });
 
-        state_ctx.state = NVME_STATE_WAIT_CREATE_IO_CQ;
-        LOG_NVME("Submitted Create I/O CQ, waiting for completion\n");
+        state_ctx.state = NVME_STATE_WAIT_SET_NUM_QUEUES;
+        LOG_NVME("Submitted Set Features (Number of Queues = %u), waiting for completion\n", state_ctx.num_io_queues);
         break;
     }
 
-    case NVME_STATE_WAIT_CREATE_IO_CQ: {
-        LOG_NVME("Create I/O CQ completed\n");
+    case NVME_STATE_WAIT_SET_NUM_QUEUES: {
+        /* The controller may allocate more or fewer queues than requested. [NVMe-2.1 §5.1.25.1.5] */
+        uint16_t nsqa = (entry.cdw0 & NVME_NUM_QUEUES_SQ_MASK) >> NVME_NUM_QUEUES_SQ_SHIFT;
+        uint16_t ncqa = (entry.cdw0 & NVME_NUM_QUEUES_CQ_MASK) >> NVME_NUM_QUEUES_CQ_SHIFT;
+        LOG_NVME("Number of Queues: %u SQs, %u CQs allocated\n", nsqa + 1U, ncqa + 1U);
 
-        // 11. Allocate the appropriate number of I/O Submission Queues [...]
-        //     The I/O Submission Queues are allocated using the Create I/O Submission Queue command.
-        // §5.2.2
-        uint32_t admin_cid;
-        int err = ialloc_alloc(&cid_ialloc, &admin_cid);
-        assert(err == 0);
-        assert(admin_cid <= UINT16_MAX);
+        if (nsqa + 1U < state_ctx.num_io_queues || ncqa + 1U < state_ctx.num_io_queues) {
+            LOG_NVME_ERR("controller allocated %u SQs and %u CQs, fewer than the %u connections\n", nsqa + 1U,
+                         ncqa + 1U, state_ctx.num_io_queues);
+            assert(false);
+        }
 
-        nvme_queue_submit(
-            &admin_queue,
-            &(nvme_submission_queue_entry_t) {
-                .cdw0 = nvme_build_cdw0((uint16_t)admin_cid, NVME_ADMIN_OP_CREATE_IO_SQ, NVME_CDW0_PSDT_PRP),
-                .cdw10 = nvme_build_create_io_q_cdw10(NVME_DEFAULT_IO_Q_ID, state_ctx.io_queue_depth),
-                .cdw11 = nvme_build_create_io_sq_cdw11(NVME_DEFAULT_IO_Q_ID, NVME_CREATE_IO_SQ_QPRIO_URGENT, true),
-                .cdw12 = 0,
-                .dptr2 = 0,
-                .dptr1 = nvme_io_sq_region_paddr,
-            });
+        state_ctx.creating_io_queue = 0;
+        submit_create_io_cq(0);
+        break;
+    }
 
-        state_ctx.state = NVME_STATE_WAIT_CREATE_IO_SQ;
-        LOG_NVME("Submitted Create I/O SQ, waiting for completion\n");
+    case NVME_STATE_WAIT_CREATE_IO_CQ: {
+        LOG_NVME("Create I/O CQ %u completed\n", NVME_IO_Q_ID(state_ctx.creating_io_queue));
+        submit_create_io_sq(state_ctx.creating_io_queue);
         break;
     }
 
     case NVME_STATE_WAIT_CREATE_IO_SQ: {
-        LOG_NVME("Create I/O SQ completed\n");
+        LOG_NVME("Create I/O SQ %u completed\n", NVME_IO_Q_ID(state_ctx.creating_io_queue));
+
+        state_ctx.creating_io_queue++;
+        if (state_ctx.creating_io_queue < state_ctx.num_io_queues) {
+            submit_create_io_cq(state_ctx.creating_io_queue);
+            break;
+        }
 
         // 12. To enable asynchronous notification of optional events, the host should issue a Set Features
         // command specifying the events to enable. To enable asynchronous notification of events, the host
@@ -618,25 +943,39 @@ static void handle_admin_completions(void)
 
         nvme_irq_unmask();
 
-        blk_queue_init(&blk_queue, blk_config.virt.req_queue.vaddr, blk_config.virt.resp_queue.vaddr,
-                       blk_config.virt.num_buffers);
-        storage_info = blk_config.virt.storage_info.vaddr;
-
-        /* Set storage info */
-        storage_info->read_only = false;
-        storage_info->sector_size = nvme_namespace_sector_size(nvme_identify_ns);
-        storage_info->block_size = 1;
-        storage_info->queue_depth = state_ctx.io_queue_depth;
-        storage_info->cylinders = 0;
-        storage_info->heads = 0;
-        storage_info->blocks = 0;
-        storage_info->capacity = (nvme_identify_ns->nsze * storage_info->sector_size) / BLK_TRANSFER_SIZE;
+        for (uint16_t qn = 0; qn < state_ctx.num_io_queues; qn++) {
+            nvme_io_queue_t *ioq = &io_queues[qn];
+            blk_queue_init(&ioq->blk_queue, ioq->conn->req_queue.vaddr, ioq->conn->resp_queue.vaddr,
+                           ioq->conn->num_buffers);
+            blk_storage_info_t *storage_info = ioq->conn->storage_info.vaddr;
+            ioq->storage_info = storage_info;
+
+            /* Set storage info */
+            storage_info->read_only = false;
+            storage_info->sector_size = ioq->ns->sector_size;
+            storage_info->block_size = 1;
+            storage_info->queue_depth = state_ctx.io_queue_depth;
+            storage_info->cylinders = 0;
+            storage_info->heads = 0;
+            storage_info->blocks = 0;
+            storage_info->capacity = ioq->ns->capacity;
+            storage_info->max_transfer = MIN(state_ctx.max_io_pages, UINT16_MAX);
+            /* A discard is a single range, whose 32-bit length never limits it. Write Zeroes is
+             * limited by its 16-bit NLB field. */
+            storage_info->max_discard = (state_ctx.oncs & NVME_IDENTIFY_ONCS_DSM) ? UINT16_MAX : 0;
+            storage_info->max_write_zeroes = 0;
+            if (state_ctx.oncs & NVME_IDENTIFY_ONCS_WRITE_ZEROES) {
+                uint32_t max_write_zeroes = (NVME_RW_CDW12_NLB_MASK + 1U) / ioq->ns->sectors_per_block;
+                storage_info->max_write_zeroes = MIN(max_write_zeroes, UINT16_MAX);
+            }
 
-        copy_trim_ascii(storage_info->serial_number, sizeof(storage_info->serial_number),
-                        (const char *)nvme_identify_ctrl->sn, sizeof(nvme_identify_ctrl->sn));
+            copy_trim_ascii(storage_info->serial_number, sizeof(storage_info->serial_number),
+                            (const char *)nvme_identify_ctrl->sn, sizeof(nvme_identify_ctrl->sn));
 
-        LOG_NVME("Setting storage info ready at %p...\n", storage_info);
-        blk_storage_set_ready(storage_info, true);
+            LOG_NVME("Setting storage info of queue %u (NSID %u) ready at %p...\n", NVME_IO_Q_ID(qn), ioq->ns->nsid,
+                     storage_info);
+            blk_storage_set_ready(storage_info, true);
+        }
 
         state_ctx.state = NVME_STATE_READY;
         LOG_NVME("sDDF NVMe Driver Ready\n");
@@ -649,40 +988,76 @@ static void handle_admin_completions(void)
     }
 }
 
-static void handle_io_completions(void)
+static void handle_io_completions(uint16_t qn)
 {
+    nvme_io_queue_t *ioq = &io_queues[qn];
     nvme_completion_queue_entry_t cq_entry;
     bool notify = false;
+    uint64_t now = blk_stats_now();
 
-    while (nvme_queue_consume(&io_queue, &cq_entry) == 0) {
+    while (nvme_queue_consume(&ioq->queue, &cq_entry) == 0) {
         uint16_t cid = cq_entry.cid;
         assert(cid <= state_ctx.io_queue_depth);
-        assert(ialloc_in_use(&cid_ialloc, cid));
+        assert(ialloc_in_use(&ioq->cid_ialloc, cid));
 
-        uint32_t id = cid_to_id[cid];
-        uint16_t count = cid_to_count[cid];
+        uint32_t id = ioq->cid_to_id[cid];
+        uint16_t count = ioq->cid_to_count[cid];
         uint16_t status = (cq_entry.phase_tag_and_status & NVME_CQE_STATUS_MASK) >> NVME_CQE_STATUS_SHIFT;
 
-        /* Free the CID */
-        int err = ialloc_free(&cid_ialloc, cid);
+        /* Free the CID and its PRP list pages */
+        prp_pool_free(ioq->cid_to_prp[cid]);
+        int err = ialloc_free(&ioq->cid_ialloc, cid);
         assert(err == 0);
 
         blk_resp_status_t resp_status = (status == 0) ? BLK_RESP_OK : BLK_RESP_ERR_UNSPEC;
         /* Return the original requested count on success */
-        err = blk_enqueue_resp(&blk_queue, resp_status, (resp_status == BLK_RESP_OK) ? count : 0, id);
+        err = blk_enqueue_resp(&ioq->blk_queue, resp_status, (resp_status == BLK_RESP_OK) ? count : 0, id);
         assert(!err);
+        blk_stats_complete(ioq->stats, ioq->cid_to_code[cid], count, resp_status, ioq->cid_to_start[cid], now);
         notify = true;
     }
 
     if (notify) {
-        microkit_notify(blk_config.virt.id);
+        microkit_notify(ioq->conn->id);
+    }
+
+    if (ioq->deferred) {
+        handle_request(qn);
+    }
+}
+
+/* Whether an I/O queue pair has commands outstanding with the controller. */
+static inline bool io_queue_busy(nvme_io_queue_t *ioq)
+{
+    return ialloc_num_free(&ioq->cid_ialloc) < MAX_PENDING_REQS + 1U;
+}
+
+/*
+ * Spin on a polled queue's CQ phase bit for a bounded time, handling
+ * completions as they arrive. The shared interrupt vector is masked while
+ * spinning so that completions found by the spin do not also raise an
+ * interrupt, and any commands still outstanding afterwards complete through
+ * the interrupt once it is unmasked.
+ */
+static void poll_io_queue(uint16_t qn)
+{
+    nvme_io_queue_t *ioq = &io_queues[qn];
+    nvme_irq_mask();
+    for (uint32_t i = 0; i < NVME_POLL_SPIN_ITERATIONS && io_queue_busy(ioq); i++) {
+        if (nvme_queue_completion_pending(&ioq->queue)) {
+            handle_io_completions(qn);
+        }
     }
+    nvme_irq_unmask();
 }
 
 static void handle_irq(void)
 {
     if (state_ctx.state == NVME_STATE_READY) {
-        handle_io_completions();
+        /* All I/O CQs share one interrupt vector */
+        for (uint16_t qn = 0; qn < state_ctx.num_io_queues; qn++) {
+            handle_io_completions(qn);
+        }
     } else {
         handle_admin_completions();
     }
@@ -769,7 +1144,7 @@ static void nvme_poll_controller_status(void)
         nvme_irq_unmask();
 
         uint32_t admin_cid;
-        int err = ialloc_alloc(&cid_ialloc, &admin_cid);
+        int err = ialloc_alloc(&admin_cid_ialloc, &admin_cid);
         assert(err == 0);
         assert(admin_cid <= UINT16_MAX);
 
@@ -834,6 +1209,9 @@ void nvme_controller_init()
         .timeout_ms = (cap_to + 1) * 500,
         .waited_ms = 0,
         .io_queue_depth = (mqes < desired) ? mqes : desired,
+        /* One queue pair per virtualiser connection */
+        .num_io_queues = 1 + blk_config.num_virt_queues,
+        .num_namespaces = NVME_NAMESPACE_PER_QUEUE ? 1 + blk_config.num_virt_queues : 1,
     };
 
     LOG_NVME("MQES: raw=0x%x -> max %u entries, using %u entries\n", mqes, (uint32_t)mqes + 1U,
@@ -901,14 +1279,28 @@ void init(void)
     nvme_identify_ctrl = (void *)NVME_IDENTIFY_CTRL_VADDR;
     nvme_identify_ns = (void *)NVME_IDENTIFY_NS_VADDR;
 
-    /* Initialise CID allocator */
-    ialloc_init(&cid_ialloc, cid_ialloc_idxlist, MAX_PENDING_REQS + 1U);
+    /* Initialise CID allocators */
+    ialloc_init(&admin_cid_ialloc, admin_cid_ialloc_idxlist, NVME_ASQ_CAPACITY + 1U);
+    ialloc_init(&prp_pool, prp_pool_idxlist, PRP_POOL_PAGES);
+    assert(blk_config.num_virt_queues < SDDF_BLK_MAX_QUEUES);
+    uint16_t num_io_queues = 1 + blk_config.num_virt_queues;
+    stats = blk_stats_init(&blk_config.stats, stats_fallback, sizeof(stats_fallback), BLK_STATS_DRIVER,
+                           num_io_queues);
+    for (uint16_t qn = 0; qn < num_io_queues; qn++) {
+        nvme_io_queue_t *ioq = &io_queues[qn];
+        ioq->conn = (qn == 0) ? &blk_config.virt : &blk_config.virt_queues[qn - 1];
+        ioq->stats = &stats->queues[qn];
+        ioq->stats->capacity = ioq->conn->num_buffers;
+        ioq->ns = &namespaces[NVME_NAMESPACE_PER_QUEUE ? qn : 0];
+        ioq->polled = (NVME_POLLED_QUEUES & BIT(qn)) != 0;
+        ialloc_init(&ioq->cid_ialloc, ioq->cid_ialloc_idxlist, MAX_PENDING_REQS + 1U);
+    }
 
     /* NVMe Controller Init */
     nvme_controller_init();
 }
 
-void notified(microkit_channel ch)
+static void handle_notification(microkit_channel ch)
 {
     if (ch == NVME_IRQ) {
         /* Guard against early IRQ delivery before admin queues are initialised. */
@@ -926,9 +1318,22 @@ void notified(microkit_channel ch)
         return;
     }
 
-    if (ch == blk_config.virt.id) {
-        handle_request();
-    } else {
-        LOG_NVME("Unknown notification ch=%d\n", ch);
+    for (uint16_t qn = 0; qn < state_ctx.num_io_queues; qn++) {
+        if (ch == io_queues[qn].conn->id) {
+            handle_request(qn);
+            if (io_queues[qn].polled) {
+                poll_io_queue(qn);
+            }
+            return;
+        }
     }
+
+    LOG_NVME("Unknown notification ch=%d\n", ch);
+}
+
+void notified(microkit_channel ch)
+{
+    blk_stats_begin(stats);
+    handle_notification(ch);
+    blk_stats_end(stats);
 }
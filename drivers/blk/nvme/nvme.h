@@ -136,16 +136,38 @@ _Static_assert(offsetof(nvme_controller_t, _reserved2) == 0x6C, "nvme_controller
 /*
  * Opcodes used by this driver.
  * [NVMe-2.1 §7.2, §5.1.12, §5.1.13, §5.2.1, §5.2.2]
- * [NVM-CommandSet-1.1 §3.3.4, §3.3.6]
+ * [NVM-CommandSet-1.1 §3.3.3, §3.3.4, §3.3.6, §3.3.8]
  */
-#define NVME_OP_FLUSH 0x00
-#define NVME_OP_WRITE 0x01
-#define NVME_OP_READ  0x02
+#define NVME_OP_FLUSH        0x00
+#define NVME_OP_WRITE        0x01
+#define NVME_OP_READ         0x02
+#define NVME_OP_WRITE_ZEROES 0x08
+#define NVME_OP_DSM          0x09
 
 #define NVME_ADMIN_OP_CREATE_IO_SQ 0x01
 #define NVME_ADMIN_OP_GET_LOG_PAGE 0x02
 #define NVME_ADMIN_OP_CREATE_IO_CQ 0x05
 #define NVME_ADMIN_OP_IDENTIFY     0x06
+#define NVME_ADMIN_OP_SET_FEATURES 0x09
+
+/* Feature identifiers used by this driver. [NVMe-2.1 §5.1.25, Fig. 385] */
+#define NVME_FEATURE_NUMBER_OF_QUEUES 0x07U
+
+/*
+ * Number of Queues CDW11 requests NSQR[15:0] and NCQR[31:16]; completion CDW0
+ * returns NSQA[15:0] and NCQA[31:16]. All counts are 0-based.
+ * [NVMe-2.1 §5.1.25.1.5, Fig. 399, Fig. 400]
+ */
+#define NVME_NUM_QUEUES_SQ_SHIFT 0
+#define NVME_NUM_QUEUES_SQ_MASK  BIT_MASK(0, 15)
+#define NVME_NUM_QUEUES_CQ_SHIFT 16
+#define NVME_NUM_QUEUES_CQ_MASK  BIT_MASK(16, 31)
+
+static inline uint32_t nvme_build_num_queues_cdw11(uint16_t nsqr, uint16_t ncqr)
+{
+    return (((uint32_t)nsqr << NVME_NUM_QUEUES_SQ_SHIFT) & NVME_NUM_QUEUES_SQ_MASK)
+         | (((uint32_t)ncqr << NVME_NUM_QUEUES_CQ_SHIFT) & NVME_NUM_QUEUES_CQ_MASK);
+}
 
 /*
  * Create I/O CQ and SQ CDW10 fields (identical layout). [NVMe-2.1 §5.2.1, Fig. 474; §5.2.2, Fig. 478]
@@ -203,6 +225,18 @@ static inline uint32_t nvme_build_rw_cdw12(uint16_t nlb, bool lr)
     return ((uint32_t)nlb & NVME_RW_CDW12_NLB_MASK) | (lr ? NVME_RW_CDW12_LR : 0U);
 }
 
+/* Dataset Management CDW10/CDW11 fields. [NVM-CommandSet-1.1 §3.3.3, Fig. 39, Fig. 40] */
+#define NVME_DSM_CDW10_NR_MASK BIT_MASK(0, 7)
+#define NVME_DSM_CDW11_AD      BIT(2)
+
+/* Dataset Management range, NR+1 of which make up the command's data. [NVM-CommandSet-1.1 §3.3.3, Fig. 41] */
+typedef struct nvme_dsm_range {
+    uint32_t cattr; /* Context Attributes */
+    uint32_t nlb; /* Length in logical blocks (not 0-based) */
+    uint64_t slba; /* Starting LBA */
+} nvme_dsm_range_t;
+_Static_assert(sizeof(nvme_dsm_range_t) == 16, "Dataset Management range must be 16 bytes");
+
 /* Admin and I/O commands use the common 64-byte SQE layout. [NVMe-2.1 §4.1.1, Fig. 92] */
 typedef struct nvme_submission_queue_entry {
     uint32_t cdw0;  /* Command Dword 0 (common) */
@@ -290,6 +324,13 @@ _Static_assert(sizeof(nvme_completion_queue_entry_t) == 16,
 /* Identify CNS values used by this driver. [NVMe-2.1 §5.1.13, Fig. 310] */
 #define NVME_IDENTIFY_CNS_NAMESPACE  0x00U
 #define NVME_IDENTIFY_CNS_CONTROLLER 0x01U
+#define NVME_IDENTIFY_CNS_ACTIVE_NSID_LIST 0x02U
+
+/*
+ * Active Namespace ID list (CNS=02h): NSIDs greater than the command's NSID
+ * in increasing order, terminated by 0 if fewer than 1024. [NVMe-2.1 §5.1.13.2.2]
+ */
+#define NVME_IDENTIFY_NSID_LIST_LEN 1024
 
 /*
  * Identify Controller (I/O Command Set Independent) response for CNS=01h.
@@ -309,9 +350,11 @@ typedef struct nvme_identify_ctrl {
     uint8_t _reserved2[512 - 100];
     uint8_t sqes; /* MINSQES[3:0], MAXSQES[7:4] (required value is 6 => 64-byte SQE) */
     uint8_t cqes; /* MINCQES[3:0], MAXCQES[7:4] (required value is 4 => 16-byte CQE) */
-    uint8_t _reserved3[536 - 514];
+    uint8_t _reserved3[520 - 514];
+    uint16_t oncs; /* Optional NVM Command Support */
+    uint8_t _reserved4[536 - 522];
     uint32_t sgls; /* SGL Support */
-    uint8_t _reserved4[4096 - 540];
+    uint8_t _reserved5[4096 - 540];
 } nvme_identify_ctrl_t;
 _Static_assert(sizeof(nvme_identify_ctrl_t) == 4096, "Identify Controller data structure must be 4096 bytes");
 _Static_assert(offsetof(nvme_identify_ctrl_t, vid) == 0, "VID must be at byte offset 0");
@@ -323,6 +366,7 @@ _Static_assert(offsetof(nvme_identify_ctrl_t, mdts) == 77, "MDTS must be at byte
 _Static_assert(offsetof(nvme_identify_ctrl_t, ctratt) == 96, "CTRATT must be at byte offset 96");
 _Static_assert(offsetof(nvme_identify_ctrl_t, sqes) == 512, "SQES must be at byte offset 512");
 _Static_assert(offsetof(nvme_identify_ctrl_t, cqes) == 513, "CQES must be at byte offset 513");
+_Static_assert(offsetof(nvme_identify_ctrl_t, oncs) == 520, "ONCS must be at byte offset 520");
 _Static_assert(offsetof(nvme_identify_ctrl_t, sgls) == 536, "SGLS must be at byte offset 536");
 
 /* Min/max SQES/CQES (min in bits 3:0, max in bits 7:4). [NVMe-2.1 Fig. 312] */
@@ -374,6 +418,10 @@ static inline uint8_t nvme_identify_flbas_format_index(uint8_t flbas)
 #define NVME_IDENTIFY_SGLS_TRANSPORT_BYTE_ALIGNED  BIT(0)
 #define NVME_IDENTIFY_SGLS_TRANSPORT_DWORD_ALIGNED BIT(1)
 
+/* ONCS optional NVM commands. [NVMe-2.1 Fig. 312] */
+#define NVME_IDENTIFY_ONCS_DSM          BIT(2)
+#define NVME_IDENTIFY_ONCS_WRITE_ZEROES BIT(3)
+
 /* ═══════════════════════════════════════════════════════════════════════
  *  Platform Constants
  * ═══════════════════════════════════════════════════════════════════════ */
@@ -381,6 +429,35 @@ static inline uint8_t nvme_identify_flbas_format_index(uint8_t flbas)
 #define NVME_ADMIN_QUEUE_SIZE 0x1000
 #define NVME_IO_QUEUE_SIZE    0x1000
 
+/* Most I/O queue pairs the driver creates, one per virtualiser connection. */
+#define NVME_MAX_IO_QUEUES 8
+
+/*
+ * Polled I/O queue pairs, bit n set for queue pair n. After submitting to a
+ * polled pair, the driver masks the interrupt vector and spins on the CQ
+ * phase bit for up to NVME_POLL_SPIN_ITERATIONS, handling completions as they
+ * arrive. Any commands still outstanding after the spin are completed through
+ * the interrupt, which is unmasked again, so idle polled queues cost nothing.
+ * This trades CPU time for not waiting on interrupt delivery for commands
+ * completing within the spin.
+ */
+#ifndef NVME_POLLED_QUEUES
+#define NVME_POLLED_QUEUES 0x0U
+#endif
+#ifndef NVME_POLL_SPIN_ITERATIONS
+#define NVME_POLL_SPIN_ITERATIONS 10000U
+#endif
+
+/*
+ * With NVME_NAMESPACE_PER_QUEUE set, I/O queue pair n exposes the n-th active
+ * namespace as a block device of its own, so that each connection gets an
+ * isolated namespace without partitioning. Otherwise every queue pair exposes
+ * the first active namespace.
+ */
+#ifndef NVME_NAMESPACE_PER_QUEUE
+#define NVME_NAMESPACE_PER_QUEUE 0
+#endif
+
 /*
  * PCI Configuration (hardcoded)
  * FUTURE: Get these from PCIe enumeration
@@ -394,25 +471,25 @@ static inline uint8_t nvme_identify_flbas_format_index(uint8_t flbas)
 #define NVME_CONTROLLER_VADDR 0x20000000
 #define NVME_ASQ_VADDR        0x20100000
 #define NVME_ACQ_VADDR        0x20101000
-#define NVME_IO_SQ_VADDR      0x20102000
-#define NVME_IO_CQ_VADDR      0x20103000
 #define NVME_IDENTIFY_VADDR   0x20104000
+#define NVME_IO_SQ_VADDR      0x20110000
+#define NVME_IO_CQ_VADDR      0x20120000
 #define NVME_PRP_LIST_VADDR   0x20200000
 
 /* Memory Region Physical Addresses */
 #if defined(CONFIG_ARCH_RISCV)
 #define NVME_ASQ_PADDR        0x9EDF0000
 #define NVME_ACQ_PADDR        0x9EDF1000
-#define NVME_IO_SQ_PADDR      0x9EDF2000
-#define NVME_IO_CQ_PADDR      0x9EDF3000
 #define NVME_IDENTIFY_PADDR   0x9EDF4000
+#define NVME_IO_SQ_PADDR      0x9EE00000
+#define NVME_IO_CQ_PADDR      0x9EE10000
 #define NVME_PRP_LIST_PADDR   0x9F800000
 #else /* ARM / x86 */
 #define NVME_ASQ_PADDR        0x5EDF0000
 #define NVME_ACQ_PADDR        0x5EDF1000
-#define NVME_IO_SQ_PADDR      0x5EDF2000
-#define NVME_IO_CQ_PADDR      0x5EDF3000
 #define NVME_IDENTIFY_PADDR   0x5EDF4000
+#define NVME_IO_SQ_PADDR      0x5EE00000
+#define NVME_IO_CQ_PADDR      0x5EE10000
 #define NVME_PRP_LIST_PADDR   0x5F800000
 #endif
 
@@ -440,8 +517,11 @@ static inline uint8_t nvme_identify_flbas_format_index(uint8_t flbas)
 /* Memory Region Sizes. */
 #define NVME_ASQ_REGION_SIZE        0x1000
 #define NVME_ACQ_REGION_SIZE        0x1000
+/* I/O queues of each pair, laid out back to back in the nvme_io_sq and nvme_io_cq regions. */
 #define NVME_IO_SQ_REGION_SIZE      0x1000
 #define NVME_IO_CQ_REGION_SIZE      0x1000
+#define NVME_IO_SQS_REGION_SIZE     (NVME_MAX_IO_QUEUES * NVME_IO_SQ_REGION_SIZE)
+#define NVME_IO_CQS_REGION_SIZE     (NVME_MAX_IO_QUEUES * NVME_IO_CQ_REGION_SIZE)
 #define NVME_IDENTIFY_REGION_SIZE   0x2000
 #define NVME_PRP_LIST_REGION_SIZE   0x80000
 
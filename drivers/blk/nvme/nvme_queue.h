@@ -85,6 +85,13 @@ static inline void nvme_queue_submit(nvme_queue_info_t *queue, nvme_submission_q
     *queue->submission.doorbell = queue->submission.tail;
 }
 
+/* Whether the controller has posted a completion that has not been consumed yet. */
+static inline bool nvme_queue_completion_pending(nvme_queue_info_t *queue)
+{
+    nvme_completion_queue_entry_t *cq_head_entry = &queue->completion.queue[queue->completion.head];
+    return (cq_head_entry->phase_tag_and_status & NVME_CQE_PHASE_MASK) != queue->completion.phase;
+}
+
 static inline int nvme_queue_consume(nvme_queue_info_t *queue, nvme_completion_queue_entry_t *entry)
 {
     //TODO: consider mapping the queue regions cached and add appropriate cache maintenance operations here
@@ -0,0 +1,31 @@
+#
+# Copyright 2026, UNSW
+# SPDX-License-Identifier: BSD-2-Clause
+#
+# Include this snippet in your project Makefile to build the ramdisk driver.
+# Assumes libsddf_util_debug.a is in ${LIBS}.
+#
+# The driver only needs a timer if it is configured with a latency, set
+# BLK_NEED_TIMER in your Makefile in that case.
+
+BLK_DRIVER_DIR := $(realpath $(dir $(lastword $(MAKEFILE_LIST))))
+
+CHECK_RAMDISK_FLAGS_MD5:=.ramdisk_cflags-$(shell echo -- ${CFLAGS} | shasum | sed 's/ *-//')
+
+${CHECK_RAMDISK_FLAGS_MD5}:
+	-rm -f .ramdisk_cflags-*
+	touch $@
+
+blk_driver.elf: blk_driver.o
+	$(LD) $(LDFLAGS) $^ $(LIBS) -o $@
+
+blk_driver.o: ${BLK_DRIVER_DIR}/ramdisk.c ${CHECK_RAMDISK_FLAGS_MD5}
+	$(CC) -c $(CFLAGS) -o $@ $<
+
+-include blk_driver.d
+
+clean::
+	rm -f blk_driver.o
+
+clobber::
+	rm -f blk_driver.elf
@@ -0,0 +1,255 @@
+/*
+ * Copyright 2026, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <os/sddf.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sddf/blk/config.h>
+#include <sddf/blk/queue.h>
+#include <sddf/blk/stats.h>
+#include <sddf/blk/storage_info.h>
+#include <sddf/timer/client.h>
+#include <sddf/timer/config.h>
+#include <sddf/util/printf.h>
+#include <sddf/util/util.h>
+
+/**
+ * The ramdisk is a block driver backed by memory rather than a device, for
+ * running block systems where no storage hardware is available and for
+ * measuring the overhead of the block components in isolation. Requests are
+ * served by copying between the storage region and the request's buffer,
+ * which is resolved from its IO address in the same way as in the block
+ * cache. Discards and write zeroes both zero the blocks. Flushes and
+ * barriers complete immediately as there is nothing to persist.
+ *
+ * If a latency is configured, each request is served when it is received but
+ * its response is held back until the latency has passed, emulating a device
+ * with that service time and an unbounded number of requests in flight.
+ */
+
+/* Uncomment this to enable debug logging */
+// #define DEBUG_DRIVER
+
+#if defined(DEBUG_DRIVER)
+#define LOG_DRIVER(...) do{ sddf_dprintf("BLK_RAMDISK|INFO: "); sddf_dprintf(__VA_ARGS__); }while(0)
+#else
+#define LOG_DRIVER(...) do{}while(0)
+#endif
+#define LOG_DRIVER_ERR(...) do{ sddf_printf("BLK_RAMDISK|ERROR: "); sddf_printf(__VA_ARGS__); }while(0)
+
+#define RAMDISK_SECTOR_SIZE 512
+
+/* Most responses held back at once when a latency is configured */
+#define MAX_PENDING 1024
+
+__attribute__((__section__(".blk_ramdisk_config"))) blk_ramdisk_config_t config;
+/* Only required if a latency is configured */
+__attribute__((__section__(".timer_client_config"))) timer_client_config_t timer_config;
+
+static blk_queue_handle_t blk_queue;
+
+/* Capacity of the disk in BLK_TRANSFER_SIZE units */
+static uint64_t capacity;
+
+/**
+ * Responses held back until their due time. All requests take the same time
+ * to complete, so the responses fall due in the order they were queued.
+ */
+typedef struct pending_resp {
+    uint64_t due;
+    uint32_t id;
+    uint16_t success_count;
+    blk_resp_status_t status;
+    /* for statistics, the request and the time it was dequeued */
+    blk_req_code_t code;
+    uint16_t count;
+    uint64_t start;
+} pending_resp_t;
+
+static struct {
+    pending_resp_t resps[MAX_PENDING];
+    uint32_t head;
+    uint32_t tail;
+} pending;
+
+/* Time the next timeout is due, 0 if none is set */
+static uint64_t timeout_at;
+
+static uint64_t stats_fallback[BLK_STATS_SIZE(1) / sizeof(uint64_t)];
+static blk_stats_t *stats;
+
+static uintptr_t buffer_vaddr(uintptr_t io_addr, uint16_t count)
+{
+    uint64_t len = (uint64_t)count * BLK_TRANSFER_SIZE;
+    for (uint8_t i = 0; i < config.num_data; i++) {
+        device_region_resource_t *data = &config.data[i];
+        if (io_addr >= data->io_addr && io_addr + len <= data->io_addr + data->region.size) {
+            return (uintptr_t)data->region.vaddr + (io_addr - data->io_addr);
+        }
+    }
+    return 0;
+}
+
+static blk_resp_status_t serve_request(blk_req_code_t code, uintptr_t io_addr, uint64_t block_number, uint16_t count)
+{
+    switch (code) {
+    case BLK_REQ_READ:
+    case BLK_REQ_WRITE: {
+        if (count == 0 || block_number >= capacity || count > capacity - block_number) {
+            LOG_DRIVER_ERR("request for %u blocks at block %lu is out of bounds\n", count, block_number);
+            return BLK_RESP_ERR_INVALID_PARAM;
+        }
+        uintptr_t vaddr = buffer_vaddr(io_addr, count);
+        if (!vaddr) {
+            LOG_DRIVER_ERR("request buffer 0x%lx is not within a data region\n", io_addr);
+            return BLK_RESP_ERR_INVALID_PARAM;
+        }
+        void *disk = (char *)config.storage.vaddr + block_number * BLK_TRANSFER_SIZE;
+        size_t len = (size_t)count * BLK_TRANSFER_SIZE;
+        if (code == BLK_REQ_READ) {
+            memcpy((void *)vaddr, disk, len);
+        } else {
+            memcpy(disk, (void *)vaddr, len);
+        }
+        return BLK_RESP_OK;
+    }
+    case BLK_REQ_DISCARD:
+    case BLK_REQ_WRITE_ZEROES:
+        if (count == 0 || block_number >= capacity || count > capacity - block_number) {
+            LOG_DRIVER_ERR("request for %u blocks at block %lu is out of bounds\n", count, block_number);
+            return BLK_RESP_ERR_INVALID_PARAM;
+        }
+        memset((char *)config.storage.vaddr + block_number * BLK_TRANSFER_SIZE, 0, (size_t)count * BLK_TRANSFER_SIZE);
+        return BLK_RESP_OK;
+    case BLK_REQ_FLUSH:
+    case BLK_REQ_BARRIER:
+        return BLK_RESP_OK;
+    default:
+        /* The virtualiser should have sanitised the request code and so we should never get here. */
+        LOG_DRIVER_ERR("unsupported request code: 0x%x\n", code);
+        return BLK_RESP_ERR_INVALID_PARAM;
+    }
+}
+
+static bool resp_queue_full(uint32_t resp_tail)
+{
+    return resp_tail - blk_queue.resp_queue->head == blk_queue.capacity;
+}
+
+static void handle_requests(void)
+{
+    uint64_t now = config.latency ? sddf_timer_time_now(timer_config.driver_id) : 0;
+    uint32_t req_head = blk_queue.req_queue->head;
+    uint32_t resp_tail = blk_queue.resp_queue->tail;
+    blk_queue_stats_t *qs = &stats->queues[0];
+
+    /* Respond to requests whose latency has passed */
+    uint64_t ticks = blk_stats_now();
+    while (pending.head != pending.tail && pending.resps[pending.head % MAX_PENDING].due <= now
+           && !resp_queue_full(resp_tail)) {
+        pending_resp_t *resp = &pending.resps[pending.head % MAX_PENDING];
+        int err = blk_enqueue_resp_local(&blk_queue, &resp_tail, resp->status, resp->success_count, resp->id);
+        assert(!err);
+        blk_stats_complete(qs, resp->code, resp->count, resp->status, resp->start, ticks);
+        pending.head++;
+    }
+
+    while (true) {
+        if (config.latency ? pending.tail - pending.head == MAX_PENDING : resp_queue_full(resp_tail)) {
+            break;
+        }
+
+        blk_req_code_t code;
+        uintptr_t io_addr;
+        uint64_t block_number;
+        uint16_t count;
+        uint32_t id;
+        int err = blk_dequeue_req_local(&blk_queue, &req_head, &code, &io_addr, &block_number, &count, &id);
+        if (err) {
+            break;
+        }
+
+        LOG_DRIVER("request code: %d, io_addr: 0x%lx, block_number: %lu, count: %u, id: %u\n", code, io_addr,
+                   block_number, count, id);
+        uint64_t start = blk_stats_now();
+        blk_stats_submit(qs);
+
+        blk_resp_status_t status = serve_request(code, io_addr, block_number, count);
+        uint16_t success_count = (status == BLK_RESP_OK) ? count : 0;
+        if (config.latency) {
+            pending.resps[pending.tail % MAX_PENDING] = (pending_resp_t) {
+                .due = now + config.latency,
+                .id = id,
+                .success_count = success_count,
+                .status = status,
+                .code = code,
+                .count = count,
+                .start = start,
+            };
+            pending.tail++;
+        } else {
+            err = blk_enqueue_resp_local(&blk_queue, &resp_tail, status, success_count, id);
+            assert(!err);
+            blk_stats_complete(qs, code, count, status, start, blk_stats_now());
+        }
+    }
+
+    blk_req_update_shared_head(&blk_queue, req_head);
+    if (resp_tail != blk_queue.resp_queue->tail) {
+        blk_resp_update_shared_tail(&blk_queue, resp_tail);
+        sddf_notify(config.virt.id);
+    }
+
+    if (pending.head != pending.tail) {
+        uint64_t due = pending.resps[pending.head % MAX_PENDING].due;
+        if (timeout_at == 0 || due < timeout_at) {
+            timeout_at = due;
+            sddf_timer_set_timeout(timer_config.driver_id, due > now ? due - now : 0);
+        }
+    }
+}
+
+void init(void)
+{
+    assert(blk_config_check_magic(&config));
+    if (config.latency) {
+        assert(timer_config_check_magic(&timer_config));
+    }
+
+    blk_queue_init(&blk_queue, config.virt.req_queue.vaddr, config.virt.resp_queue.vaddr, config.virt.num_buffers);
+    stats = blk_stats_init(&config.stats, stats_fallback, sizeof(stats_fallback), BLK_STATS_DRIVER, 1);
+    stats->queues[0].capacity = config.virt.num_buffers;
+
+    capacity = config.storage.size / BLK_TRANSFER_SIZE;
+    assert(capacity);
+
+    blk_storage_info_t *storage_info = config.virt.storage_info.vaddr;
+    strcpy(storage_info->serial_number, "ramdisk");
+    storage_info->read_only = false;
+    storage_info->sector_size = RAMDISK_SECTOR_SIZE;
+    storage_info->block_size = 1;
+    storage_info->queue_depth = config.virt.num_buffers;
+    storage_info->capacity = capacity;
+    storage_info->max_discard = UINT16_MAX;
+    storage_info->max_write_zeroes = UINT16_MAX;
+    blk_storage_set_ready(storage_info, true);
+
+    LOG_DRIVER("ramdisk of %lu blocks ready, latency %luns\n", capacity, config.latency);
+}
+
+void notified(sddf_channel ch)
+{
+    blk_stats_begin(stats);
+    if (ch == config.virt.id) {
+        handle_requests();
+    } else if (config.latency && ch == timer_config.driver_id) {
+        timeout_at = 0;
+        handle_requests();
+    } else {
+        LOG_DRIVER_ERR("received notification from unknown channel: 0x%x\n", ch);
+    }
+    blk_stats_end(stats);
+}
@@ -17,13 +17,13 @@
 
 #include <os/sddf.h>
 #include <sddf/util/util.h>
-#include <sddf/util/ialloc.h>
 #include <sddf/virtio/transport/common.h>
 #include <sddf/virtio/transport/pci.h>
-#include <sddf/virtio/queue.h>
+#include <sddf/virtio/ring.h>
 #include <sddf/virtio/feature.h>
 #include <sddf/blk/queue.h>
 #include <sddf/blk/config.h>
+#include <sddf/blk/stats.h>
 #include <sddf/blk/storage_info.h>
 #include <sddf/resources/device.h>
 #include <sddf/pci/conf_space.h>
@@ -34,29 +34,61 @@ virtio_device_handle_t dev;
 #define QUEUE_SIZE 1024
 #define VIRTQ_NUM_REQUESTS QUEUE_SIZE
 
+/* Most data descriptors of a request, which are only needed to honour VIRTIO_BLK_F_SIZE_MAX */
+#define VIRTIO_BLK_MAX_SEGS 8
+/* Descriptors of a request, the header, its data and the status */
+#define VIRTIO_BLK_MAX_DESC (VIRTIO_BLK_MAX_SEGS + 2)
+
+#if defined(CONFIG_ARCH_X86_64)
+/* Sizes of the hard-coded x86 regions, whose headers region only has room for a single request queue */
+#define X86_REQUESTS_REGION_SIZE 0x200000
+#define X86_HEADERS_REGION_SIZE 0x10000
+#endif
+
 uintptr_t requests_paddr;
 uintptr_t requests_vaddr;
 
-static volatile struct virtq virtq;
-static blk_queue_handle_t blk_queue;
-
 uintptr_t virtio_headers_paddr;
 static struct virtio_blk_req *virtio_headers;
 
 /*
- * A mapping from virtIO header index in the descriptor virtq ring, to the sDDF ID given
- * in the request. We need this mapping due to out of order operations.
+ * Each connection to a virtualiser is served on a virtqueue of its own, the
+ * first on virtqueue 0 and those in config.virt_queues on the following ones,
+ * which requires VIRTIO_BLK_F_MQ.
  */
-uint32_t virtio_header_to_id[QUEUE_SIZE];
+typedef struct virtio_blk_queue {
+    blk_connection_resource_t *conn;
+    blk_queue_handle_t blk_queue;
+    virtio_ring_t virtq;
+    virtio_ring_id_t virtq_ids[QUEUE_SIZE];
+    /* headers of the virtqueue's requests, selected by buffer id */
+    struct virtio_blk_req *headers;
+    uintptr_t headers_paddr;
+    /*
+     * A mapping from the buffer id of a virtIO request, which also selects its header, to
+     * the sDDF ID and block count given in the request. We need this mapping due to out of
+     * order operations.
+     */
+    uint32_t header_to_id[QUEUE_SIZE];
+    uint16_t header_to_count[QUEUE_SIZE];
+    /* for statistics, the request code and the time each request was dequeued */
+    blk_req_code_t header_to_code[QUEUE_SIZE];
+    uint64_t header_to_start[QUEUE_SIZE];
+    blk_queue_stats_t *stats;
+} virtio_blk_queue_t;
+
+static virtio_blk_queue_t queues[SDDF_BLK_MAX_QUEUES];
+static uint16_t num_queues;
+
+static uint64_t stats_fallback[BLK_STATS_SIZE(SDDF_BLK_MAX_QUEUES) / sizeof(uint64_t)];
+static blk_stats_t *stats;
 
 /*
- * Due to the out-of-order nature of virtIO, we need a way of allocating indexes in a
- * non-linear way.
+ * Largest data descriptor and most data descriptors of a request the device
+ * accepts, from VIRTIO_BLK_F_SIZE_MAX and VIRTIO_BLK_F_SEG_MAX.
  */
-ialloc_t ialloc_desc;
-uint32_t descriptors[QUEUE_SIZE];
-
-uint16_t last_seen_used = 0;
+static uint32_t seg_size;
+static uint16_t max_segs;
 
 /* Block device configuration, populated during initiliastion. */
 volatile struct virtio_blk_config *virtio_config;
@@ -64,62 +96,43 @@ volatile struct virtio_blk_config *virtio_config;
 __attribute__((__section__(".device_resources"))) device_resources_t device_resources;
 __attribute__((__section__(".blk_driver_config"))) blk_driver_config_t config;
 
-void handle_response(void)
+void handle_response(virtio_blk_queue_t *q)
 {
     bool notify = false;
+    uint64_t now = blk_stats_now();
+
+    /* Once caught up, ask to be interrupted for the next response and check
+     * for any that arrived in the meantime. */
+    do {
+        uint16_t virtio_id;
+        uint32_t len;
+        while (!virtio_ring_get_used(&q->virtq, &virtio_id, &len)) {
+            struct virtio_blk_req *hdr = &q->headers[virtio_id];
+            LOG_DRIVER("response for buffer %u, sDDF id: %u\n", virtio_id, q->header_to_id[virtio_id]);
+            virtio_blk_print_req(hdr);
+
+            blk_resp_status_t status;
+            if (hdr->status == VIRTIO_BLK_S_OK) {
+                status = BLK_RESP_OK;
+            } else {
+                status = BLK_RESP_ERR_UNSPEC;
+            }
+            int err = blk_enqueue_resp(&q->blk_queue, status, q->header_to_count[virtio_id],
+                                       q->header_to_id[virtio_id]);
+            assert(!err);
+            blk_stats_complete(q->stats, q->header_to_code[virtio_id], q->header_to_count[virtio_id], status,
+                               q->header_to_start[virtio_id], now);
 
-    uint16_t i = last_seen_used;
-    uint16_t curr_idx = virtq.used->idx;
-    while (i != curr_idx) {
-        uint16_t virtq_idx = i % virtq.num;
-        struct virtq_used_elem hdr_used = virtq.used->ring[virtq_idx];
-        assert(virtq.desc[hdr_used.id].flags & VIRTQ_DESC_F_NEXT);
-
-        struct virtq_desc hdr_desc = virtq.desc[hdr_used.id];
-        LOG_DRIVER("response header addr: 0x%lx, len: %d\n", hdr_desc.addr, hdr_desc.len);
-
-        assert(hdr_desc.len == VIRTIO_BLK_REQ_HDR_SIZE);
-        struct virtio_blk_req *hdr = &virtio_headers[virtq_idx];
-        virtio_blk_print_req(hdr);
-
-        uint16_t data_desc_idx = virtq.desc[hdr_used.id].next;
-        struct virtq_desc data_desc = virtq.desc[data_desc_idx % virtq.num];
-        uint32_t data_len = data_desc.len;
-#ifdef DEBUG_DRIVER
-        LOG_DRIVER("response data addr: 0x%lx, data len: %d\n", data_desc.addr, data_len);
-#endif
-
-        uint16_t footer_desc_idx = virtq.desc[data_desc_idx].next;
-
-        blk_resp_status_t status;
-        if (hdr->status == VIRTIO_BLK_S_OK) {
-            status = BLK_RESP_OK;
-        } else {
-            status = BLK_RESP_ERR_UNSPEC;
+            notify = true;
         }
-        int err = blk_enqueue_resp(&blk_queue, status, data_len / BLK_TRANSFER_SIZE, virtio_header_to_id[hdr_used.id]);
-        assert(!err);
-
-        /* Free up the descriptors we used */
-        err = ialloc_free(&ialloc_desc, hdr_used.id);
-        assert(!err);
-        err = ialloc_free(&ialloc_desc, data_desc_idx);
-        assert(!err);
-        err = ialloc_free(&ialloc_desc, footer_desc_idx);
-        assert(!err);
-
-        i += 1;
-        notify = true;
-    }
+    } while (virtio_ring_enable_interrupt(&q->virtq, 0));
 
     if (notify) {
-        sddf_notify(config.virt.id);
+        sddf_notify(q->conn->id);
     }
-
-    last_seen_used = i;
 }
 
-void handle_request()
+void handle_request(virtio_blk_queue_t *q)
 {
     /* Whether or not we notify the virtIO device to say something has changed
      * in the virtq. */
@@ -127,14 +140,16 @@ void handle_request()
 
     /* Consume all requests and put them in the 'avail' ring of the virtq. We do not
      * dequeue unless we know we can put the request in the virtq. */
-    while (!blk_queue_empty_req(&blk_queue) && ialloc_num_free(&ialloc_desc) >= 3) {
+    while (!blk_queue_empty_req(&q->blk_queue) && virtio_ring_can_add(&q->virtq, max_segs + 2)) {
         blk_req_code_t req_code;
         uintptr_t phys_addr;
         uint64_t block_number;
         uint16_t count;
         uint32_t id;
-        int err = blk_dequeue_req(&blk_queue, &req_code, &phys_addr, &block_number, &count, &id);
+        int err = blk_dequeue_req(&q->blk_queue, &req_code, &phys_addr, &block_number, &count, &id);
         assert(!err);
+        uint64_t start = blk_stats_now();
+        blk_stats_submit(q->stats);
 
         /*
          * The block size sDDF expects is different to virtIO, so we must first convert the request
@@ -161,6 +176,8 @@ void handle_request()
              * a 'footer' descriptor with the single remaining field of the header
              * (the status field).
              *
+             * If the device limits the size of a descriptor, the data is split over as
+             * many descriptors as needed.
              */
 
             /* It is the responsibility of the virtualiser to check that the request is valid,
@@ -177,70 +194,104 @@ void handle_request()
                     phys_addr, block_number, count, id);
             }
 
-            uint32_t hdr_desc_idx = -1;
-            uint32_t data_desc_idx = -1;
-            uint32_t footer_desc_idx = -1;
-
-            int err;
-            err = ialloc_alloc(&ialloc_desc, &hdr_desc_idx);
-            assert(!err && hdr_desc_idx != -1);
-            err = ialloc_alloc(&ialloc_desc, &data_desc_idx);
-            assert(!err && data_desc_idx != -1);
-            err = ialloc_alloc(&ialloc_desc, &footer_desc_idx);
-            assert(!err && footer_desc_idx != -1);
+            uint32_t len = VIRTIO_BLK_SECTOR_SIZE * virtio_count;
+            if (len > (uint64_t)seg_size * max_segs) {
+                LOG_DRIVER_ERR("request too large (%u blocks, max %lu)\n", count,
+                               (uint64_t)seg_size * max_segs / BLK_TRANSFER_SIZE);
+                err = blk_enqueue_resp(&q->blk_queue, BLK_RESP_ERR_INVALID_PARAM, 0, id);
+                assert(!err);
+                blk_stats_complete(q->stats, req_code, count, BLK_RESP_ERR_INVALID_PARAM, start, blk_stats_now());
+                sddf_notify(q->conn->id);
+                break;
+            }
 
-            uint16_t data_flags = VIRTQ_DESC_F_NEXT;
             uint16_t type;
             if (req_code == BLK_REQ_READ) {
                 type = VIRTIO_BLK_T_IN;
-                /* Doing a read request, so device needs to be able to write into the DMA region. */
-                data_flags |= VIRTQ_DESC_F_WRITE;
             } else {
                 type = VIRTIO_BLK_T_OUT;
             }
 
-            struct virtio_blk_req *hdr = &virtio_headers[hdr_desc_idx];
+            /* The header is selected by the buffer id, so fill it in before adding the buffer */
+            uint16_t virtio_id = virtio_ring_next_id(&q->virtq);
+            struct virtio_blk_req *hdr = &q->headers[virtio_id];
             hdr->type = type;
             hdr->sector = virtio_block_number;
 
-            virtq.desc[hdr_desc_idx] = (struct virtq_desc) {
-                .addr = virtio_headers_paddr + (hdr_desc_idx * sizeof(struct virtio_blk_req)),
-                .len = VIRTIO_BLK_REQ_HDR_SIZE,
-                .flags = VIRTQ_DESC_F_NEXT,
-                .next = data_desc_idx,
-            };
+            uint64_t hdr_paddr = q->headers_paddr + (virtio_id * sizeof(struct virtio_blk_req));
+            virtio_ring_buf_t bufs[VIRTIO_BLK_MAX_DESC];
+            uint16_t num_bufs = 0;
+            bufs[num_bufs++] = (virtio_ring_buf_t) { .addr = hdr_paddr, .len = VIRTIO_BLK_REQ_HDR_SIZE };
+            for (uint32_t off = 0; off < len; off += seg_size) {
+                /* Doing a read request, so device needs to be able to write into the DMA region. */
+                bufs[num_bufs++] = (virtio_ring_buf_t) { .addr = phys_addr + off,
+                                                         .len = MIN(seg_size, len - off),
+                                                         .write = (req_code == BLK_REQ_READ) };
+            }
+            bufs[num_bufs++] =
+                (virtio_ring_buf_t) { .addr = hdr_paddr + VIRTIO_BLK_REQ_HDR_SIZE, .len = 1, .write = true };
 
-            virtq.desc[data_desc_idx] = (struct virtq_desc) {
-                .addr = phys_addr,
-                .len = VIRTIO_BLK_SECTOR_SIZE * virtio_count,
-                .flags = data_flags,
-                .next = footer_desc_idx,
-            };
+            uint16_t added_id;
+            err = virtio_ring_add(&q->virtq, bufs, num_bufs, &added_id);
+            assert(!err && added_id == virtio_id);
+            virtio_queue_notify = true;
+
+            q->header_to_id[virtio_id] = id;
+            q->header_to_count[virtio_id] = count;
+            q->header_to_code[virtio_id] = req_code;
+            q->header_to_start[virtio_id] = start;
 
-            virtq.desc[footer_desc_idx] = (struct virtq_desc) {
-                .addr = virtq.desc[hdr_desc_idx].addr + VIRTIO_BLK_REQ_HDR_SIZE,
-                .len = 1,
-                .flags = VIRTQ_DESC_F_WRITE,
+            break;
+        }
+        case BLK_REQ_DISCARD:
+        case BLK_REQ_WRITE_ZEROES: {
+            /*
+             * The range is the data of the request, so it takes the place of the data
+             * descriptor. The virtualiser checks the count against the limits we report.
+             */
+            assert(virtio_block_number + virtio_count <= virtio_config->capacity);
+            LOG_DRIVER("handling %s request with block_number: 0x%lx, count: 0x%x, id: 0x%x\n",
+                       (req_code == BLK_REQ_DISCARD) ? "discard" : "write zeroes", block_number, count, id);
+
+            uint16_t virtio_id = virtio_ring_next_id(&q->virtq);
+            struct virtio_blk_req *hdr = &q->headers[virtio_id];
+            hdr->type = (req_code == BLK_REQ_DISCARD) ? VIRTIO_BLK_T_DISCARD : VIRTIO_BLK_T_WRITE_ZEROES;
+            hdr->sector = 0;
+            hdr->range.sector = virtio_block_number;
+            hdr->range.num_sectors = virtio_count;
+            hdr->range.flags = 0;
+
+            uint64_t hdr_paddr = q->headers_paddr + (virtio_id * sizeof(struct virtio_blk_req));
+            virtio_ring_buf_t bufs[] = {
+                { .addr = hdr_paddr, .len = VIRTIO_BLK_REQ_HDR_SIZE },
+                { .addr = hdr_paddr + offsetof(struct virtio_blk_req, range), .len = sizeof(hdr->range) },
+                { .addr = hdr_paddr + VIRTIO_BLK_REQ_HDR_SIZE, .len = 1, .write = true },
             };
 
-            virtq.avail->ring[virtq.avail->idx % virtq.num] = hdr_desc_idx;
-            virtq.avail->idx++;
+            uint16_t added_id;
+            err = virtio_ring_add(&q->virtq, bufs, ARRAY_SIZE(bufs), &added_id);
+            assert(!err && added_id == virtio_id);
             virtio_queue_notify = true;
 
-            virtio_header_to_id[hdr_desc_idx] = id;
+            q->header_to_id[virtio_id] = id;
+            q->header_to_count[virtio_id] = count;
+            q->header_to_code[virtio_id] = req_code;
+            q->header_to_start[virtio_id] = start;
 
             break;
         }
         case BLK_REQ_FLUSH: {
-            int err = blk_enqueue_resp(&blk_queue, BLK_RESP_OK, 0, id);
+            int err = blk_enqueue_resp(&q->blk_queue, BLK_RESP_OK, 0, id);
             assert(!err);
-            sddf_notify(config.virt.id);
+            blk_stats_complete(q->stats, req_code, 0, BLK_RESP_OK, start, blk_stats_now());
+            sddf_notify(q->conn->id);
             break;
         }
         case BLK_REQ_BARRIER: {
-            int err = blk_enqueue_resp(&blk_queue, BLK_RESP_OK, 0, id);
+            int err = blk_enqueue_resp(&q->blk_queue, BLK_RESP_OK, 0, id);
             assert(!err);
-            sddf_notify(config.virt.id);
+            blk_stats_complete(q->stats, req_code, 0, BLK_RESP_OK, start, blk_stats_now());
+            sddf_notify(q->conn->id);
             break;
         }
         default:
@@ -250,8 +301,8 @@ void handle_request()
         }
     }
 
-    if (virtio_queue_notify) {
-        virtio_transport_queue_notify(&dev, 0);
+    if (virtio_queue_notify && virtio_ring_kick_needed(&q->virtq)) {
+        virtio_transport_queue_notify(&dev, q - queues);
     }
 }
 
@@ -260,7 +311,10 @@ void handle_irq(void)
     uint32_t irq_status = virtio_transport_read_isr(&dev);
     if (irq_status & VIRTIO_IRQ_VQUEUE) {
         virtio_transport_write_isr(&dev, VIRTIO_IRQ_VQUEUE);
-        handle_response();
+        /* All virtqueues share the interrupt, so we check each of them */
+        for (uint16_t i = 0; i < num_queues; i++) {
+            handle_response(&queues[i]);
+        }
     }
 
     if (irq_status & VIRTIO_IRQ_CONFIG) {
@@ -271,7 +325,6 @@ void handle_irq(void)
 void virtio_blk_init(void)
 {
     assert(virtio_transport_probe(&device_resources, &dev, VIRTIO_DEVICE_ID_BLK));
-    ialloc_init(&ialloc_desc, descriptors, QUEUE_SIZE);
 
     /* First reset the device */
     virtio_transport_set_status(&dev, 0);
@@ -292,19 +345,6 @@ void virtio_blk_init(void)
         assert(false);
     }
 
-    /* This driver does not support Read-Only devices, so we always leave this as false */
-    blk_storage_info_t *storage_info = config.virt.storage_info.vaddr;
-    storage_info->read_only = false;
-    storage_info->capacity = (virtio_config->capacity * VIRTIO_BLK_SECTOR_SIZE) / BLK_TRANSFER_SIZE;
-    storage_info->cylinders = virtio_config->geometry.cylinders;
-    storage_info->heads = virtio_config->geometry.heads;
-    storage_info->blocks = virtio_config->geometry.sectors;
-    storage_info->block_size = 1;
-    storage_info->sector_size = VIRTIO_BLK_SECTOR_SIZE;
-
-    /* Finished populating configuration */
-    blk_storage_set_ready(storage_info, true);
-
 #ifdef DEBUG_DRIVER
     uint32_t features_low = virtio_transport_get_driver_features(&dev, 0);
     uint32_t features_high = virtio_transport_get_driver_features(&dev, 1);
@@ -312,8 +352,10 @@ void virtio_blk_init(void)
     virtio_blk_print_features(features);
 #endif
     /* Select features we want from the device */
-    virtio_transport_set_driver_features(&dev, 0, 0);
-    virtio_transport_set_driver_features(&dev, 1, 0);
+    uint64_t driver_features = BIT(VIRTIO_F_IN_ORDER) | BIT(VIRTIO_F_INDIRECT_DESC) | BIT(VIRTIO_BLK_F_MQ)
+                             | BIT(VIRTIO_BLK_F_SIZE_MAX) | BIT(VIRTIO_BLK_F_SEG_MAX) | BIT(VIRTIO_BLK_F_DISCARD)
+                             | BIT(VIRTIO_BLK_F_WRITE_ZEROES);
+    uint64_t negotiated = virtio_transport_negotiate_features(&dev, driver_features);
 
     virtio_transport_set_status(&dev, VIRTIO_DEVICE_STATUS_FEATURES_OK);
     if (!(virtio_transport_get_status(&dev) & VIRTIO_DEVICE_STATUS_FEATURES_OK)) {
@@ -321,33 +363,91 @@ void virtio_blk_init(void)
         return;
     }
 
-    /* Add virtqueues */
-    size_t desc_off = 0;
-    size_t avail_off = ALIGN(desc_off + (16 * VIRTQ_NUM_REQUESTS), 2);
-    size_t used_off = ALIGN(avail_off + (6 + 2 * VIRTQ_NUM_REQUESTS), 4);
-    size_t size = used_off + (6 + 8 * VIRTQ_NUM_REQUESTS);
+    uint16_t device_queues = (negotiated & BIT(VIRTIO_BLK_F_MQ)) ? virtio_config->num_queues : 1;
+    if (num_queues > device_queues) {
+        LOG_DRIVER_ERR("device has %u request queues, but %u connections are configured\n", device_queues,
+                       num_queues);
+        assert(false);
+    }
+
+    /* Segments are kept to whole sectors, and the data of a request must fit in the largest one otherwise */
+    seg_size = ROUND_DOWN(UINT32_MAX, BLK_TRANSFER_SIZE);
+    if (negotiated & BIT(VIRTIO_BLK_F_SIZE_MAX)) {
+        seg_size = ROUND_DOWN(virtio_config->size_max, VIRTIO_BLK_SECTOR_SIZE);
+    }
+    max_segs = VIRTIO_BLK_MAX_SEGS;
+    if (negotiated & BIT(VIRTIO_BLK_F_SEG_MAX)) {
+        max_segs = MIN(virtio_config->seg_max, VIRTIO_BLK_MAX_SEGS);
+    }
+    uint64_t max_transfer = (uint64_t)seg_size * max_segs / BLK_TRANSFER_SIZE;
+    assert(max_transfer > 0);
+
+    /* Each discard or write zeroes request is sent as a single range */
+    uint16_t sectors_per_block = BLK_TRANSFER_SIZE / VIRTIO_BLK_SECTOR_SIZE;
+    uint16_t max_discard = 0;
+    if ((negotiated & BIT(VIRTIO_BLK_F_DISCARD)) && virtio_config->max_discard_seg) {
+        max_discard = MIN(virtio_config->max_discard_sectors / sectors_per_block, UINT16_MAX);
+    }
+    uint16_t max_write_zeroes = 0;
+    if ((negotiated & BIT(VIRTIO_BLK_F_WRITE_ZEROES)) && virtio_config->max_write_zeroes_seg) {
+        max_write_zeroes = MIN(virtio_config->max_write_zeroes_sectors / sectors_per_block, UINT16_MAX);
+    }
+
+    /* This driver does not support Read-Only devices, so we always leave this as false */
+    for (uint16_t i = 0; i < num_queues; i++) {
+        blk_storage_info_t *storage_info = queues[i].conn->storage_info.vaddr;
+        storage_info->read_only = false;
+        storage_info->capacity = (virtio_config->capacity * VIRTIO_BLK_SECTOR_SIZE) / BLK_TRANSFER_SIZE;
+        storage_info->cylinders = virtio_config->geometry.cylinders;
+        storage_info->heads = virtio_config->geometry.heads;
+        storage_info->blocks = virtio_config->geometry.sectors;
+        storage_info->block_size = 1;
+        storage_info->sector_size = VIRTIO_BLK_SECTOR_SIZE;
+        storage_info->max_transfer = (negotiated & BIT(VIRTIO_BLK_F_SIZE_MAX)) ? MIN(max_transfer, UINT16_MAX) : 0;
+        storage_info->max_discard = max_discard;
+        storage_info->max_write_zeroes = max_write_zeroes;
+    }
+
+    /*
+     * Each virtqueue is followed by an indirect table for each request so that each takes one
+     * descriptor, and its headers are at the same offset of the headers region.
+     */
+    size_t indirect_off = ALIGN(virtio_ring_size(VIRTQ_NUM_REQUESTS, negotiated & BIT(VIRTIO_F_RING_PACKED)), 16);
+    size_t queue_size = ALIGN(indirect_off + virtio_ring_indirect_size(VIRTQ_NUM_REQUESTS, max_segs + 2), 16);
+    size_t headers_size = VIRTQ_NUM_REQUESTS * sizeof(struct virtio_blk_req);
 
     // Make sure that the metadata region is able to fit all the virtIO specific
     // extra data.
 
 #if defined(CONFIG_ARCH_X86_64)
     // @terryb remove hard-coded values here
-    assert(size <= 0x200000);
+    assert(num_queues * queue_size <= X86_REQUESTS_REGION_SIZE);
+    assert(num_queues * headers_size <= X86_HEADERS_REGION_SIZE);
 #else
-    assert(size <= device_resources.regions[2].region.size);
+    assert(num_queues * queue_size <= device_resources.regions[2].region.size);
+    assert(num_queues * headers_size <= device_resources.regions[1].region.size);
 #endif
 
-    virtq.num = VIRTQ_NUM_REQUESTS;
-    virtq.desc = (struct virtq_desc *)(requests_vaddr + desc_off);
-    virtq.avail = (struct virtq_avail *)(requests_vaddr + avail_off);
-    virtq.used = (struct virtq_used *)(requests_vaddr + used_off);
-
-    virtio_transport_queue_setup(&dev, 0, VIRTQ_NUM_REQUESTS, requests_paddr + desc_off, requests_paddr + avail_off,
-                                 requests_paddr + used_off);
+    for (uint16_t i = 0; i < num_queues; i++) {
+        virtio_blk_queue_t *q = &queues[i];
+        uintptr_t vaddr = requests_vaddr + i * queue_size;
+        uintptr_t paddr = requests_paddr + i * queue_size;
+        virtio_ring_init(&q->virtq, negotiated, VIRTQ_NUM_REQUESTS, vaddr, paddr, q->virtq_ids);
+        virtio_ring_init_indirect(&q->virtq, vaddr + indirect_off, paddr + indirect_off, max_segs + 2);
+        q->headers = (struct virtio_blk_req *)((uintptr_t)virtio_headers + i * headers_size);
+        q->headers_paddr = virtio_headers_paddr + i * headers_size;
+
+        virtio_transport_queue_setup(&dev, i, VIRTQ_NUM_REQUESTS, q->virtq.desc_io_addr, q->virtq.driver_io_addr,
+                                     q->virtq.device_io_addr);
+    }
 
     /* Finish initialisation */
     virtio_transport_set_status(&dev, VIRTIO_DEVICE_STATUS_DRIVER_OK);
     virtio_transport_write_isr(&dev, VIRTIO_IRQ_VQUEUE);
+
+    for (uint16_t i = 0; i < num_queues; i++) {
+        blk_storage_set_ready(queues[i].conn->storage_info.vaddr, true);
+    }
 }
 
 void init(void)
@@ -387,13 +487,31 @@ void init(void)
     dev.pci_vendor_id = VIRTIO_PCI_VEN_ID;
     dev.pci_device_id = VIRTIO_BLK_PCI_DEV_ID;
 
-    virtio_blk_init();
+    assert(config.num_virt_queues < SDDF_BLK_MAX_QUEUES);
+#if defined(CONFIG_ARCH_X86_64)
+    if (config.num_virt_queues) {
+        LOG_DRIVER_ERR("multiple request queues are not supported on x86, the hard-coded headers region only fits "
+                       "one, but %u are configured\n", 1 + config.num_virt_queues);
+        assert(false);
+    }
+#endif
+    num_queues = 1 + config.num_virt_queues;
+    stats = blk_stats_init(&config.stats, stats_fallback, sizeof(stats_fallback), BLK_STATS_DRIVER, num_queues);
+    for (uint16_t i = 0; i < num_queues; i++) {
+        virtio_blk_queue_t *q = &queues[i];
+        q->conn = (i == 0) ? &config.virt : &config.virt_queues[i - 1];
+        blk_queue_init(&q->blk_queue, q->conn->req_queue.vaddr, q->conn->resp_queue.vaddr, q->conn->num_buffers);
+        q->stats = &stats->queues[i];
+        q->stats->capacity = q->conn->num_buffers;
+    }
 
-    blk_queue_init(&blk_queue, config.virt.req_queue.vaddr, config.virt.resp_queue.vaddr, config.virt.num_buffers);
+    virtio_blk_init();
 }
 
 void notified(sddf_channel ch)
 {
+    blk_stats_begin(stats);
+
 // @billn fix ridiculousness
 #if defined(CONFIG_ARCH_X86_64)
     if (ch == 17) {
@@ -407,10 +525,21 @@ void notified(sddf_channel ch)
          * by the virtualiser because we ran out of space, so we try again now that
          * we have received a response and have resources freed.
          */
-        handle_request();
-    } else if (ch == config.virt.id) {
-        handle_request();
-    } else {
-        LOG_DRIVER_ERR("received notification from unknown channel: 0x%x\n", ch);
+        for (uint16_t i = 0; i < num_queues; i++) {
+            handle_request(&queues[i]);
+        }
+        blk_stats_end(stats);
+        return;
     }
+
+    for (uint16_t i = 0; i < num_queues; i++) {
+        if (ch == queues[i].conn->id) {
+            handle_request(&queues[i]);
+            blk_stats_end(stats);
+            return;
+        }
+    }
+
+    LOG_DRIVER_ERR("received notification from unknown channel: 0x%x\n", ch);
+    blk_stats_end(stats);
 }
@@ -89,6 +89,15 @@ struct virtio_blk_config {
     uint32_t secure_erase_sector_alignment;
 };
 
+#define VIRTIO_BLK_WRITE_ZEROES_FLAG_UNMAP 1
+
+/* Data of a VIRTIO_BLK_T_DISCARD or VIRTIO_BLK_T_WRITE_ZEROES request */
+struct virtio_blk_discard_write_zeroes {
+    uint64_t sector;
+    uint32_t num_sectors;
+    uint32_t flags;
+};
+
 struct virtio_blk_req {
     uint32_t type;
     uint32_t reserved;
@@ -96,6 +105,8 @@ struct virtio_blk_req {
     /* Here there would also be uint8_t data[], but in our case
      * we put the data in a separate descriptors */
     uint8_t status;
+    /* Not part of the header, but kept with it as the data of discard and write zeroes requests */
+    struct virtio_blk_discard_write_zeroes range;
 };
 
 static void virtio_blk_print_req(struct virtio_blk_req *req)
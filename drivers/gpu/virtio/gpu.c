@@ -19,7 +19,7 @@
 #include <sddf/util/util.h>
 #include <sddf/util/ialloc.h>
 #include <sddf/virtio/virtio.h>
-#include <sddf/virtio/virtio_queue.h>
+#include <sddf/virtio/queue.h>
 #include <sddf/gpu/queue.h>
 #include <sddf/gpu/events.h>
 #include <gpu.h>
@@ -102,6 +102,8 @@ static uint32_t ialloc_desc_idxlist[VIRTQ_QUEUE_SIZE];
 static uint32_t virtio_desc_to_id[VIRTQ_QUEUE_SIZE];
 
 static uint16_t last_handled_used_idx = 0;
+/* Whether VIRTIO_F_EVENT_IDX was negotiated */
+static bool event_idx;
 
 static void virtio_gpu_init();
 static void handle_request();
@@ -179,7 +181,6 @@ static void virtio_gpu_init(void)
     }
 
     uint32_t dev_features_low = regs->DeviceFeatures;
-    (void)(dev_features_low); /* Silence unused warnings */
     regs->DeviceFeaturesSel = 1;
     uint32_t dev_features_high = regs->DeviceFeatures;
 
@@ -210,6 +211,9 @@ static void virtio_gpu_init(void)
     uint32_t drv_features_low = 0;
 #endif
     uint32_t drv_features_high = BIT_HIGH(VIRTIO_F_VERSION_1);
+    /* Always accept event index suppression if offered */
+    drv_features_low |= dev_features_low & BIT_LOW(VIRTIO_F_EVENT_IDX);
+    event_idx = drv_features_low & BIT_LOW(VIRTIO_F_EVENT_IDX);
     regs->DriverFeatures = drv_features_low;
     regs->DriverFeaturesSel = 1;
     regs->DriverFeatures = drv_features_high;
@@ -311,8 +315,9 @@ static bool handle_response()
     int err = 0;
     bool sddf_notify = false;
     uint16_t i = last_handled_used_idx;
-    uint16_t curr_idx = virtq.used->idx;
-    while (i != curr_idx) {
+    /* Once caught up, ask to be interrupted for the next response and check
+     * for any that arrived in the meantime. */
+    while (i != virtq.used->idx || virtq_enable_used_event(&virtq, i, i, event_idx)) {
         struct virtq_used_elem used = virtq.used->ring[i % virtq.num];
         assert(used.id < VIRTQ_QUEUE_SIZE);
 
@@ -456,6 +461,7 @@ static void handle_request()
     int err = 0;
     bool virtio_queue_notify = false;
     bool sddf_notify = false;
+    uint16_t old_avail_idx = virtq.avail->idx;
     gpu_req_t req = { 0 };
     while (!gpu_queue_empty_req(&gpu_queue_h)) {
         if (ialloc_num_free(&ialloc_desc) < VIRTIO_MAX_DESC_PER_REQ) {
@@ -772,7 +778,7 @@ static void handle_request()
         microkit_notify(VIRT_CH);
     }
 
-    if (virtio_queue_notify) {
+    if (virtio_queue_notify && virtq_kick_needed(&virtq, old_avail_idx, event_idx)) {
         LOG_GPU_VIRTIO_DRIVER("Notifying device about new queue entries\n");
         regs->QueueNotify = 0;
     }
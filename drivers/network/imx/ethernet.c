@@ -44,6 +44,12 @@ hw_ring_t tx; /* Tx NIC ring */
 
 net_queue_handle_t rx_queue;
 net_queue_handle_t tx_queue;
+/* Optional queue of priority class packets, drained before tx_queue */
+net_queue_handle_t tx_queue_priority;
+bool has_tx_priority;
+
+/* Queue each Tx ring slot was filled from, so buffers are returned to it */
+net_queue_handle_t *tx_slot_queue[TX_COUNT];
 
 #define MAX_PACKET_SIZE     1536
 
@@ -145,13 +151,28 @@ static void rx_return(void)
     }
 }
 
+/**
+ * Select the queue to transmit from next. The device only has a single Tx
+ * ring in use, so priority packets are given precedence by always draining
+ * the priority queue first.
+ */
+static net_queue_handle_t *tx_next_queue(void)
+{
+    if (has_tx_priority && !net_queue_empty_active(&tx_queue_priority)) {
+        return &tx_queue_priority;
+    }
+
+    return net_queue_empty_active(&tx_queue) ? NULL : &tx_queue;
+}
+
 static void tx_provide(void)
 {
     bool reprocess = true;
     while (reprocess) {
-        while (!(hw_ring_full(&tx)) && !net_queue_empty_active(&tx_queue)) {
+        net_queue_handle_t *queue;
+        while (!(hw_ring_full(&tx)) && (queue = tx_next_queue()) != NULL) {
             net_buff_desc_t buffer;
-            int err = net_dequeue_active(&tx_queue, &buffer);
+            int err = net_dequeue_active(queue, &buffer);
             assert(!err);
 
             uint32_t idx = tx.tail % tx.capacity;
@@ -160,6 +181,7 @@ static void tx_provide(void)
                 stat |= WRAP;
             }
             update_ring_slot(&tx, idx, buffer.io_or_offset, buffer.len, stat);
+            tx_slot_queue[idx] = queue;
 
             /* The following barrier orders the write to the 'tdar' MMIO register to be after the write to
              * the 'stat' fields of the descriptors updated in function update_ring_slot().
@@ -172,10 +194,16 @@ static void tx_provide(void)
         }
 
         net_request_signal_active(&tx_queue);
+        if (has_tx_priority) {
+            net_request_signal_active(&tx_queue_priority);
+        }
         reprocess = false;
 
-        if (!hw_ring_full(&tx) && !net_queue_empty_active(&tx_queue)) {
+        if (!hw_ring_full(&tx) && tx_next_queue() != NULL) {
             net_cancel_signal_active(&tx_queue);
+            if (has_tx_priority) {
+                net_cancel_signal_active(&tx_queue_priority);
+            }
             reprocess = true;
         }
     }
@@ -184,6 +212,7 @@ static void tx_provide(void)
 static void tx_return(void)
 {
     bool enqueued = false;
+    bool enqueued_priority = false;
     while (!hw_ring_empty(&tx)) {
         /* Ensure that this buffer has been sent by the device */
         uint32_t idx = tx.head % tx.capacity;
@@ -199,15 +228,28 @@ static void tx_return(void)
         rrmb();
 
         net_buff_desc_t buffer = { d->addr, 0 };
-        int err = net_enqueue_free(&tx_queue, buffer);
+        int err = net_enqueue_free(tx_slot_queue[idx], buffer);
         assert(!err);
 
-        enqueued = true;
+        if (tx_slot_queue[idx] == &tx_queue) {
+            enqueued = true;
+        } else {
+            enqueued_priority = true;
+        }
         tx.head++;
     }
 
+    bool notify = false;
     if (enqueued && net_require_signal_free(&tx_queue)) {
         net_cancel_signal_free(&tx_queue);
+        notify = true;
+    }
+    if (enqueued_priority && net_require_signal_free(&tx_queue_priority)) {
+        net_cancel_signal_free(&tx_queue_priority);
+        notify = true;
+    }
+
+    if (notify) {
         sddf_notify(config.virt_tx.id);
     }
 }
@@ -334,6 +376,11 @@ void init(void)
                    config.virt_rx.num_buffers);
     net_queue_init(&tx_queue, config.virt_tx.free_queue.vaddr, config.virt_tx.active_queue.vaddr,
                    config.virt_tx.num_buffers);
+    if (config.virt_tx_priority.num_buffers) {
+        net_queue_init(&tx_queue_priority, config.virt_tx_priority.free_queue.vaddr,
+                       config.virt_tx_priority.active_queue.vaddr, config.virt_tx_priority.num_buffers);
+        has_tx_priority = true;
+    }
 
     rx_provide();
     tx_provide();
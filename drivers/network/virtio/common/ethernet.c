@@ -22,10 +22,9 @@
 #include <sddf/util/fence.h>
 #include <sddf/util/util.h>
 #include <sddf/util/printf.h>
-#include <sddf/util/ialloc.h>
 #include <sddf/virtio/transport/common.h>
 #include <sddf/virtio/transport/pci.h>
-#include <sddf/virtio/queue.h>
+#include <sddf/virtio/ring.h>
 #include <sddf/virtio/feature.h>
 #include <sddf/resources/device.h>
 #include <sddf/pci/conf_space.h>
@@ -54,43 +53,44 @@ net_queue_t *tx_active;
 
 #define HW_RING_SIZE (0x10000)
 
-struct virtq rx_virtq;
-struct virtq tx_virtq;
-uint16_t rx_last_seen_used = 0;
-uint16_t tx_last_seen_used = 0;
+virtio_ring_t rx_virtq;
+virtio_ring_t tx_virtq;
+virtio_ring_id_t rx_virtq_ids[RX_COUNT];
+virtio_ring_id_t tx_virtq_ids[TX_COUNT];
+
+/* The sDDF buffer of each packet in flight, indexed by the buffer id of its virtIO buffer */
+uint64_t rx_buffers[RX_COUNT];
+uint64_t tx_buffers[TX_COUNT];
 
 net_queue_handle_t rx_queue;
 net_queue_handle_t tx_queue;
 
 /*
- * This driver has no use of the virtIO net headers that go before
- * each packet. Our policy is to discard them when we get RX and
- * initialise to the default values on TX. In order to this, we use a
- * separate memory region and not the sDDF data region.
+ * The virtIO net headers that go before each packet only carry checksum
+ * offload information, which is translated to and from the flags of the sDDF
+ * buffer. As they are not part of the frame, we keep them in a separate
+ * memory region and not the sDDF data region.
  */
 uintptr_t virtio_net_tx_headers_vaddr;
 uintptr_t virtio_net_tx_headers_paddr;
 uintptr_t virtio_net_rx_headers_paddr;
 virtio_net_hdr_t *virtio_net_tx_headers;
+virtio_net_hdr_t *virtio_net_rx_headers;
 
-virtio_device_handle_t dev;
-
-ialloc_t rx_ialloc_desc;
-uint32_t rx_descriptors[RX_COUNT];
-ialloc_t tx_ialloc_desc;
-uint32_t tx_descriptors[TX_COUNT];
+/* Whether the device completes partial checksums on TX, VIRTIO_NET_F_CSUM */
+static bool tx_csum_offload;
 
-int rx_last_desc_idx = 0;
-int tx_last_desc_idx = 0;
+virtio_device_handle_t dev;
 
-static inline bool virtio_avail_full_rx(struct virtq *virtq)
+/* Each packet takes two descriptors, one for the virtIO header and one for the packet. */
+static inline bool virtio_avail_full_rx(virtio_ring_t *virtq)
 {
-    return rx_last_desc_idx >= rx_virtq.num;
+    return !virtio_ring_can_add(virtq, 2);
 }
 
-static inline bool virtio_avail_full_tx(struct virtq *virtq)
+static inline bool virtio_avail_full_tx(virtio_ring_t *virtq)
 {
-    return tx_last_desc_idx >= tx_virtq.num;
+    return !virtio_ring_can_add(virtq, 2);
 }
 
 static void rx_provide(void)
@@ -104,33 +104,19 @@ static void rx_provide(void)
             int err = net_dequeue_free(&rx_queue, &buffer);
             assert(!err);
 
-            // Allocate a desc entry for the header, and one for the packet
-            uint32_t hdr_desc_idx = -1;
-            err = ialloc_alloc(&rx_ialloc_desc, &hdr_desc_idx);
-            assert(!err && hdr_desc_idx != -1);
-            uint32_t pkt_desc_idx = -1;
-            err = ialloc_alloc(&rx_ialloc_desc, &pkt_desc_idx);
-            assert(!err && pkt_desc_idx != -1);
-
-            assert(hdr_desc_idx < rx_virtq.num);
-            assert(pkt_desc_idx < rx_virtq.num);
-
-            // Get the header address, which is an index into the virtio net headers memory region
-            rx_virtq.desc[hdr_desc_idx].addr = virtio_net_rx_headers_paddr + (hdr_desc_idx * sizeof(virtio_net_hdr_t));
-            rx_virtq.desc[hdr_desc_idx].len = sizeof(virtio_net_hdr_t);
-            // Set the next of the header to the packet
-            rx_virtq.desc[hdr_desc_idx].next = pkt_desc_idx;
-            rx_virtq.desc[hdr_desc_idx].flags = VIRTQ_DESC_F_NEXT | VIRTQ_DESC_F_WRITE;
-            // The packet address will be the actual buffer that we have dequeued from the client
-            rx_virtq.desc[pkt_desc_idx].addr = buffer.io_or_offset;
-            rx_virtq.desc[pkt_desc_idx].len = NET_BUFFER_SIZE;
-            rx_virtq.desc[pkt_desc_idx].flags = VIRTQ_DESC_F_WRITE;
-            // Set the entry in the available ring to point to the desc entry for the header
-            rx_virtq.avail->ring[rx_virtq.avail->idx % rx_virtq.num] = hdr_desc_idx;
-            // We only want to increment the avail ring by 1, as we are only increasing by one in
-            // this list, but we are adding two desc entries.
-            rx_virtq.avail->idx++;
-            rx_last_desc_idx += 2;
+            // The header is selected by the buffer id, as an index into the virtio net headers memory region
+            uint16_t virtio_id = virtio_ring_next_id(&rx_virtq);
+            virtio_ring_buf_t bufs[2] = {
+                { .addr = virtio_net_rx_headers_paddr + (virtio_id * sizeof(virtio_net_hdr_t)),
+                  .len = sizeof(virtio_net_hdr_t),
+                  .write = true },
+                // The packet address will be the actual buffer that we have dequeued from the client
+                { .addr = buffer.io_or_offset, .len = NET_BUFFER_SIZE, .write = true },
+            };
+            uint16_t added_id;
+            err = virtio_ring_add(&rx_virtq, bufs, 2, &added_id);
+            assert(!err && added_id == virtio_id);
+            rx_buffers[virtio_id] = buffer.io_or_offset;
 
             transferred = true;
         }
@@ -144,7 +130,7 @@ static void rx_provide(void)
         }
     }
 
-    if (transferred) {
+    if (transferred && virtio_ring_kick_needed(&rx_virtq)) {
         /* We have added more avail buffers, so notify the device */
         virtio_transport_queue_notify(&dev, VIRTIO_NET_RX_QUEUE);
     }
@@ -155,36 +141,33 @@ static void rx_return(void)
     /* Extract RX buffers from the 'used' and pass them up to the client by putting them
      * in our sDDF 'active' queues. */
     uint16_t packets_transferred = 0;
-    uint16_t i = rx_last_seen_used;
-    uint16_t curr_idx = rx_virtq.used->idx;
-    while (i != curr_idx) {
-        struct virtq_used_elem hdr_used = rx_virtq.used->ring[i % rx_virtq.num];
-        assert(rx_virtq.desc[hdr_used.id].flags & VIRTQ_DESC_F_NEXT);
-
-        struct virtq_desc virtio_hdr = rx_virtq.desc[hdr_used.id];
-        struct virtq_desc pkt = rx_virtq.desc[virtio_hdr.next % rx_virtq.num];
-        uint64_t addr = pkt.addr;
-        assert(!(pkt.flags & VIRTQ_DESC_F_NEXT));
-
-        /* Received packet length is obtained from used header. This includes
-        the virtIO header length as well, so this must be subtracted before
-        passing to the virtualiser. */
-        uint32_t len = hdr_used.len - virtio_hdr.len;
-        net_buff_desc_t buffer = { addr, len };
-        int err = net_enqueue_active(&rx_queue, buffer);
-        assert(!err);
-
-        err = ialloc_free(&rx_ialloc_desc, hdr_used.id);
-        assert(!err);
-        err = ialloc_free(&rx_ialloc_desc, rx_virtq.desc[hdr_used.id].next);
-        assert(!err);
-
-        rx_last_desc_idx -= 2;
-        assert(rx_last_desc_idx >= 0);
-        i++;
-        packets_transferred++;
-    }
-    rx_last_seen_used += packets_transferred;
+    /* Once caught up, ask to be interrupted for the next packet and check
+     * for any that arrived in the meantime. */
+    do {
+        uint16_t virtio_id;
+        uint32_t len;
+        while (!virtio_ring_get_used(&rx_virtq, &virtio_id, &len)) {
+            /* Received packet length is obtained from the used buffer. This includes
+            the virtIO header length as well, so this must be subtracted before
+            passing to the virtualiser. */
+            net_buff_desc_t buffer = { rx_buffers[virtio_id], len - sizeof(virtio_net_hdr_t) };
+
+            /* Header flags are only set if VIRTIO_NET_F_GUEST_CSUM was negotiated */
+            virtio_net_hdr_t *hdr = &virtio_net_rx_headers[virtio_id];
+            if (hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
+                buffer.flags = NET_BUFF_F_CSUM_PARTIAL;
+                buffer.csum_start = hdr->csum_start;
+                buffer.csum_offset = hdr->csum_offset;
+            } else if (hdr->flags & VIRTIO_NET_HDR_F_DATA_VALID) {
+                buffer.flags = NET_BUFF_F_CSUM_VALID;
+            }
+
+            int err = net_enqueue_active(&rx_queue, buffer);
+            assert(!err);
+
+            packets_transferred++;
+        }
+    } while (virtio_ring_enable_interrupt(&rx_virtq, 0));
 
     if (packets_transferred > 0 && net_require_signal_active(&rx_queue)) {
         net_cancel_signal_active(&rx_queue);
@@ -202,35 +185,33 @@ static void tx_provide(void)
             int err = net_dequeue_active(&tx_queue, &buffer);
             assert(!err);
 
-            /* Now we need to put our buffer into the virtIO ring */
-            uint32_t hdr_desc_idx = -1;
-            err = ialloc_alloc(&tx_ialloc_desc, &hdr_desc_idx);
-            assert(!err && hdr_desc_idx != -1);
-            uint32_t pkt_desc_idx = -1;
-            err = ialloc_alloc(&tx_ialloc_desc, &pkt_desc_idx);
-            assert(!err && pkt_desc_idx != -1);
-            /* We should not run out of descriptors assuming that the avail ring is not full. */
-            assert(hdr_desc_idx < tx_virtq.num);
-            assert(pkt_desc_idx < tx_virtq.num);
-            tx_virtq.avail->ring[tx_virtq.avail->idx % tx_virtq.num] = hdr_desc_idx;
-
-            virtio_net_hdr_t *hdr = &virtio_net_tx_headers[hdr_desc_idx];
+            /* Now we need to put our buffer into the virtIO ring, with the header selected by the buffer id */
+            uint16_t virtio_id = virtio_ring_next_id(&tx_virtq);
+            virtio_net_hdr_t *hdr = &virtio_net_tx_headers[virtio_id];
             hdr->flags = 0;
             hdr->gso_type = VIRTIO_NET_HDR_GSO_NONE;
             hdr->hdr_len = 0;  /* not used unless we have segmentation offload */
             hdr->gso_size = 0; /* same */
             hdr->csum_start = 0;
             hdr->csum_offset = 0;
-            tx_virtq.desc[hdr_desc_idx].addr = virtio_net_tx_headers_paddr + (hdr_desc_idx * sizeof(virtio_net_hdr_t));
-            tx_virtq.desc[hdr_desc_idx].len = sizeof(virtio_net_hdr_t);
-            tx_virtq.desc[hdr_desc_idx].next = pkt_desc_idx;
-            tx_virtq.desc[hdr_desc_idx].flags = VIRTQ_DESC_F_NEXT;
-            tx_virtq.desc[pkt_desc_idx].addr = buffer.io_or_offset;
-            tx_virtq.desc[pkt_desc_idx].len = buffer.len;
-            tx_virtq.desc[pkt_desc_idx].flags = 0;
-
-            tx_virtq.avail->idx++;
-            tx_last_desc_idx += 2;
+            if (buffer.flags & NET_BUFF_F_CSUM_PARTIAL) {
+                /* The Tx virtualiser only passes on partial checksums if configured for a device completing them */
+                assert(tx_csum_offload);
+                hdr->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+                hdr->csum_start = buffer.csum_start;
+                hdr->csum_offset = buffer.csum_offset;
+            }
+
+            virtio_ring_buf_t bufs[2] = {
+                { .addr = virtio_net_tx_headers_paddr + (virtio_id * sizeof(virtio_net_hdr_t)),
+                  .len = sizeof(virtio_net_hdr_t) },
+                { .addr = buffer.io_or_offset, .len = buffer.len },
+            };
+            uint16_t added_id;
+            err = virtio_ring_add(&tx_virtq, bufs, 2, &added_id);
+            /* We should not run out of descriptors assuming that the ring is not full. */
+            assert(!err && added_id == virtio_id);
+            tx_buffers[virtio_id] = buffer.io_or_offset;
 
             packets_transferred = true;
         }
@@ -244,7 +225,7 @@ static void tx_provide(void)
         }
     }
 
-    if (packets_transferred) {
+    if (packets_transferred && virtio_ring_kick_needed(&tx_virtq)) {
         /* Finally, need to notify the queue if we have transferred data */
         /* This assumes VIRTIO_F_NOTIFICATION_DATA has not been negotiated */
         virtio_transport_queue_notify(&dev, VIRTIO_NET_TX_QUEUE);
@@ -256,35 +237,29 @@ static void tx_return(void)
     /* We must look through the 'used' ring of the TX virtqueue and place them in our
      * sDDF TX free queue. */
     uint16_t enqueued = 0;
-    uint16_t i = tx_last_seen_used;
-    uint16_t curr_idx = tx_virtq.used->idx;
-    while (i != curr_idx && !net_queue_full_free(&tx_queue)) {
-        /* For each TX free entry in the sDDF queue, there are *two* virtq used entries.
-         * One for the virtIO header, and one for the packet. */
-        struct virtq_used_elem hdr_used = tx_virtq.used->ring[i % tx_virtq.num];
-
-        assert(tx_virtq.desc[hdr_used.id].flags & VIRTQ_DESC_F_NEXT);
-
-        struct virtq_desc pkt = tx_virtq.desc[tx_virtq.desc[hdr_used.id].next % tx_virtq.num];
-        uint64_t addr = pkt.addr;
-        assert(!(pkt.flags & VIRTQ_DESC_F_NEXT));
-
-        net_buff_desc_t buffer = { addr, 0 };
-        int err = net_enqueue_free(&tx_queue, buffer);
-        assert(!err);
-
-        err = ialloc_free(&tx_ialloc_desc, hdr_used.id);
-        assert(!err);
-        err = ialloc_free(&tx_ialloc_desc, tx_virtq.desc[hdr_used.id].next);
-        assert(!err);
-        tx_last_desc_idx -= 2;
-        assert(tx_last_desc_idx >= 0);
-        i++;
-
-        enqueued++;
-    }
+    bool reprocess = true;
+    while (reprocess) {
+        uint16_t virtio_id;
+        uint32_t len;
+        while (!net_queue_full_free(&tx_queue) && !virtio_ring_get_used(&tx_virtq, &virtio_id, &len)) {
+            net_buff_desc_t buffer = { tx_buffers[virtio_id], 0 };
+            int err = net_enqueue_free(&tx_queue, buffer);
+            assert(!err);
+
+            enqueued++;
+        }
 
-    tx_last_seen_used += enqueued;
+        /*
+         * Transmitted buffers are only needed back once the client runs low,
+         * so with VIRTIO_F_EVENT_IDX ask to be interrupted only when three
+         * quarters of those in flight have been sent, rather than for each.
+         */
+        reprocess = false;
+        if (!net_queue_full_free(&tx_queue)) {
+            uint16_t delay = (virtio_ring_num_in_flight(&tx_virtq) * 3) / 4;
+            reprocess = virtio_ring_enable_interrupt(&tx_virtq, delay);
+        }
+    }
 
     if (enqueued > 0 && net_require_signal_free(&tx_queue)) {
         net_cancel_signal_free(&tx_queue);
@@ -331,8 +306,18 @@ static void eth_setup(void)
     virtio_net_print_features(feature);
 #endif
 
-    virtio_transport_set_driver_features(&dev, 0, VIRTIO_NET_F_MAC);
-    virtio_transport_set_driver_features(&dev, 1, VIRTIO_F_VERSION_1);
+    /*
+     * VIRTIO_F_IN_ORDER is not accepted, as the device could then omit the length of received packets.
+     * Segmentation offloads and VIRTIO_NET_F_MRG_RXBUF are not accepted either, as an sDDF buffer holds
+     * exactly one frame of at most NET_BUFFER_SIZE bytes.
+     */
+    uint64_t negotiated = virtio_transport_negotiate_features(
+        &dev, BIT(VIRTIO_NET_F_MAC) | BIT(VIRTIO_F_VERSION_1) | BIT(VIRTIO_F_INDIRECT_DESC) | BIT(VIRTIO_NET_F_CSUM)
+                  | BIT(VIRTIO_NET_F_GUEST_CSUM));
+    tx_csum_offload = negotiated & BIT(VIRTIO_NET_F_CSUM);
+    if (!tx_csum_offload) {
+        LOG_DRIVER_ERR("device does not offer VIRTIO_NET_F_CSUM, the Tx virtualiser must complete partial checksums\n");
+    }
 
     virtio_transport_set_status(&dev, VIRTIO_DEVICE_STATUS_FEATURES_OK);
 
@@ -348,52 +333,45 @@ static void eth_setup(void)
 
     // Setup the virtqueues
 
-    size_t rx_desc_off = 0;
-    size_t rx_avail_off = ALIGN(rx_desc_off + (16 * RX_COUNT), 2);
-    size_t rx_used_off = ALIGN(rx_avail_off + (6 + 2 * RX_COUNT), 4);
-    size_t tx_desc_off = ALIGN(rx_used_off + (6 + 8 * RX_COUNT), 16);
-    size_t tx_avail_off = ALIGN(tx_desc_off + (16 * TX_COUNT), 2);
-    size_t tx_used_off = ALIGN(tx_avail_off + (6 + 2 * TX_COUNT), 4);
-    size_t virtq_size = tx_used_off + (6 + 8 * TX_COUNT);
-
-    rx_virtq.num = RX_COUNT;
-    rx_virtq.desc = (struct virtq_desc *)(hw_ring_buffer_vaddr + rx_desc_off);
-    rx_virtq.avail = (struct virtq_avail *)(hw_ring_buffer_vaddr + rx_avail_off);
-    rx_virtq.used = (struct virtq_used *)(hw_ring_buffer_vaddr + rx_used_off);
-
-    assert((uintptr_t)rx_virtq.desc % 16 == 0);
-    assert((uintptr_t)rx_virtq.avail % 2 == 0);
-    assert((uintptr_t)rx_virtq.used % 4 == 0);
+    bool packed = negotiated & BIT(VIRTIO_F_RING_PACKED);
+    size_t rx_virtq_off = 0;
+    size_t tx_virtq_off = ALIGN(rx_virtq_off + virtio_ring_size(RX_COUNT, packed), 16);
+    size_t virtq_size = tx_virtq_off + virtio_ring_size(TX_COUNT, packed);
 
-    tx_virtq.num = TX_COUNT;
-    tx_virtq.desc = (struct virtq_desc *)(hw_ring_buffer_vaddr + tx_desc_off);
-    tx_virtq.avail = (struct virtq_avail *)(hw_ring_buffer_vaddr + tx_avail_off);
-    tx_virtq.used = (struct virtq_used *)(hw_ring_buffer_vaddr + tx_used_off);
-
-    assert((uintptr_t)tx_virtq.desc % 16 == 0);
-    assert((uintptr_t)tx_virtq.avail % 2 == 0);
-    assert((uintptr_t)tx_virtq.used % 4 == 0);
+    virtio_ring_init(&rx_virtq, negotiated, RX_COUNT, hw_ring_buffer_vaddr + rx_virtq_off,
+                     hw_ring_buffer_paddr + rx_virtq_off, rx_virtq_ids);
+    virtio_ring_init(&tx_virtq, negotiated, TX_COUNT, hw_ring_buffer_vaddr + tx_virtq_off,
+                     hw_ring_buffer_paddr + tx_virtq_off, tx_virtq_ids);
 
     /* Virtio TX headers will proceed the virtq structures. Then RX headers. */
     virtio_net_tx_headers_vaddr = hw_ring_buffer_vaddr + virtq_size;
     virtio_net_tx_headers_paddr = hw_ring_buffer_paddr + virtq_size;
     virtio_net_tx_headers = (virtio_net_hdr_t *)virtio_net_tx_headers_vaddr;
-    size_t tx_headers_size = ((TX_COUNT / 2) * sizeof(virtio_net_hdr_t));
+    size_t tx_headers_size = (TX_COUNT * sizeof(virtio_net_hdr_t));
     virtio_net_rx_headers_paddr = virtio_net_tx_headers_paddr + tx_headers_size;
-    size_t rx_headers_size = ((RX_COUNT / 2) * sizeof(virtio_net_hdr_t));
+    virtio_net_rx_headers = (virtio_net_hdr_t *)(virtio_net_tx_headers_vaddr + tx_headers_size);
+    size_t rx_headers_size = (RX_COUNT * sizeof(virtio_net_hdr_t));
+
+    /*
+     * Then the RX indirect tables, so that each RX buffer takes one descriptor of the ring. There is no room
+     * left for TX tables, and TX ring space is rarely the limit as buffers are returned once transmitted.
+     */
+    size_t rx_indirect_off = ALIGN(virtq_size + tx_headers_size + rx_headers_size, 16);
+    virtio_ring_init_indirect(&rx_virtq, hw_ring_buffer_vaddr + rx_indirect_off, hw_ring_buffer_paddr + rx_indirect_off,
+                              2);
 
-    assert(virtq_size + tx_headers_size + rx_headers_size <= HW_RING_SIZE);
+    assert(rx_indirect_off + virtio_ring_indirect_size(RX_COUNT, 2) <= HW_RING_SIZE);
 
     rx_provide();
     tx_provide();
 
     // Setup RX queue first
-    assert(virtio_transport_queue_setup(&dev, VIRTIO_NET_RX_QUEUE, RX_COUNT, hw_ring_buffer_paddr + rx_desc_off,
-                                        hw_ring_buffer_paddr + rx_avail_off, hw_ring_buffer_paddr + rx_used_off));
+    assert(virtio_transport_queue_setup(&dev, VIRTIO_NET_RX_QUEUE, RX_COUNT, rx_virtq.desc_io_addr,
+                                        rx_virtq.driver_io_addr, rx_virtq.device_io_addr));
 
     // Setup TX queue
-    assert(virtio_transport_queue_setup(&dev, VIRTIO_NET_TX_QUEUE, TX_COUNT, hw_ring_buffer_paddr + tx_desc_off,
-                                        hw_ring_buffer_paddr + tx_avail_off, hw_ring_buffer_paddr + tx_used_off));
+    assert(virtio_transport_queue_setup(&dev, VIRTIO_NET_TX_QUEUE, TX_COUNT, tx_virtq.desc_io_addr,
+                                        tx_virtq.driver_io_addr, tx_virtq.device_io_addr));
 
     // Set the MAC address
     config->mac[0] = 0x52;
@@ -428,8 +406,6 @@ void init(void)
     hw_ring_buffer_paddr = device_resources.regions[1].io_addr;
 #endif
 
-    ialloc_init(&rx_ialloc_desc, rx_descriptors, RX_COUNT);
-    ialloc_init(&tx_ialloc_desc, tx_descriptors, TX_COUNT);
 
     net_queue_init(&rx_queue, config.virt_rx.free_queue.vaddr, config.virt_rx.active_queue.vaddr,
                    config.virt_rx.num_buffers);
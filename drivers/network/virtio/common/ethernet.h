@@ -56,6 +56,9 @@
 #define VIRTIO_NET_S_LINK_UP 1
 #define VIRTIO_NET_S_ANNOUNCE 2
 
+#define VIRTIO_NET_HDR_F_NEEDS_CSUM 1
+#define VIRTIO_NET_HDR_F_DATA_VALID 2
+
 #define VIRTIO_NET_HDR_GSO_NONE 0
 
 typedef struct virtio_net_config {
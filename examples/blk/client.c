@@ -147,6 +147,9 @@ void init(void)
      * do I/O on is sane. */
     assert(REQUEST_BLK_NUMBER < storage_info->capacity - REQUEST_NUM_BLOCKS);
 
+    /* Ask the virtualiser to notify us of our responses. As we only ever have
+     * one request outstanding, we re-arm this before sending each one. */
+    blk_queue_request_signal_resp(&blk_queue);
     test_basic();
     sddf_notify(blk_config.virt.id);
 }
@@ -155,7 +158,10 @@ void notified(sddf_channel ch)
 {
     assert(ch == blk_config.virt.id || ch == serial_config.tx.id);
 
-    if (ch == blk_config.virt.id && !test_basic()) {
-        sddf_notify(blk_config.virt.id);
+    if (ch == blk_config.virt.id) {
+        blk_queue_request_signal_resp(&blk_queue);
+        if (!test_basic()) {
+            sddf_notify(blk_config.virt.id);
+        }
     }
 }
@@ -85,18 +85,18 @@ def generate(
             dma_regions = [
                 ("nvme_admin_sq", 0x9EDF0000, 0x20100000, 0x1000),
                 ("nvme_admin_cq", 0x9EDF1000, 0x20101000, 0x1000),
-                ("nvme_io_sq", 0x9EDF2000, 0x20102000, 0x1000),
-                ("nvme_io_cq", 0x9EDF3000, 0x20103000, 0x1000),
                 ("nvme_identify", 0x9EDF4000, 0x20104000, 0x2000),
+                ("nvme_io_sq", 0x9EE00000, 0x20110000, 0x8000),
+                ("nvme_io_cq", 0x9EE10000, 0x20120000, 0x8000),
                 ("nvme_prp_list", 0x9F800000, 0x20200000, 0x80000),
             ]
         else:
             dma_regions = [
                 ("nvme_admin_sq", 0x5EDF0000, 0x20100000, 0x1000),
                 ("nvme_admin_cq", 0x5EDF1000, 0x20101000, 0x1000),
-                ("nvme_io_sq", 0x5EDF2000, 0x20102000, 0x1000),
-                ("nvme_io_cq", 0x5EDF3000, 0x20103000, 0x1000),
                 ("nvme_identify", 0x5EDF4000, 0x20104000, 0x2000),
+                ("nvme_io_sq", 0x5EE00000, 0x20110000, 0x8000),
+                ("nvme_io_cq", 0x5EE10000, 0x20120000, 0x8000),
                 ("nvme_prp_list", 0x5F800000, 0x20200000, 0x80000),
             ]
         for name, paddr, vaddr, size in dma_regions:
@@ -0,0 +1,329 @@
+/*
+ * Copyright 2026, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <os/sddf.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sddf/util/printf.h>
+#include <sddf/util/util.h>
+#include <sddf/util/si_units.h>
+#include <sddf/util/ialloc.h>
+#include <sddf/blk/queue.h>
+#include <sddf/blk/storage_info.h>
+#include <sddf/blk/config.h>
+#include <sddf/blk/stats.h>
+#include <sddf/serial/queue.h>
+#include <sddf/serial/config.h>
+#include <sddf/timer/client.h>
+#include <sddf/timer/config.h>
+
+#include "bench_config.h"
+
+/**
+ * Block benchmark client. Runs each workload of bench_config.h against its
+ * block device in turn, keeping up to the workload's queue depth of requests
+ * in flight, and reports the throughput and the distribution of request
+ * latencies. Timestamps are taken once per notification, so latencies include
+ * the time a response waits for the client to be scheduled, as they would for
+ * any other client. Once every workload has finished, the statistics of the
+ * virtualiser and driver shared with the benchmark are printed, which show
+ * where requests spent their time.
+ */
+
+#define LOG_BENCH(...) do{ sddf_printf("BENCH|INFO: "); sddf_printf(__VA_ARGS__); }while(0)
+
+#define BENCH_MAX_QUEUE_DEPTH 256
+
+#define NUM_WORKLOADS (sizeof(bench_workloads) / sizeof(bench_workloads[0]))
+
+__attribute__((__section__(".blk_client_config"))) blk_client_config_t blk_config;
+__attribute__((__section__(".serial_client_config"))) serial_client_config_t serial_config;
+__attribute__((__section__(".timer_client_config"))) timer_client_config_t timer_config;
+/* Optional, no statistics are printed without it */
+__attribute__((__section__(".bench_stats_config"))) bench_stats_config_t stats_config;
+
+static serial_queue_handle_t serial_tx_queue_handle;
+
+static blk_queue_handle_t blk_queue;
+
+/* Requests in flight, indexed by request id, which also selects the request's buffer */
+static ialloc_t ialloc;
+static uint32_t ialloc_idxlist[BENCH_MAX_QUEUE_DEPTH];
+static uint64_t issued_at[BENCH_MAX_QUEUE_DEPTH];
+
+/* Latency of each completed request of the current workload in nanoseconds */
+static uint64_t latencies[BENCH_MAX_REQUESTS];
+
+static struct {
+    uint32_t workload;
+    uint16_t queue_depth;
+    uint64_t span;
+    uint32_t issued;
+    uint32_t completed;
+    uint32_t errors;
+    uint64_t next_block;
+    uint64_t start;
+    bool finished;
+} run;
+
+static uint64_t capacity;
+static uint64_t rand_state = 0x9e3779b97f4a7c15;
+
+static uint64_t rand_next(void)
+{
+    /* xorshift64* */
+    rand_state ^= rand_state >> 12;
+    rand_state ^= rand_state << 25;
+    rand_state ^= rand_state >> 27;
+    return rand_state * 0x2545f4914f6cdd1d;
+}
+
+static void sift_down(uint64_t *a, uint32_t root, uint32_t n)
+{
+    while (2 * root + 1 < n) {
+        uint32_t child = 2 * root + 1;
+        if (child + 1 < n && a[child + 1] > a[child]) {
+            child++;
+        }
+        if (a[root] >= a[child]) {
+            return;
+        }
+        uint64_t tmp = a[root];
+        a[root] = a[child];
+        a[child] = tmp;
+        root = child;
+    }
+}
+
+static void heap_sort(uint64_t *a, uint32_t n)
+{
+    for (uint32_t i = n / 2; i > 0; i--) {
+        sift_down(a, i - 1, n);
+    }
+    for (uint32_t end = n; end > 1; end--) {
+        uint64_t tmp = a[0];
+        a[0] = a[end - 1];
+        a[end - 1] = tmp;
+        sift_down(a, 0, end - 1);
+    }
+}
+
+/* Latency below which the given share, in hundredths of a percent, of requests completed */
+static uint64_t percentile(uint32_t n, uint32_t per_10000)
+{
+    uint64_t rank = ((uint64_t)n * per_10000 + 9999) / 10000;
+    return latencies[rank ? rank - 1 : 0];
+}
+
+static void print_us(const char *name, uint64_t ns)
+{
+    sddf_printf(" %s=%lu.%luus", name, (uint64_t)(ns / NS_IN_US), (uint64_t)(ns % NS_IN_US) / 100);
+}
+
+static void report(const bench_workload_t *w, uint64_t elapsed)
+{
+    uint32_t n = run.completed;
+    uint64_t bytes = (uint64_t)n * w->block_count * BLK_TRANSFER_SIZE;
+    elapsed = elapsed ? elapsed : 1;
+
+    heap_sort(latencies, n);
+
+    LOG_BENCH("%s: %u requests (%u errors) at queue depth %u in %lu us\n", w->name, n, run.errors, run.queue_depth,
+              (uint64_t)(elapsed / NS_IN_US));
+    LOG_BENCH("%s: %lu IOPS, %lu KiB/s\n", w->name, (uint64_t)(n * NS_IN_S / elapsed),
+              (uint64_t)(bytes * NS_IN_S / elapsed / 1024));
+    LOG_BENCH("%s: latency", w->name);
+    print_us("p50", percentile(n, 5000));
+    print_us("p90", percentile(n, 9000));
+    print_us("p99", percentile(n, 9900));
+    print_us("p99.9", percentile(n, 9990));
+    print_us("max", latencies[n - 1]);
+    sddf_printf("\n");
+}
+
+static const char *blk_stats_components[] = { "unknown", "virt", "driver" };
+
+static const char *blk_stats_kinds[BLK_STATS_NUM_KINDS] = { "read", "write", "other" };
+
+/* Large enough for the connections of a virtualiser with a single client, or a driver */
+#define BENCH_STATS_MAX_QUEUES SDDF_BLK_MAX_QUEUES
+
+static uint64_t stats_snapshot[BLK_STATS_SIZE(BENCH_STATS_MAX_QUEUES) / sizeof(uint64_t)];
+
+/* Print the counters of the block components shared with the benchmark, accumulated since boot */
+static void print_blk_stats(void)
+{
+    blk_stats_t *snapshot = (blk_stats_t *)stats_snapshot;
+    for (uint8_t i = 0; i < stats_config.num_regions; i++) {
+        if (!blk_stats_read(stats_config.regions[i].vaddr, snapshot, BENCH_STATS_MAX_QUEUES)) {
+            LOG_BENCH("statistics region %u is not initialised\n", i);
+            continue;
+        }
+
+        const char *component = (snapshot->component < ARRAY_SIZE(blk_stats_components))
+                                  ? blk_stats_components[snapshot->component]
+                                  : blk_stats_components[0];
+        for (uint32_t q = 0; q < MIN(snapshot->num_queues, BENCH_STATS_MAX_QUEUES); q++) {
+            blk_queue_stats_t *qs = &snapshot->queues[q];
+            LOG_BENCH("%s queue %u:", component, q);
+            for (uint32_t kind = 0; kind < BLK_STATS_NUM_KINDS; kind++) {
+                uint64_t requests = 0;
+                for (uint32_t b = 0; b < BLK_STATS_BUCKETS; b++) {
+                    requests += qs->latency[kind][b];
+                }
+                if (!requests) {
+                    continue;
+                }
+                sddf_printf(" %s %lu", blk_stats_kinds[kind], requests);
+                if (snapshot->tick_freq) {
+                    print_us("mean", qs->latency_sum[kind] / requests * NS_IN_S / snapshot->tick_freq);
+                }
+            }
+            sddf_printf(" errors %lu inflight max %u/%u\n", qs->errors, qs->max_inflight, qs->capacity);
+        }
+    }
+}
+
+static void workload_start(uint32_t idx, uint64_t now)
+{
+    const bench_workload_t *w = &bench_workloads[idx];
+    assert(w->num_requests > 0 && w->num_requests <= BENCH_MAX_REQUESTS);
+
+    uint64_t buffers = blk_config.data.size / ((uint64_t)w->block_count * BLK_TRANSFER_SIZE);
+    uint64_t depth = MIN(MIN(w->queue_depth, BENCH_MAX_QUEUE_DEPTH), MIN(buffers, blk_queue.capacity));
+    assert(depth > 0);
+    if (depth < w->queue_depth) {
+        LOG_BENCH("%s: reducing queue depth to %lu\n", w->name, depth);
+    }
+
+    run.workload = idx;
+    run.queue_depth = depth;
+    run.span = w->span ? MIN(w->span, capacity) : capacity;
+    assert(run.span >= w->block_count);
+    run.issued = 0;
+    run.completed = 0;
+    run.errors = 0;
+    run.next_block = 0;
+    run.start = now;
+    ialloc_init(&ialloc, ialloc_idxlist, run.queue_depth);
+}
+
+static uint64_t next_block(const bench_workload_t *w)
+{
+    uint64_t slots = run.span / w->block_count;
+    if (w->random) {
+        return (rand_next() % slots) * w->block_count;
+    }
+
+    uint64_t block = run.next_block;
+    run.next_block += w->block_count;
+    if (run.next_block + w->block_count > run.span) {
+        run.next_block = 0;
+    }
+    return block;
+}
+
+/* Keep the queue filled to the workload's depth, returns whether any request was issued */
+static bool issue_requests(uint64_t now)
+{
+    const bench_workload_t *w = &bench_workloads[run.workload];
+    uint32_t tail = blk_queue.req_queue->tail;
+
+    while (run.issued < w->num_requests && !ialloc_full(&ialloc)) {
+        uint32_t id;
+        int err = ialloc_alloc(&ialloc, &id);
+        assert(!err);
+
+        blk_req_code_t code = (rand_next() % 100 < w->read_percent) ? BLK_REQ_READ : BLK_REQ_WRITE;
+        uintptr_t offset = (uintptr_t)id * w->block_count * BLK_TRANSFER_SIZE;
+        err = blk_enqueue_req_local(&blk_queue, &tail, code, offset, next_block(w), w->block_count, id);
+        assert(!err);
+
+        issued_at[id] = now;
+        run.issued++;
+    }
+
+    if (tail == blk_queue.req_queue->tail) {
+        return false;
+    }
+    blk_req_update_shared_tail(&blk_queue, tail);
+    return true;
+}
+
+/* Collect responses, returns whether the current workload has finished */
+static bool collect_responses(uint64_t now)
+{
+    const bench_workload_t *w = &bench_workloads[run.workload];
+    uint32_t head = blk_queue.resp_queue->head;
+
+    blk_resp_status_t status;
+    uint16_t success_count;
+    uint32_t id;
+    while (!blk_dequeue_resp_local(&blk_queue, &head, &status, &success_count, &id)) {
+        assert(ialloc_in_use(&ialloc, id));
+        if (status != BLK_RESP_OK || success_count != w->block_count) {
+            run.errors++;
+        }
+        latencies[run.completed++] = now - issued_at[id];
+        ialloc_free(&ialloc, id);
+    }
+    blk_resp_update_shared_head(&blk_queue, head);
+
+    return run.completed == w->num_requests;
+}
+
+static void bench(void)
+{
+    if (run.finished) {
+        return;
+    }
+
+    uint64_t now = sddf_timer_time_now(timer_config.driver_id);
+    while (collect_responses(now)) {
+        report(&bench_workloads[run.workload], now - run.start);
+        if (run.workload + 1 == NUM_WORKLOADS) {
+            print_blk_stats();
+            LOG_BENCH("finished\n");
+            run.finished = true;
+            return;
+        }
+        now = sddf_timer_time_now(timer_config.driver_id);
+        workload_start(run.workload + 1, now);
+    }
+
+    if (issue_requests(now)) {
+        sddf_notify(blk_config.virt.id);
+    }
+}
+
+void init(void)
+{
+    assert(serial_config_check_magic(&serial_config));
+    serial_queue_init(&serial_tx_queue_handle, serial_config.tx.queue.vaddr, serial_config.tx.data.size,
+                      serial_config.tx.data.vaddr);
+    serial_putchar_init(serial_config.tx.id, &serial_tx_queue_handle);
+
+    assert(blk_config_check_magic(&blk_config));
+    assert(timer_config_check_magic(&timer_config));
+    blk_queue_init(&blk_queue, blk_config.virt.req_queue.vaddr, blk_config.virt.resp_queue.vaddr,
+                   blk_config.virt.num_buffers);
+
+    blk_storage_info_t *storage_info = blk_config.virt.storage_info.vaddr;
+    while (!blk_storage_is_ready(storage_info));
+    capacity = storage_info->capacity;
+    LOG_BENCH("device size: 0x%lx bytes, %lu workloads\n", capacity * BLK_TRANSFER_SIZE, NUM_WORKLOADS);
+
+    blk_queue_request_signal_resp(&blk_queue);
+    workload_start(0, sddf_timer_time_now(timer_config.driver_id));
+    bench();
+}
+
+void notified(sddf_channel ch)
+{
+    if (ch == blk_config.virt.id) {
+        blk_queue_request_signal_resp(&blk_queue);
+        bench();
+    }
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright 2026, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sddf/resources/common.h>
+
+typedef struct bench_workload {
+    const char *name;
+    /* requests go to random aligned offsets rather than one after the other */
+    bool random;
+    /* share of requests that are reads, the rest are writes */
+    uint8_t read_percent;
+    /* size of each request in BLK_TRANSFER_SIZE units */
+    uint16_t block_count;
+    /* most requests kept in flight at once */
+    uint16_t queue_depth;
+    /* number of requests to complete, at most BENCH_MAX_REQUESTS */
+    uint32_t num_requests;
+    /* blocks at the start of the device the workload is confined to, 0 for all of it */
+    uint64_t span;
+} bench_workload_t;
+
+#define BENCH_MAX_REQUESTS 16384
+
+/*
+ * Workloads run in order. Queue depths are reduced if the client's data
+ * region cannot hold a buffer for each request in flight.
+ */
+static const bench_workload_t bench_workloads[] = {
+    { "seq-write-128k-qd8", false, 0, 32, 8, 2048, 0 },
+    { "seq-read-128k-qd8", false, 100, 32, 8, 2048, 0 },
+    { "seq-read-4k-qd1", false, 100, 1, 1, 8192, 0 },
+    { "rand-read-4k-qd1", true, 100, 1, 1, 8192, 0 },
+    { "rand-read-4k-qd32", true, 100, 1, 32, 16384, 0 },
+    { "rand-write-4k-qd1", true, 0, 1, 1, 8192, 0 },
+    { "rand-write-4k-qd32", true, 0, 1, 32, 16384, 0 },
+    { "rand-rw70-4k-qd16", true, 70, 1, 16, 16384, 0 },
+};
+
+#define BENCH_MAX_STATS 2
+
+typedef struct bench_stats_config {
+    /* Statistics regions of the block virtualiser and driver, shared
+    read-only with the benchmark, which prints them once every workload has
+    finished. See sddf/blk/stats.h. */
+    region_resource_t regions[BENCH_MAX_STATS];
+    /* Number of statistics regions. */
+    uint8_t num_regions;
+} bench_stats_config_t;
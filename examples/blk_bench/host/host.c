@@ -0,0 +1,530 @@
+/*
+ * Copyright 2026, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * Host shim for running the block benchmark client, the block virtualiser and
+ * the ramdisk driver, optionally with the block log between the latter two, as
+ * threads of a Linux process. Each component keeps its own init and notified
+ * entry points and config, which are renamed when the component is linked
+ * (see the Makefile). Notifications are delivered through a pending channel
+ * mask per component, and the timer is emulated with CLOCK_MONOTONIC, so that
+ * the overhead of the virtualiser can be measured without a device or a
+ * simulator in the way. As components run on threads
+ * of their own they run concurrently, as they would on a multicore system.
+ * Once the benchmark finishes, the statistics of the virtualiser and the
+ * ramdisk are printed to show where requests spent their time.
+ *
+ * Usage: blk_bench [storage size in MiB] [ramdisk latency in ns] [log size in MiB]
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sddf/blk/config.h>
+#include <sddf/serial/config.h>
+#include <sddf/serial/queue.h>
+#include <sddf/timer/config.h>
+#include <sddf/timer/protocol.h>
+#include <sddf/util/si_units.h>
+
+#include "bench_config.h"
+
+#define MAX_CHANNELS 63
+#define MAX_MRS 4
+#define LINE_MAX_LEN 1024
+
+#define CLIENT_DATA_SIZE (4 * 1024 * 1024)
+#define DRIVER_DATA_SIZE (2 * 1024 * 1024)
+#define LOG_STAGE_SIZE (4 * 1024 * 1024)
+#define QUEUE_CAPACITY 128
+
+/* MBR partition the client is given, starting 1MiB into the disk */
+#define PARTITION_START_SECTOR 2048
+#define PARTITION_TYPE_LINUX 0x83
+
+#define DEFAULT_STORAGE_MIB 256
+
+/* Printed by the benchmark once it has run all of its workloads */
+#define BENCH_FINISHED "BENCH|INFO: finished\n"
+
+typedef struct pd pd_t;
+
+typedef struct channel {
+    pd_t *peer;
+    sddf_channel peer_ch;
+    /* protected procedure calls on the channel go to the emulated timer */
+    bool timer;
+} channel_t;
+
+struct pd {
+    char name[SDDF_NAME_LENGTH];
+    void (*init)(void);
+    void (*notified)(sddf_channel ch);
+    channel_t channels[MAX_CHANNELS + 1];
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint64_t pending;
+    /* absolute CLOCK_MONOTONIC time of the requested timeout, 0 if none */
+    uint64_t timeout;
+    sddf_channel timer_ch;
+};
+
+/* Component entry points and configs, renamed when they are linked */
+extern void bench_init(void);
+extern void bench_notified(sddf_channel ch);
+extern blk_client_config_t bench_blk_config;
+extern serial_client_config_t bench_serial_config;
+extern timer_client_config_t bench_timer_config;
+extern bench_stats_config_t bench_stats_config;
+
+extern void virt_init(void);
+extern void virt_notified(sddf_channel ch);
+extern blk_virt_config_t virt_config;
+
+extern void ramdisk_init(void);
+extern void ramdisk_notified(sddf_channel ch);
+extern blk_ramdisk_config_t ramdisk_config;
+extern timer_client_config_t ramdisk_timer_config;
+
+extern void log_init(void);
+extern void log_notified(sddf_channel ch);
+extern blk_log_config_t log_config;
+
+enum { PD_BENCH, PD_VIRT, PD_RAMDISK, PD_LOG, NUM_PDS };
+static pd_t pds[NUM_PDS];
+
+static __thread pd_t *current;
+static __thread uint64_t mrs[MAX_MRS];
+
+static pthread_mutex_t timer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t timer_cond;
+
+/* Statistics regions, and the start of the run to calibrate their counter against if its frequency is unknown */
+static region_resource_t virt_stats;
+static region_resource_t ramdisk_stats;
+static uint64_t start_time;
+static uint64_t start_ticks;
+
+static uint64_t time_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NS_IN_S + ts.tv_nsec;
+}
+
+static void print_queue_stats(const char *name, blk_queue_stats_t *qs, double ns_per_tick)
+{
+    static const char *kinds[BLK_STATS_NUM_KINDS] = { "read", "write", "other" };
+
+    printf("HOST|INFO: %s:", name);
+    for (int kind = 0; kind < BLK_STATS_NUM_KINDS; kind++) {
+        uint64_t requests = 0;
+        for (int i = 0; i < BLK_STATS_BUCKETS; i++) {
+            requests += qs->latency[kind][i];
+        }
+        if (requests) {
+            printf(" %lu %s mean %.1fus,", requests, kinds[kind],
+                   qs->latency_sum[kind] * ns_per_tick / requests / NS_IN_US);
+        }
+    }
+    printf(" %lu errors, max %u in flight\n", qs->errors, qs->max_inflight);
+}
+
+/*
+ * Print how long requests took from the virtualiser's client connection, its
+ * driver connection and the ramdisk, so that the time spent in each of them
+ * can be told apart.
+ */
+static void print_stats(void)
+{
+    uint64_t virt_snapshot[BLK_STATS_SIZE(2) / sizeof(uint64_t)];
+    uint64_t ramdisk_snapshot[BLK_STATS_SIZE(1) / sizeof(uint64_t)];
+    blk_stats_t *virt = (blk_stats_t *)virt_snapshot;
+    blk_stats_t *ramdisk = (blk_stats_t *)ramdisk_snapshot;
+    if (!blk_stats_read(virt_stats.vaddr, virt, 2) || !blk_stats_read(ramdisk_stats.vaddr, ramdisk, 1)) {
+        return;
+    }
+
+    double ns_per_tick = 0;
+    if (virt->tick_freq) {
+        ns_per_tick = (double)NS_IN_S / virt->tick_freq;
+    } else if (blk_stats_now() > start_ticks) {
+        ns_per_tick = (double)(time_now() - start_time) / (blk_stats_now() - start_ticks);
+    }
+
+    print_queue_stats("virt client", &virt->queues[1], ns_per_tick);
+    print_queue_stats("virt driver", &virt->queues[0], ns_per_tick);
+    print_queue_stats("ramdisk", &ramdisk->queues[0], ns_per_tick);
+}
+
+static void signal_pd(pd_t *pd, sddf_channel ch)
+{
+    pthread_mutex_lock(&pd->lock);
+    pd->pending |= 1ull << ch;
+    pthread_cond_signal(&pd->cond);
+    pthread_mutex_unlock(&pd->lock);
+}
+
+char *sddf_get_pd_name(void)
+{
+    return current->name;
+}
+
+void sddf_irq_ack(sddf_channel ch)
+{
+}
+
+void sddf_deferred_irq_ack(sddf_channel ch)
+{
+}
+
+void sddf_notify(sddf_channel ch)
+{
+    channel_t *channel = &current->channels[ch];
+    if (channel->peer == NULL) {
+        fprintf(stderr, "%s: notified unconnected channel %u\n", current->name, ch);
+        abort();
+    }
+    signal_pd(channel->peer, channel->peer_ch);
+}
+
+void sddf_deferred_notify(sddf_channel ch)
+{
+    sddf_notify(ch);
+}
+
+seL4_MessageInfo_t sddf_ppcall(sddf_channel ch, seL4_MessageInfo_t msginfo)
+{
+    if (!current->channels[ch].timer) {
+        fprintf(stderr, "%s: protected procedure call on non-timer channel %u\n", current->name, ch);
+        abort();
+    }
+
+    uint64_t now = time_now();
+    switch (seL4_MessageInfo_get_label(msginfo)) {
+    case SDDF_TIMER_GET_TIME:
+        mrs[0] = now;
+        break;
+    case SDDF_TIMER_SET_TIMEOUT: {
+        uint64_t timeout = now + mrs[0];
+        pthread_mutex_lock(&timer_lock);
+        if (current->timeout == 0 || timeout < current->timeout) {
+            current->timeout = timeout;
+            current->timer_ch = ch;
+            pthread_cond_signal(&timer_cond);
+        }
+        pthread_mutex_unlock(&timer_lock);
+        break;
+    }
+    default:
+        fprintf(stderr, "%s: unknown timer request %lu\n", current->name, seL4_MessageInfo_get_label(msginfo));
+        abort();
+    }
+
+    return seL4_MessageInfo_new(0, 0, 0, 0);
+}
+
+uint64_t sddf_get_mr(unsigned int n)
+{
+    return mrs[n];
+}
+
+void sddf_set_mr(unsigned int n, uint64_t val)
+{
+    mrs[n] = val;
+}
+
+/*
+ * Components print through this, buffered a line at a time so that their
+ * output does not interleave. The process exits once the benchmark reports
+ * that it has finished.
+ */
+void _sddf_putchar(char character)
+{
+    static __thread char line[LINE_MAX_LEN];
+    static __thread size_t len;
+
+    line[len++] = character;
+    if (character == '\n' || len == LINE_MAX_LEN) {
+        fwrite(line, 1, len, stdout);
+        fflush(stdout);
+        if (current == &pds[PD_BENCH] && len == strlen(BENCH_FINISHED) && !memcmp(line, BENCH_FINISHED, len)) {
+            print_stats();
+            exit(0);
+        }
+        len = 0;
+    }
+}
+
+void serial_putchar_init(sddf_channel serial_tx_ch, serial_queue_handle_t *serial_tx_queue_handle)
+{
+}
+
+/* Memory is coherent between threads */
+void cache_clean_and_invalidate(unsigned long start, unsigned long end)
+{
+}
+
+void cache_clean(unsigned long start, unsigned long end)
+{
+}
+
+static void *pd_thread(void *arg)
+{
+    current = arg;
+    current->init();
+
+    while (true) {
+        pthread_mutex_lock(&current->lock);
+        while (current->pending == 0) {
+            pthread_cond_wait(&current->cond, &current->lock);
+        }
+        uint64_t pending = current->pending;
+        current->pending = 0;
+        pthread_mutex_unlock(&current->lock);
+
+        while (pending) {
+            sddf_channel ch = __builtin_ctzll(pending);
+            pending &= pending - 1;
+            current->notified(ch);
+        }
+    }
+
+    return NULL;
+}
+
+static void *timer_thread(void *arg)
+{
+    pthread_mutex_lock(&timer_lock);
+    while (true) {
+        uint64_t next = 0;
+        for (int i = 0; i < NUM_PDS; i++) {
+            if (pds[i].timeout && (next == 0 || pds[i].timeout < next)) {
+                next = pds[i].timeout;
+            }
+        }
+
+        if (next == 0) {
+            pthread_cond_wait(&timer_cond, &timer_lock);
+            continue;
+        }
+
+        struct timespec ts = { .tv_sec = next / NS_IN_S, .tv_nsec = next % NS_IN_S };
+        if (pthread_cond_timedwait(&timer_cond, &timer_lock, &ts) != ETIMEDOUT) {
+            continue;
+        }
+
+        uint64_t now = time_now();
+        for (int i = 0; i < NUM_PDS; i++) {
+            if (pds[i].timeout && pds[i].timeout <= now) {
+                pds[i].timeout = 0;
+                signal_pd(&pds[i], pds[i].timer_ch);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static void *region_alloc(size_t size)
+{
+    void *vaddr = aligned_alloc(0x1000, size);
+    if (vaddr == NULL) {
+        fprintf(stderr, "failed to allocate 0x%zx bytes\n", size);
+        exit(1);
+    }
+    memset(vaddr, 0, size);
+    return vaddr;
+}
+
+static region_resource_t region(size_t size)
+{
+    return (region_resource_t) { .vaddr = region_alloc(size), .size = size };
+}
+
+/* Data regions are given an IO address equal to their virtual address */
+static device_region_resource_t device_region(size_t size)
+{
+    region_resource_t r = region(size);
+    return (device_region_resource_t) { .region = r, .io_addr = (uintptr_t)r.vaddr };
+}
+
+/* Allocate the regions of a connection, shared by both of its ends */
+static blk_connection_resource_t connection(uint8_t id)
+{
+    return (blk_connection_resource_t) {
+        .storage_info = region(BLK_STORAGE_INFO_REGION_SIZE),
+        .req_queue = region(sizeof(blk_req_queue_t) + QUEUE_CAPACITY * sizeof(blk_req_t)),
+        .resp_queue = region(sizeof(blk_resp_queue_t) + QUEUE_CAPACITY * sizeof(blk_resp_t)),
+        .num_buffers = QUEUE_CAPACITY,
+        .id = id,
+    };
+}
+
+static blk_connection_resource_t peer_connection(blk_connection_resource_t conn, uint8_t id)
+{
+    conn.id = id;
+    return conn;
+}
+
+static void pd_setup(pd_t *pd, const char *name, void (*init)(void), void (*notified)(sddf_channel))
+{
+    snprintf(pd->name, sizeof(pd->name), "%s", name);
+    pd->init = init;
+    pd->notified = notified;
+    pthread_mutex_init(&pd->lock, NULL);
+    pthread_cond_init(&pd->cond, NULL);
+}
+
+static void connect(pd_t *a, sddf_channel a_ch, pd_t *b, sddf_channel b_ch)
+{
+    a->channels[a_ch] = (channel_t) { .peer = b, .peer_ch = b_ch };
+    b->channels[b_ch] = (channel_t) { .peer = a, .peer_ch = a_ch };
+}
+
+/* The partition covers the disk from PARTITION_START_SECTOR up to size */
+static void write_mbr(void *storage, uint64_t size)
+{
+    struct {
+        uint8_t bootstrap[446];
+        struct {
+            uint8_t status;
+            uint8_t chs_start[3];
+            uint8_t type;
+            uint8_t chs_end[3];
+            uint32_t lba_start;
+            uint32_t sectors;
+        } __attribute__((packed)) partitions[4];
+        uint16_t signature;
+    } __attribute__((packed)) *mbr = storage;
+
+    mbr->partitions[0].type = PARTITION_TYPE_LINUX;
+    mbr->partitions[0].lba_start = PARTITION_START_SECTOR;
+    mbr->partitions[0].sectors = size / 512 - PARTITION_START_SECTOR;
+    mbr->signature = 0xAA55;
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t storage_size = (argc > 1 ? strtoull(argv[1], NULL, 0) : DEFAULT_STORAGE_MIB) * 1024 * 1024;
+    uint64_t latency = argc > 2 ? strtoull(argv[2], NULL, 0) : 0;
+    uint64_t log_size = (argc > 3 ? strtoull(argv[3], NULL, 0) : 0) * 1024 * 1024;
+    if (storage_size <= log_size + PARTITION_START_SECTOR * 512) {
+        fprintf(stderr, "storage must be larger than the log and 1MiB\n");
+        return 1;
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&timer_cond, &attr);
+
+    pd_t *bench = &pds[PD_BENCH];
+    pd_t *virt = &pds[PD_VIRT];
+    pd_t *ramdisk = &pds[PD_RAMDISK];
+    pd_t *log = &pds[PD_LOG];
+    pd_setup(bench, "client", bench_init, bench_notified);
+    pd_setup(virt, "blk_virt", virt_init, virt_notified);
+    pd_setup(ramdisk, "blk_driver", ramdisk_init, ramdisk_notified);
+    pd_setup(log, "blk_log", log_init, log_notified);
+
+    /* Channels: bench 0 - virt 1, virt 0 - ramdisk 0 or with the log virt 0 - log 1 and log 0 - ramdisk 0,
+    and channel 1 of bench and ramdisk to the timer */
+    connect(bench, 0, virt, 1);
+    if (log_size) {
+        connect(virt, 0, log, 1);
+        connect(log, 0, ramdisk, 0);
+    } else {
+        connect(virt, 0, ramdisk, 0);
+    }
+    bench->channels[1].timer = true;
+    ramdisk->channels[1].timer = true;
+
+    blk_connection_resource_t client_conn = connection(0);
+    device_region_resource_t client_data = device_region(CLIENT_DATA_SIZE);
+    blk_connection_resource_t driver_conn = connection(0);
+    device_region_resource_t driver_data = device_region(DRIVER_DATA_SIZE);
+
+    memcpy(bench_blk_config.magic, SDDF_BLK_MAGIC, SDDF_BLK_MAGIC_LEN);
+    bench_blk_config.virt = client_conn;
+    bench_blk_config.data = client_data.region;
+
+    /* Output goes straight to stdout, the queue is only there to be initialised */
+    memcpy(bench_serial_config.magic, SDDF_SERIAL_MAGIC, SDDF_SERIAL_MAGIC_LEN);
+    bench_serial_config.tx.queue = region(0x1000);
+    bench_serial_config.tx.data = region(0x1000);
+
+    memcpy(bench_timer_config.magic, SDDF_TIMER_MAGIC, SDDF_TIMER_MAGIC_LEN);
+    bench_timer_config.driver_id = 1;
+
+    memcpy(virt_config.magic, SDDF_BLK_MAGIC, SDDF_BLK_MAGIC_LEN);
+    virt_config.num_clients = 1;
+    virt_config.driver.conn = driver_conn;
+    virt_config.driver.data = driver_data;
+    virt_config.clients[0].conn = peer_connection(client_conn, 1);
+    virt_config.clients[0].data = client_data;
+    virt_config.clients[0].partition = 0;
+    virt_config.scheduler = BLK_SCHED_FIFO;
+    virt_stats = region(BLK_STATS_SIZE(2));
+    virt_config.stats = virt_stats;
+
+    memcpy(ramdisk_config.magic, SDDF_BLK_MAGIC, SDDF_BLK_MAGIC_LEN);
+    ramdisk_config.virt = driver_conn;
+    ramdisk_config.data[0] = driver_data;
+    ramdisk_config.data[1] = client_data;
+    ramdisk_config.num_data = 2;
+    ramdisk_config.storage = region(storage_size);
+    ramdisk_config.latency = latency;
+    ramdisk_stats = region(BLK_STATS_SIZE(1));
+    ramdisk_config.stats = ramdisk_stats;
+
+    bench_stats_config.regions[0] = virt_stats;
+    bench_stats_config.regions[1] = ramdisk_stats;
+    bench_stats_config.num_regions = 2;
+    write_mbr(ramdisk_config.storage.vaddr, storage_size - log_size);
+
+    if (log_size) {
+        blk_connection_resource_t log_conn = connection(0);
+        memcpy(log_config.magic, SDDF_BLK_MAGIC, SDDF_BLK_MAGIC_LEN);
+        log_config.virt = peer_connection(driver_conn, 1);
+        log_config.driver = log_conn;
+        log_config.data[0] = driver_data;
+        log_config.data[1] = client_data;
+        log_config.num_data = 2;
+        log_config.stage = device_region(LOG_STAGE_SIZE);
+        log_config.log_blocks = log_size / BLK_TRANSFER_SIZE;
+
+        ramdisk_config.virt = log_conn;
+        ramdisk_config.data[2] = log_config.stage;
+        ramdisk_config.num_data = 3;
+    }
+
+    memcpy(ramdisk_timer_config.magic, SDDF_TIMER_MAGIC, SDDF_TIMER_MAGIC_LEN);
+    ramdisk_timer_config.driver_id = 1;
+
+    printf("HOST|INFO: %lu MiB ramdisk, %lu ns latency, %lu MiB log\n", storage_size / 1024 / 1024, latency,
+           log_size / 1024 / 1024);
+
+    start_time = time_now();
+    start_ticks = blk_stats_now();
+    pthread_t timer;
+    pthread_create(&timer, NULL, timer_thread, NULL);
+    for (int i = NUM_PDS - 1; i >= 0; i--) {
+        if (i != PD_LOG || log_size) {
+            pthread_create(&pds[i].thread, NULL, pd_thread, &pds[i]);
+        }
+    }
+
+    pthread_join(pds[PD_BENCH].thread, NULL);
+
+    return 1;
+}
@@ -0,0 +1,10 @@
+/*
+ * Copyright 2026, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/* This is a fake header file for running components as Linux threads. */
+
+#pragma once
+
+#include <os/sddf.h>
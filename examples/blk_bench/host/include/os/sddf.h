@@ -0,0 +1,28 @@
+/*
+ * Copyright 2026, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * This is a fake header file for running components as Linux threads. Each
+ * component runs on a thread of its own, and the functions below are
+ * implemented by the host shim in host.c.
+ */
+
+#pragma once
+
+#include <sel4/sel4.h>
+#include <stdint.h>
+
+typedef unsigned int sddf_channel;
+
+#define SDDF_NAME_LENGTH 64
+
+char *sddf_get_pd_name(void);
+void sddf_irq_ack(sddf_channel ch);
+void sddf_deferred_irq_ack(sddf_channel ch);
+void sddf_notify(sddf_channel ch);
+void sddf_deferred_notify(sddf_channel ch);
+seL4_MessageInfo_t sddf_ppcall(sddf_channel ch, seL4_MessageInfo_t msginfo);
+uint64_t sddf_get_mr(unsigned int n);
+void sddf_set_mr(unsigned int n, uint64_t val);
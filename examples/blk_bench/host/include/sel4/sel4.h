@@ -0,0 +1,26 @@
+/*
+ * Copyright 2026, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/* This is a fake header file for running components as Linux threads. */
+
+#pragma once
+
+#include <stdint.h>
+
+typedef struct seL4_MessageInfo {
+    uint64_t label;
+    uint64_t length;
+} seL4_MessageInfo_t;
+
+static inline seL4_MessageInfo_t seL4_MessageInfo_new(uint64_t label, uint64_t caps_unwrapped, uint64_t extra_caps,
+                                                      uint64_t length)
+{
+    return (seL4_MessageInfo_t) { .label = label, .length = length };
+}
+
+static inline uint64_t seL4_MessageInfo_get_label(seL4_MessageInfo_t info)
+{
+    return info.label;
+}
@@ -0,0 +1,175 @@
+# Copyright 2026, UNSW
+# SPDX-License-Identifier: BSD-2-Clause
+import os, sys
+import argparse
+import struct
+from sdfgen import SystemDescription, Sddf, DeviceTree
+
+sys.path.append(
+    os.path.join(os.path.dirname(os.path.abspath(__file__)), "../../tools/meta")
+)
+from board import BOARDS
+
+ProtectionDomain = SystemDescription.ProtectionDomain
+MemoryRegion = SystemDescription.MemoryRegion
+Map = SystemDescription.Map
+
+SDDF_BLK_MAX_CLIENTS = 64
+SDDF_BLK_MAX_QUEUES = 8
+# Size of a blk_connection_resource_t
+BLK_CONNECTION_SIZE = 56
+
+
+class BenchStatsConfig:
+    def __init__(self, regions):
+        self.regions = regions
+
+    """
+        Matches struct definition:
+        {
+            struct {
+                void *;
+                uint64_t;
+            } [2];
+            uint8_t;
+        }
+    """
+
+    def serialise(self) -> bytes:
+        num_regions = len(self.regions)
+        assert num_regions <= 2
+        regions = self.regions + [(0, 0)] * (2 - num_regions)
+        return struct.pack(
+            "<" + "qq" * 2 + "B",
+            *(field for region in regions for field in region),
+            num_regions,
+        )
+
+
+# The statistics regions of the block virtualiser and driver follow fields
+# that sdfgen does not know about, so those are appended to the generated
+# configs zeroed, which leaves them at their defaults, followed by the region.
+def append_config(data_name: str, extra: bytes):
+    assert os.path.isfile(data_name)
+    with open(data_name, "r+b") as f:
+        data = f.read()
+        # Aligned for the 64-bit fields that follow
+        f.write(bytes(-len(data) % 8))
+        f.write(extra)
+
+
+def append_blk_virt_stats(data_name: str, stats_vaddr: int, stats_size: int):
+    """
+    Matches the fields of blk_virt_config_t following the clients:
+    {
+        uint8_t;
+        region_resource_t;
+        blk_virt_config_sched_t [64];
+    }
+    where each blk_virt_config_sched_t is 16 bytes.
+    """
+    append_config(
+        data_name,
+        struct.pack("<Bxxxxxxxqq", 0, stats_vaddr, stats_size)
+        + bytes(16 * SDDF_BLK_MAX_CLIENTS),
+    )
+
+
+def append_blk_driver_stats(data_name: str, stats_vaddr: int, stats_size: int):
+    """
+    Matches the fields of blk_driver_config_t following the virt connection:
+    {
+        blk_connection_resource_t [7];
+        uint8_t;
+        region_resource_t;
+    }
+    """
+    append_config(
+        data_name,
+        bytes(BLK_CONNECTION_SIZE * (SDDF_BLK_MAX_QUEUES - 1))
+        + struct.pack("<Bxxxxxxxqq", 0, stats_vaddr, stats_size),
+    )
+
+
+def generate(sdf_file: str, output_dir: str, dtb: DeviceTree):
+    uart_node = dtb.node(board.serial)
+    assert uart_node is not None
+    blk_node = dtb.node(board.blk)
+    assert blk_node is not None
+    timer_node = dtb.node(board.timer)
+    assert timer_node is not None
+
+    serial_driver = ProtectionDomain("serial_driver", "serial_driver.elf", priority=200)
+    serial_virt_tx = ProtectionDomain(
+        "serial_virt_tx", "serial_virt_tx.elf", priority=199
+    )
+    timer_driver = ProtectionDomain("timer_driver", "timer_driver.elf", priority=201)
+    blk_driver = ProtectionDomain(
+        "blk_driver", "blk_driver.elf", priority=200, stack_size=0x2000
+    )
+    blk_virt = ProtectionDomain(
+        "blk_virt", "blk_virt.elf", priority=199, stack_size=0x2000
+    )
+    bench = ProtectionDomain("bench", "bench.elf", priority=1)
+
+    serial_system = Sddf.Serial(
+        sdf, uart_node, serial_driver, serial_virt_tx, enable_color=False
+    )
+    serial_system.add_client(bench)
+
+    # The benchmark timestamps requests with the timer
+    timer_system = Sddf.Timer(sdf, timer_node, timer_driver)
+    timer_system.add_client(bench)
+
+    blk_system = Sddf.Blk(sdf, blk_node, blk_driver, blk_virt)
+    partition = int(args.partition) if args.partition else board.partition
+    blk_system.add_client(bench, partition=partition)
+
+    pds = [serial_driver, serial_virt_tx, timer_driver, blk_driver, blk_virt, bench]
+    for pd in pds:
+        sdf.add_pd(pd)
+
+    # Share the virtualiser's and driver's statistics read-only with the benchmark
+    stats_regions = []
+    for i, pd in enumerate([blk_virt, blk_driver]):
+        stats_mr = MemoryRegion(sdf, f"blk_stats_{pd.name}", 0x1000)
+        sdf.add_mr(stats_mr)
+        pd.add_map(Map(stats_mr, 0x5_000_000, perms="rw"))
+        bench.add_map(Map(stats_mr, 0x6_000_000 + 0x1000 * i, perms="r"))
+        stats_regions.append((0x6_000_000 + 0x1000 * i, 0x1000))
+
+    assert blk_system.connect()
+    assert blk_system.serialise_config(output_dir)
+    append_blk_virt_stats(f"{output_dir}/blk_virt.data", 0x5_000_000, 0x1000)
+    append_blk_driver_stats(f"{output_dir}/blk_driver.data", 0x5_000_000, 0x1000)
+    with open(f"{output_dir}/bench_stats_config.data", "wb+") as f:
+        f.write(BenchStatsConfig(stats_regions).serialise())
+    assert serial_system.connect()
+    assert serial_system.serialise_config(output_dir)
+    assert timer_system.connect()
+    assert timer_system.serialise_config(output_dir)
+
+    with open(f"{output_dir}/{sdf_file}", "w+") as f:
+        f.write(sdf.render())
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--dtb", required=True)
+    parser.add_argument("--sddf", required=True)
+    parser.add_argument("--board", required=True, choices=[b.name for b in BOARDS])
+    parser.add_argument("--output", required=True)
+    parser.add_argument("--sdf", required=True)
+    parser.add_argument("--partition")
+
+    args = parser.parse_args()
+
+    board = next(filter(lambda b: b.name == args.board, BOARDS))
+
+    sdf = SystemDescription(board.arch, board.paddr_top)
+    sddf = Sddf(args.sddf)
+
+    with open(args.dtb, "rb") as f:
+        dtb = DeviceTree(f.read())
+
+    generate(args.sdf, args.output, dtb)
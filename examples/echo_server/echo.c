@@ -8,6 +8,7 @@
 #include <sddf/util/util.h>
 #include <string.h>
 #include <sddf/util/printf.h>
+#include <sddf/network/arp.h>
 #include <sddf/network/lib_sddf_lwip.h>
 #include <sddf/network/queue.h>
 #include <sddf/network/config.h>
@@ -16,6 +17,7 @@
 #include <sddf/timer/client.h>
 #include <sddf/timer/config.h>
 #include <sddf/benchmark/config.h>
+#include "lwip/netif.h"
 #include "lwip/pbuf.h"
 
 #include "echo.h"
@@ -28,8 +30,12 @@ __attribute__((__section__(".net_client_config"))) net_client_config_t net_confi
 
 __attribute__((__section__(".benchmark_client_config"))) benchmark_client_config_t benchmark_config;
 
+__attribute__((__section__(".benchmark_net_stats_config"))) benchmark_net_stats_config_t net_stats_config;
+
 __attribute__((__section__(".lib_sddf_lwip_config"))) lib_sddf_lwip_config_t lib_sddf_lwip_config;
 
+__attribute__((__section__(".echo_arp_config"))) echo_arp_config_t arp_config;
+
 serial_queue_handle_t serial_tx_queue_handle;
 
 net_queue_handle_t net_rx_handle;
@@ -46,6 +52,14 @@ net_queue_handle_t net_tx_handle;
 void netif_status_callback(char *ip_addr)
 {
     sddf_printf("DHCP request finished, IP address for netif %s is: %s\n", sddf_get_pd_name(), ip_addr);
+
+    if (arp_config.enabled) {
+        arp_err_t err = arp_register_ipv4(arp_config.id, ip4_addr_get_u32(netif_ip4_addr(netif_default)));
+        if (err != ARP_ERR_OKAY) {
+            sddf_dprintf("%s: failed to register IP address with the ARP component, error %d\n",
+                         sddf_get_pd_name(), err);
+        }
+    }
 }
 
 /**
@@ -73,7 +87,7 @@ void init(void)
     set_timeout();
 
     setup_udp_socket();
-    setup_utilization_socket(&benchmark_config);
+    setup_utilization_socket(&benchmark_config, &net_stats_config);
     setup_tcp_socket();
 
     sddf_lwip_maybe_notify();
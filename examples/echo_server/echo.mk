@@ -52,7 +52,7 @@ SDDF_CUSTOM_LIBC := 1
 vpath %.c ${SDDF} ${ECHO_SERVER}
 
 IMAGES := eth_driver.elf echo.elf benchmark.elf idle.elf \
-	  network_virt_rx.elf network_virt_tx.elf network_copy.elf \
+	  network_virt_rx.elf network_virt_tx.elf network_copy.elf network_arp.elf \
 	  timer_driver.elf serial_driver.elf serial_virt_tx.elf
 
 
@@ -110,6 +110,8 @@ endif
 	$(OBJCOPY) --update-section .net_virt_tx_config=net_virt_tx.data network_virt_tx.elf
 	$(OBJCOPY) --update-section .net_copy_config=net_copy_client0_net_copier.data network_copy.elf network_copy0.elf
 	$(OBJCOPY) --update-section .net_copy_config=net_copy_client1_net_copier.data network_copy.elf network_copy1.elf
+	$(OBJCOPY) --update-section .net_copy_config=net_copy_net_arp_net_copier.data network_copy.elf network_copy2.elf
+	$(OBJCOPY) --update-section .net_arp_config=net_arp.data network_arp.elf
 	$(OBJCOPY) --update-section .device_resources=timer_driver_device_resources.data timer_driver.elf
 	$(OBJCOPY) --update-section .timer_client_config=timer_client_client0.data echo0.elf
 	$(OBJCOPY) --update-section .net_client_config=net_client_client0.data echo0.elf
@@ -119,6 +121,8 @@ endif
 	$(OBJCOPY) --update-section .serial_client_config=serial_client_client1.data echo1.elf
 	$(OBJCOPY) --update-section .lib_sddf_lwip_config=lib_sddf_lwip_config_client0.data echo0.elf
 	$(OBJCOPY) --update-section .lib_sddf_lwip_config=lib_sddf_lwip_config_client1.data echo1.elf
+	$(OBJCOPY) --update-section .echo_arp_config=echo_arp_config_client0.data echo0.elf
+	$(OBJCOPY) --update-section .echo_arp_config=echo_arp_config_client1.data echo1.elf
 	touch $@
 
 ${IMAGE_FILE} $(REPORT_FILE): $(IMAGES) $(SYSTEM_FILE)
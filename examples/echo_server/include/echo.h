@@ -5,6 +5,8 @@
 
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <os/sddf.h>
 
 #define UDP_ECHO_PORT 1235
@@ -13,6 +15,13 @@
 
 #define TCP_ECHO_MAX_CONNS 4
 
+typedef struct echo_arp_config {
+    /* Whether the system has an ARP component answering for the client */
+    bool enabled;
+    /* Channel over which the client registers its IP address */
+    uint8_t id;
+} echo_arp_config_t;
+
 int setup_udp_socket(void);
-int setup_utilization_socket(void *benchmark_config);
+int setup_utilization_socket(void *benchmark_config, void *net_stats_config);
 int setup_tcp_socket(void);
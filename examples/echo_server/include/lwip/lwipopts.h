@@ -102,6 +102,15 @@
 #define CHECKSUM_GEN_ICMP               0
 #define CHECKSUM_GEN_ICMP6              0
 
+#elif defined(NETWORK_HW_HAS_PARTIAL_CHECKSUM)
+
+/* Leave TCP and UDP checksums on tx to hw, which cannot generate the rest */
+#define CHECKSUM_GEN_IP                 1
+#define CHECKSUM_GEN_UDP                0
+#define CHECKSUM_GEN_TCP                0
+#define CHECKSUM_GEN_ICMP               1
+#define CHECKSUM_GEN_ICMP6              1
+
 #else
 
 #define CHECKSUM_GEN_IP                 1
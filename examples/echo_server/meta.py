@@ -152,6 +152,221 @@ class BenchmarkConfig:
         )
 
 
+class BenchmarkNetStatsConfig:
+    def __init__(self, regions: List[Tuple[int, int]]):
+        self.regions = regions
+
+    """
+        Matches struct definition:
+        {
+            struct {
+                void *;
+                uint64_t;
+            } [4];
+            uint8_t;
+        }
+    """
+
+    def serialise(self) -> bytes:
+        num_regions = len(self.regions)
+        assert num_regions <= 4
+        regions = self.regions + [(0, 0)] * (4 - num_regions)
+        return struct.pack(
+            "<" + "qq" * 4 + "B",
+            *(field for region in regions for field in region),
+            num_regions,
+        )
+
+
+def append_config(data_name: str, extra: bytes):
+    data_name += ".data"
+    assert os.path.isfile(data_name)
+    with open(data_name, "r+b") as f:
+        data = f.read()
+        # Aligned for the 64-bit fields that follow
+        f.write(bytes(-len(data) % 8))
+        f.write(extra)
+
+
+# The statistics region of a network virtualiser directly follows the fields
+# serialised by sdfgen, which does not know about it, so it is appended to the
+# generated config. Matches struct definition: { void *; uint64_t; }
+def append_net_stats(data_name: str, stats_vaddr: int, stats_size: int):
+    append_config(data_name, struct.pack("<qq", stats_vaddr, stats_size))
+
+
+# Offset of the id of a net_connection_resource_t within it
+NET_CONNECTION_ID_OFFSET = 34
+
+
+class NetConnection:
+    def __init__(
+        self,
+        free_queue: int,
+        active_queue: int,
+        queue_size: int,
+        num_buffers: int,
+        id: int,
+    ):
+        self.free_queue = free_queue
+        self.active_queue = active_queue
+        self.queue_size = queue_size
+        self.num_buffers = num_buffers
+        self.id = id
+
+    """
+        Matches struct definition:
+        {
+            region_resource_t;
+            region_resource_t;
+            uint16_t;
+            uint8_t;
+        }
+    """
+
+    def serialise(self) -> bytes:
+        return struct.pack(
+            "<qqqqHBxxxxx",
+            self.free_queue,
+            self.queue_size,
+            self.active_queue,
+            self.queue_size,
+            self.num_buffers,
+            self.id,
+        )
+
+
+class NetVirtTxSchedConfig:
+    def __init__(self, weight=0, priority=False, rate_limit=0, burst_bytes=0):
+        self.weight = weight
+        self.priority = priority
+        self.rate_limit = rate_limit
+        self.burst_bytes = burst_bytes
+
+    """
+        Matches struct definition:
+        {
+            uint16_t;
+            bool;
+            uint64_t;
+            uint32_t;
+        }
+    """
+
+    def serialise(self) -> bytes:
+        return struct.pack(
+            "<H?xxxxxQIxxxx",
+            self.weight,
+            self.priority,
+            self.rate_limit,
+            self.burst_bytes,
+        )
+
+
+# Fields of the Tx virtualiser config following those serialised by sdfgen,
+# which does not know about them, so they are appended to the generated config
+class NetVirtTxExtraConfig:
+    def __init__(
+        self,
+        stats_vaddr: int,
+        stats_size: int,
+        driver_csum_partial: bool,
+        driver_priority: Optional[NetConnection],
+        sched: List[NetVirtTxSchedConfig],
+    ):
+        self.stats_vaddr = stats_vaddr
+        self.stats_size = stats_size
+        self.driver_csum_partial = driver_csum_partial
+        self.driver_priority = driver_priority
+        self.sched = sched
+
+    """
+        Matches struct definition:
+        {
+            region_resource_t;
+            uint16_t;
+            bool;
+            net_connection_resource_t;
+            net_virt_tx_client_sched_config_t [];
+        }
+    """
+
+    def serialise(self) -> bytes:
+        driver_priority = self.driver_priority or NetConnection(0, 0, 0, 0, 0)
+        # A driver budget of 0 leaves it at the driver's queue capacity
+        return (
+            struct.pack(
+                "<qqH?xxxxx",
+                self.stats_vaddr,
+                self.stats_size,
+                0,
+                self.driver_csum_partial,
+            )
+            + driver_priority.serialise()
+            + b"".join(sched.serialise() for sched in self.sched)
+        )
+
+
+# The MAC address is the last field of a net_client_config_t, which may be padded
+def net_client_mac_offset(client_config: bytes) -> int:
+    return (len(client_config) - 6) & ~7
+
+
+class NetArpConfig:
+    def __init__(self, client_config: bytes, clients: List[Tuple[int, bytes]]):
+        self.client_config = client_config
+        self.clients = clients
+
+    """
+        Matches struct definition:
+        {
+            char [5];
+            net_connection_resource_t;
+            region_resource_t;
+            net_connection_resource_t;
+            region_resource_t;
+            struct {
+                uint8_t;
+                uint8_t [6];
+            } [64];
+            uint8_t;
+        }
+        where the fields up to the clients are those of the ARP component's own
+        net_client_config_t, which are followed by its MAC address.
+    """
+
+    def serialise(self) -> bytes:
+        mac_offset = net_client_mac_offset(self.client_config)
+        client_bytes = bytearray()
+        for client in self.clients:
+            assert len(client[1]) == 6
+            client_bytes.extend(client[0].to_bytes(1, "little"))
+            client_bytes.extend(client[1])
+
+        client_bytes = client_bytes.ljust(64 * 7, b"\0")
+        return (
+            self.client_config[:mac_offset]
+            + bytes(client_bytes)
+            + len(self.clients).to_bytes(1, "little")
+        )
+
+
+class EchoArpConfig:
+    def __init__(self, ch_arp: int):
+        self.ch_arp = ch_arp
+
+    """
+        Matches struct definition:
+        {
+            bool;
+            uint8_t;
+        }
+    """
+
+    def serialise(self) -> bytes:
+        return struct.pack("<?B", True, self.ch_arp)
+
+
 # Adds ".elf" to elf strings
 def copy_elf(source_elf: str, new_elf: str, elf_number=None):
     source_elf += ".elf"
@@ -339,12 +554,60 @@ def generate(
         cpu=get_core("client1_net_copier"),
     )
 
+    # The ARP component answers ARP requests for the clients' IP addresses,
+    # which they register with it once DHCP has assigned them
+    net_arp = ProtectionDomain(
+        "net_arp", "network_arp.elf", priority=98, cpu=get_core("net_arp")
+    )
+    net_arp_net_copier_elf = copy_elf("network_copy", "network_copy", 2)
+    net_arp_net_copier = ProtectionDomain(
+        "net_arp_net_copier",
+        net_arp_net_copier_elf,
+        priority=98,
+        budget=20000,
+        cpu=get_core("net_arp_net_copier"),
+    )
+    arp_channels = []
+    for client in [client0, client1]:
+        arp_channel = Channel(client, net_arp, pp=Channel.End.A)
+        sdf.add_channel(arp_channel)
+        arp_channels.append((client, arp_channel))
+
+    # On boards with the i.MX ENET driver, packets of the priority class are
+    # passed to the driver over a queue it drains ahead of the bulk one
+    driver_priority = None
+    if board.name in ["imx8mm_evk", "imx8mq_evk", "maaxboard"]:
+        driver_priority = []
+        for queue in ["free", "active"]:
+            queue_mr = MemoryRegion(sdf, f"net_driver_priority_{queue}", 0x1000)
+            sdf.add_mr(queue_mr)
+            vaddr = 0x5_100_000 + 0x1000 * len(driver_priority)
+            ethernet_driver.add_map(Map(queue_mr, vaddr, perms="rw"))
+            net_virt_tx.add_map(Map(queue_mr, vaddr, perms="rw"))
+            driver_priority.append(vaddr)
+
+    # Share the virtualisers' statistics read-only with the benchmarking client
+    net_stats_vaddrs = []
+    for i, virt in enumerate([net_virt_rx, net_virt_tx]):
+        net_stats_mr = MemoryRegion(sdf, f"net_stats_{virt.name}", 0x1000)
+        sdf.add_mr(net_stats_mr)
+        virt.add_map(Map(net_stats_mr, 0x5_000_000, perms="rw"))
+        client0.add_map(Map(net_stats_mr, 0x21_000_000 + 0x1000 * i, perms="r"))
+        net_stats_vaddrs.append(0x21_000_000 + 0x1000 * i)
+
     serial_system.add_client(client0)
     serial_system.add_client(client1)
     timer_system.add_client(client0)
     timer_system.add_client(client1)
-    net_system.add_client_with_copier(client0, client0_net_copier)
-    net_system.add_client_with_copier(client1, client1_net_copier)
+    # Clients of the Tx virtualiser are numbered in the order they are added.
+    # ARP replies are sent as priority class packets ahead of the echo traffic.
+    net_clients = [
+        (client0, client0_net_copier, False),
+        (client1, client1_net_copier, False),
+        (net_arp, net_arp_net_copier, True),
+    ]
+    for client, copier, _ in net_clients:
+        net_system.add_client_with_copier(client, copier)
 
     client0_lib_sddf_lwip = Sddf.Lwip(sdf, net_system, client0)
     client1_lib_sddf_lwip = Sddf.Lwip(sdf, net_system, client1)
@@ -360,6 +623,8 @@ def generate(
         client0_net_copier,
         client1,
         client1_net_copier,
+        net_arp,
+        net_arp_net_copier,
         timer_driver,
     ]
 
@@ -477,6 +742,51 @@ def generate(
     assert serial_system.serialise_config(output_dir)
     assert net_system.connect()
     assert net_system.serialise_config(output_dir)
+    append_net_stats(f"{output_dir}/{net_virt_rx.name}", 0x5_000_000, 0x1000)
+    driver_priority_conn = None
+    if driver_priority is not None:
+        # Notifications for priority packets share the channel of their bulk
+        # counterparts, so the connections reuse its ids
+        with open(f"{output_dir}/net_driver.data", "rb") as f:
+            driver_config = f.read()
+        # Follows the magic and the virt_rx connection
+        virt_tx_id = driver_config[8 + 40 + NET_CONNECTION_ID_OFFSET]
+        append_config(
+            f"{output_dir}/net_driver",
+            NetConnection(*driver_priority, 0x1000, 128, virt_tx_id).serialise(),
+        )
+        with open(f"{output_dir}/{net_virt_tx.name}.data", "rb") as f:
+            # The driver connection follows the magic
+            driver_id = f.read()[8 + NET_CONNECTION_ID_OFFSET]
+        driver_priority_conn = NetConnection(*driver_priority, 0x1000, 128, driver_id)
+    # The virtIO net devices of these boards offer VIRTIO_NET_F_CSUM, so the
+    # driver passes partial checksums on for the device to complete
+    driver_csum_partial = board.name in [
+        "qemu_virt_aarch64",
+        "qemu_virt_riscv64",
+        "x86_64_generic",
+    ]
+    virt_tx_config = NetVirtTxExtraConfig(
+        0x5_000_000,
+        0x1000,
+        driver_csum_partial,
+        driver_priority_conn,
+        [NetVirtTxSchedConfig(priority=priority) for _, _, priority in net_clients],
+    )
+    append_config(f"{output_dir}/{net_virt_tx.name}", virt_tx_config.serialise())
+    arp_clients = []
+    for client, arp_channel in arp_channels:
+        with open(f"{output_dir}/net_client_{client.name}.data", "rb") as f:
+            client_config = f.read()
+        mac_offset = net_client_mac_offset(client_config)
+        client_mac = client_config[mac_offset : mac_offset + 6]
+        with open(f"{output_dir}/echo_arp_config_{client.name}.data", "wb+") as f:
+            f.write(EchoArpConfig(arp_channel.pd_a_id).serialise())
+        arp_clients.append((arp_channel.pd_b_id, client_mac))
+    with open(f"{output_dir}/net_client_{net_arp.name}.data", "rb") as f:
+        arp_config = NetArpConfig(f.read(), arp_clients)
+    with open(f"{output_dir}/net_arp.data", "wb+") as f:
+        f.write(arp_config.serialise())
     assert timer_system.connect()
     assert timer_system.serialise_config(output_dir)
     assert client0_lib_sddf_lwip.connect()
@@ -495,6 +805,15 @@ def generate(
         client0_elf, "benchmark_client_config", "benchmark_client_config"
     )
 
+    net_stats_config = BenchmarkNetStatsConfig(
+        [(vaddr, 0x1000) for vaddr in net_stats_vaddrs]
+    )
+    with open(f"{output_dir}/benchmark_net_stats_config.data", "wb+") as f:
+        f.write(net_stats_config.serialise())
+    update_elf_section(
+        client0_elf, "benchmark_net_stats_config", "benchmark_net_stats_config"
+    )
+
     for i in range(num_cores):
         core = core_objs[i]["core"]
         update_elf_section(
@@ -12,6 +12,8 @@
 
 #include <sddf/benchmark/bench.h>
 #include <sddf/benchmark/config.h>
+#include <sddf/network/config.h>
+#include <sddf/network/stats.h>
 #include <sddf/util/printf.h>
 
 #include "echo.h"
@@ -68,6 +70,7 @@ static struct tcp_pcb *utiliz_socket;
     ","STR(y)","STR(z)
 
 benchmark_client_config_t *bench;
+benchmark_net_stats_config_t *net_stats;
 
 uint64_t core_ccount_start[CONFIG_MAX_NUM_NODES];
 uint64_t idle_ccount_start[CONFIG_MAX_NUM_NODES];
@@ -105,6 +108,42 @@ static inline void my_itoa(uint64_t n, char s[])
     my_reverse(s);
 }
 
+static const char *net_stats_components[] = { "unknown", "virt_rx", "virt_tx", "copy", "arp", "vswitch" };
+
+static const char *net_drop_reasons[NET_DROP_NUM_REASONS] = { "no_buffer", "no_match", "filtered", "invalid",
+                                                               "denied", "queue_full" };
+
+/* Large enough for the connections of a Tx virtualiser with the most clients */
+#define NET_STATS_MAX_QUEUES (NET_TX_NUM_CLASSES * (1 + SDDF_NET_MAX_CLIENTS))
+
+static uint64_t net_stats_snapshot[NET_STATS_SIZE(NET_STATS_MAX_QUEUES) / sizeof(uint64_t)];
+
+/* Print the counters of the network components shared with this client, accumulated since boot */
+static void print_net_stats(void)
+{
+    net_stats_t *snapshot = (net_stats_t *)net_stats_snapshot;
+    for (uint8_t i = 0; i < net_stats->num_regions; i++) {
+        if (!net_stats_read(net_stats->regions[i].vaddr, snapshot, NET_STATS_MAX_QUEUES)) {
+            sddf_printf("NET_STATS|region %u is not initialised\n", i);
+            continue;
+        }
+
+        const char *component = (snapshot->component < ARRAY_SIZE(net_stats_components))
+                                  ? net_stats_components[snapshot->component]
+                                  : net_stats_components[0];
+        for (uint32_t q = 0; q < snapshot->num_queues; q++) {
+            net_queue_stats_t *qs = &snapshot->queues[q];
+            sddf_printf("NET_STATS|%s queue %u: packets %lu bytes %lu notify %lu/%lu occupancy %u/%u drops", component,
+                        q, qs->packets, qs->bytes, qs->notify_sent, qs->notify_sent + qs->notify_suppressed,
+                        qs->max_occupancy, qs->capacity);
+            for (uint8_t r = 0; r < NET_DROP_NUM_REASONS; r++) {
+                sddf_printf(" %s=%lu", net_drop_reasons[r], qs->drops[r]);
+            }
+            sddf_printf("\n");
+        }
+    }
+}
+
 static err_t utilization_sent_callback(void *arg, struct tcp_pcb *pcb, u16_t len)
 {
     return ERR_OK;
@@ -142,6 +181,7 @@ static err_t utilization_recv_callback(void *arg, struct tcp_pcb *pcb, struct pb
         }
     } else if (msg_match(data_packet_str, STOP)) {
         sddf_printf("%s measurement finished \n", sddf_get_pd_name());
+        print_net_stats();
 
         uint64_t total = 0, idle = 0;
         for (uint8_t i = 0; i < bench->num_cores; i++) {
@@ -197,9 +237,10 @@ static err_t utilization_accept_callback(void *arg, struct tcp_pcb *newpcb, err_
     return ERR_OK;
 }
 
-int setup_utilization_socket(void *benchmark_config)
+int setup_utilization_socket(void *benchmark_config, void *net_stats_config)
 {
     bench = (benchmark_client_config_t *)benchmark_config;
+    net_stats = (benchmark_net_stats_config_t *)net_stats_config;
 
     utiliz_socket = tcp_new_ip_type(IPADDR_TYPE_V4);
     if (utiliz_socket == NULL) {
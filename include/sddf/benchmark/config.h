@@ -8,6 +8,7 @@
 #include <os/sddf.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <sddf/resources/common.h>
 #include "bench.h"
 
 /* At the moment we run systems that contain this benchmarking code on architectures
@@ -30,6 +31,7 @@
 #endif
 
 #define BENCHMARK_MAX_CHILDREN 64 // TODO: Can we have a higher upper bound on this?
+#define BENCHMARK_MAX_NET_STATS 4
 
 typedef struct benchmark_child_config {
     char name[SDDF_NAME_LENGTH];
@@ -88,3 +90,12 @@ typedef struct benchmark_client_config {
     with the idle thread on that core. */
     void *core_ccounts[CONFIG_MAX_NUM_NODES];
 } benchmark_client_config_t;
+
+typedef struct benchmark_net_stats_config {
+    /* Statistics regions of network components, shared read-only with the
+    benchmarking client, which prints them when a benchmark finishes. See
+    sddf/network/stats.h. */
+    region_resource_t regions[BENCHMARK_MAX_NET_STATS];
+    /* Number of statistics regions. */
+    uint8_t num_regions;
+} benchmark_net_stats_config_t;
@@ -11,9 +11,12 @@
 #include <sddf/resources/common.h>
 #include <sddf/resources/device.h>
 #include <sddf/blk/queue.h>
+#include <sddf/blk/stats.h>
 #include <sddf/blk/storage_info.h>
 
 #define SDDF_BLK_MAX_CLIENTS 64
+/* Most connections a driver can have, one for each device queue it uses */
+#define SDDF_BLK_MAX_QUEUES 8
 
 #define SDDF_BLK_MAGIC_LEN 5
 static char SDDF_BLK_MAGIC[SDDF_BLK_MAGIC_LEN] = { 's', 'D', 'D', 'F', 0x2 };
@@ -29,14 +32,57 @@ typedef struct blk_connection_resource {
 typedef struct blk_driver_config {
     char magic[SDDF_BLK_MAGIC_LEN];
     blk_connection_resource_t virt;
+    /**
+     * Optional connections in addition to virt, for drivers of devices with
+     * several hardware queues. Each connection is served on a device queue of
+     * its own, so that virtualisers submitting from different cores do not
+     * contend for one. Every connection has its own storage info.
+     */
+    blk_connection_resource_t virt_queues[SDDF_BLK_MAX_QUEUES - 1];
+    uint8_t num_virt_queues;
+    /**
+     * Optional region the driver exports its statistics in, of at least
+     * BLK_STATS_SIZE(num_virt_queues + 1) bytes. See sddf/blk/stats.h.
+     */
+    region_resource_t stats;
 } blk_driver_config_t;
 
+/* Policy the virtualiser uses to choose which client's requests to pass on next */
+typedef enum blk_sched_policy {
+    /* clients are served in index order, each until its queue is empty */
+    BLK_SCHED_FIFO = 0,
+    /* deadline clients first, then fair clients by deficit round robin over bytes */
+    BLK_SCHED_FAIR,
+} blk_sched_policy_t;
+
+typedef enum blk_sched_class {
+    BLK_SCHED_CLASS_FAIR = 0,
+    /* latency sensitive, served strictly ahead of fair clients */
+    BLK_SCHED_CLASS_DEADLINE,
+} blk_sched_class_t;
+
 typedef struct blk_virt_config_client {
     blk_connection_resource_t conn;
     device_region_resource_t data;
     uint32_t partition;
 } blk_virt_config_client_t;
 
+/**
+ * Scheduling parameters of a client, only used with BLK_SCHED_FAIR. Fair
+ * clients share the device in proportion to their weight, a weight of 0 is
+ * treated as 1. The IOPS and bandwidth (in bytes per second) caps apply to
+ * both classes, 0 disables a cap. Capped clients may burst up to a tenth of a
+ * second's worth of their limit. Caps require the virtualiser to be given a
+ * timer client config.
+ */
+typedef struct blk_virt_config_sched {
+    /* blk_sched_class_t */
+    uint8_t sched_class;
+    uint16_t weight;
+    uint32_t iops_limit;
+    uint64_t bandwidth_limit;
+} blk_virt_config_sched_t;
+
 typedef struct blk_virt_config_driver {
     blk_connection_resource_t conn;
     device_region_resource_t data;
@@ -47,8 +93,109 @@ typedef struct blk_virt_config {
     uint64_t num_clients;
     blk_virt_config_driver_t driver;
     blk_virt_config_client_t clients[SDDF_BLK_MAX_CLIENTS];
+    /* blk_sched_policy_t */
+    uint8_t scheduler;
+    /**
+     * Optional region the virtualiser exports its statistics in, of at least
+     * BLK_STATS_SIZE(num_clients + 1) bytes. See sddf/blk/stats.h.
+     */
+    region_resource_t stats;
+    /**
+     * Scheduling parameters of clients[i]. They are kept apart from clients,
+     * after every other field, so that configs generated without them keep
+     * their layout and leave every client an uncapped fair client of equal
+     * weight.
+     */
+    blk_virt_config_sched_t sched[SDDF_BLK_MAX_CLIENTS];
 } blk_virt_config_t;
 
+typedef enum blk_cache_mode {
+    BLK_CACHE_WRITE_THROUGH = 0,
+    BLK_CACHE_WRITE_BACK,
+} blk_cache_mode_t;
+
+typedef struct blk_cache_config {
+    char magic[SDDF_BLK_MAGIC_LEN];
+    /* connection to the virtualiser, to which the cache acts as the driver */
+    blk_connection_resource_t virt;
+    blk_connection_resource_t driver;
+    /**
+     * Data regions of the virtualiser and its clients. Requests refer to
+     * buffers by IO address, which the cache resolves against these regions
+     * to copy blocks to and from its own memory.
+     */
+    device_region_resource_t data[SDDF_BLK_MAX_CLIENTS + 1];
+    uint8_t num_data;
+    /* region holding cached blocks, one per BLK_TRANSFER_SIZE bytes */
+    device_region_resource_t cache;
+    /* blk_cache_mode_t */
+    uint8_t mode;
+} blk_cache_config_t;
+
+/* Most member devices of a RAID component */
+#define SDDF_BLK_MAX_RAID_DEVICES 8
+
+typedef enum blk_raid_level {
+    /* blocks are striped across the devices in chunks (RAID-0) */
+    BLK_RAID_STRIPE = 0,
+    /* every device holds a copy of every block (RAID-1) */
+    BLK_RAID_MIRROR,
+} blk_raid_level_t;
+
+typedef struct blk_raid_config {
+    char magic[SDDF_BLK_MAGIC_LEN];
+    /* connection to the virtualiser, to which the component acts as the driver */
+    blk_connection_resource_t virt;
+    /* connections to the drivers of the member devices, in stripe order */
+    blk_connection_resource_t drivers[SDDF_BLK_MAX_RAID_DEVICES];
+    uint8_t num_drivers;
+    /* blk_raid_level_t */
+    uint8_t level;
+    /* size of a stripe chunk in BLK_TRANSFER_SIZE units, only used with BLK_RAID_STRIPE */
+    uint16_t chunk_blocks;
+} blk_raid_config_t;
+
+typedef struct blk_log_config {
+    char magic[SDDF_BLK_MAGIC_LEN];
+    /* connection to the virtualiser, to which the log acts as the driver */
+    blk_connection_resource_t virt;
+    blk_connection_resource_t driver;
+    /**
+     * Data regions of the virtualiser and its clients, against which the IO
+     * addresses of requests are resolved, as with the block cache.
+     */
+    device_region_resource_t data[SDDF_BLK_MAX_CLIENTS + 1];
+    uint8_t num_data;
+    /* region staging log records and blocks being written back, in BLK_TRANSFER_SIZE units */
+    device_region_resource_t stage;
+    /* blocks at the end of the device holding the log, in BLK_TRANSFER_SIZE units */
+    uint32_t log_blocks;
+} blk_log_config_t;
+
+typedef struct blk_ramdisk_config {
+    char magic[SDDF_BLK_MAGIC_LEN];
+    blk_connection_resource_t virt;
+    /**
+     * Data regions of the virtualiser and its clients, against which the IO
+     * addresses of requests are resolved, as with the block cache.
+     */
+    device_region_resource_t data[SDDF_BLK_MAX_CLIENTS + 1];
+    uint8_t num_data;
+    /* memory backing the disk, its size in BLK_TRANSFER_SIZE units is the capacity */
+    region_resource_t storage;
+    /**
+     * Optional time in nanoseconds each request takes to complete, 0 completes
+     * requests immediately. Requires the driver to be given a timer client
+     * config.
+     */
+    uint64_t latency;
+    /**
+     * Optional region the driver exports its statistics in, of at least
+     * BLK_STATS_SIZE(1) bytes. See sddf/blk/stats.h.
+     */
+    region_resource_t stats;
+} blk_ramdisk_config_t;
+
 typedef struct blk_client_config {
     char magic[SDDF_BLK_MAGIC_LEN];
     blk_connection_resource_t virt;
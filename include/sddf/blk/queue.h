@@ -10,6 +10,7 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include <sddf/util/fence.h>
+#include <sddf/util/util.h>
 
 /* Size of a single block to be transferred */
 #define BLK_TRANSFER_SIZE 4096
@@ -20,6 +21,10 @@ typedef enum blk_req_code {
     BLK_REQ_WRITE,
     BLK_REQ_FLUSH,
     BLK_REQ_BARRIER,
+    /* the blocks are no longer needed, their contents are undefined afterwards. The buffer is ignored */
+    BLK_REQ_DISCARD,
+    /* the blocks read as zeroes afterwards. The buffer is ignored */
+    BLK_REQ_WRITE_ZEROES,
 } blk_req_code_t;
 
 /* Response status for block */
@@ -52,11 +57,21 @@ typedef struct blk_resp {
     uint32_t id; /* stores corresponding request ID */
 } blk_resp_t;
 
+/*
+ * Values of a queue's consumer_signalled flag. Consumers that never request
+ * signalling leave it zeroed and are signalled whenever the producer has
+ * enqueued, so signal suppression only applies to consumers opting into it.
+ */
+#define BLK_QUEUE_SIGNAL_ALWAYS 0
+#define BLK_QUEUE_SIGNAL_REQUESTED 1
+#define BLK_QUEUE_SIGNAL_SENT 2
+
 /* Circular buffer containing requests */
 typedef struct blk_req_queue {
     uint32_t head;
     uint32_t tail;
     bool plugged; /* prevent requests from being dequeued when plugged */
+    uint32_t consumer_signalled; /* whether consumer requires signalling, one of BLK_QUEUE_SIGNAL_* */
     blk_req_t buffers[];
 } blk_req_queue_t;
 
@@ -64,6 +79,7 @@ typedef struct blk_req_queue {
 typedef struct blk_resp_queue {
     uint32_t head;
     uint32_t tail;
+    uint32_t consumer_signalled; /* whether consumer requires signalling, one of BLK_QUEUE_SIGNAL_* */
     blk_resp_t buffers[];
 } blk_resp_queue_t;
 
@@ -269,6 +285,38 @@ static inline int blk_dequeue_req(blk_queue_handle_t *h, blk_req_code_t *code, u
     return 0;
 }
 
+/**
+ * Read the element at the head of the request queue without dequeueing it.
+ *
+ * @param h queue handle containing request queue to read from.
+ * @param code pointer to request code.
+ * @param io_or_offset pointer to offset of buffer within buffer memory region or io address of buffer
+ * @param block_number pointer to  block number to read/write to.
+ * @param count pointer to number of blocks to read/write.
+ * @param id pointer to store request ID.
+ *
+ * @return -1 when request queue is empty, 0 on success.
+ */
+static inline int blk_peek_req(blk_queue_handle_t *h, blk_req_code_t *code, uintptr_t *io_or_offset,
+                               uint64_t *block_number, uint16_t *count, uint32_t *id)
+{
+    struct blk_req *brp;
+    struct blk_req_queue *brqp;
+    if (blk_queue_empty_req(h)) {
+        return -1;
+    }
+
+    brqp = h->req_queue;
+    brp = brqp->buffers + (brqp->head % h->capacity);
+    *code = brp->code;
+    *io_or_offset = brp->io_or_offset;
+    *block_number = brp->block_number;
+    *count = brp->count;
+    *id = brp->id;
+
+    return 0;
+}
+
 /**
  * Dequeue an element from a response queue.
  *
@@ -301,6 +349,291 @@ static inline int blk_dequeue_resp(blk_queue_handle_t *h,
     return 0;
 }
 
+/**
+ * Enqueue an element into the request queue without making it visible to the
+ * consumer, advancing a local tail instead. Publish a batch of requests
+ * enqueued this way with blk_req_update_shared_tail().
+ *
+ * @param h queue handle containing request queue to enqueue to.
+ * @param local_tail address of the tail to be used and incremented.
+ * @param code request code.
+ * @param io_or_offset offset of buffer within buffer memory region or io address of buffer.
+ * @param block_number block number to read/write to.
+ * @param count the number of blocks to read/write
+ * @param id request ID to identify this request.
+ *
+ * @return -1 when request queue is full, 0 on success.
+ */
+static inline int blk_enqueue_req_local(blk_queue_handle_t *h, uint32_t *local_tail, blk_req_code_t code,
+                                        uintptr_t io_or_offset, uint64_t block_number, uint16_t count, uint32_t id)
+{
+    struct blk_req *brp;
+    struct blk_req_queue *brqp = h->req_queue;
+
+    if (*local_tail - brqp->head == h->capacity) {
+        return -1;
+    }
+
+    brp = brqp->buffers + (*local_tail % h->capacity);
+    brp->code = code;
+    brp->io_or_offset = io_or_offset;
+    brp->block_number = block_number;
+    brp->count = count;
+    brp->id = id;
+    (*local_tail)++;
+
+    return 0;
+}
+
+/**
+ * Enqueue an element into the response queue without making it visible to the
+ * consumer, advancing a local tail instead. Publish a batch of responses
+ * enqueued this way with blk_resp_update_shared_tail().
+ *
+ * @param h queue handle containing response queue to enqueue to.
+ * @param local_tail address of the tail to be used and incremented.
+ * @param status response status.
+ * @param success_count number of blocks successfully read/written
+ * @param id request ID to identify which request the response is for.
+ *
+ * @return -1 when response queue is full, 0 on success.
+ */
+static inline int blk_enqueue_resp_local(blk_queue_handle_t *h, uint32_t *local_tail, blk_resp_status_t status,
+                                         uint16_t success_count, uint32_t id)
+{
+    struct blk_resp *brp;
+    struct blk_resp_queue *brqp = h->resp_queue;
+
+    if (*local_tail - brqp->head == h->capacity) {
+        return -1;
+    }
+
+    brp = brqp->buffers + (*local_tail % h->capacity);
+    brp->status = status;
+    brp->success_count = success_count;
+    brp->id = id;
+    (*local_tail)++;
+
+    return 0;
+}
+
+/**
+ * Dequeue an element from the request queue without returning its slot to the
+ * producer, advancing a local head instead. Release a batch of requests
+ * dequeued this way with blk_req_update_shared_head().
+ *
+ * @param h queue handle containing request queue to dequeue from.
+ * @param local_head address of the head to be used and incremented.
+ * @param code pointer to request code.
+ * @param io_or_offset pointer to offset of buffer within buffer memory region or io address of buffer
+ * @param block_number pointer to  block number to read/write to.
+ * @param count pointer to number of blocks to read/write.
+ * @param id pointer to store request ID.
+ *
+ * @return -1 when request queue is empty, 0 on success.
+ */
+static inline int blk_dequeue_req_local(blk_queue_handle_t *h, uint32_t *local_head, blk_req_code_t *code,
+                                        uintptr_t *io_or_offset, uint64_t *block_number, uint16_t *count,
+                                        uint32_t *id)
+{
+    struct blk_req *brp;
+    struct blk_req_queue *brqp = h->req_queue;
+
+    if (brqp->tail == *local_head) {
+        return -1;
+    }
+
+    brp = brqp->buffers + (*local_head % h->capacity);
+    *code = brp->code;
+    *io_or_offset = brp->io_or_offset;
+    *block_number = brp->block_number;
+    *count = brp->count;
+    *id = brp->id;
+    (*local_head)++;
+
+    return 0;
+}
+
+/**
+ * Dequeue an element from the response queue without returning its slot to
+ * the producer, advancing a local head instead. Release a batch of responses
+ * dequeued this way with blk_resp_update_shared_head().
+ *
+ * @param h queue handle containing response queue to dequeue from.
+ * @param local_head address of the head to be used and incremented.
+ * @param status pointer to response status.
+ * @param success_count pointer to number of blocks successfully read/written
+ * @param id pointer to store request ID to identify which request this response is for.
+ *
+ * @return -1 when response queue is empty, 0 on success.
+ */
+static inline int blk_dequeue_resp_local(blk_queue_handle_t *h, uint32_t *local_head, blk_resp_status_t *status,
+                                         uint16_t *success_count, uint32_t *id)
+{
+    struct blk_resp *brp;
+    struct blk_resp_queue *brqp = h->resp_queue;
+
+    if (brqp->tail == *local_head) {
+        return -1;
+    }
+
+    brp = brqp->buffers + (*local_head % h->capacity);
+    *status = brp->status;
+    *success_count = brp->success_count;
+    *id = brp->id;
+    (*local_head)++;
+
+    return 0;
+}
+
+/**
+ * Publish requests enqueued with blk_enqueue_req_local().
+ *
+ * @param h queue handle containing request queue to update.
+ * @param local_tail tail which points to the next enqueue slot.
+ */
+static inline void blk_req_update_shared_tail(blk_queue_handle_t *h, uint32_t local_tail)
+{
+    /* Ensure updates to tail do not decrease the queue length or exceed capacity */
+    assert(local_tail - h->req_queue->head >= h->req_queue->tail - h->req_queue->head);
+    assert(local_tail - h->req_queue->head <= h->capacity);
+
+    THREAD_MEMORY_RELEASE();
+    h->req_queue->tail = local_tail;
+}
+
+/**
+ * Publish responses enqueued with blk_enqueue_resp_local().
+ *
+ * @param h queue handle containing response queue to update.
+ * @param local_tail tail which points to the next enqueue slot.
+ */
+static inline void blk_resp_update_shared_tail(blk_queue_handle_t *h, uint32_t local_tail)
+{
+    /* Ensure updates to tail do not decrease the queue length or exceed capacity */
+    assert(local_tail - h->resp_queue->head >= h->resp_queue->tail - h->resp_queue->head);
+    assert(local_tail - h->resp_queue->head <= h->capacity);
+
+    THREAD_MEMORY_RELEASE();
+    h->resp_queue->tail = local_tail;
+}
+
+/**
+ * Return the slots of requests dequeued with blk_dequeue_req_local() to the
+ * producer.
+ *
+ * @param h queue handle containing request queue to update.
+ * @param local_head head which points to the next request to dequeue.
+ */
+static inline void blk_req_update_shared_head(blk_queue_handle_t *h, uint32_t local_head)
+{
+    /* Ensure updates to head don't pass the tail */
+    assert(h->req_queue->tail - local_head <= h->req_queue->tail - h->req_queue->head);
+
+    THREAD_MEMORY_RELEASE();
+    h->req_queue->head = local_head;
+}
+
+/**
+ * Return the slots of responses dequeued with blk_dequeue_resp_local() to the
+ * producer.
+ *
+ * @param h queue handle containing response queue to update.
+ * @param local_head head which points to the next response to dequeue.
+ */
+static inline void blk_resp_update_shared_head(blk_queue_handle_t *h, uint32_t local_head)
+{
+    /* Ensure updates to head don't pass the tail */
+    assert(h->resp_queue->tail - local_head <= h->resp_queue->tail - h->resp_queue->head);
+
+    THREAD_MEMORY_RELEASE();
+    h->resp_queue->head = local_head;
+}
+
+/**
+ * Indicate to producer of the request queue that consumer requires signalling.
+ * The consumer must check the queue again afterwards, see the signalling
+ * protocol in docs/developing.md.
+ *
+ * @param h queue handle of request queue that requires signalling upon enqueuing.
+ */
+static inline void blk_queue_request_signal_req(blk_queue_handle_t *h)
+{
+    h->req_queue->consumer_signalled = BLK_QUEUE_SIGNAL_REQUESTED;
+#ifdef CONFIG_ENABLE_SMP_SUPPORT
+    THREAD_MEMORY_RELEASE();
+#endif
+}
+
+/**
+ * Indicate to producer of the response queue that consumer requires signalling.
+ * The consumer must check the queue again afterwards, see the signalling
+ * protocol in docs/developing.md.
+ *
+ * @param h queue handle of response queue that requires signalling upon enqueuing.
+ */
+static inline void blk_queue_request_signal_resp(blk_queue_handle_t *h)
+{
+    h->resp_queue->consumer_signalled = BLK_QUEUE_SIGNAL_REQUESTED;
+#ifdef CONFIG_ENABLE_SMP_SUPPORT
+    THREAD_MEMORY_RELEASE();
+#endif
+}
+
+/**
+ * Indicate to producer of the request queue that consumer has been signalled.
+ * Consumers which have never requested signalling keep being signalled.
+ *
+ * @param h queue handle of the request queue that has been signalled.
+ */
+static inline void blk_queue_cancel_signal_req(blk_queue_handle_t *h)
+{
+    if (h->req_queue->consumer_signalled == BLK_QUEUE_SIGNAL_ALWAYS) {
+        return;
+    }
+    h->req_queue->consumer_signalled = BLK_QUEUE_SIGNAL_SENT;
+#ifdef CONFIG_ENABLE_SMP_SUPPORT
+    THREAD_MEMORY_RELEASE();
+#endif
+}
+
+/**
+ * Indicate to producer of the response queue that consumer has been signalled.
+ * Consumers which have never requested signalling keep being signalled.
+ *
+ * @param h queue handle of the response queue that has been signalled.
+ */
+static inline void blk_queue_cancel_signal_resp(blk_queue_handle_t *h)
+{
+    if (h->resp_queue->consumer_signalled == BLK_QUEUE_SIGNAL_ALWAYS) {
+        return;
+    }
+    h->resp_queue->consumer_signalled = BLK_QUEUE_SIGNAL_SENT;
+#ifdef CONFIG_ENABLE_SMP_SUPPORT
+    THREAD_MEMORY_RELEASE();
+#endif
+}
+
+/**
+ * Consumer of the request queue requires signalling.
+ *
+ * @param h queue handle of the request queue to check.
+ */
+static inline bool blk_queue_require_signal_req(blk_queue_handle_t *h)
+{
+    return h->req_queue->consumer_signalled != BLK_QUEUE_SIGNAL_SENT;
+}
+
+/**
+ * Consumer of the response queue requires signalling.
+ *
+ * @param h queue handle of the response queue to check.
+ */
+static inline bool blk_queue_require_signal_resp(blk_queue_handle_t *h)
+{
+    return h->resp_queue->consumer_signalled != BLK_QUEUE_SIGNAL_SENT;
+}
+
 /**
  * Set the plug of the request queue to true.
  *
@@ -0,0 +1,285 @@
+/*
+ * Copyright 2026, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+#include <os/sddf.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sddf/blk/queue.h>
+#include <sddf/resources/common.h>
+#include <sddf/util/fence.h>
+#include <sddf/util/util.h>
+
+/**
+ * Block components keep counters and histograms for each of their
+ * connections in a statistics region, which the system may share read-only
+ * with a monitoring component or benchmark. The region starts with a
+ * blk_stats_t header followed by one blk_queue_stats_t per connection.
+ * Connections are indexed as follows:
+ *
+ * virt:   queues[0] - driver, queues[1 + c] - client c
+ * driver: queues[0] - virt, queues[1 + q] - virt_queues[q]
+ *
+ * A request is timed from the component dequeuing it to the component
+ * enqueuing its response, so comparing the virtualiser's client and driver
+ * connections with the driver shows how long requests spend in the
+ * virtualiser, waiting in the driver's queue and with the device.
+ *
+ * Histograms have log2 buckets: bucket 0 counts values of 0 and bucket i
+ * counts values in [2^(i-1), 2^i), with the last bucket also counting any
+ * larger values. Latencies are in ticks of a free running counter, which is
+ * read directly rather than through the timer driver, and converted with
+ * tick_freq. Components on platforms without a counter they can read leave
+ * latencies at 0.
+ *
+ * Counters only ever increase and are updated between blk_stats_begin and
+ * blk_stats_end, so a reader can take a consistent snapshot with
+ * blk_stats_read. Readers must check the version, as the layout may change
+ * between versions.
+ */
+
+#define BLK_STATS_MAGIC 0x73447342 /* "BsDs" */
+#define BLK_STATS_VERSION 1
+
+#define BLK_STATS_BUCKETS 32
+/* Request codes counted separately, one more than the highest blk_req_code_t */
+#define BLK_STATS_NUM_CODES (BLK_REQ_WRITE_ZEROES + 1)
+
+typedef enum {
+    BLK_STATS_VIRT = 1,
+    BLK_STATS_DRIVER,
+} blk_stats_component_t;
+
+/* Kinds of request with a latency histogram of their own */
+typedef enum {
+    BLK_STATS_READ = 0,
+    BLK_STATS_WRITE,
+    /* flushes, barriers, discards and write zeroes */
+    BLK_STATS_OTHER,
+    BLK_STATS_NUM_KINDS,
+} blk_stats_kind_t;
+
+typedef struct blk_queue_stats {
+    /* completed requests and the blocks they asked for, by blk_req_code_t */
+    uint64_t requests[BLK_STATS_NUM_CODES];
+    uint64_t blocks[BLK_STATS_NUM_CODES];
+    /* requests completed with a status other than BLK_RESP_OK */
+    uint64_t errors;
+    /* time from dequeue to response in ticks, by blk_stats_kind_t */
+    uint64_t latency_sum[BLK_STATS_NUM_KINDS];
+    uint64_t latency[BLK_STATS_NUM_KINDS][BLK_STATS_BUCKETS];
+    /* blocks asked for by each read and write */
+    uint64_t size[BLK_STATS_BUCKETS];
+    /* requests in flight on the connection as each one is dequeued, including itself */
+    uint64_t depth[BLK_STATS_BUCKETS];
+    uint32_t inflight;
+    uint32_t max_inflight;
+    uint32_t capacity;
+} blk_queue_stats_t;
+
+typedef struct blk_stats {
+    uint32_t magic;
+    uint16_t version;
+    /* blk_stats_component_t */
+    uint16_t component;
+    uint32_t num_queues;
+    /* odd while the component is updating counters */
+    uint32_t seq;
+    /* frequency in Hz of the counter latencies are measured with, 0 if not known */
+    uint64_t tick_freq;
+    blk_queue_stats_t queues[];
+} blk_stats_t;
+
+/* Size in bytes of a statistics region holding num_queues connections */
+#define BLK_STATS_SIZE(num_queues) (sizeof(blk_stats_t) + (num_queues) * sizeof(blk_queue_stats_t))
+
+#if defined(CONFIG_ARCH_AARCH64) && (CONFIG_EXPORT_VCNT_USER || CONFIG_EXPORT_PCNT_USER)
+#if CONFIG_EXPORT_VCNT_USER
+#define BLK_STATS_COUNTER "cntvct_el0"
+#else
+#define BLK_STATS_COUNTER "cntpct_el0"
+#endif
+
+/**
+ * Read the counter requests are timed with.
+ */
+static inline uint64_t blk_stats_now(void)
+{
+    uint64_t ticks;
+    asm volatile("mrs %0, " BLK_STATS_COUNTER : "=r"(ticks));
+    return ticks;
+}
+
+static inline uint64_t blk_stats_tick_freq(void)
+{
+    uint64_t freq;
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(freq));
+    return freq;
+}
+#elif defined(CONFIG_ARCH_X86_64)
+static inline uint64_t blk_stats_now(void)
+{
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/* The TSC frequency is not architecturally discoverable */
+static inline uint64_t blk_stats_tick_freq(void)
+{
+    return 0;
+}
+#else
+static inline uint64_t blk_stats_now(void)
+{
+    return 0;
+}
+
+static inline uint64_t blk_stats_tick_freq(void)
+{
+    return 0;
+}
+#endif
+
+/**
+ * Histogram bucket of a value.
+ */
+static inline uint32_t blk_stats_bucket(uint64_t value)
+{
+    uint32_t bucket = value ? 64 - __builtin_clzll(value) : 0;
+    return bucket < BLK_STATS_BUCKETS ? bucket : BLK_STATS_BUCKETS - 1;
+}
+
+/**
+ * Initialise a component's statistics. Components which are not given a
+ * statistics region keep their counters in private memory instead.
+ *
+ * @param region statistics region from the component's config, may be unmapped.
+ * @param fallback private memory to use if the region is unmapped.
+ * @param fallback_size size of the private memory in bytes.
+ * @param component blk_stats_component_t of the caller.
+ * @param num_queues number of connections to keep counters for.
+ *
+ * @return the initialised statistics.
+ */
+static inline blk_stats_t *blk_stats_init(region_resource_t *region, void *fallback, size_t fallback_size,
+                                          uint16_t component, uint32_t num_queues)
+{
+    blk_stats_t *stats = (blk_stats_t *)fallback;
+    size_t size = fallback_size;
+    if (region->vaddr != NULL) {
+        stats = (blk_stats_t *)region->vaddr;
+        size = region->size;
+    }
+    assert(size >= BLK_STATS_SIZE(num_queues));
+
+    memset(stats, 0, BLK_STATS_SIZE(num_queues));
+    stats->component = component;
+    stats->num_queues = num_queues;
+    stats->version = BLK_STATS_VERSION;
+    stats->tick_freq = blk_stats_tick_freq();
+    THREAD_MEMORY_RELEASE();
+    stats->magic = BLK_STATS_MAGIC;
+
+    return stats;
+}
+
+/**
+ * Mark the start of a batch of counter updates.
+ */
+static inline void blk_stats_begin(blk_stats_t *stats)
+{
+    stats->seq++;
+    THREAD_MEMORY_RELEASE();
+}
+
+/**
+ * Mark the end of a batch of counter updates.
+ */
+static inline void blk_stats_end(blk_stats_t *stats)
+{
+    THREAD_MEMORY_RELEASE();
+    stats->seq++;
+}
+
+/**
+ * Record a request being dequeued from a connection.
+ */
+static inline void blk_stats_submit(blk_queue_stats_t *qs)
+{
+    qs->inflight++;
+    if (qs->inflight > qs->max_inflight) {
+        qs->max_inflight = qs->inflight;
+    }
+    qs->depth[blk_stats_bucket(qs->inflight)]++;
+}
+
+/**
+ * Record the response to a request of a connection.
+ *
+ * @param qs statistics of the connection.
+ * @param code request code.
+ * @param count number of blocks the request asked for.
+ * @param status status of the response.
+ * @param start time the request was dequeued, from blk_stats_now.
+ * @param now time the response was enqueued, from blk_stats_now.
+ */
+static inline void blk_stats_complete(blk_queue_stats_t *qs, blk_req_code_t code, uint16_t count,
+                                      blk_resp_status_t status, uint64_t start, uint64_t now)
+{
+    assert(qs->inflight);
+    qs->inflight--;
+
+    if (code < BLK_STATS_NUM_CODES) {
+        qs->requests[code]++;
+        qs->blocks[code] += count;
+    }
+    if (status != BLK_RESP_OK) {
+        qs->errors++;
+    }
+
+    blk_stats_kind_t kind = BLK_STATS_OTHER;
+    if (code == BLK_REQ_READ || code == BLK_REQ_WRITE) {
+        kind = (code == BLK_REQ_READ) ? BLK_STATS_READ : BLK_STATS_WRITE;
+        qs->size[blk_stats_bucket(count)]++;
+    }
+
+    uint64_t latency = (now > start) ? now - start : 0;
+    qs->latency_sum[kind] += latency;
+    qs->latency[kind][blk_stats_bucket(latency)]++;
+}
+
+/**
+ * Take a consistent snapshot of another component's statistics.
+ *
+ * @param stats statistics region of the component.
+ * @param snapshot buffer to copy the statistics into.
+ * @param max_queues number of connections the snapshot buffer can hold.
+ *
+ * @return false if the region is not initialised or has an unknown layout,
+ *         true otherwise.
+ */
+static inline bool blk_stats_read(volatile blk_stats_t *stats, blk_stats_t *snapshot, uint32_t max_queues)
+{
+    if (stats->magic != BLK_STATS_MAGIC || stats->version != BLK_STATS_VERSION) {
+        return false;
+    }
+    THREAD_MEMORY_ACQUIRE();
+
+    uint32_t num_queues = stats->num_queues < max_queues ? stats->num_queues : max_queues;
+    uint32_t seq;
+    do {
+        seq = stats->seq;
+        THREAD_MEMORY_ACQUIRE();
+        memcpy(snapshot, (void *)stats, BLK_STATS_SIZE(num_queues));
+        THREAD_MEMORY_ACQUIRE();
+    } while ((seq & 1) || seq != stats->seq);
+
+    snapshot->num_queues = num_queues;
+    return true;
+}
@@ -29,6 +29,12 @@ typedef struct blk_storage_info {
     uint16_t cylinders, heads, blocks;
     /* total capacity of the device, specified in BLK_TRANSFER_SIZE sized units. */
     uint64_t capacity;
+    /* largest request accepted, specified in BLK_TRANSFER_SIZE sized units, 0 if unknown */
+    uint16_t max_transfer;
+    /* largest discard request accepted, specified in BLK_TRANSFER_SIZE sized units, 0 if unsupported */
+    uint16_t max_discard;
+    /* largest write zeroes request accepted, specified in BLK_TRANSFER_SIZE sized units, 0 if unsupported */
+    uint16_t max_write_zeroes;
 } blk_storage_info_t;
 _Static_assert(sizeof(blk_storage_info_t) <= BLK_STORAGE_INFO_REGION_SIZE,
                "struct blk_storage_info must be smaller than the region size");
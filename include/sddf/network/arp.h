@@ -5,14 +5,90 @@
 
 #pragma once
 
-#include <microkit.h>
+#include <stdint.h>
+#include <os/sddf.h>
+#include <sddf/network/mac802.h>
 
-bool arp_register_ipv4(microkit_channel arp_ch, uint32_t ipv4_addr, uint8_t mac[6])
+#define ETH_TYPE_ARP 0x0806U
+
+#define ARP_OPCODE_REQUEST 1
+#define ARP_OPCODE_REPLY 2
+
+#define ARP_HWTYPE_ETHERNET 1
+#define ARP_IPV4_PROTO_LEN 4
+
+/* ARP packet for IPv4 over ethernet, including the ethernet header */
+typedef struct __attribute__((__packed__)) arp_packet {
+    /* ethernet header */
+    mac_addr_t ethdst_addr;
+    mac_addr_t ethsrc_addr;
+    uint16_t type;
+    /* hardware type, always ethernet */
+    uint16_t hwtype;
+    /* protocol type, always IPv4 */
+    uint16_t proto;
+    /* hardware address length in bytes */
+    uint8_t hwlen;
+    /* protocol address length in bytes */
+    uint8_t protolen;
+    /* request or reply */
+    uint16_t opcode;
+    /* sender hardware and protocol address */
+    mac_addr_t hwsrc_addr;
+    uint32_t ipsrc_addr;
+    /* target hardware and protocol address */
+    mac_addr_t hwdst_addr;
+    uint32_t ipdst_addr;
+    /* pad to the minimum ethernet frame length */
+    uint8_t padding[18];
+} arp_packet_t;
+
+/* ARP component operation status codes */
+typedef enum {
+    /* no error */
+    ARP_ERR_OKAY = 0,
+    /* Invalid IP address provided */
+    ARP_ERR_INVALID_IP,
+    /* IP address is already registered by another client */
+    ARP_ERR_IP_IN_USE,
+    /* Unsupported operation */
+    ARP_ERR_INVALID_OPERATION,
+} arp_err_t;
+
+/**
+ * Register a client's IPv4 address with the ARP component. Upon success the
+ * ARP component answers ARP requests for this address on the client's behalf
+ * and announces it with a gratuitous ARP.
+ */
+#define ARP_REG_IP 0
+
+typedef enum {
+    /* IPv4 address to register, in network byte order */
+    ARP_REG_IP_ARG = 0,
+    /* Number of arguments */
+    ARP_REG_NUM_ARGS,
+} arp_reg_args_t;
+
+typedef enum {
+    /* Success of operation */
+    ARP_REG_RET_ERR = 0,
+    /* Number of return arguments */
+    ARP_REG_RET_NUM_ARGS,
+} arp_reg_ret_args_t;
+
+/**
+ * Register an IPv4 address with the ARP component. The MAC address answered
+ * with is the one the client was configured with, so is not passed.
+ *
+ * @param arp_ch channel of the ARP component.
+ * @param ipv4_addr IPv4 address to register, in network byte order.
+ *
+ * @return status of the operation.
+ */
+static inline arp_err_t arp_register_ipv4(sddf_channel arp_ch, uint32_t ipv4_addr)
 {
-    microkit_mr_set(0, ipv4_addr);
-    microkit_mr_set(1, (mac[0] << 8) | mac[1]);
-    microkit_mr_set(2, (mac[2] << 24) | (mac[3] << 16) | (mac[4] << 8) | mac[5]);
-    microkit_ppcall(arp_ch, microkit_msginfo_new(0, 3));
+    sddf_set_mr(ARP_REG_IP_ARG, ipv4_addr);
+    sddf_ppcall(arp_ch, seL4_MessageInfo_new(ARP_REG_IP, 0, 0, ARP_REG_NUM_ARGS));
 
-    return true;
+    return (arp_err_t)sddf_get_mr(ARP_REG_RET_ERR);
 }
@@ -10,7 +10,9 @@
 #include <stdint.h>
 #include <sddf/resources/common.h>
 #include <sddf/resources/device.h>
+#include <sddf/network/filter.h>
 #include <sddf/network/mac802.h>
+#include <sddf/network/stats.h>
 
 #define SDDF_NET_MAX_CLIENTS 64
 
@@ -24,10 +26,27 @@ typedef struct net_connection_resource {
     uint8_t id;
 } net_connection_resource_t;
 
+/**
+ * Traffic classes of Tx connections, in decreasing order of priority. Packets
+ * of the priority class are always transmitted ahead of bulk packets.
+ */
+typedef enum {
+    NET_TX_CLASS_PRIORITY = 0,
+    NET_TX_CLASS_BULK,
+    NET_TX_NUM_CLASSES,
+} net_tx_class_t;
+
 typedef struct net_driver_config {
     char magic[SDDF_NET_MAGIC_LEN];
     net_connection_resource_t virt_rx;
     net_connection_resource_t virt_tx;
+    /**
+     * Optional connection for priority class packets, unused if it has no
+     * buffers. Drivers supporting it drain it before virt_tx, mapping it to a
+     * higher priority hardware queue where the device has one. Notifications
+     * for it are sent over the virt_tx channel.
+     */
+    net_connection_resource_t virt_tx_priority;
 } net_driver_config_t;
 
 typedef struct net_virt_tx_data_region {
@@ -41,11 +60,68 @@ typedef struct net_virt_tx_client_config {
     uint8_t num_regions;
 } net_virt_tx_client_config_t;
 
+typedef struct net_virt_tx_client_sched_config {
+    /**
+     * Relative share of the driver's Tx queue the client receives when
+     * clients are contending for it. A weight of 0 is treated as 1.
+     */
+    uint16_t weight;
+    /**
+     * Whether the client's packets belong to the priority class, such as those
+     * of a component sending control plane messages. They are transmitted
+     * strictly ahead of all bulk packets, subject only to the client's rate
+     * cap, and the client's weight is not used.
+     */
+    bool priority;
+    /**
+     * Optional cap on the client's transmit rate in bytes per second, 0
+     * disables the cap. Rate limited clients may burst up to burst_bytes above
+     * their rate, which must be at least NET_BUFFER_SIZE.
+     */
+    uint64_t rate_limit;
+    uint32_t burst_bytes;
+} net_virt_tx_client_sched_config_t;
+
 typedef struct net_virt_tx_config {
     char magic[SDDF_NET_MAGIC_LEN];
     net_connection_resource_t driver;
     net_virt_tx_client_config_t clients[SDDF_NET_MAX_CLIENTS];
     uint8_t num_clients;
+    /**
+     * The remaining fields are not written by sdfgen, and zeroed ones leave
+     * the corresponding feature unused. They directly follow the fields it
+     * does write so that a system can append them to the generated config.
+     */
+    /**
+     * Optional region the component exports its statistics in, of at least
+     * NET_STATS_SIZE(NET_TX_NUM_CLASSES * (num_clients + 1)) bytes. See sddf/network/stats.h.
+     */
+    region_resource_t stats;
+    /**
+     * Maximum number of buffers the Tx virtualiser keeps outstanding with the
+     * driver, 0 for no limit. Bounding the driver's queue keeps the backlog in
+     * the client queues, where it is scheduled fairly, rather than in a single
+     * FIFO in front of the device.
+     */
+    uint16_t driver_budget;
+    /**
+     * Whether the driver's device completes the checksums of buffers marked
+     * with NET_BUFF_F_CSUM_PARTIAL. If not, the Tx virtualiser completes them
+     * in software before passing the buffers on, so only set this for devices
+     * known to support it, such as virtIO net devices offering
+     * VIRTIO_NET_F_CSUM.
+     */
+    bool driver_csum_partial;
+    /**
+     * Optional connection to the driver for priority class packets, unused if
+     * it has no buffers. It is notified over the driver channel.
+     */
+    net_connection_resource_t driver_priority;
+    /**
+     * Scheduling parameters of clients[i], zeroed ones giving every client an
+     * equal share of the bulk class without a rate limit.
+     */
+    net_virt_tx_client_sched_config_t sched[SDDF_NET_MAX_CLIENTS];
 } net_virt_tx_config_t;
 
 typedef struct net_virt_rx_client_config {
@@ -71,6 +147,21 @@ typedef struct net_virt_rx_config {
     region_resource_t buffer_metadata;
     net_virt_rx_client_config_t clients[SDDF_NET_MAX_CLIENTS];
     uint8_t num_clients;
+    /**
+     * Optional region the component exports its statistics in, of at least
+     * NET_STATS_SIZE(num_clients + 1) bytes. See sddf/network/stats.h.
+     */
+    region_resource_t stats;
+    /**
+     * Packets addressed to clients[i] are checked against filters[i] before
+     * being passed on, and dropped early by the Rx virtualiser if they are
+     * rejected. A zeroed filter accepts every packet. See
+     * sddf/network/filter.h for details.
+     *
+     * The filters are kept apart from clients, after every other field, so
+     * that configs generated without them keep their layout.
+     */
+    net_filter_config_t filters[SDDF_NET_MAX_CLIENTS];
 } net_virt_rx_config_t;
 
 typedef struct net_copy_config {
@@ -80,6 +171,11 @@ typedef struct net_copy_config {
 
     net_connection_resource_t client;
     region_resource_t client_data;
+    /**
+     * Optional region the component exports its statistics in, of at least
+     * NET_STATS_SIZE(2) bytes. See sddf/network/stats.h.
+     */
+    region_resource_t stats;
 } net_copy_config_t;
 
 typedef struct net_client_config {
@@ -93,6 +189,30 @@ typedef struct net_client_config {
     mac_addr_t mac_addr;
 } net_client_config_t;
 
+typedef struct net_arp_client_config {
+    /* channel over which the client registers its IP address */
+    uint8_t id;
+    /* MAC address ARP requests for the client's IP address are answered with */
+    mac_addr_t mac_addr;
+} net_arp_client_config_t;
+
+typedef struct net_arp_config {
+    char magic[SDDF_NET_MAGIC_LEN];
+    net_connection_resource_t rx;
+    region_resource_t rx_data;
+
+    net_connection_resource_t tx;
+    region_resource_t tx_data;
+
+    net_arp_client_config_t clients[SDDF_NET_MAX_CLIENTS];
+    uint8_t num_clients;
+    /**
+     * Optional region the component exports its statistics in, of at least
+     * NET_STATS_SIZE(2) bytes. See sddf/network/stats.h.
+     */
+    region_resource_t stats;
+} net_arp_config_t;
+
 typedef struct net_vswitch_port_config {
     net_connection_resource_t rx;
     net_connection_resource_t tx;
@@ -135,6 +255,11 @@ typedef struct net_vswitch_config {
      * (ports[0].tx.num_buffers + ... + ports[num_ports].tx.num_buffers) * sizeof(uin8_t) bytes
      */
     region_resource_t buffer_metadata;
+    /**
+     * Optional region the component exports its statistics in, of at least
+     * NET_STATS_SIZE(2 * num_ports) bytes. See sddf/network/stats.h.
+     */
+    region_resource_t stats;
 } net_vswitch_config_t;
 
 static inline bool net_config_check_magic(void *config)
@@ -20,3 +20,13 @@
     || defined(CONFIG_PLAT_ODROIDC2) || defined(CONFIG_PLAT_ZYNQMP)
 #define NETWORK_HW_HAS_CHECKSUM
 #endif
+
+/*
+ * Hardware which cannot generate checksums itself, but can complete a
+ * transport layer checksum given the checksum of the pseudo-header and a
+ * buffer marked with NET_BUFF_F_CSUM_PARTIAL. IP header checksums must still
+ * be calculated in software.
+ */
+#if defined(CONFIG_PLAT_QEMU_ARM_VIRT) || defined(CONFIG_PLAT_QEMU_RISCV_VIRT) || defined(CONFIG_ARCH_X86_64)
+#define NETWORK_HW_HAS_PARTIAL_CHECKSUM
+#endif
@@ -0,0 +1,224 @@
+/*
+ * Copyright 2026, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sddf/network/ip.h>
+#include <sddf/network/mac802.h>
+#include <sddf/network/util.h>
+#include <sddf/util/util.h>
+
+/**
+ * Early packet filtering is performed by the Rx virtualiser on each client's
+ * behalf before a packet is handed to its copier. Each client has an ordered
+ * table of match rules on the ethernet, IPv4 and UDP/TCP headers. The first
+ * rule matching a packet decides its fate, and if no rule matches the
+ * client's default action applies.
+ *
+ * Since the tables are part of the Rx virtualiser's config, a zero-initialised
+ * filter has no rules and accepts every packet.
+ */
+
+#define NET_FILTER_MAX_RULES 16
+
+typedef enum {
+    NET_FILTER_ACCEPT = 0,
+    NET_FILTER_DROP,
+} net_filter_action_t;
+
+/* Header fields a rule can match on */
+#define NET_FILTER_MATCH_ETYPE BIT(0)
+#define NET_FILTER_MATCH_IP_PROTO BIT(1)
+#define NET_FILTER_MATCH_SRC_IP BIT(2)
+#define NET_FILTER_MATCH_DST_IP BIT(3)
+#define NET_FILTER_MATCH_SRC_PORT BIT(4)
+#define NET_FILTER_MATCH_DST_PORT BIT(5)
+#define NET_FILTER_MATCH_ALL BIT_MASK(0, 5)
+
+typedef struct net_filter_rule {
+    /* bitmap of NET_FILTER_MATCH_* fields that must match, 0 matches any packet */
+    uint16_t match;
+    /* net_filter_action_t taken on a match */
+    uint8_t action;
+    /* IPv4 transport layer protocol */
+    uint8_t ip_proto;
+    /* ethertype in host byte order */
+    uint16_t etype;
+    /* inclusive transport layer port ranges in host byte order */
+    uint16_t src_port_min;
+    uint16_t src_port_max;
+    uint16_t dst_port_min;
+    uint16_t dst_port_max;
+    /* IPv4 addresses and masks in network byte order */
+    uint32_t src_ip;
+    uint32_t src_ip_mask;
+    uint32_t dst_ip;
+    uint32_t dst_ip_mask;
+} net_filter_rule_t;
+
+typedef struct net_filter_config {
+    net_filter_rule_t rules[NET_FILTER_MAX_RULES];
+    uint8_t num_rules;
+    /* net_filter_action_t taken when no rule matches */
+    uint8_t default_action;
+} net_filter_config_t;
+
+/**
+ * Number of packets matched by each rule of a filter. The hits of the default
+ * action are counted in the final slot.
+ */
+typedef struct net_filter_stats {
+    uint64_t hits[NET_FILTER_MAX_RULES + 1];
+} net_filter_stats_t;
+
+/* Header fields of a packet extracted once and shared between filters */
+typedef struct net_filter_key {
+    /* bitmap of NET_FILTER_MATCH_* fields present in the packet */
+    uint16_t present;
+    uint8_t ip_proto;
+    uint16_t etype;
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint32_t src_ip;
+    uint32_t dst_ip;
+} net_filter_key_t;
+
+/**
+ * Check that a filter is well formed. Filters are checked once at
+ * initialisation so that evaluation does not need to.
+ *
+ * @param filter filter to check.
+ *
+ * @return true if the filter is valid, false otherwise.
+ */
+static inline bool net_filter_check(const net_filter_config_t *filter)
+{
+    if (filter->num_rules > NET_FILTER_MAX_RULES || filter->default_action > NET_FILTER_DROP) {
+        return false;
+    }
+
+    for (uint8_t i = 0; i < filter->num_rules; i++) {
+        const net_filter_rule_t *rule = &filter->rules[i];
+        if (rule->action > NET_FILTER_DROP || (rule->match & ~NET_FILTER_MATCH_ALL)) {
+            return false;
+        }
+        if (((rule->match & NET_FILTER_MATCH_SRC_PORT) && rule->src_port_min > rule->src_port_max)
+            || ((rule->match & NET_FILTER_MATCH_DST_PORT) && rule->dst_port_min > rule->dst_port_max)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Extract the header fields filters match on from a packet. Fields are only
+ * marked present if the packet is long enough to contain them, and ports are
+ * only extracted from the first fragment of an IPv4 datagram. IPv4 fields are
+ * not extracted from packets with a malformed header length.
+ *
+ * @param frame address of the ethernet header of the packet.
+ * @param len length of the packet in bytes.
+ * @param key key to fill in.
+ */
+static inline void net_filter_parse(const void *frame, uint16_t len, net_filter_key_t *key)
+{
+    key->present = 0;
+    if (len < sizeof(ether_hdr_t)) {
+        return;
+    }
+
+    const ether_hdr_t *eth = (const ether_hdr_t *)frame;
+    key->etype = ((uint16_t)eth->etype[0] << 8) | eth->etype[1];
+    key->present |= NET_FILTER_MATCH_ETYPE;
+    if (key->etype != ETH_TYPE_IP || len < sizeof(ether_hdr_t) + sizeof(ipv4_hdr_t)) {
+        return;
+    }
+
+    const ipv4_hdr_t *ip = (const ipv4_hdr_t *)((const uint8_t *)frame + sizeof(ether_hdr_t));
+    /* A header shorter than the minimum of five words or longer than the packet is malformed */
+    uint32_t ip_hdr_len = ipv4_header_length((ipv4_hdr_t *)ip);
+    if (ip->ihl < 5 || len < sizeof(ether_hdr_t) + ip_hdr_len) {
+        return;
+    }
+
+    key->ip_proto = ip->protocol;
+    key->src_ip = ip->src_ip;
+    key->dst_ip = ip->dst_ip;
+    key->present |= NET_FILTER_MATCH_IP_PROTO | NET_FILTER_MATCH_SRC_IP | NET_FILTER_MATCH_DST_IP;
+
+    uint32_t l4_offset = sizeof(ether_hdr_t) + ip_hdr_len;
+    bool first_fragment = ip->frag_offset1 == 0 && ip->frag_offset2 == 0;
+    if (!first_fragment || (ip->protocol != IPV4_PROTO_UDP && ip->protocol != IPV4_PROTO_TCP)
+        || len < l4_offset + 2 * sizeof(uint16_t)) {
+        return;
+    }
+
+    /*
+     * Ports are the first two fields of both UDP and TCP headers. They are
+     * read directly rather than through udp_hdr_t, as this header is included
+     * by lwIP clients through the net config and so must not define the
+     * transport layer headers that lwIP also defines.
+     */
+    const uint16_t *ports = (const uint16_t *)((const uint8_t *)frame + l4_offset);
+    key->src_port = HTONS(ports[0]);
+    key->dst_port = HTONS(ports[1]);
+    key->present |= NET_FILTER_MATCH_SRC_PORT | NET_FILTER_MATCH_DST_PORT;
+}
+
+static inline bool net_filter_rule_matches(const net_filter_rule_t *rule, const net_filter_key_t *key)
+{
+    if ((rule->match & key->present) != rule->match) {
+        return false;
+    }
+
+    if ((rule->match & NET_FILTER_MATCH_ETYPE) && key->etype != rule->etype) {
+        return false;
+    }
+    if ((rule->match & NET_FILTER_MATCH_IP_PROTO) && key->ip_proto != rule->ip_proto) {
+        return false;
+    }
+    if ((rule->match & NET_FILTER_MATCH_SRC_IP) && (key->src_ip & rule->src_ip_mask) != (rule->src_ip & rule->src_ip_mask)) {
+        return false;
+    }
+    if ((rule->match & NET_FILTER_MATCH_DST_IP) && (key->dst_ip & rule->dst_ip_mask) != (rule->dst_ip & rule->dst_ip_mask)) {
+        return false;
+    }
+    if ((rule->match & NET_FILTER_MATCH_SRC_PORT)
+        && (key->src_port < rule->src_port_min || key->src_port > rule->src_port_max)) {
+        return false;
+    }
+    if ((rule->match & NET_FILTER_MATCH_DST_PORT)
+        && (key->dst_port < rule->dst_port_min || key->dst_port > rule->dst_port_max)) {
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Evaluate a filter against a parsed packet and count the hit.
+ *
+ * @param filter filter to evaluate, must have passed net_filter_check.
+ * @param key header fields of the packet.
+ * @param stats hit counters of the filter.
+ *
+ * @return true if the packet is accepted, false if it should be dropped.
+ */
+static inline bool net_filter_accept(const net_filter_config_t *filter, const net_filter_key_t *key,
+                                     net_filter_stats_t *stats)
+{
+    for (uint8_t i = 0; i < filter->num_rules; i++) {
+        if (net_filter_rule_matches(&filter->rules[i], key)) {
+            stats->hits[i]++;
+            return filter->rules[i].action == NET_FILTER_ACCEPT;
+        }
+    }
+
+    stats->hits[NET_FILTER_MAX_RULES]++;
+    return filter->default_action == NET_FILTER_ACCEPT;
+}
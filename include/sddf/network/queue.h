@@ -40,8 +40,31 @@ typedef struct net_buff_desc {
      * and Ethernet drivers, and should always be set to 0 by net clients.
      */
     uint8_t oid : 6;
+    /**
+     * Checksum offload flags, see NET_BUFF_F_*. These are only set by clients
+     * and drivers for hardware which supports checksum offload, and are
+     * otherwise 0. Components which pass a buffer on preserve them, while
+     * components which fill a buffer, like the copy component, set them.
+     */
+    uint8_t flags;
+    /* with NET_BUFF_F_CSUM_PARTIAL, offset in the frame to checksum from */
+    uint16_t csum_start;
+    /* with NET_BUFF_F_CSUM_PARTIAL, offset from csum_start of the checksum field */
+    uint16_t csum_offset;
 } net_buff_desc_t;
 
+/**
+ * The transport layer checksum of the packet is incomplete, and holds only the
+ * checksum of the pseudo-header. Data from csum_start to the end of the frame
+ * is to be checksummed and the result stored csum_offset bytes past
+ * csum_start. Set by clients on transmit for the hardware to complete it. Set
+ * by drivers on receive for packets that were sent from the host, whose data
+ * can be trusted.
+ */
+#define NET_BUFF_F_CSUM_PARTIAL BIT(0)
+/* The hardware has verified the checksums of a received packet */
+#define NET_BUFF_F_CSUM_VALID BIT(1)
+
 typedef struct net_queue {
     /* index to insert at */
     uint16_t tail;
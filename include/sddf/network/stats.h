@@ -0,0 +1,198 @@
+/*
+ * Copyright 2026, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sddf/network/queue.h>
+#include <sddf/resources/common.h>
+#include <sddf/util/fence.h>
+#include <sddf/util/util.h>
+
+/**
+ * Network components keep counters for each of their connections in a
+ * statistics region, which the system may share read-only with a monitoring
+ * component. The region starts with a net_stats_t header followed by one
+ * net_queue_stats_t per connection. Connections are indexed as follows:
+ *
+ * virt_rx: queues[0] - driver, queues[1 + c] - client c
+ * virt_tx: queues[0 + class] - driver, queues[2 + c * 2 + class] - client c
+ * copy:    queues[0] - Rx virtualiser, queues[1] - client
+ * arp:     queues[0] - Rx, queues[1] - Tx
+ * vswitch: queues[p * 2] - port p Rx, queues[p * 2 + 1] - port p Tx
+ *
+ * where class is a net_tx_class_t. Counters only ever increase and are
+ * updated between net_stats_begin and net_stats_end, so a reader can take a
+ * consistent snapshot with net_stats_read. Readers must check the version, as
+ * the layout may change between versions.
+ */
+
+#define NET_STATS_MAGIC 0x7344734e /* "NsDs" */
+#define NET_STATS_VERSION 1
+
+typedef enum {
+    NET_STATS_VIRT_RX = 1,
+    NET_STATS_VIRT_TX,
+    NET_STATS_COPY,
+    NET_STATS_ARP,
+    NET_STATS_VSWITCH,
+} net_stats_component_t;
+
+typedef enum {
+    /* the receiving side had no free buffer to hold the packet */
+    NET_DROP_NO_BUFFER = 0,
+    /* no client matched the destination MAC address */
+    NET_DROP_NO_MATCH,
+    /* rejected by the receiving client's filter */
+    NET_DROP_FILTERED,
+    /* buffer provided by the sender failed validation */
+    NET_DROP_INVALID,
+    /* sender is not permitted to transmit to the destination */
+    NET_DROP_DENIED,
+    /* destination queue already held as many buffers as it can */
+    NET_DROP_QUEUE_FULL,
+    NET_DROP_NUM_REASONS,
+} net_drop_reason_t;
+
+typedef struct net_queue_stats {
+    /* packets and bytes carried over the connection's active queue */
+    uint64_t packets;
+    uint64_t bytes;
+    /* packets received from or destined for the connection that were dropped */
+    uint64_t drops[NET_DROP_NUM_REASONS];
+    /* notifications sent to the peer, and those skipped as it did not require one */
+    uint64_t notify_sent;
+    uint64_t notify_suppressed;
+    /* highest number of buffers observed in the active queue */
+    uint32_t max_occupancy;
+    uint32_t capacity;
+} net_queue_stats_t;
+
+typedef struct net_stats {
+    uint32_t magic;
+    uint16_t version;
+    /* net_stats_component_t */
+    uint16_t component;
+    uint32_t num_queues;
+    /* odd while the component is updating counters */
+    uint32_t seq;
+    net_queue_stats_t queues[];
+} net_stats_t;
+
+/* Size in bytes of a statistics region holding num_queues connections */
+#define NET_STATS_SIZE(num_queues) (sizeof(net_stats_t) + (num_queues) * sizeof(net_queue_stats_t))
+
+/**
+ * Initialise a component's statistics. Components which are not given a
+ * statistics region keep their counters in private memory instead.
+ *
+ * @param region statistics region from the component's config, may be unmapped.
+ * @param fallback private memory to use if the region is unmapped.
+ * @param fallback_size size of the private memory in bytes.
+ * @param component net_stats_component_t of the caller.
+ * @param num_queues number of connections to keep counters for.
+ *
+ * @return the initialised statistics.
+ */
+static inline net_stats_t *net_stats_init(region_resource_t *region, void *fallback, size_t fallback_size,
+                                          uint16_t component, uint32_t num_queues)
+{
+    net_stats_t *stats = (net_stats_t *)fallback;
+    size_t size = fallback_size;
+    if (region->vaddr != NULL) {
+        stats = (net_stats_t *)region->vaddr;
+        size = region->size;
+    }
+    assert(size >= NET_STATS_SIZE(num_queues));
+
+    memset(stats, 0, NET_STATS_SIZE(num_queues));
+    stats->component = component;
+    stats->num_queues = num_queues;
+    stats->version = NET_STATS_VERSION;
+    THREAD_MEMORY_RELEASE();
+    stats->magic = NET_STATS_MAGIC;
+
+    return stats;
+}
+
+/**
+ * Mark the start of a batch of counter updates.
+ */
+static inline void net_stats_begin(net_stats_t *stats)
+{
+    stats->seq++;
+    THREAD_MEMORY_RELEASE();
+}
+
+/**
+ * Mark the end of a batch of counter updates.
+ */
+static inline void net_stats_end(net_stats_t *stats)
+{
+    THREAD_MEMORY_RELEASE();
+    stats->seq++;
+}
+
+static inline void net_stats_packet(net_queue_stats_t *qs, uint16_t len)
+{
+    qs->packets++;
+    qs->bytes += len;
+}
+
+/**
+ * Record the occupancy of a connection's active queue.
+ */
+static inline void net_stats_occupancy(net_queue_stats_t *qs, net_queue_handle_t *queue)
+{
+    uint16_t length = net_queue_length(queue->active);
+    if (length > qs->max_occupancy) {
+        qs->max_occupancy = length;
+    }
+}
+
+/**
+ * Record whether work passed to a connection's peer required a notification.
+ */
+static inline void net_stats_notify(net_queue_stats_t *qs, bool sent)
+{
+    if (sent) {
+        qs->notify_sent++;
+    } else {
+        qs->notify_suppressed++;
+    }
+}
+
+/**
+ * Take a consistent snapshot of another component's statistics.
+ *
+ * @param stats statistics region of the component.
+ * @param snapshot buffer to copy the statistics into.
+ * @param max_queues number of connections the snapshot buffer can hold.
+ *
+ * @return false if the region is not initialised or has an unknown layout,
+ *         true otherwise.
+ */
+static inline bool net_stats_read(volatile net_stats_t *stats, net_stats_t *snapshot, uint32_t max_queues)
+{
+    if (stats->magic != NET_STATS_MAGIC || stats->version != NET_STATS_VERSION) {
+        return false;
+    }
+    THREAD_MEMORY_ACQUIRE();
+
+    uint32_t num_queues = stats->num_queues < max_queues ? stats->num_queues : max_queues;
+    uint32_t seq;
+    do {
+        seq = stats->seq;
+        THREAD_MEMORY_ACQUIRE();
+        memcpy(snapshot, (void *)stats, NET_STATS_SIZE(num_queues));
+        THREAD_MEMORY_ACQUIRE();
+    } while ((seq & 1) || seq != stats->seq);
+
+    snapshot->num_queues = num_queues;
+    return true;
+}
@@ -6,6 +6,8 @@
 #pragma once
 
 #include <os/sddf.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <sddf/util/util.h>
 
 #if BYTE_ORDER == BIG_ENDIAN
@@ -23,3 +25,47 @@ static inline void net_set_mac_addr(uint8_t *mac, uint64_t val)
     mac[4] = val >> 8 & 0xff;
     mac[5] = val & 0xff;
 }
+
+/**
+ * Complete the transport layer checksum of a frame marked with
+ * NET_BUFF_F_CSUM_PARTIAL in software, as hardware supporting partial
+ * checksum offload would. The internet checksum of the frame from csum_start
+ * to its end, which includes the checksum of the pseudo-header left in the
+ * checksum field, replaces the checksum field.
+ *
+ * @param frame start of the ethernet frame.
+ * @param len length of the frame.
+ * @param csum_start offset in the frame to checksum from.
+ * @param csum_offset offset of the checksum field from csum_start.
+ *
+ * @return false if the checksum field lies outside of the frame, true otherwise.
+ */
+static inline bool net_csum_complete(uint8_t *frame, uint16_t len, uint16_t csum_start, uint16_t csum_offset)
+{
+    uint32_t field = (uint32_t)csum_start + csum_offset;
+    if (field + 2 > len) {
+        return false;
+    }
+
+    uint32_t sum = 0;
+    uint32_t i = csum_start;
+    for (; i + 1 < len; i += 2) {
+        sum += ((uint32_t)frame[i] << 8) | frame[i + 1];
+    }
+    if (i < len) {
+        sum += (uint32_t)frame[i] << 8;
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+
+    /* A computed checksum of 0 is sent as all ones, which UDP reserves 0 against */
+    uint16_t csum = ~sum;
+    if (csum == 0) {
+        csum = 0xffff;
+    }
+    frame[field] = csum >> 8;
+    frame[field + 1] = csum & 0xff;
+
+    return true;
+}
@@ -19,6 +19,7 @@
 /*
  * An interface for efficient virtio implementation.
  */
+#include <stdbool.h>
 #include <stdint.h>
 
 /* This marks a buffer as continuing via the next field. */
@@ -46,6 +47,12 @@
 /* Arbitrary descriptor layouts. */
 #define VIRTIO_F_ANY_LAYOUT       27
 
+/* Support for the packed virtqueue layout */
+#define VIRTIO_F_RING_PACKED      34
+
+/* Buffers are used by the device in the same order they are made available */
+#define VIRTIO_F_IN_ORDER         35
+
 /* Virtqueue descriptors: 16 bytes.
  * These can chain together via "next". */
 struct virtq_desc {
@@ -90,6 +97,35 @@ struct virtq {
     struct virtq_used *used;
 };
 
+/* Packed virtqueue descriptor flags, in addition to the ones above. */
+#define VIRTQ_DESC_F_AVAIL      (1 << 7)
+#define VIRTQ_DESC_F_USED       (1 << 15)
+
+/* Packed virtqueue event suppression flags. */
+#define RING_EVENT_FLAGS_ENABLE  0x0
+#define RING_EVENT_FLAGS_DISABLE 0x1
+/* Only if VIRTIO_F_EVENT_IDX: notify at the descriptor given by off_wrap. */
+#define RING_EVENT_FLAGS_DESC    0x2
+
+/* Packed virtqueue descriptors: 16 bytes.
+ * The device writes used descriptors back into the same ring. */
+struct pvirtq_desc {
+    /* Buffer address (guest-physical). */
+    uint64_t addr;
+    /* Buffer length. */
+    uint32_t len;
+    /* Buffer ID. */
+    uint16_t id;
+    /* The flags depending on descriptor type. */
+    uint16_t flags;
+};
+
+struct pvirtq_event_suppress {
+    /* Descriptor ring offset in bits 0-14, wrap counter in bit 15. */
+    uint16_t off_wrap;
+    uint16_t flags;
+};
+
 static inline int virtq_need_event(uint16_t event_idx, uint16_t new_idx, uint16_t old_idx)
 {
     return (uint16_t)(new_idx - event_idx - 1) < (uint16_t)(new_idx - old_idx);
@@ -107,3 +143,59 @@ static inline uint16_t *virtq_avail_event(struct virtq *vq)
     /* For backwards compat, avail event index is at *end* of used ring. */
     return (uint16_t *)&vq->used->ring[vq->num];
 }
+
+/*
+ * The device runs concurrently with the driver, so publishing an index and
+ * reading the other side's event index must not be reordered with each other.
+ */
+static inline void virtq_mb(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/**
+ * Check whether the device needs to be notified of the buffers the driver
+ * has made available since the available index was old_idx. With
+ * VIRTIO_F_EVENT_IDX the device is only notified if the index it asked to be
+ * notified at was passed, otherwise unless it has set VIRTQ_USED_F_NO_NOTIFY.
+ *
+ * @param vq virtqueue buffers were made available in.
+ * @param old_idx available index before the buffers were added.
+ * @param event_idx whether VIRTIO_F_EVENT_IDX was negotiated.
+ *
+ * @return true if the driver must notify the device.
+ */
+static inline bool virtq_kick_needed(struct virtq *vq, uint16_t old_idx, bool event_idx)
+{
+    virtq_mb();
+    if (event_idx) {
+        return virtq_need_event(*virtq_avail_event(vq), vq->avail->idx, old_idx);
+    }
+    return !(vq->used->flags & VIRTQ_USED_F_NO_NOTIFY);
+}
+
+/**
+ * Ask the device to interrupt the driver once it has used the entry at
+ * used_idx of the used ring. Drivers which want to be interrupted for each
+ * completion pass the next used index they will process. Entries the device
+ * used before seeing the request do not cause an interrupt, so the driver
+ * must process them itself if this returns true. Without VIRTIO_F_EVENT_IDX
+ * the device interrupts for every completion, and this only checks for
+ * entries the driver has not seen.
+ *
+ * @param vq virtqueue to be interrupted for.
+ * @param last_seen_used next used index the driver will process.
+ * @param used_idx index of the used ring entry to be interrupted at.
+ * @param event_idx whether VIRTIO_F_EVENT_IDX was negotiated.
+ *
+ * @return true if there are used entries from last_seen_used onwards.
+ */
+static inline bool virtq_enable_used_event(struct virtq *vq, uint16_t last_seen_used, uint16_t used_idx,
+                                           bool event_idx)
+{
+    if (event_idx) {
+        *virtq_used_event(vq) = used_idx;
+    }
+    virtq_mb();
+    return vq->used->idx != last_seen_used;
+}
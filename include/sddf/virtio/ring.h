@@ -0,0 +1,570 @@
+/*
+ * Copyright 2026, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sddf/util/util.h>
+#include <sddf/util/fence.h>
+#include <sddf/virtio/queue.h>
+
+/**
+ * Driver side of a virtqueue in either the split or the packed layout,
+ * whichever was negotiated. Drivers add buffers made up of one or more
+ * descriptors and get a buffer id back for each, below the queue size, with
+ * which they look up their own state for the buffer once it has been used.
+ *
+ * The split ring keeps its free descriptors on a list chained through the
+ * descriptor table, and the id of a buffer is the index of its first
+ * descriptor. The packed ring keeps descriptors, available and used entries
+ * in a single ring, which the driver and device both walk in order, so there
+ * is no descriptor allocation and each operation touches fewer cache lines.
+ * As the device overwrites descriptors of the packed ring with used ones, its
+ * buffer ids are allocated separately, and simply in order if
+ * VIRTIO_F_IN_ORDER was negotiated.
+ *
+ * If VIRTIO_F_INDIRECT_DESC was negotiated and the driver provides indirect
+ * tables, buffers of several descriptors are written to the table of their
+ * buffer id and take up a single descriptor in the ring, so the ring holds
+ * as many buffers as it has descriptors.
+ */
+
+/* Features of the virtqueue rather than the device, implemented here for every driver */
+#define VIRTIO_RING_FEATURES ((1ULL << VIRTIO_F_EVENT_IDX) | (1ULL << VIRTIO_F_RING_PACKED))
+
+typedef struct virtio_ring_buf {
+    uint64_t addr;
+    uint32_t len;
+    /* the device writes to the buffer rather than reading from it */
+    bool write;
+} virtio_ring_buf_t;
+
+/* Buffer id state, only used by packed rings */
+typedef struct virtio_ring_id {
+    /* next free id */
+    uint16_t next;
+    /* number of descriptors of the buffer */
+    uint16_t num_desc;
+} virtio_ring_id_t;
+
+typedef struct virtio_ring {
+    uint16_t num;
+    bool packed;
+    bool in_order;
+    bool event_idx;
+    bool indirect_desc;
+    /* descriptors not part of any buffer */
+    uint16_t num_free;
+    /* buffers added and not yet used */
+    uint16_t num_in_flight;
+    /* entries added since the device was last notified, buffers if split and descriptors if packed */
+    uint16_t num_added;
+    /* io addresses of the descriptor, driver and device areas for queue setup */
+    uint64_t desc_io_addr;
+    uint64_t driver_io_addr;
+    uint64_t device_io_addr;
+
+    /* indirect tables, one per buffer id of indirect_max descriptors, if used */
+    uint16_t indirect_max;
+    uintptr_t indirect_vaddr;
+    uint64_t indirect_io_addr;
+
+    /* split layout */
+    struct virtq split;
+    uint16_t free_head;
+    uint16_t last_used;
+
+    /* packed layout */
+    struct pvirtq_desc *desc;
+    struct pvirtq_event_suppress *driver_event;
+    struct pvirtq_event_suppress *device_event;
+    uint16_t next_avail;
+    bool avail_wrap;
+    uint16_t next_used;
+    bool used_wrap;
+    virtio_ring_id_t *ids;
+    /* head of the free id list, or the next id to allocate if in order */
+    uint16_t free_id;
+    /* if in order, the oldest id in flight */
+    uint16_t used_id;
+    /* if in order, the id and length of the last buffer of the batch being returned */
+    bool batch;
+    uint16_t batch_id;
+    uint32_t batch_len;
+} virtio_ring_t;
+
+/**
+ * Memory needed for a virtqueue.
+ *
+ * @param num number of descriptors in the virtqueue.
+ * @param packed whether VIRTIO_F_RING_PACKED was negotiated.
+ *
+ * @return size of the virtqueue in bytes.
+ */
+static inline size_t virtio_ring_size(uint16_t num, bool packed)
+{
+    if (packed) {
+        return 16 * num + 2 * sizeof(struct pvirtq_event_suppress);
+    }
+    size_t used_off = ALIGN(16 * num + 6 + 2 * num, 4);
+    return used_off + 6 + 8 * num;
+}
+
+/**
+ * Initialise a virtqueue in zeroed memory, before it is set up with the
+ * transport.
+ *
+ * @param ring virtqueue to initialise.
+ * @param features features negotiated with the device.
+ * @param num number of descriptors, a power of two for split rings.
+ * @param vaddr virtual address of virtio_ring_size(num) bytes, 16 byte aligned.
+ * @param io_addr io address of the same memory.
+ * @param ids buffer id state of num entries.
+ */
+static inline void virtio_ring_init(virtio_ring_t *ring, uint64_t features, uint16_t num, uintptr_t vaddr,
+                                    uint64_t io_addr, virtio_ring_id_t *ids)
+{
+    assert(num > 0);
+    assert(vaddr % 16 == 0);
+
+    *ring = (virtio_ring_t) {
+        .num = num,
+        .packed = features & (1ULL << VIRTIO_F_RING_PACKED),
+        .in_order = features & (1ULL << VIRTIO_F_IN_ORDER),
+        .event_idx = features & (1ULL << VIRTIO_F_EVENT_IDX),
+        .indirect_desc = features & (1ULL << VIRTIO_F_INDIRECT_DESC),
+        .num_free = num,
+    };
+
+    if (ring->packed) {
+        size_t event_off = 16 * num;
+        ring->desc = (struct pvirtq_desc *)vaddr;
+        ring->driver_event = (struct pvirtq_event_suppress *)(vaddr + event_off);
+        ring->device_event = ring->driver_event + 1;
+        ring->desc_io_addr = io_addr;
+        ring->driver_io_addr = io_addr + event_off;
+        ring->device_io_addr = ring->driver_io_addr + sizeof(struct pvirtq_event_suppress);
+
+        ring->avail_wrap = true;
+        ring->used_wrap = true;
+        ring->driver_event->flags = RING_EVENT_FLAGS_ENABLE;
+        ring->ids = ids;
+        for (uint16_t i = 0; i < num; i++) {
+            ring->desc[i].flags = 0;
+            ring->ids[i].next = i + 1;
+        }
+    } else {
+        assert((num & (num - 1)) == 0);
+        size_t avail_off = 16 * num;
+        size_t used_off = ALIGN(avail_off + 6 + 2 * num, 4);
+        ring->split.num = num;
+        ring->split.desc = (struct virtq_desc *)vaddr;
+        ring->split.avail = (struct virtq_avail *)(vaddr + avail_off);
+        ring->split.used = (struct virtq_used *)(vaddr + used_off);
+        ring->desc_io_addr = io_addr;
+        ring->driver_io_addr = io_addr + avail_off;
+        ring->device_io_addr = io_addr + used_off;
+
+        /* Free descriptors are chained through their next field */
+        for (uint16_t i = 0; i < num; i++) {
+            ring->split.desc[i].next = i + 1;
+        }
+    }
+}
+
+/**
+ * Memory needed for the indirect tables of a virtqueue.
+ *
+ * @param num number of descriptors in the virtqueue.
+ * @param max_desc most descriptors of a buffer added through its indirect table.
+ *
+ * @return size of the indirect tables in bytes.
+ */
+static inline size_t virtio_ring_indirect_size(uint16_t num, uint16_t max_desc)
+{
+    return (size_t)num * max_desc * 16;
+}
+
+/**
+ * Give the virtqueue indirect tables to add buffers through, which is only
+ * done if VIRTIO_F_INDIRECT_DESC was negotiated. Buffers of more than
+ * max_desc descriptors are still added to the ring directly.
+ *
+ * @param ring virtqueue to use the tables for.
+ * @param vaddr virtual address of virtio_ring_indirect_size(num, max_desc) bytes, 16 byte aligned.
+ * @param io_addr io address of the same memory.
+ * @param max_desc most descriptors in each table.
+ */
+static inline void virtio_ring_init_indirect(virtio_ring_t *ring, uintptr_t vaddr, uint64_t io_addr,
+                                             uint16_t max_desc)
+{
+    assert(vaddr % 16 == 0);
+    if (!ring->indirect_desc) {
+        return;
+    }
+
+    ring->indirect_max = max_desc;
+    ring->indirect_vaddr = vaddr;
+    ring->indirect_io_addr = io_addr;
+}
+
+static inline bool virtio_ring_use_indirect(virtio_ring_t *ring, uint16_t n)
+{
+    return n > 1 && n <= ring->indirect_max;
+}
+
+/**
+ * Get the number of descriptors not part of any buffer.
+ *
+ * @param ring virtqueue to check.
+ *
+ * @return number of free descriptors.
+ */
+static inline uint16_t virtio_ring_num_free(virtio_ring_t *ring)
+{
+    return ring->num_free;
+}
+
+/**
+ * Check whether a buffer can be added.
+ *
+ * @param ring virtqueue to check.
+ * @param n number of descriptors of the buffer.
+ *
+ * @return true if there is space for the buffer.
+ */
+static inline bool virtio_ring_can_add(virtio_ring_t *ring, uint16_t n)
+{
+    return (virtio_ring_use_indirect(ring, n) ? 1 : n) <= ring->num_free;
+}
+
+/**
+ * Get the number of buffers added that the device has not used yet.
+ *
+ * @param ring virtqueue to check.
+ *
+ * @return number of buffers in flight.
+ */
+static inline uint16_t virtio_ring_num_in_flight(virtio_ring_t *ring)
+{
+    return ring->num_in_flight;
+}
+
+/**
+ * Get the buffer id the next buffer added will be given, for drivers which
+ * need to prepare memory selected by the id before adding the buffer.
+ *
+ * @param ring virtqueue to check.
+ *
+ * @return id of the next buffer.
+ */
+static inline uint16_t virtio_ring_next_id(virtio_ring_t *ring)
+{
+    return ring->packed ? ring->free_id : ring->free_head;
+}
+
+static inline void virtio_ring_add_split(virtio_ring_t *ring, const virtio_ring_buf_t *bufs, uint16_t n,
+                                         uint16_t flags, uint16_t *id)
+{
+    uint16_t head = ring->free_head;
+    uint16_t idx = head;
+    for (uint16_t i = 0; i < n; i++) {
+        struct virtq_desc *desc = &ring->split.desc[idx];
+        desc->addr = bufs[i].addr;
+        desc->len = bufs[i].len;
+        desc->flags = flags | (bufs[i].write ? VIRTQ_DESC_F_WRITE : 0) | (i + 1 < n ? VIRTQ_DESC_F_NEXT : 0);
+        /* The free list already chains the descriptors together */
+        idx = desc->next;
+    }
+    ring->free_head = idx;
+
+    struct virtq_avail *avail = ring->split.avail;
+    avail->ring[avail->idx % ring->num] = head;
+    THREAD_MEMORY_RELEASE();
+    avail->idx++;
+
+    ring->num_added++;
+    *id = head;
+}
+
+static inline void virtio_ring_add_packed(virtio_ring_t *ring, const virtio_ring_buf_t *bufs, uint16_t n,
+                                          uint16_t flags, uint16_t *id)
+{
+    uint16_t buf_id = ring->free_id;
+    if (ring->in_order) {
+        ring->free_id = (buf_id + 1) % ring->num;
+    } else {
+        ring->free_id = ring->ids[buf_id].next;
+    }
+    ring->ids[buf_id].num_desc = n;
+
+    uint16_t head = ring->next_avail;
+    uint16_t head_flags = 0;
+    uint16_t pos = head;
+    bool wrap = ring->avail_wrap;
+    for (uint16_t i = 0; i < n; i++) {
+        uint16_t desc_flags = flags | (bufs[i].write ? VIRTQ_DESC_F_WRITE : 0) | (i + 1 < n ? VIRTQ_DESC_F_NEXT : 0);
+        desc_flags |= wrap ? VIRTQ_DESC_F_AVAIL : VIRTQ_DESC_F_USED;
+
+        struct pvirtq_desc *desc = &ring->desc[pos];
+        desc->addr = bufs[i].addr;
+        desc->len = bufs[i].len;
+        desc->id = buf_id;
+        /* The device may only see the buffer once all of its descriptors are written */
+        if (i == 0) {
+            head_flags = desc_flags;
+        } else {
+            desc->flags = desc_flags;
+        }
+
+        if (++pos == ring->num) {
+            pos = 0;
+            wrap = !wrap;
+        }
+    }
+    ring->next_avail = pos;
+    ring->avail_wrap = wrap;
+
+    THREAD_MEMORY_RELEASE();
+    ring->desc[head].flags = head_flags;
+
+    ring->num_added += n;
+    *id = buf_id;
+}
+
+/**
+ * Make a buffer available to the device. The device is not notified, see
+ * virtio_ring_kick_needed.
+ *
+ * @param ring virtqueue to add the buffer to.
+ * @param bufs descriptors of the buffer in order.
+ * @param n number of descriptors.
+ * @param id buffer id to identify the buffer once used.
+ *
+ * @return -1 if there are not enough free descriptors, otherwise 0.
+ */
+static inline int virtio_ring_add(virtio_ring_t *ring, const virtio_ring_buf_t *bufs, uint16_t n, uint16_t *id)
+{
+    if (n == 0 || !virtio_ring_can_add(ring, n)) {
+        return -1;
+    }
+
+    uint16_t flags = 0;
+    virtio_ring_buf_t table;
+    if (virtio_ring_use_indirect(ring, n)) {
+        /* Write the descriptors to the buffer's indirect table and add the table instead */
+        size_t table_off = virtio_ring_indirect_size(virtio_ring_next_id(ring), ring->indirect_max);
+        for (uint16_t i = 0; i < n; i++) {
+            uint16_t desc_flags = bufs[i].write ? VIRTQ_DESC_F_WRITE : 0;
+            if (ring->packed) {
+                struct pvirtq_desc *desc = (struct pvirtq_desc *)(ring->indirect_vaddr + table_off) + i;
+                *desc = (struct pvirtq_desc) { .addr = bufs[i].addr, .len = bufs[i].len, .flags = desc_flags };
+            } else {
+                struct virtq_desc *desc = (struct virtq_desc *)(ring->indirect_vaddr + table_off) + i;
+                if (i + 1 < n) {
+                    desc_flags |= VIRTQ_DESC_F_NEXT;
+                }
+                *desc = (struct virtq_desc) {
+                    .addr = bufs[i].addr, .len = bufs[i].len, .flags = desc_flags, .next = i + 1
+                };
+            }
+        }
+        table = (virtio_ring_buf_t) { .addr = ring->indirect_io_addr + table_off, .len = n * 16 };
+        bufs = &table;
+        n = 1;
+        flags = VIRTQ_DESC_F_INDIRECT;
+    }
+
+    if (ring->packed) {
+        virtio_ring_add_packed(ring, bufs, n, flags, id);
+    } else {
+        virtio_ring_add_split(ring, bufs, n, flags, id);
+    }
+    ring->num_free -= n;
+    ring->num_in_flight++;
+
+    return 0;
+}
+
+static inline bool virtio_ring_desc_used(virtio_ring_t *ring, uint16_t pos)
+{
+    uint16_t flags = __atomic_load_n(&ring->desc[pos].flags, __ATOMIC_ACQUIRE);
+    bool avail = flags & VIRTQ_DESC_F_AVAIL;
+    bool used = flags & VIRTQ_DESC_F_USED;
+    return avail == used && used == ring->used_wrap;
+}
+
+static inline void virtio_ring_free_packed(virtio_ring_t *ring, uint16_t id)
+{
+    uint16_t num_desc = ring->ids[id].num_desc;
+    ring->next_used += num_desc;
+    if (ring->next_used >= ring->num) {
+        ring->next_used -= ring->num;
+        ring->used_wrap = !ring->used_wrap;
+    }
+    ring->num_free += num_desc;
+
+    if (!ring->in_order) {
+        ring->ids[id].next = ring->free_id;
+        ring->free_id = id;
+    }
+}
+
+static inline int virtio_ring_get_used_packed(virtio_ring_t *ring, uint16_t *id, uint32_t *len)
+{
+    if (!ring->batch) {
+        if (!virtio_ring_desc_used(ring, ring->next_used)) {
+            return -1;
+        }
+        struct pvirtq_desc *desc = &ring->desc[ring->next_used];
+        if (!ring->in_order) {
+            *id = desc->id;
+            *len = desc->len;
+            virtio_ring_free_packed(ring, *id);
+            return 0;
+        }
+        ring->batch = true;
+        ring->batch_id = desc->id;
+        ring->batch_len = desc->len;
+    }
+
+    /*
+     * Buffers are used in order, and the device may write a single used
+     * descriptor for a batch of them, with the id of the last one.
+     */
+    *id = ring->used_id;
+    ring->used_id = (ring->used_id + 1) % ring->num;
+    virtio_ring_free_packed(ring, *id);
+    if (*id == ring->batch_id) {
+        ring->batch = false;
+        *len = ring->batch_len;
+    } else {
+        *len = 0;
+    }
+
+    return 0;
+}
+
+static inline int virtio_ring_get_used_split(virtio_ring_t *ring, uint16_t *id, uint32_t *len)
+{
+    if (ring->last_used == __atomic_load_n(&ring->split.used->idx, __ATOMIC_ACQUIRE)) {
+        return -1;
+    }
+
+    struct virtq_used_elem *used = &ring->split.used->ring[ring->last_used % ring->num];
+    *id = used->id;
+    *len = used->len;
+    ring->last_used++;
+
+    /* Put the buffer's descriptors back on the free list */
+    uint16_t idx = *id;
+    uint16_t num_desc = 1;
+    while (ring->split.desc[idx].flags & VIRTQ_DESC_F_NEXT) {
+        idx = ring->split.desc[idx].next;
+        num_desc++;
+    }
+    ring->split.desc[idx].next = ring->free_head;
+    ring->free_head = *id;
+    ring->num_free += num_desc;
+
+    return 0;
+}
+
+/**
+ * Take the next buffer the device has used. If VIRTIO_F_IN_ORDER was
+ * negotiated, the device may only report the length written for the last
+ * buffer of a batch, and the length of the others is given as 0.
+ *
+ * @param ring virtqueue to take the buffer from.
+ * @param id buffer id given when the buffer was added.
+ * @param len number of bytes the device wrote to the buffer.
+ *
+ * @return -1 if there are no used buffers, otherwise 0.
+ */
+static inline int virtio_ring_get_used(virtio_ring_t *ring, uint16_t *id, uint32_t *len)
+{
+    int err = ring->packed ? virtio_ring_get_used_packed(ring, id, len) : virtio_ring_get_used_split(ring, id, len);
+    if (!err) {
+        ring->num_in_flight--;
+    }
+    return err;
+}
+
+/**
+ * Check whether the device needs to be notified of the buffers added since
+ * it was last notified. Must be called, and the device notified if it
+ * returns true, after buffers have been added.
+ *
+ * @param ring virtqueue buffers were added to.
+ *
+ * @return true if the driver must notify the device.
+ */
+static inline bool virtio_ring_kick_needed(virtio_ring_t *ring)
+{
+    uint16_t added = ring->num_added;
+    ring->num_added = 0;
+
+    if (!ring->packed) {
+        return virtq_kick_needed(&ring->split, ring->split.avail->idx - added, ring->event_idx);
+    }
+
+    virtq_mb();
+    uint16_t off_wrap = ring->device_event->off_wrap;
+    uint16_t flags = ring->device_event->flags;
+    if (flags != RING_EVENT_FLAGS_DESC) {
+        return flags != RING_EVENT_FLAGS_DISABLE;
+    }
+
+    /* Compare positions in the previous lap of the ring as negative */
+    uint16_t event = off_wrap & ~(1 << 15);
+    if ((bool)(off_wrap >> 15) != ring->avail_wrap) {
+        event -= ring->num;
+    }
+    return virtq_need_event(event, ring->next_avail, ring->next_avail - added);
+}
+
+/**
+ * Ask the device to interrupt the driver once it has used more buffers, and
+ * check for buffers it used in the meantime. Once it has no used buffers
+ * left, the driver calls this and processes used buffers again until it
+ * returns false. Without VIRTIO_F_EVENT_IDX the device interrupts for every
+ * buffer it uses.
+ *
+ * @param ring virtqueue to be interrupted for.
+ * @param delay number of used buffers after the next one that the interrupt
+ *              may be held back for, an estimate for packed rings.
+ *
+ * @return true if the device has used buffers that have not been taken.
+ */
+static inline bool virtio_ring_enable_interrupt(virtio_ring_t *ring, uint16_t delay)
+{
+    if (!ring->packed) {
+        return virtq_enable_used_event(&ring->split, ring->last_used, ring->last_used + delay, ring->event_idx);
+    }
+
+    if (ring->event_idx) {
+        /* Used descriptors are written at the position of each buffer's first descriptor */
+        uint16_t off = ring->next_used;
+        bool wrap = ring->used_wrap;
+        if (delay && ring->num_in_flight) {
+            uint32_t desc_in_flight = ring->num - ring->num_free;
+            off += MIN((uint32_t)delay * desc_in_flight / ring->num_in_flight, desc_in_flight - 1);
+            if (off >= ring->num) {
+                off -= ring->num;
+                wrap = !wrap;
+            }
+        }
+        ring->driver_event->off_wrap = off | ((uint16_t)wrap << 15);
+        THREAD_MEMORY_RELEASE();
+        ring->driver_event->flags = RING_EVENT_FLAGS_DESC;
+    } else {
+        ring->driver_event->flags = RING_EVENT_FLAGS_ENABLE;
+    }
+
+    virtq_mb();
+    return ring->batch || virtio_ring_desc_used(ring, ring->next_used);
+}
@@ -7,6 +7,7 @@
 
 #include <sddf/resources/device.h>
 #include <sddf/util/printf.h>
+#include <sddf/virtio/ring.h>
 
 // #define DEBUG_VIRTIO_TRANSPORT
 
@@ -62,3 +63,28 @@ bool virtio_transport_queue_setup(virtio_device_handle_t *device_handle, uint32_
 void virtio_transport_queue_notify(virtio_device_handle_t *device_handle, uint32_t select);
 uint32_t virtio_transport_read_isr(virtio_device_handle_t *device_handle);
 void virtio_transport_write_isr(virtio_device_handle_t *device_handle, uint32_t isr);
+
+/**
+ * Negotiate features with the device. The driver accepts those of the given
+ * features that the device offers, along with the virtqueue features
+ * (VIRTIO_RING_FEATURES) it offers, which every driver using virtio_ring_t
+ * supports. VIRTIO_F_IN_ORDER is only accepted along with the packed layout.
+ *
+ * @param device_handle device to negotiate with.
+ * @param features features the driver supports, as a mask of feature bits.
+ *
+ * @return the negotiated features.
+ */
+static inline uint64_t virtio_transport_negotiate_features(virtio_device_handle_t *device_handle, uint64_t features)
+{
+    uint64_t offered = virtio_transport_get_device_features(device_handle, 0)
+                     | ((uint64_t)virtio_transport_get_device_features(device_handle, 1) << 32);
+    uint64_t negotiated = offered & (features | VIRTIO_RING_FEATURES);
+    if (!(negotiated & (1ULL << VIRTIO_F_RING_PACKED))) {
+        negotiated &= ~(1ULL << VIRTIO_F_IN_ORDER);
+    }
+    virtio_transport_set_driver_features(device_handle, 0, (uint32_t)negotiated);
+    virtio_transport_set_driver_features(device_handle, 1, (uint32_t)(negotiated >> 32));
+
+    return negotiated;
+}
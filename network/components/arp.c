@@ -3,63 +3,64 @@
  * SPDX-License-Identifier: BSD-2-Clause
  */
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
-#include <microkit.h>
-#include <sddf/network/queue.h>
+#include <os/sddf.h>
+#include <sddf/network/arp.h>
+#include <sddf/network/config.h>
 #include <sddf/network/constants.h>
+#include <sddf/network/mac802.h>
+#include <sddf/network/queue.h>
+#include <sddf/network/stats.h>
 #include <sddf/network/util.h>
+#include <sddf/util/util.h>
 #include <sddf/util/printf.h>
-#include <ethernet_config.h>
-
-#define ETH_TYPE_ARP 0x0806U
-#define ETHARP_OPCODE_REQUEST 1
-#define ETHARP_OPCODE_REPLY 2
-#define ETH_HWADDR_LEN 6
-
-#define RX_CH 0
-#define TX_CH 1
-#define CLIENT_CH 2
-#define REG_IP 0
-#define IPV4_PROTO_LEN 4
-#define PADDING_SIZE 10
-#define LWIP_IANA_HWTYPE_ETHERNET 1
-#define NUM_ARP_CLIENTS (NUM_NETWORK_CLIENTS - 1)
-
-#define ETH_TYPE_ARP 0x0806U
-#define ETH_TYPE_IP 0x0800U
-#define ETHARP_OPCODE_REQUEST 1
-#define ETHARP_OPCODE_REPLY 2
-
-net_queue_handle_t rx_queue;
-net_queue_handle_t tx_queue;
-
-net_queue_t *rx_free;
-net_queue_t *rx_active;
-net_queue_t *tx_free;
-net_queue_t *tx_active;
-
-uintptr_t rx_buffer_data_region;
-uintptr_t tx_buffer_data_region;
-
-uint8_t mac_addrs[NUM_ARP_CLIENTS][ETH_HWADDR_LEN];
-uint32_t ipv4_addrs[NUM_ARP_CLIENTS];
-
-struct __attribute__((__packed__)) arp_packet {
-    uint8_t ethdst_addr[ETH_HWADDR_LEN];
-    uint8_t ethsrc_addr[ETH_HWADDR_LEN];
-    uint16_t type;
-    uint16_t hwtype;
-    uint16_t proto;
-    uint8_t hwlen;
-    uint8_t protolen;
-    uint16_t opcode;
-    uint8_t hwsrc_addr[ETH_HWADDR_LEN];
-    uint32_t ipsrc_addr;
-    uint8_t hwdst_addr[ETH_HWADDR_LEN];
-    uint32_t ipdst_addr;
-    uint8_t padding[10];
-    uint32_t crc;
-};
+
+/* Number of characters needed to store string of longest IPV4 address */
+#define ARP_IPV4_ADDR_STRLEN 16
+
+/**
+ * The IP lookup table is an open addressing hash table with linear probing.
+ * It has twice as many slots as the maximum number of clients so that probe
+ * sequences stay short, and must be a power of two in size.
+ */
+#define ARP_TABLE_BITS 7
+#define ARP_TABLE_SIZE (1 << ARP_TABLE_BITS)
+#define ARP_TABLE_MASK (ARP_TABLE_SIZE - 1)
+
+_Static_assert(ARP_TABLE_SIZE >= 2 * SDDF_NET_MAX_CLIENTS, "ARP table must be at least twice the number of clients");
+
+__attribute__((__section__(".net_arp_config"))) net_arp_config_t config;
+
+typedef struct arp_entry {
+    /* IPv4 address in network byte order, 0 marks an empty slot */
+    uint32_t ip_addr;
+    uint8_t client;
+} arp_entry_t;
+
+typedef struct state {
+    net_queue_handle_t rx_queue;
+    net_queue_handle_t tx_queue;
+    arp_entry_t table[ARP_TABLE_SIZE];
+    /* IP address currently registered by each client, 0 if none */
+    uint32_t client_ip_addrs[SDDF_NET_MAX_CLIENTS];
+    /* Bitmap of clients whose gratuitous ARP could not yet be transmitted */
+    uint64_t garp_pending;
+} state_t;
+
+state_t state;
+
+/* Booleans to indicate whether buffers have been enqueued during notification handling */
+static bool notify_rx;
+static bool notify_tx;
+
+#define STATS_RX 0
+#define STATS_TX 1
+#define STATS_NUM_QUEUES 2
+
+static uint64_t stats_fallback[NET_STATS_SIZE(STATS_NUM_QUEUES) / sizeof(uint64_t)];
+net_stats_t *stats;
 
 static char *ipaddr_to_string(uint32_t s_addr, char *buf, int buflen)
 {
@@ -92,143 +93,316 @@ static char *ipaddr_to_string(uint32_t s_addr, char *buf, int buflen)
     return buf;
 }
 
-static int match_ip_to_client(uint32_t addr)
+static inline uint32_t arp_table_hash(uint32_t ip_addr)
 {
-    for (int i = 0; i < NUM_ARP_CLIENTS; i++) {
-        if (ipv4_addrs[i] == addr) {
-            return i;
-        }
+    /* Fibonacci hashing, the top bits of the product are the best mixed */
+    return (ip_addr * 0x9E3779B1U) >> (32 - ARP_TABLE_BITS);
+}
+
+/**
+ * Find the slot holding an IP address, or the empty slot which terminates its
+ * probe sequence if the address is not in the table.
+ */
+static uint32_t arp_table_slot(uint32_t ip_addr)
+{
+    uint32_t slot = arp_table_hash(ip_addr);
+    while (state.table[slot].ip_addr != 0 && state.table[slot].ip_addr != ip_addr) {
+        slot = (slot + 1) & ARP_TABLE_MASK;
     }
 
-    return -1;
+    return slot;
 }
 
-static int arp_reply(const uint8_t ethsrc_addr[ETH_HWADDR_LEN],
-                     const uint8_t ethdst_addr[ETH_HWADDR_LEN],
-                     const uint8_t hwsrc_addr[ETH_HWADDR_LEN], const uint32_t ipsrc_addr,
-                     const uint8_t hwdst_addr[ETH_HWADDR_LEN], const uint32_t ipdst_addr)
+/**
+ * Return the client that has registered the IP address, or -1 if there is
+ * none.
+ */
+static int arp_table_lookup(uint32_t ip_addr)
 {
-    if (net_queue_empty_free(&tx_queue)) {
-        sddf_dprintf("ARP|LOG: Transmit free queue empty or transmit active queue full. Dropping reply\n");
+    arp_entry_t *entry = &state.table[arp_table_slot(ip_addr)];
+    if (entry->ip_addr == 0) {
         return -1;
     }
 
+    return entry->client;
+}
+
+static void arp_table_remove(uint32_t ip_addr)
+{
+    uint32_t hole = arp_table_slot(ip_addr);
+    if (state.table[hole].ip_addr == 0) {
+        return;
+    }
+
+    /* Shift back any following entries whose probe sequence passes through the
+    hole, so that lookups never need tombstones */
+    uint32_t next = hole;
+    while (true) {
+        next = (next + 1) & ARP_TABLE_MASK;
+        if (state.table[next].ip_addr == 0) {
+            break;
+        }
+
+        uint32_t home = arp_table_hash(state.table[next].ip_addr);
+        bool reachable = (hole <= next) ? (hole < home && home <= next) : (hole < home || home <= next);
+        if (reachable) {
+            continue;
+        }
+
+        state.table[hole] = state.table[next];
+        hole = next;
+    }
+
+    state.table[hole].ip_addr = 0;
+}
+
+static arp_err_t arp_table_insert(uint32_t ip_addr, uint8_t client)
+{
+    uint32_t slot = arp_table_slot(ip_addr);
+    if (state.table[slot].ip_addr != 0 && state.table[slot].client != client) {
+        return ARP_ERR_IP_IN_USE;
+    }
+
+    state.table[slot].ip_addr = ip_addr;
+    state.table[slot].client = client;
+
+    return ARP_ERR_OKAY;
+}
+
+/**
+ * Build an ARP packet in a free Tx buffer and enqueue it for transmission.
+ * The Tx virtualiser is not notified, this is left to the caller once the
+ * whole batch has been enqueued.
+ *
+ * @return false if no free Tx buffer is available, true otherwise.
+ */
+static bool arp_enqueue(uint16_t opcode, const mac_addr_t *ethdst_addr, const mac_addr_t *hwsrc_addr,
+                        uint32_t ipsrc_addr, const mac_addr_t *hwdst_addr, uint32_t ipdst_addr)
+{
+    if (net_queue_empty_free(&state.tx_queue)) {
+        return false;
+    }
+
     net_buff_desc_t buffer;
-    int err = net_dequeue_free(&tx_queue, &buffer);
+    int err = net_dequeue_free(&state.tx_queue, &buffer);
     assert(!err);
 
-    struct arp_packet *reply = (struct arp_packet *)(tx_buffer_data_region + buffer.io_or_offset);
-    memcpy(&reply->ethdst_addr, ethdst_addr, ETH_HWADDR_LEN);
-    memcpy(&reply->ethsrc_addr, ethsrc_addr, ETH_HWADDR_LEN);
-
-    reply->type = HTONS(ETH_TYPE_ARP);
-    reply->hwtype = HTONS(LWIP_IANA_HWTYPE_ETHERNET);
-    reply->proto = HTONS(ETH_TYPE_IP);
-    reply->hwlen = ETH_HWADDR_LEN;
-    reply->protolen = IPV4_PROTO_LEN;
-    reply->opcode = HTONS(ETHARP_OPCODE_REPLY);
-
-    memcpy(&reply->hwsrc_addr, hwsrc_addr, ETH_HWADDR_LEN);
-    reply->ipsrc_addr = ipsrc_addr;
-    memcpy(&reply->hwdst_addr, hwdst_addr, ETH_HWADDR_LEN);
-    reply->ipdst_addr = ipdst_addr;
-    memset(&reply->padding, 0, 10);
-
-    buffer.len = 56;
-    err = net_enqueue_active(&tx_queue, buffer);
+    arp_packet_t *pkt = (arp_packet_t *)(config.tx_data.vaddr + buffer.io_or_offset);
+    pkt->ethdst_addr = *ethdst_addr;
+    pkt->ethsrc_addr = *hwsrc_addr;
+    pkt->type = HTONS(ETH_TYPE_ARP);
+    pkt->hwtype = HTONS(ARP_HWTYPE_ETHERNET);
+    pkt->proto = HTONS(ETH_TYPE_IP);
+    pkt->hwlen = MAC802_BYTES;
+    pkt->protolen = ARP_IPV4_PROTO_LEN;
+    pkt->opcode = HTONS(opcode);
+    pkt->hwsrc_addr = *hwsrc_addr;
+    pkt->ipsrc_addr = ipsrc_addr;
+    pkt->hwdst_addr = *hwdst_addr;
+    pkt->ipdst_addr = ipdst_addr;
+    memset(&pkt->padding, 0, sizeof(pkt->padding));
+
+    buffer.len = sizeof(arp_packet_t);
+    err = net_enqueue_active(&state.tx_queue, buffer);
     assert(!err);
+    net_stats_packet(&stats->queues[STATS_TX], buffer.len);
+    notify_tx = true;
 
-    return 0;
+    return true;
 }
 
-void receive(void)
+/**
+ * Announce a client's IP address with a gratuitous ARP request so that
+ * neighbours update any stale cache entries.
+ */
+static bool arp_announce(uint8_t client)
 {
-    bool transmitted = false;
+    const mac_addr_t bcast = { { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF } };
+    const mac_addr_t unknown = { { 0 } };
+    uint32_t ip_addr = state.client_ip_addrs[client];
+
+    return arp_enqueue(ARP_OPCODE_REQUEST, &bcast, &config.clients[client].mac_addr, ip_addr, &unknown, ip_addr);
+}
+
+/**
+ * Transmit any outstanding gratuitous ARPs. If we run out of free Tx buffers,
+ * request a notification from the Tx virtualiser once more are returned.
+ */
+static void send_pending_announcements(void)
+{
+    bool reprocess = true;
+    while (reprocess) {
+        while (state.garp_pending) {
+            uint8_t client = __builtin_ctzll(state.garp_pending);
+            if (!arp_announce(client)) {
+                break;
+            }
+            state.garp_pending &= ~BIT(client);
+        }
+
+        reprocess = false;
+        if (!state.garp_pending) {
+            net_cancel_signal_free(&state.tx_queue);
+            break;
+        }
+
+        net_request_signal_free(&state.tx_queue);
+        if (!net_queue_empty_free(&state.tx_queue)) {
+            net_cancel_signal_free(&state.tx_queue);
+            reprocess = true;
+        }
+    }
+}
+
+static void rx_return(void)
+{
+    net_stats_occupancy(&stats->queues[STATS_RX], &state.rx_queue);
     bool reprocess = true;
     while (reprocess) {
-        while (!net_queue_empty_active(&rx_queue)) {
+        while (!net_queue_empty_active(&state.rx_queue)) {
             net_buff_desc_t buffer;
-            int err = net_dequeue_active(&rx_queue, &buffer);
+            int err = net_dequeue_active(&state.rx_queue, &buffer);
             assert(!err);
-
-            /* Check if packet is an ARP request */
-            struct ethernet_header *ethhdr = (struct ethernet_header *)(rx_buffer_data_region + buffer.io_or_offset);
-            if (ethhdr->type == HTONS(ETH_TYPE_ARP)) {
-                struct arp_packet *pkt = (struct arp_packet *)addr;
-                /* Check if it's a probe, ignore announcements */
-                if (pkt->opcode == HTONS(ETHARP_OPCODE_REQUEST)) {
-                    /* Check it it's for a client */
-                    int client = match_ip_to_client(pkt->ipdst_addr);
-                    if (client >= 0) {
-                        /* Send a response */
-                        if (!arp_reply(mac_addrs[client], pkt->ethsrc_addr, mac_addrs[client], pkt->ipdst_addr,
-                                       pkt->hwsrc_addr, pkt->ipsrc_addr)) {
-                            transmitted = true;
-                        }
+            net_stats_packet(&stats->queues[STATS_RX], buffer.len);
+
+            arp_packet_t *pkt = (arp_packet_t *)(config.rx_data.vaddr + buffer.io_or_offset);
+            /* Only answer well formed IPv4 requests, announcements and replies are ignored */
+            if (buffer.len >= offsetof(arp_packet_t, padding) && pkt->type == HTONS(ETH_TYPE_ARP)
+                && pkt->opcode == HTONS(ARP_OPCODE_REQUEST) && pkt->proto == HTONS(ETH_TYPE_IP)
+                && pkt->protolen == ARP_IPV4_PROTO_LEN && pkt->hwlen == MAC802_BYTES) {
+                int client = arp_table_lookup(pkt->ipdst_addr);
+                if (client >= 0) {
+                    if (!arp_enqueue(ARP_OPCODE_REPLY, &pkt->ethsrc_addr, &config.clients[client].mac_addr,
+                                     pkt->ipdst_addr, &pkt->hwsrc_addr, pkt->ipsrc_addr)) {
+                        sddf_dprintf("ARP|LOG: Transmit free queue empty. Dropping reply\n");
+                        stats->queues[STATS_TX].drops[NET_DROP_NO_BUFFER]++;
                     }
                 }
             }
 
             buffer.len = 0;
-            err = net_enqueue_free(&rx_queue, buffer);
+            err = net_enqueue_free(&state.rx_queue, buffer);
             assert(!err);
+            notify_rx = true;
         }
 
-        net_request_signal_active(&rx_queue);
+        net_request_signal_active(&state.rx_queue);
         reprocess = false;
 
-        if (!net_queue_empty_active(&rx_queue)) {
-            net_cancel_signal_active(&rx_queue);
+        if (!net_queue_empty_active(&state.rx_queue)) {
+            net_cancel_signal_active(&state.rx_queue);
             reprocess = true;
         }
     }
+}
 
-    if (transmitted && net_require_signal_active(&tx_queue)) {
-        net_cancel_signal_active(&tx_queue);
-        microkit_deferred_notify(TX_CH);
+static void notify_virts(void)
+{
+    if (notify_rx) {
+        bool signal = net_require_signal_free(&state.rx_queue);
+        if (signal) {
+            net_cancel_signal_free(&state.rx_queue);
+            sddf_notify(config.rx.id);
+        }
+        net_stats_notify(&stats->queues[STATS_RX], signal);
     }
+    notify_rx = false;
+
+    if (notify_tx) {
+        net_stats_occupancy(&stats->queues[STATS_TX], &state.tx_queue);
+        bool signal = net_require_signal_active(&state.tx_queue);
+        if (signal) {
+            net_cancel_signal_active(&state.tx_queue);
+            sddf_notify(config.tx.id);
+        }
+        net_stats_notify(&stats->queues[STATS_TX], signal);
+    }
+    notify_tx = false;
 }
 
-void notified(microkit_channel ch)
+void notified(sddf_channel ch)
 {
-    receive();
+    net_stats_begin(stats);
+    if (ch == config.rx.id) {
+        rx_return();
+    }
+
+    /* Free Tx buffers may have been returned, retry any deferred announcements */
+    send_pending_announcements();
+    notify_virts();
+    net_stats_end(stats);
 }
 
-seL4_MessageInfo_t protected(microkit_channel ch, microkit_msginfo msginfo)
+seL4_MessageInfo_t protected(sddf_channel ch, seL4_MessageInfo_t msginfo)
 {
-    int client = ch - CLIENT_CH;
-    if (client >= NUM_ARP_CLIENTS || client < 0) {
-        sddf_dprintf("ARP|LOG: PPC from unkown client %d\n", client);
-        return microkit_msginfo_new(0, 0);
-    }
-
-    uint32_t ip_addr = microkit_mr_get(0);
-    uint32_t mac_higher = microkit_mr_get(1);
-    uint32_t mac_lower = microkit_mr_get(2);
-    uint64_t mac = (((uint64_t) mac_higher) << 32) | mac_lower;
-
-    char buf[16];
-    switch (microkit_msginfo_get_label(msginfo)) {
-    case REG_IP:
-        sddf_printf("ARP|NOTICE: client%d registering ip address: %s with MAC: %02lx:%02lx:%02lx:%02lx:%02lx:%02lx\n",
-                    client, ipaddr_to_string(ip_addr, buf, 16), mac >> 40, mac >> 32 & 0xff, mac >> 24 & 0xff,
-                    mac >> 16 & 0xff, mac >> 8 & 0xff, mac & 0xff);
-        ipv4_addrs[client] = ip_addr;
-        break;
-    default:
-        sddf_dprintf("ARP|LOG: PPC from client%d with unknown message label %lu\n", client,
-                     microkit_msginfo_get_label(msginfo));
-        break;
+    uint8_t client = 0;
+    while (client < config.num_clients && config.clients[client].id != ch) {
+        client++;
     }
 
-    return microkit_msginfo_new(0, 0);
+    if (client == config.num_clients) {
+        sddf_dprintf("ARP|LOG: PPC from unknown channel %u\n", ch);
+        sddf_set_mr(0, ARP_ERR_INVALID_OPERATION);
+        return seL4_MessageInfo_new(0, 0, 0, 1);
+    }
+
+    switch (seL4_MessageInfo_get_label(msginfo)) {
+    case ARP_REG_IP: {
+        uint32_t ip_addr = sddf_get_mr(ARP_REG_IP_ARG);
+        if (ip_addr == 0) {
+            sddf_set_mr(ARP_REG_RET_ERR, ARP_ERR_INVALID_IP);
+            return seL4_MessageInfo_new(0, 0, 0, ARP_REG_RET_NUM_ARGS);
+        }
+
+        int owner = arp_table_lookup(ip_addr);
+        if (owner >= 0 && owner != client) {
+            sddf_set_mr(ARP_REG_RET_ERR, ARP_ERR_IP_IN_USE);
+            return seL4_MessageInfo_new(0, 0, 0, ARP_REG_RET_NUM_ARGS);
+        }
+
+        if (state.client_ip_addrs[client] != 0 && state.client_ip_addrs[client] != ip_addr) {
+            arp_table_remove(state.client_ip_addrs[client]);
+        }
+
+        arp_err_t err = arp_table_insert(ip_addr, client);
+        assert(err == ARP_ERR_OKAY);
+        state.client_ip_addrs[client] = ip_addr;
+
+        char buf[ARP_IPV4_ADDR_STRLEN];
+        const uint8_t *mac = config.clients[client].mac_addr.addr;
+        sddf_printf("ARP|NOTICE: client%u registering ip address: %s with MAC: %02x:%02x:%02x:%02x:%02x:%02x\n",
+                    client, ipaddr_to_string(ip_addr, buf, ARP_IPV4_ADDR_STRLEN), mac[0], mac[1], mac[2], mac[3],
+                    mac[4], mac[5]);
+
+        state.garp_pending |= BIT(client);
+        net_stats_begin(stats);
+        send_pending_announcements();
+        notify_virts();
+        net_stats_end(stats);
+
+        sddf_set_mr(ARP_REG_RET_ERR, ARP_ERR_OKAY);
+        return seL4_MessageInfo_new(0, 0, 0, ARP_REG_RET_NUM_ARGS);
+    }
+    default:
+        sddf_dprintf("ARP|LOG: PPC from client%u with unknown message label %lu\n", client,
+                     seL4_MessageInfo_get_label(msginfo));
+        sddf_set_mr(0, ARP_ERR_INVALID_OPERATION);
+        return seL4_MessageInfo_new(0, 0, 0, 1);
+    }
 }
 
 void init(void)
 {
-    net_queue_init(&rx_queue, rx_free, rx_active, ETHERNET_RX_QUEUE_SIZE_ARP);
-    net_queue_init(&tx_queue, tx_free, tx_active, ETHERNET_TX_QUEUE_SIZE_ARP);
-    net_buffers_init(&tx_queue, 0);
+    assert(net_config_check_magic(&config));
+
+    net_queue_init(&state.rx_queue, config.rx.free_queue.vaddr, config.rx.active_queue.vaddr, config.rx.num_buffers);
+    net_queue_init(&state.tx_queue, config.tx.free_queue.vaddr, config.tx.active_queue.vaddr, config.tx.num_buffers);
+    net_buffers_init(&state.tx_queue, 0);
+
+    stats = net_stats_init(&config.stats, stats_fallback, sizeof(stats_fallback), NET_STATS_ARP, STATS_NUM_QUEUES);
+    stats->queues[STATS_RX].capacity = config.rx.num_buffers;
+    stats->queues[STATS_TX].capacity = config.tx.num_buffers;
 
-    ethernet_arp_mac_addr_init_sys(microkit_name, (uint8_t *) mac_addrs);
+    /* Free Tx buffers are only waited on while announcements are outstanding */
+    net_cancel_signal_free(&state.tx_queue);
 }
@@ -7,6 +7,7 @@
 #include <os/sddf.h>
 #include <sddf/network/queue.h>
 #include <sddf/network/config.h>
+#include <sddf/network/stats.h>
 #include <string.h>
 #include <sddf/util/util.h>
 #include <sddf/util/printf.h>
@@ -16,12 +17,21 @@ __attribute__((__section__(".net_copy_config"))) net_copy_config_t config;
 net_queue_handle_t rx_queue_virt;
 net_queue_handle_t rx_queue_cli;
 
+#define STATS_VIRT 0
+#define STATS_CLIENT 1
+#define STATS_NUM_QUEUES 2
+
+static uint64_t stats_fallback[NET_STATS_SIZE(STATS_NUM_QUEUES) / sizeof(uint64_t)];
+net_stats_t *stats;
+
 void rx_return(void)
 {
     bool client_enqueued = false;
     bool virt_enqueued = false;
     bool reprocess = true;
 
+    net_stats_begin(stats);
+    net_stats_occupancy(&stats->queues[STATS_VIRT], &rx_queue_virt);
     while (reprocess) {
         while (!net_queue_empty_active(&rx_queue_virt)) {
             /* Copy into client buffer if available, else return to rx virt free queue */
@@ -35,6 +45,7 @@ void rx_return(void)
                     sddf_dprintf("COPY|LOG: Client provided offset %lx which is not buffer aligned or outside of "
                                  "buffer region\n",
                                  cli_buffer.io_or_offset);
+                    stats->queues[STATS_CLIENT].drops[NET_DROP_INVALID]++;
                     continue;
                 }
 
@@ -48,9 +59,14 @@ void rx_return(void)
 
                 memcpy(cli_addr, virt_addr, virt_buffer.len);
                 cli_buffer.len = virt_buffer.len;
+                cli_buffer.flags = virt_buffer.flags;
+                cli_buffer.csum_start = virt_buffer.csum_start;
+                cli_buffer.csum_offset = virt_buffer.csum_offset;
 
                 err = net_enqueue_active(&rx_queue_cli, cli_buffer);
                 assert(!err);
+                net_stats_packet(&stats->queues[STATS_VIRT], virt_buffer.len);
+                net_stats_packet(&stats->queues[STATS_CLIENT], cli_buffer.len);
 
                 /* In case the copy component receives packets from the vswitch,
                  * we preserve the packet's length field as it may be reused. */
@@ -65,6 +81,7 @@ void rx_return(void)
 
                 err = net_enqueue_free(&rx_queue_virt, virt_buffer);
                 assert(!err);
+                stats->queues[STATS_CLIENT].drops[NET_DROP_NO_BUFFER]++;
             }
             virt_enqueued = true;
         }
@@ -78,15 +95,25 @@ void rx_return(void)
         }
     }
 
-    if (client_enqueued && net_require_signal_active(&rx_queue_cli)) {
-        net_cancel_signal_active(&rx_queue_cli);
-        sddf_notify(config.client.id);
+    net_stats_occupancy(&stats->queues[STATS_CLIENT], &rx_queue_cli);
+    if (client_enqueued) {
+        bool signal = net_require_signal_active(&rx_queue_cli);
+        if (signal) {
+            net_cancel_signal_active(&rx_queue_cli);
+            sddf_notify(config.client.id);
+        }
+        net_stats_notify(&stats->queues[STATS_CLIENT], signal);
     }
 
-    if (virt_enqueued && net_require_signal_free(&rx_queue_virt)) {
-        net_cancel_signal_free(&rx_queue_virt);
-        sddf_deferred_notify(config.rx.id);
+    if (virt_enqueued) {
+        bool signal = net_require_signal_free(&rx_queue_virt);
+        if (signal) {
+            net_cancel_signal_free(&rx_queue_virt);
+            sddf_deferred_notify(config.rx.id);
+        }
+        net_stats_notify(&stats->queues[STATS_VIRT], signal);
     }
+    net_stats_end(stats);
 }
 
 void notified(sddf_channel ch)
@@ -103,4 +130,8 @@ void init(void)
     net_queue_init(&rx_queue_virt, config.rx.free_queue.vaddr, config.rx.active_queue.vaddr, config.rx.num_buffers);
 
     net_buffers_init(&rx_queue_cli, 0);
+
+    stats = net_stats_init(&config.stats, stats_fallback, sizeof(stats_fallback), NET_STATS_COPY, STATS_NUM_QUEUES);
+    stats->queues[STATS_VIRT].capacity = rx_queue_virt.capacity;
+    stats->queues[STATS_CLIENT].capacity = rx_queue_cli.capacity;
 }
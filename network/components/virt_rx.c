@@ -8,8 +8,10 @@
 #include <os/sddf.h>
 #include <sddf/network/config.h>
 #include <sddf/network/constants.h>
+#include <sddf/network/filter.h>
 #include <sddf/network/mac802.h>
 #include <sddf/network/queue.h>
+#include <sddf/network/stats.h>
 #include <sddf/network/util.h>
 #include <sddf/util/cache.h>
 #include <sddf/util/printf.h>
@@ -29,10 +31,19 @@ uint8_t *buffer_refs;
 typedef struct state {
     net_queue_handle_t rx_queue_drv;
     net_queue_handle_t rx_queue_clients[SDDF_NET_MAX_CLIENTS];
+    /* Whether a client's filter can reject packets, so must be evaluated */
+    bool filter_enabled[SDDF_NET_MAX_CLIENTS];
+    net_filter_stats_t filter_stats[SDDF_NET_MAX_CLIENTS];
 } state_t;
 
 state_t state;
 
+#define STATS_DRIVER 0
+#define STATS_CLIENT(client) (1 + (client))
+
+static uint64_t stats_fallback[NET_STATS_SIZE(1 + SDDF_NET_MAX_CLIENTS) / sizeof(uint64_t)];
+net_stats_t *stats;
+
 /* Boolean to indicate whether a packet has been enqueued into the driver's free queue during notification handling */
 static bool notify_drv;
 
@@ -57,15 +68,40 @@ int get_mac_addr_match(ether_hdr_t *buffer)
     return -1;
 }
 
+/**
+ * Check whether a client accepts a packet. The packet's headers are only
+ * parsed the first time a filter needs to be evaluated.
+ */
+static bool client_accepts(int client, ether_hdr_t *frame, uint16_t len, net_filter_key_t *key, bool *parsed)
+{
+    if (!state.filter_enabled[client]) {
+        return true;
+    }
+
+    if (!*parsed) {
+        net_filter_parse(frame, len, key);
+        *parsed = true;
+    }
+
+    if (!net_filter_accept(&config.filters[client], key, &state.filter_stats[client])) {
+        stats->queues[STATS_CLIENT(client)].drops[NET_DROP_FILTERED]++;
+        return false;
+    }
+
+    return true;
+}
+
 void rx_return(void)
 {
     bool reprocess = true;
     bool notify_clients[SDDF_NET_MAX_CLIENTS] = { false };
+    net_stats_occupancy(&stats->queues[STATS_DRIVER], &state.rx_queue_drv);
     while (reprocess) {
         while (!net_queue_empty_active(&state.rx_queue_drv)) {
             net_buff_desc_t buffer;
             int err = net_dequeue_active(&state.rx_queue_drv, &buffer);
             assert(!err);
+            net_stats_packet(&stats->queues[STATS_DRIVER], buffer.len);
 
             buffer.io_or_offset = buffer.io_or_offset - config.data.io_addr;
             uintptr_t buffer_vaddr = buffer.io_or_offset + (uintptr_t)config.data.region.vaddr;
@@ -80,28 +116,53 @@ void rx_return(void)
             //
             // [1]: https://developer.arm.com/documentation/ddi0595/2021-06/AArch64-Instructions/DC-IVAC--Data-or-unified-Cache-line-Invalidate-by-VA-to-PoC
             cache_clean_and_invalidate(buffer_vaddr, buffer_vaddr + buffer.len);
-            int client = get_mac_addr_match((ether_hdr_t *)buffer_vaddr);
-            if (client == BROADCAST_ID) {
-                int ref_index = buffer.io_or_offset / NET_BUFFER_SIZE;
-                assert(buffer_refs[ref_index] == 0);
-                // For broadcast packets, set the refcount to number of clients
-                // in the system. Only enqueue buffer back to driver if
-                // all clients have consumed the buffer.
-                buffer_refs[ref_index] = config.num_clients;
+            ether_hdr_t *frame = (ether_hdr_t *)buffer_vaddr;
+            net_filter_key_t key;
+            bool parsed = false;
+            int client = get_mac_addr_match(frame);
+            if (client == -1) {
+                stats->queues[STATS_DRIVER].drops[NET_DROP_NO_MATCH]++;
+            } else if (client >= 0 && !client_accepts(client, frame, buffer.len, &key, &parsed)) {
+                client = -1;
+            }
 
+            if (client == BROADCAST_ID) {
+                bool accepted[SDDF_NET_MAX_CLIENTS];
+                uint8_t num_accepted = 0;
                 for (int i = 0; i < config.num_clients; i++) {
-                    err = net_enqueue_active(&state.rx_queue_clients[i], buffer);
-                    assert(!err);
-                    notify_clients[i] = true;
+                    accepted[i] = client_accepts(i, frame, buffer.len, &key, &parsed);
+                    num_accepted += accepted[i];
+                }
+
+                if (num_accepted) {
+                    int ref_index = buffer.io_or_offset / NET_BUFFER_SIZE;
+                    assert(buffer_refs[ref_index] == 0);
+                    // For broadcast packets, set the refcount to number of
+                    // clients accepting the packet. Only enqueue buffer back to
+                    // driver once all of them have consumed the buffer.
+                    buffer_refs[ref_index] = num_accepted;
+
+                    for (int i = 0; i < config.num_clients; i++) {
+                        if (!accepted[i]) {
+                            continue;
+                        }
+                        err = net_enqueue_active(&state.rx_queue_clients[i], buffer);
+                        assert(!err);
+                        net_stats_packet(&stats->queues[STATS_CLIENT(i)], buffer.len);
+                        notify_clients[i] = true;
+                    }
+                    continue;
                 }
-                continue;
-            } else if (client >= 0) {
+            }
+
+            if (client >= 0) {
                 int ref_index = buffer.io_or_offset / NET_BUFFER_SIZE;
                 assert(buffer_refs[ref_index] == 0);
                 buffer_refs[ref_index] = 1;
 
                 err = net_enqueue_active(&state.rx_queue_clients[client], buffer);
                 assert(!err);
+                net_stats_packet(&stats->queues[STATS_CLIENT(client)], buffer.len);
                 notify_clients[client] = true;
             } else {
                 buffer.io_or_offset = buffer.io_or_offset + config.data.io_addr;
@@ -120,10 +181,17 @@ void rx_return(void)
     }
 
     for (int client = 0; client < config.num_clients; client++) {
-        if (notify_clients[client] && net_require_signal_active(&state.rx_queue_clients[client])) {
+        if (!notify_clients[client]) {
+            continue;
+        }
+
+        net_stats_occupancy(&stats->queues[STATS_CLIENT(client)], &state.rx_queue_clients[client]);
+        bool signal = net_require_signal_active(&state.rx_queue_clients[client]);
+        if (signal) {
             net_cancel_signal_active(&state.rx_queue_clients[client]);
             sddf_notify(config.clients[client].conn.id);
         }
+        net_stats_notify(&stats->queues[STATS_CLIENT(client)], signal);
     }
 }
 
@@ -168,17 +236,23 @@ void rx_provide(void)
         }
     }
 
-    if (notify_drv && net_require_signal_free(&state.rx_queue_drv)) {
-        net_cancel_signal_free(&state.rx_queue_drv);
-        sddf_deferred_notify(config.driver.id);
-        notify_drv = false;
+    if (notify_drv) {
+        bool signal = net_require_signal_free(&state.rx_queue_drv);
+        if (signal) {
+            net_cancel_signal_free(&state.rx_queue_drv);
+            sddf_deferred_notify(config.driver.id);
+            notify_drv = false;
+        }
+        net_stats_notify(&stats->queues[STATS_DRIVER], signal);
     }
 }
 
 void notified(sddf_channel ch)
 {
+    net_stats_begin(stats);
     rx_return();
     rx_provide();
+    net_stats_end(stats);
 }
 
 void init(void)
@@ -186,17 +260,25 @@ void init(void)
     assert(net_config_check_magic(&config));
 
     buffer_refs = config.buffer_metadata.vaddr;
+    stats = net_stats_init(&config.stats, stats_fallback, sizeof(stats_fallback), NET_STATS_VIRT_RX,
+                           1 + config.num_clients);
 
-    /* Set up client queues */
+    /* Set up client queues and filters */
     for (int i = 0; i < config.num_clients; i++) {
         net_queue_init(&state.rx_queue_clients[i], config.clients[i].conn.free_queue.vaddr,
                        config.clients[i].conn.active_queue.vaddr, config.clients[i].conn.num_buffers);
+        stats->queues[STATS_CLIENT(i)].capacity = config.clients[i].conn.num_buffers;
+
+        net_filter_config_t *filter = &config.filters[i];
+        assert(net_filter_check(filter));
+        state.filter_enabled[i] = filter->num_rules || filter->default_action != NET_FILTER_ACCEPT;
     }
 
     /* Set up driver queues */
     net_queue_init(&state.rx_queue_drv, config.driver.free_queue.vaddr, config.driver.active_queue.vaddr,
                    config.driver.num_buffers);
     net_buffers_init(&state.rx_queue_drv, config.data.io_addr);
+    stats->queues[STATS_DRIVER].capacity = config.driver.num_buffers;
 
     if (net_require_signal_free(&state.rx_queue_drv)) {
         net_cancel_signal_free(&state.rx_queue_drv);
@@ -6,19 +6,77 @@
 #include <os/sddf.h>
 #include <sddf/network/queue.h>
 #include <sddf/network/config.h>
+#include <sddf/network/stats.h>
+#include <sddf/network/util.h>
+#include <sddf/timer/client.h>
+#include <sddf/timer/config.h>
 #include <sddf/util/cache.h>
+#include <sddf/util/si_units.h>
 #include <sddf/util/util.h>
 #include <sddf/util/printf.h>
 
 __attribute__((__section__(".net_virt_tx_config"))) net_virt_tx_config_t config;
 
+/* Only required when at least one client has a rate limit */
+__attribute__((__section__(".timer_client_config"))) timer_client_config_t timer_config;
+
+/**
+ * Clients are scheduled with deficit round robin. Each time a client is
+ * visited in a round it is granted a quantum of its weight times the largest
+ * packet size in bytes, and may transmit packets while their total length
+ * fits within its deficit. Unused deficit carries over to the next round as
+ * long as the client has packets waiting.
+ *
+ * Deficit round robin only applies to clients of the bulk class. Packets of
+ * priority class clients are sent ahead of all bulk packets, with clients
+ * taking turns, and are only held back by the client's rate limit and the
+ * driver's budget.
+ */
+#define VIRT_TX_QUANTUM NET_BUFFER_SIZE
+
+typedef struct client_state {
+    /* bytes the client may still transmit in the current round */
+    uint64_t deficit;
+    /* whether the client has been granted its quantum for the current round */
+    bool in_round;
+    /* head packet dequeued from the client which did not yet fit */
+    bool has_held;
+    net_buff_desc_t held;
+    /* token bucket in bytes for rate limited clients */
+    uint64_t tokens;
+    uint64_t last_refill;
+} client_state_t;
+
 typedef struct state {
-    net_queue_handle_t tx_queue_drv;
+    net_queue_handle_t tx_queue_drv[NET_TX_NUM_CLASSES];
     net_queue_handle_t tx_queue_clients[SDDF_NET_MAX_CLIENTS];
+    client_state_t clients[SDDF_NET_MAX_CLIENTS];
+    /* client to resume the round robin from */
+    uint8_t next_client;
+    /* number of buffers currently enqueued with the driver */
+    uint32_t inflight;
+    uint32_t budget;
+    /* whether the driver has a separate queue for priority packets */
+    bool drv_priority;
+    /* whether any client has a rate limit, requiring the timer */
+    bool rate_limited;
+    /* absolute time of the outstanding timeout, 0 if there is none */
+    uint64_t timeout_at;
 } state_t;
 
 state_t state;
 
+#define STATS_DRIVER(cls) (cls)
+#define STATS_CLIENT(client, cls) (NET_TX_NUM_CLASSES * (1 + (client)) + (cls))
+
+static uint64_t stats_fallback[NET_STATS_SIZE(NET_TX_NUM_CLASSES * (1 + SDDF_NET_MAX_CLIENTS)) / sizeof(uint64_t)];
+net_stats_t *stats;
+
+static inline net_tx_class_t client_class(uint8_t client)
+{
+    return config.sched[client].priority ? NET_TX_CLASS_PRIORITY : NET_TX_CLASS_BULK;
+}
+
 bool extract_offset(uintptr_t *phys, uint8_t *client, uint8_t *oid)
 {
     for (uint8_t c = 0; c < config.num_clients; c++) {
@@ -36,117 +94,415 @@ bool extract_offset(uintptr_t *phys, uint8_t *client, uint8_t *oid)
     return false;
 }
 
+static void refill_tokens(uint8_t client, uint64_t now)
+{
+    client_state_t *cs = &state.clients[client];
+    uint64_t elapsed = now - cs->last_refill;
+    uint64_t rate = config.sched[client].rate_limit;
+    /* Split the elapsed time to avoid overflow after long idle periods */
+    uint64_t earned = (elapsed / NS_IN_S) * rate + ((elapsed % NS_IN_S) * rate) / NS_IN_S;
+    if (earned == 0) {
+        return;
+    }
+
+    cs->tokens = MIN(cs->tokens + earned, (uint64_t)config.sched[client].burst_bytes);
+    cs->last_refill = now;
+}
+
+/**
+ * Request a timeout for when a rate limited client will have accumulated
+ * enough tokens to transmit a packet of length len.
+ */
+static void schedule_refill(uint8_t client, uint16_t len, uint64_t now)
+{
+    client_state_t *cs = &state.clients[client];
+    uint64_t missing = len - cs->tokens;
+    uint64_t wait = (missing * NS_IN_S + config.sched[client].rate_limit - 1) / config.sched[client].rate_limit;
+
+    if (state.timeout_at == 0 || now + wait < state.timeout_at) {
+        state.timeout_at = now + wait;
+        sddf_timer_set_timeout(timer_config.driver_id, wait);
+    }
+}
+
+/**
+ * Check that a buffer provided by a client lies within one of its regions.
+ */
+static bool buffer_valid(uint8_t client, net_buff_desc_t *buffer)
+{
+    net_virt_tx_client_config_t *client_config = &config.clients[client];
+    if (buffer->oid >= client_config->num_regions) {
+        sddf_dprintf("VIRT_TX|LOG: Client provided buffer with id %d which is not from within the mapped memory\n",
+                     buffer->oid);
+        return false;
+    }
+
+    if (buffer->io_or_offset % NET_BUFFER_SIZE
+        || buffer->io_or_offset >= NET_BUFFER_SIZE * client_config->regions[buffer->oid].num_buffers) {
+        sddf_dprintf("VIRT_TX|LOG: Client provided offset %lx which is not buffer aligned or outside of buffer region\n",
+                     buffer->io_or_offset);
+        return false;
+    }
+
+    if (buffer->len > NET_BUFFER_SIZE) {
+        sddf_dprintf("VIRT_TX|LOG: Client provided length %u which is larger than a buffer\n", buffer->len);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Dequeue the next valid packet of a client, returning invalid buffers to the
+ * client as they are found.
+ *
+ * @return false if the client has no packet waiting, true otherwise.
+ */
+static bool next_packet(uint8_t client, bool *notify_client)
+{
+    client_state_t *cs = &state.clients[client];
+    net_queue_handle_t *queue = &state.tx_queue_clients[client];
+
+    while (!cs->has_held && !net_queue_empty_active(queue)) {
+        net_buff_desc_t buffer;
+        int err = net_dequeue_active(queue, &buffer);
+        assert(!err);
+
+        if (buffer_valid(client, &buffer)) {
+            cs->held = buffer;
+            cs->has_held = true;
+            break;
+        }
+
+        stats->queues[STATS_CLIENT(client, client_class(client))].drops[NET_DROP_INVALID]++;
+        err = net_enqueue_free(queue, buffer);
+        assert(!err);
+        *notify_client = true;
+    }
+
+    return cs->has_held;
+}
+
+/**
+ * Check whether a client's rate limit allows its held packet to be sent, and
+ * if not arrange to be woken once it does.
+ */
+static bool within_rate(uint8_t client, uint64_t now)
+{
+    client_state_t *cs = &state.clients[client];
+    if (!config.sched[client].rate_limit || cs->held.len <= cs->tokens) {
+        return true;
+    }
+
+    schedule_refill(client, cs->held.len, now);
+    return false;
+}
+
+/**
+ * Pass the held packet of a client to the driver.
+ */
+static void transmit_held(uint8_t client)
+{
+    client_state_t *cs = &state.clients[client];
+    net_buff_desc_t buffer = cs->held;
+    net_virt_tx_data_region_t *region = &config.clients[client].regions[buffer.oid];
+    net_tx_class_t cls = client_class(client);
+
+    if (config.sched[client].rate_limit) {
+        cs->tokens -= buffer.len;
+    }
+
+    uintptr_t buffer_vaddr = buffer.io_or_offset + (uintptr_t)region->data.region.vaddr;
+    if ((buffer.flags & NET_BUFF_F_CSUM_PARTIAL) && !config.driver_csum_partial) {
+        if (!net_csum_complete((uint8_t *)buffer_vaddr, buffer.len, buffer.csum_start, buffer.csum_offset)) {
+            sddf_dprintf("VIRT_TX|LOG: Client %u provided checksum offset outside of its frame\n", client);
+        }
+        buffer.flags &= ~NET_BUFF_F_CSUM_PARTIAL;
+    }
+    cache_clean(buffer_vaddr, buffer_vaddr + buffer.len);
+
+    buffer.io_or_offset = buffer.io_or_offset + region->data.io_addr;
+    net_tx_class_t drv_cls = state.drv_priority ? cls : NET_TX_CLASS_BULK;
+    int err = net_enqueue_active(&state.tx_queue_drv[drv_cls], buffer);
+    assert(!err);
+
+    cs->has_held = false;
+    net_stats_packet(&stats->queues[STATS_CLIENT(client, cls)], buffer.len);
+    net_stats_packet(&stats->queues[STATS_DRIVER(drv_cls)], buffer.len);
+    state.inflight++;
+}
+
+/**
+ * Transmit a single packet of a priority class client if its rate limit and
+ * the driver's budget allow.
+ *
+ * @return true if a packet was transmitted.
+ */
+static bool serve_priority(uint8_t client, uint64_t now, bool *notify_client)
+{
+    if (client_class(client) != NET_TX_CLASS_PRIORITY || state.inflight >= state.budget
+        || !next_packet(client, notify_client) || !within_rate(client, now)) {
+        return false;
+    }
+
+    transmit_held(client);
+    return true;
+}
+
+/**
+ * Transmit packets of a bulk class client while they fit within its deficit,
+ * its rate limit and the driver's budget.
+ *
+ * @return true if at least one packet was transmitted.
+ */
+static bool serve_bulk(uint8_t client, uint64_t now, bool *notify_client)
+{
+    client_state_t *cs = &state.clients[client];
+    uint16_t weight = config.sched[client].weight ? config.sched[client].weight : 1;
+    bool sent = false;
+
+    if (client_class(client) != NET_TX_CLASS_BULK) {
+        return false;
+    }
+
+    if (!cs->in_round) {
+        if (!next_packet(client, notify_client)) {
+            cs->deficit = 0;
+            return false;
+        }
+        /* Rate limited clients do not accumulate deficit while waiting */
+        if (!within_rate(client, now)) {
+            return false;
+        }
+        cs->deficit += (uint64_t)weight * VIRT_TX_QUANTUM;
+        cs->in_round = true;
+    }
+
+    while (state.inflight < state.budget && next_packet(client, notify_client)) {
+        uint16_t len = cs->held.len;
+        if (len > cs->deficit || !within_rate(client, now)) {
+            break;
+        }
+
+        transmit_held(client);
+        cs->deficit -= len;
+        sent = true;
+    }
+
+    /* The round only ends for this client once it has used its deficit or
+    run out of packets, not when it was cut short by the driver's budget */
+    if (state.inflight < state.budget || !cs->has_held) {
+        cs->in_round = false;
+    }
+    if (!cs->has_held && net_queue_empty_active(&state.tx_queue_clients[client])) {
+        cs->deficit = 0;
+    }
+
+    return sent;
+}
+
+static void notify_clients_free(bool notify_clients[])
+{
+    for (uint8_t client = 0; client < config.num_clients; client++) {
+        if (!notify_clients[client]) {
+            continue;
+        }
+
+        bool signal = net_require_signal_free(&state.tx_queue_clients[client]);
+        if (signal) {
+            net_cancel_signal_free(&state.tx_queue_clients[client]);
+            sddf_notify(config.clients[client].conn.id);
+        }
+        net_stats_notify(&stats->queues[STATS_CLIENT(client, client_class(client))], signal);
+    }
+}
+
 void tx_provide(void)
 {
     bool enqueued = false;
-    for (int client = 0; client < config.num_clients; client++) {
-        bool reprocess = true;
-        while (reprocess) {
-            while (!net_queue_empty_active(&state.tx_queue_clients[client])) {
-                net_buff_desc_t buffer;
-                int err = net_dequeue_active(&state.tx_queue_clients[client], &buffer);
-                assert(!err);
+    bool notify_clients[SDDF_NET_MAX_CLIENTS] = { false };
+    uint64_t now = 0;
 
-                if (buffer.oid >= config.clients[client].num_regions) {
-                    sddf_dprintf(
-                        "VIRT_TX|LOG: Client provided buffer with id %d which is not from within the mapped memory\n",
-                        buffer.oid);
-                    err = net_enqueue_free(&state.tx_queue_clients[client], buffer);
-                    assert(!err);
-                    continue;
-                }
+    if (state.rate_limited) {
+        now = sddf_timer_time_now(timer_config.driver_id);
+        for (uint8_t client = 0; client < config.num_clients; client++) {
+            if (config.sched[client].rate_limit) {
+                refill_tokens(client, now);
+            }
+        }
+    }
+
+    for (uint8_t client = 0; client < config.num_clients; client++) {
+        net_stats_occupancy(&stats->queues[STATS_CLIENT(client, client_class(client))],
+                            &state.tx_queue_clients[client]);
+    }
 
-                if (buffer.io_or_offset % NET_BUFFER_SIZE
-                    || buffer.io_or_offset
-                           >= NET_BUFFER_SIZE * config.clients[client].regions[buffer.oid].num_buffers) {
-                    sddf_dprintf("VIRT_TX|LOG: Client provided offset %lx which is not buffer aligned or outside of buffer region\n",
-                                 buffer.io_or_offset);
-                    err = net_enqueue_free(&state.tx_queue_clients[client], buffer);
-                    assert(!err);
-                    continue;
+    bool reprocess = true;
+    while (reprocess) {
+        /* Strict priority, all priority packets go before any bulk packet.
+        Priority clients take turns to send one packet each. */
+        bool progress = true;
+        while (progress && state.inflight < state.budget) {
+            progress = false;
+            for (uint8_t client = 0; client < config.num_clients; client++) {
+                if (serve_priority(client, now, &notify_clients[client])) {
+                    progress = true;
+                    enqueued = true;
                 }
+            }
+        }
 
-                uintptr_t buffer_vaddr = buffer.io_or_offset
-                                       + (uintptr_t)config.clients[client].regions[buffer.oid].data.region.vaddr;
-                cache_clean(buffer_vaddr, buffer_vaddr + buffer.len);
+        progress = true;
+        while (progress && state.inflight < state.budget) {
+            progress = false;
+            for (uint8_t i = 0; i < config.num_clients; i++) {
+                uint8_t client = (state.next_client + i) % config.num_clients;
+                if (serve_bulk(client, now, &notify_clients[client])) {
+                    progress = true;
+                    enqueued = true;
+                }
+                if (state.inflight >= state.budget) {
+                    /* Resume from this client if it was cut short, otherwise
+                    from the next one */
+                    state.next_client = state.clients[client].in_round ? client : (client + 1) % config.num_clients;
+                    break;
+                }
+            }
+        }
 
-                buffer.io_or_offset = buffer.io_or_offset + config.clients[client].regions[buffer.oid].data.io_addr;
-                err = net_enqueue_active(&state.tx_queue_drv, buffer);
-                assert(!err);
-                enqueued = true;
+        reprocess = false;
+        for (uint8_t client = 0; client < config.num_clients; client++) {
+            if (state.clients[client].has_held) {
+                /* Still has work, we will be woken by the driver or timer */
+                continue;
             }
 
             net_request_signal_active(&state.tx_queue_clients[client]);
-            reprocess = false;
-
             if (!net_queue_empty_active(&state.tx_queue_clients[client])) {
                 net_cancel_signal_active(&state.tx_queue_clients[client]);
-                reprocess = true;
+                reprocess |= state.inflight < state.budget;
             }
         }
     }
 
-    if (enqueued && net_require_signal_active(&state.tx_queue_drv)) {
-        net_cancel_signal_active(&state.tx_queue_drv);
+    bool notify_drv = false;
+    for (net_tx_class_t cls = 0; enqueued && cls < NET_TX_NUM_CLASSES; cls++) {
+        if (cls == NET_TX_CLASS_PRIORITY && !state.drv_priority) {
+            continue;
+        }
+
+        net_stats_occupancy(&stats->queues[STATS_DRIVER(cls)], &state.tx_queue_drv[cls]);
+        bool signal = net_require_signal_active(&state.tx_queue_drv[cls]);
+        if (signal) {
+            net_cancel_signal_active(&state.tx_queue_drv[cls]);
+            notify_drv = true;
+        }
+        net_stats_notify(&stats->queues[STATS_DRIVER(cls)], signal);
+    }
+
+    if (notify_drv) {
         sddf_deferred_notify(config.driver.id);
     }
+
+    notify_clients_free(notify_clients);
 }
 
 void tx_return(void)
 {
-    bool reprocess = true;
     bool notify_clients[SDDF_NET_MAX_CLIENTS] = { false };
-    while (reprocess) {
-        while (!net_queue_empty_free(&state.tx_queue_drv)) {
-            net_buff_desc_t buffer;
-            int err = net_dequeue_free(&state.tx_queue_drv, &buffer);
-            assert(!err);
+    for (net_tx_class_t drv_cls = 0; drv_cls < NET_TX_NUM_CLASSES; drv_cls++) {
+        if (drv_cls == NET_TX_CLASS_PRIORITY && !state.drv_priority) {
+            continue;
+        }
 
-            uint8_t oid = 0, client = 0;
-            bool success = extract_offset(&buffer.io_or_offset, &client, &oid);
-            assert(success);
-            buffer.oid = oid;
+        net_queue_handle_t *drv_queue = &state.tx_queue_drv[drv_cls];
+        bool reprocess = true;
+        while (reprocess) {
+            while (!net_queue_empty_free(drv_queue)) {
+                net_buff_desc_t buffer;
+                int err = net_dequeue_free(drv_queue, &buffer);
+                assert(!err);
 
-            err = net_enqueue_free(&state.tx_queue_clients[client], buffer);
-            assert(!err);
-            notify_clients[client] = true;
-        }
+                uint8_t oid = 0, client = 0;
+                bool success = extract_offset(&buffer.io_or_offset, &client, &oid);
+                assert(success);
+                buffer.oid = oid;
 
-        net_request_signal_free(&state.tx_queue_drv);
-        reprocess = false;
+                err = net_enqueue_free(&state.tx_queue_clients[client], buffer);
+                assert(!err);
+                notify_clients[client] = true;
 
-        if (!net_queue_empty_free(&state.tx_queue_drv)) {
-            net_cancel_signal_free(&state.tx_queue_drv);
-            reprocess = true;
-        }
-    }
+                assert(state.inflight);
+                state.inflight--;
+            }
 
-    for (int client = 0; client < config.num_clients; client++) {
-        if (notify_clients[client] && net_require_signal_free(&state.tx_queue_clients[client])) {
-            net_cancel_signal_free(&state.tx_queue_clients[client]);
-            sddf_notify(config.clients[client].conn.id);
+            net_request_signal_free(drv_queue);
+            reprocess = false;
+
+            if (!net_queue_empty_free(drv_queue)) {
+                net_cancel_signal_free(drv_queue);
+                reprocess = true;
+            }
         }
     }
+
+    notify_clients_free(notify_clients);
 }
 
 void notified(sddf_channel ch)
 {
+    if (state.rate_limited && ch == timer_config.driver_id) {
+        state.timeout_at = 0;
+    }
+
+    net_stats_begin(stats);
     tx_return();
     tx_provide();
+    net_stats_end(stats);
 }
 
 void init(void)
 {
     assert(net_config_check_magic(&config));
 
+    stats = net_stats_init(&config.stats, stats_fallback, sizeof(stats_fallback), NET_STATS_VIRT_TX,
+                           NET_TX_NUM_CLASSES * (1 + config.num_clients));
+
     /* Set up driver queues */
-    net_queue_init(&state.tx_queue_drv, config.driver.free_queue.vaddr, config.driver.active_queue.vaddr,
-                   config.driver.num_buffers);
+    net_queue_init(&state.tx_queue_drv[NET_TX_CLASS_BULK], config.driver.free_queue.vaddr,
+                   config.driver.active_queue.vaddr, config.driver.num_buffers);
+    stats->queues[STATS_DRIVER(NET_TX_CLASS_BULK)].capacity = config.driver.num_buffers;
+    uint32_t drv_capacity = config.driver.num_buffers;
+    if (config.driver_priority.num_buffers) {
+        net_queue_init(&state.tx_queue_drv[NET_TX_CLASS_PRIORITY], config.driver_priority.free_queue.vaddr,
+                       config.driver_priority.active_queue.vaddr, config.driver_priority.num_buffers);
+        stats->queues[STATS_DRIVER(NET_TX_CLASS_PRIORITY)].capacity = config.driver_priority.num_buffers;
+        drv_capacity += config.driver_priority.num_buffers;
+        state.drv_priority = true;
+    }
+    state.budget = config.driver_budget ? MIN(config.driver_budget, drv_capacity) : drv_capacity;
 
     for (int i = 0; i < config.num_clients; i++) {
         net_queue_init(&state.tx_queue_clients[i], config.clients[i].conn.free_queue.vaddr,
                        config.clients[i].conn.active_queue.vaddr, config.clients[i].conn.num_buffers);
+        stats->queues[STATS_CLIENT(i, client_class(i))].capacity = config.clients[i].conn.num_buffers;
+
+        if (config.sched[i].rate_limit) {
+            assert(config.sched[i].burst_bytes >= NET_BUFFER_SIZE);
+            state.clients[i].tokens = config.sched[i].burst_bytes;
+            state.rate_limited = true;
+        }
+    }
+
+    if (state.rate_limited) {
+        assert(timer_config_check_magic(&timer_config));
+        uint64_t now = sddf_timer_time_now(timer_config.driver_id);
+        for (int i = 0; i < config.num_clients; i++) {
+            state.clients[i].last_refill = now;
+        }
     }
 
+    net_stats_begin(stats);
     tx_provide();
+    net_stats_end(stats);
 }
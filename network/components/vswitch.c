@@ -10,6 +10,7 @@
 #include <sddf/network/queue.h>
 #include <sddf/network/mac802.h>
 #include <sddf/network/config.h>
+#include <sddf/network/stats.h>
 #include <sddf/network/ip.h>
 #include <sddf/network/icmp.h>
 #include <sddf/network/tcp.h>
@@ -108,6 +109,12 @@ buffer_ref_t *buffer_refs_start[SDDF_NET_MAX_CLIENTS];
  */
 uint32_t num_forwarded_bufs[SDDF_NET_MAX_CLIENTS];
 
+#define STATS_RX(port) (2 * (port))
+#define STATS_TX(port) (2 * (port) + 1)
+
+static uint64_t stats_fallback[NET_STATS_SIZE(2 * SDDF_NET_MAX_CLIENTS) / sizeof(uint64_t)];
+net_stats_t *stats;
+
 #ifdef NETWORK_HW_HAS_CHECKSUM
 /**
  * Clear IPv4 header checksums and supported (UDP, TCP, ICMP) transport layer
@@ -152,12 +159,16 @@ static bool forward_frame(uint8_t src_id, uint8_t dst_id, net_buff_desc_t *src_b
     /* Don't forward more than the destination queue's capacity before some
     buffers are returned */
     if (num_forwarded_bufs[dst_id] >= config.ports[dst_id].rx.num_buffers) {
+        stats->queues[STATS_RX(dst_id)].drops[NET_DROP_QUEUE_FULL]++;
         return false;
     }
 
     net_buff_desc_t dest_buf;
     dest_buf.len = src_buf->len;
     dest_buf.io_or_offset = src_buf->io_or_offset;
+    dest_buf.flags = src_buf->flags;
+    dest_buf.csum_start = src_buf->csum_start;
+    dest_buf.csum_offset = src_buf->csum_offset;
     /* Tag the owner of the buffer so the destination copier knows which data
     region it belongs to. Also, upon return the tag tells the vswitch how to
     free the buffer. */
@@ -172,6 +183,7 @@ static bool forward_frame(uint8_t src_id, uint8_t dst_id, net_buff_desc_t *src_b
 #endif
 
     net_enqueue_active(&state.rx_queues[dst_id], dest_buf);
+    net_stats_packet(&stats->queues[STATS_RX(dst_id)], dest_buf.len);
     need_rx_signal[dst_id] = true;
     num_forwarded_bufs[dst_id]++;
 
@@ -240,8 +252,12 @@ static bool try_send(uint8_t src_id, const mac_addr_t *dest_macaddr, net_buff_de
     bool success = false;
     uint8_t dst_id = mac_addr_find(dest_macaddr);
 
-    if (dst_id != VSWITCH_WRONG_PORT && vswitch_can_send_to(src_id, dst_id)) {
+    if (dst_id == VSWITCH_WRONG_PORT) {
+        stats->queues[STATS_TX(src_id)].drops[NET_DROP_NO_MATCH]++;
+    } else if (vswitch_can_send_to(src_id, dst_id)) {
         success = forward_frame(src_id, dst_id, buffer);
+    } else {
+        stats->queues[STATS_TX(src_id)].drops[NET_DROP_DENIED]++;
     }
     return success;
 }
@@ -309,6 +325,7 @@ static void forward_traffic_from(uint8_t port_id)
     vswitch clients and virtualisers */
     net_queue_handle_t *src = &state.tx_queues[port_id];
 
+    net_stats_occupancy(&stats->queues[STATS_TX(port_id)], src);
     bool reprocess = true;
     while (reprocess) {
         while (!net_queue_empty_active(src)) {
@@ -320,10 +337,12 @@ static void forward_traffic_from(uint8_t port_id)
                 || buffer.io_or_offset >= NET_BUFFER_SIZE * config.ports[port_id].tx.num_buffers) {
                 LOG_VSWITCH_ERR("Port %u provided offset %lx which is not buffer aligned or outside of buffer region\n",
                                 port_id, buffer.io_or_offset);
+                stats->queues[STATS_TX(port_id)].drops[NET_DROP_INVALID]++;
                 err = net_enqueue_free(src, buffer);
                 assert(!err);
                 continue;
             }
+            net_stats_packet(&stats->queues[STATS_TX(port_id)], buffer.len);
 
             const char *frame_data = config.ports[port_id].tx_data.vaddr + buffer.io_or_offset;
             const ether_hdr_t *macaddr = (ether_hdr_t *)frame_data;
@@ -353,6 +372,7 @@ static void forward_traffic_from(uint8_t port_id)
 
 void notified(sddf_channel ch)
 {
+    net_stats_begin(stats);
     for (uint8_t i = 0; i < config.num_ports; i++) {
         if (ch == config.ports[i].tx.id) {
             forward_traffic_from(i);
@@ -364,17 +384,27 @@ void notified(sddf_channel ch)
     }
 
     for (uint8_t i = 0; i < config.num_ports; i++) {
-        if (need_rx_signal[i] && net_require_signal_active(&state.rx_queues[i])) {
-            net_cancel_signal_active(&state.rx_queues[i]);
-            need_rx_signal[i] = false;
-            sddf_notify(config.ports[i].rx.id);
+        if (need_rx_signal[i]) {
+            net_stats_occupancy(&stats->queues[STATS_RX(i)], &state.rx_queues[i]);
+            bool signal = net_require_signal_active(&state.rx_queues[i]);
+            if (signal) {
+                net_cancel_signal_active(&state.rx_queues[i]);
+                need_rx_signal[i] = false;
+                sddf_notify(config.ports[i].rx.id);
+            }
+            net_stats_notify(&stats->queues[STATS_RX(i)], signal);
         }
-        if (need_tx_signal[i] && net_require_signal_free(&state.tx_queues[i])) {
-            net_cancel_signal_free(&state.tx_queues[i]);
-            need_tx_signal[i] = false;
-            sddf_notify(config.ports[i].tx.id);
+        if (need_tx_signal[i]) {
+            bool signal = net_require_signal_free(&state.tx_queues[i]);
+            if (signal) {
+                net_cancel_signal_free(&state.tx_queues[i]);
+                need_tx_signal[i] = false;
+                sddf_notify(config.ports[i].tx.id);
+            }
+            net_stats_notify(&stats->queues[STATS_TX(i)], signal);
         }
     }
+    net_stats_end(stats);
 }
 
 void init(void)
@@ -384,12 +414,17 @@ void init(void)
     buffer_refs = (buffer_ref_t *)config.buffer_metadata.vaddr;
     buffer_refs_start[0] = buffer_refs;
 
+    stats = net_stats_init(&config.stats, stats_fallback, sizeof(stats_fallback), NET_STATS_VSWITCH,
+                           2 * config.num_ports);
+
     /* Set up queues and buffers references */
     for (uint8_t i = 0; i < config.num_ports; i++) {
         net_queue_init(&state.rx_queues[i], config.ports[i].rx.free_queue.vaddr, config.ports[i].rx.active_queue.vaddr,
                        config.ports[i].rx.num_buffers);
         net_queue_init(&state.tx_queues[i], config.ports[i].tx.free_queue.vaddr, config.ports[i].tx.active_queue.vaddr,
                        config.ports[i].tx.num_buffers);
+        stats->queues[STATS_RX(i)].capacity = config.ports[i].rx.num_buffers;
+        stats->queues[STATS_TX(i)].capacity = config.ports[i].tx.num_buffers;
 
         /* Set the allow_list based on predefined settings */
         state.allow_list[i] = config.ports[i].acl;
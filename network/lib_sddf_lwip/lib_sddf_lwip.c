@@ -23,6 +23,12 @@
 #include "lwip/sys.h"
 #include "lwip/timeouts.h"
 #include "lwip/dhcp.h"
+#include "lwip/inet_chksum.h"
+#include "lwip/prot/ethernet.h"
+#include "lwip/prot/ip.h"
+#include "lwip/prot/ip4.h"
+#include "lwip/prot/tcp.h"
+#include "lwip/prot/udp.h"
 
 /* Number of characters needed to store string of longest IPV4 address */
 #define SDDF_LWIP_IPV4_ADDR_STRLEN 16
@@ -299,6 +305,85 @@ static struct pbuf *create_interface_buffer(uint64_t offset, size_t length)
                                (void *)(offset + sddf_state.rx_buffer_data_region), NET_BUFFER_SIZE);
 }
 
+#if defined(NETWORK_HW_HAS_PARTIAL_CHECKSUM) && (!CHECKSUM_GEN_TCP || !CHECKSUM_GEN_UDP)
+/**
+ * Have the hardware complete the TCP or UDP checksum of an outgoing frame if
+ * lwIP is configured not to generate it. The checksum field is set to the
+ * checksum of the pseudo-header and the buffer is marked with the offsets of
+ * the data to checksum.
+ *
+ * @param frame address of the ethernet header of the frame.
+ * @param buffer sddf buffer holding the frame.
+ */
+static void tx_offload_checksum(uintptr_t frame, net_buff_desc_t *buffer)
+{
+    struct eth_hdr *ethhdr = (struct eth_hdr *)frame;
+    if (buffer->len < SIZEOF_ETH_HDR + IP_HLEN || ethhdr->type != PP_HTONS(ETHTYPE_IP)) {
+        return;
+    }
+
+    /* Only the first fragment holds the transport header, but the checksum covers all of them */
+    struct ip_hdr *iphdr = (struct ip_hdr *)(frame + SIZEOF_ETH_HDR);
+    if (IPH_OFFSET(iphdr) & PP_HTONS(IP_MF | IP_OFFMASK)) {
+        return;
+    }
+
+    uint16_t csum_offset;
+    switch (IPH_PROTO(iphdr)) {
+#if !CHECKSUM_GEN_TCP
+    case IP_PROTO_TCP:
+        csum_offset = offsetof(struct tcp_hdr, chksum);
+        break;
+#endif
+#if !CHECKSUM_GEN_UDP
+    case IP_PROTO_UDP:
+        csum_offset = offsetof(struct udp_hdr, chksum);
+        break;
+#endif
+    default:
+        return;
+    }
+
+    uint16_t csum_start = SIZEOF_ETH_HDR + IPH_HL_BYTES(iphdr);
+    if (csum_start + csum_offset + sizeof(uint16_t) > buffer->len) {
+        return;
+    }
+
+    /* The one's complement sum is the same in either byte order, so the fields are summed as stored */
+    uint16_t proto_len = lwip_ntohs(IPH_LEN(iphdr)) - IPH_HL_BYTES(iphdr);
+    uint32_t sum = (iphdr->src.addr & 0xffff) + (iphdr->src.addr >> 16) + (iphdr->dest.addr & 0xffff)
+                 + (iphdr->dest.addr >> 16) + lwip_htons(IPH_PROTO(iphdr)) + lwip_htons(proto_len);
+    sum = FOLD_U32T(sum);
+    sum = FOLD_U32T(sum);
+    *(uint16_t *)(frame + csum_start + csum_offset) = (uint16_t)sum;
+
+    buffer->flags = NET_BUFF_F_CSUM_PARTIAL;
+    buffer->csum_start = csum_start;
+    buffer->csum_offset = csum_offset;
+}
+#endif
+
+#if CHECKSUM_CHECK_TCP || CHECKSUM_CHECK_UDP
+/**
+ * Complete the partial checksum of a received frame, which the hardware has
+ * left for us as the frame was sent from its host, so that lwIP can verify it.
+ *
+ * @param frame address of the ethernet header of the frame.
+ * @param buffer sddf buffer holding the frame.
+ */
+static void rx_complete_checksum(uintptr_t frame, net_buff_desc_t *buffer)
+{
+    if (buffer->csum_start + buffer->csum_offset + sizeof(uint16_t) > buffer->len) {
+        return;
+    }
+
+    uint16_t *check = (uint16_t *)(frame + buffer->csum_start + buffer->csum_offset);
+    uint16_t sum = inet_chksum((void *)(frame + buffer->csum_start), buffer->len - buffer->csum_start);
+    /* A UDP checksum of 0 means none was computed, and is equivalent to 0xffff for TCP */
+    *check = sum ? sum : 0xffff;
+}
+#endif
+
 /**
  * Copy a pbuf into an sddf buffer and insert it into the transmit active queue.
  * If client is RX only, and transmission is not intercepted, this function will
@@ -346,6 +431,10 @@ static err_t lwip_eth_send(struct netif *netif, struct pbuf *p)
     }
 
     buffer.len = copied;
+    buffer.flags = 0;
+#if defined(NETWORK_HW_HAS_PARTIAL_CHECKSUM) && (!CHECKSUM_GEN_TCP || !CHECKSUM_GEN_UDP)
+    tx_offload_checksum(frame, &buffer);
+#endif
     err = net_enqueue_active(&sddf_state.tx_queue, buffer);
     assert(!err);
 
@@ -374,6 +463,12 @@ void sddf_lwip_process_rx(void)
             int err = net_dequeue_active(&sddf_state.rx_queue, &buffer);
             assert(!err);
 
+#if CHECKSUM_CHECK_TCP || CHECKSUM_CHECK_UDP
+            if (buffer.flags & NET_BUFF_F_CSUM_PARTIAL) {
+                rx_complete_checksum(buffer.io_or_offset + sddf_state.rx_buffer_data_region, &buffer);
+            }
+#endif
+
             struct pbuf *p = create_interface_buffer(buffer.io_or_offset, buffer.len);
             assert(p != NULL);
             if (lwip_state.netif.input(p, &lwip_state.netif) != ERR_OK) {